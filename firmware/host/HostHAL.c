@@ -0,0 +1,838 @@
+//
+//  Host HAL
+//
+//  Simulated ATmega328P peripherals for the host build.
+//
+#include "HostHAL.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+#include <avr/wdt.h>
+
+#define HOSTHAL_DEFINE8(name) volatile uint8_t name;
+#define HOSTHAL_DEFINE16(name) volatile uint16_t name;
+
+HOSTHAL_DEFINE8(SREG)
+HOSTHAL_DEFINE8(PINB) HOSTHAL_DEFINE8(DDRB) HOSTHAL_DEFINE8(PORTB)
+HOSTHAL_DEFINE8(PINC) HOSTHAL_DEFINE8(DDRC) HOSTHAL_DEFINE8(PORTC)
+HOSTHAL_DEFINE8(PIND) HOSTHAL_DEFINE8(DDRD) HOSTHAL_DEFINE8(PORTD)
+HOSTHAL_DEFINE8(PCICR)
+HOSTHAL_DEFINE8(PCMSK0) HOSTHAL_DEFINE8(PCMSK1) HOSTHAL_DEFINE8(PCMSK2)
+HOSTHAL_DEFINE8(TCCR0A) HOSTHAL_DEFINE8(TCCR0B) HOSTHAL_DEFINE8(TCNT0)
+HOSTHAL_DEFINE8(OCR0A) HOSTHAL_DEFINE8(OCR0B)
+HOSTHAL_DEFINE8(TIMSK0) HOSTHAL_DEFINE8(TIFR0)
+HOSTHAL_DEFINE8(TCCR1A) HOSTHAL_DEFINE8(TCCR1B) HOSTHAL_DEFINE8(TCCR1C)
+HOSTHAL_DEFINE16(TCNT1) HOSTHAL_DEFINE16(OCR1A) HOSTHAL_DEFINE16(OCR1B)
+HOSTHAL_DEFINE16(ICR1)
+HOSTHAL_DEFINE8(TIMSK1)
+HOSTHAL_DEFINE16(EEAR)
+HOSTHAL_DEFINE8(UCSR0A) HOSTHAL_DEFINE8(UCSR0B) HOSTHAL_DEFINE8(UCSR0C)
+HOSTHAL_DEFINE16(UBRR0)
+HOSTHAL_DEFINE8(WDTCSR) HOSTHAL_DEFINE8(MCUSR)
+HOSTHAL_DEFINE8(GPIOR0) HOSTHAL_DEFINE8(GPIOR1) HOSTHAL_DEFINE8(GPIOR2)
+
+// interrupt service routines. weak so that vectors nobody implements
+// are null
+#define HOSTHAL_VECTOR(name) extern void name (void) __attribute__((weak));
+HOSTHAL_VECTOR(PCINT0_vect)
+HOSTHAL_VECTOR(PCINT1_vect)
+HOSTHAL_VECTOR(PCINT2_vect)
+HOSTHAL_VECTOR(TIMER1_CAPT_vect)
+HOSTHAL_VECTOR(TIMER1_COMPA_vect)
+HOSTHAL_VECTOR(TIMER1_COMPB_vect)
+HOSTHAL_VECTOR(TIMER1_OVF_vect)
+HOSTHAL_VECTOR(USART_RX_vect)
+HOSTHAL_VECTOR(USART_UDRE_vect)
+HOSTHAL_VECTOR(USART_TX_vect)
+HOSTHAL_VECTOR(EE_READY_vect)
+
+// EEMEM variables go in this section. Aligning it to the EEPROM size
+// makes the low bits of each variable's address its EEPROM address.
+static char eememAnchor[0]
+    __attribute__((section("hosthal_eeprom"), aligned(E2END + 1), used));
+
+static uint64_t cycles;
+
+// write-one-to-clear interrupt flag register
+typedef struct FlagRegister_struct {
+    uint8_t flags;
+    volatile uint8_t written;
+    bool accessed;
+} FlagRegister;
+static FlagRegister pcifr;
+static FlagRegister tifr1;
+
+// timer 1
+static uint16_t timer1PrescaleCycles;
+
+// EEPROM
+#define EEPROM_WRITE_CYCLES ((uint64_t)F_CPU * 34 / 10000)   // 3.4mS
+static uint8_t eeprom[E2END + 1] = { [0 ... E2END] = 0xFF };
+static volatile uint8_t eecr;
+static volatile uint8_t eedr;
+static bool eepromProgramming;
+static uint64_t eepromReadyCycle;
+
+// USART 0. udr0 holds UDR0_READ_MARK plus the received byte until the
+// firmware writes to it
+#define UDR0_READ_MARK 0x5A5A0000UL
+static volatile uint32_t udr0;
+static bool udr0Accessed;
+static uint8_t rxData;
+static uint8_t txBuffer;
+static uint8_t txShift;
+static bool txShifting;
+static uint64_t txDoneCycle;
+static HostHAL_UARTOutputCB uartOutputCB;
+static void* uartOutputData;
+
+// RXD (PD0) once HostHAL_sendUARTByte has driven it. The receiver samples
+// the line at the UART's own rate, so bytes sent at another rate arrive
+// garbled, as on the real thing
+static bool rxdDriven;
+static bool rxdSending;
+static uint8_t rxdByte;
+static uint32_t rxdBaud;
+static uint64_t rxdStartCycle;
+static bool rxdLastLevel;
+static bool rxReceiving;
+static uint64_t rxStartCycle;
+static uint8_t rxBit;           // next bit to sample. 0 is the start bit
+static uint8_t rxShift;
+
+// watchdog
+static bool wdtEnabled;
+static uint64_t wdtTimeoutCycles;
+static uint64_t wdtLastReset;
+static bool wdtExpired;
+
+static void serviceFlagRegister (
+    FlagRegister* reg)
+{
+    if (reg->accessed) {
+        reg->accessed = false;
+        reg->flags &= ~reg->written;
+    }
+}
+
+static volatile uint8_t* accessFlagRegister (
+    FlagRegister* reg)
+{
+    serviceFlagRegister(reg);
+    reg->written = 0;
+    reg->accessed = true;
+    return &reg->written;
+}
+
+static void serviceEEPROM (void)
+{
+    if (eecr & (1 << EERE)) {
+        eedr = eeprom[EEAR & E2END];
+        eecr &= ~(1 << EERE);
+        cycles += 4;
+    }
+    if ((eecr & (1 << EEPE)) && !eepromProgramming) {
+        if (eecr & (1 << EEMPE)) {
+            uint8_t* cell = &eeprom[EEAR & E2END];
+            switch ((eecr >> EEPM0) & 3) {
+                case 0 :    *cell = eedr;   break;  // erase and write
+                case 1 :    *cell = 0xFF;   break;  // erase only
+                case 2 :    *cell &= eedr;  break;  // write only
+                default :                   break;
+            }
+            eepromProgramming = true;
+            eepromReadyCycle = cycles + EEPROM_WRITE_CYCLES;
+        } else {
+            // EEPE without EEMPE has no effect
+            eecr &= ~(1 << EEPE);
+        }
+        eecr &= ~(1 << EEMPE);
+    }
+    if (eepromProgramming && (cycles >= eepromReadyCycle)) {
+        eepromProgramming = false;
+        eecr &= ~(1 << EEPE);
+    }
+}
+
+static uint32_t uartBitCycles (void)
+{
+    return ((UCSR0A & (1 << U2X0)) ? 8UL : 16UL) * ((UBRR0 & 0x0FFF) + 1UL);
+}
+
+uint32_t HostHAL_uartByteCycles (void)
+{
+    return uartBitCycles() * 10;    // start, 8 data and stop bits
+}
+
+uint32_t HostHAL_uartBaud (void)
+{
+    return F_CPU / uartBitCycles();
+}
+
+static void transmitByte (
+    const uint8_t byte)
+{
+    if (!(UCSR0B & (1 << TXEN0))) {
+        return;
+    }
+    if (!txShifting) {
+        txShift = byte;
+        txShifting = true;
+        txDoneCycle = cycles + HostHAL_uartByteCycles();
+        UCSR0A &= ~(1 << TXC0);
+    } else if (UCSR0A & (1 << UDRE0)) {
+        txBuffer = byte;
+        UCSR0A &= ~(1 << UDRE0);
+    }
+    // else the byte is lost, as on the real thing
+}
+
+static void serviceUART (void)
+{
+    if (udr0Accessed) {
+        udr0Accessed = false;
+        if ((udr0 & 0xFFFF0000UL) != UDR0_READ_MARK) {
+            // the firmware wrote UDR0
+            transmitByte(udr0 & 0xFF);
+        } else {
+            // reading UDR0 empties the receive buffer
+            UCSR0A &= ~(1 << RXC0);
+        }
+    }
+    if (txShifting && (cycles >= txDoneCycle)) {
+        if (uartOutputCB != NULL) {
+            uartOutputCB(txShift, uartOutputData);
+        }
+        if (!(UCSR0A & (1 << UDRE0))) {
+            txShift = txBuffer;
+            txDoneCycle = cycles + HostHAL_uartByteCycles();
+            UCSR0A |= (1 << UDRE0);
+        } else {
+            txShifting = false;
+            UCSR0A |= (1 << TXC0);
+        }
+    }
+}
+
+static void receiveByte (
+    const uint8_t byte)
+{
+    rxData = byte;
+    udr0 = UDR0_READ_MARK | rxData;
+    UCSR0A |= (1 << RXC0);
+}
+
+// level of the byte being sent on RXD: start bit, data LSB first, then
+// stop bit and idle
+static bool rxdLevel (void)
+{
+    if (!rxdSending) {
+        return true;
+    }
+    const uint64_t bit = ((cycles - rxdStartCycle) * rxdBaud) / F_CPU;
+    if (bit == 0) {
+        return false;
+    }
+    if (bit <= 8) {
+        return (rxdByte >> (bit - 1)) & 1;
+    }
+    if (bit >= 10) {
+        rxdSending = false;
+    }
+    return true;
+}
+
+// drives RXD and runs the UART receiver on it
+static void serviceRXD (void)
+{
+    if (!rxdDriven) {
+        return;
+    }
+    const bool level = rxdLevel();
+    if ((((PIND >> PD0) & 1) != 0) != level) {
+        HostHAL_setPin(&PIND, PD0, level);
+    }
+    const bool lastLevel = rxdLastLevel;
+    rxdLastLevel = level;
+    if (!(UCSR0B & (1 << RXEN0))) {
+        rxReceiving = false;
+        return;
+    }
+    if (!rxReceiving) {
+        // a start bit begins with a falling edge
+        if (lastLevel && !level) {
+            rxReceiving = true;
+            rxStartCycle = cycles;
+            rxBit = 0;
+            rxShift = 0;
+        }
+        return;
+    }
+    // each bit is sampled in the middle, at the UART's rate
+    const uint32_t bitCycles = uartBitCycles();
+    if (cycles < (rxStartCycle + (rxBit * bitCycles) + (bitCycles / 2))) {
+        return;
+    }
+    if (rxBit == 0) {
+        // false start
+        rxReceiving = !level;
+    } else if (rxBit <= 8) {
+        rxShift |= level << (rxBit - 1);
+    } else {
+        if (level) {
+            UCSR0A &= ~(1 << FE0);
+        } else {
+            UCSR0A |= (1 << FE0);
+        }
+        if (UCSR0A & (1 << RXC0)) {
+            UCSR0A |= (1 << DOR0);
+        } else {
+            receiveByte(rxShift);
+        }
+        rxReceiving = false;
+    }
+    ++rxBit;
+}
+
+static void serviceWatchdog (void)
+{
+    if (wdtEnabled && !wdtExpired &&
+        ((cycles - wdtLastReset) >= wdtTimeoutCycles)) {
+        wdtExpired = true;
+    }
+}
+
+static void timer1Clock (void)
+{
+    const bool ctc = (TCCR1B & (1 << WGM12)) != 0;
+    if (ctc && (TCNT1 == OCR1A)) {
+        TCNT1 = 0;
+    } else {
+        ++TCNT1;
+        if (TCNT1 == 0) {
+            tifr1.flags |= (1 << TOV1);
+        }
+    }
+    if (TCNT1 == OCR1A) {
+        tifr1.flags |= (1 << OCF1A);
+    }
+    if (TCNT1 == OCR1B) {
+        tifr1.flags |= (1 << OCF1B);
+    }
+}
+
+static uint16_t timer1Prescale (void)
+{
+    static const uint16_t prescales[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+    return prescales[TCCR1B & 7];
+}
+
+static void serviceTimer1 (
+    const uint16_t elapsedCycles)
+{
+    const uint16_t prescale = timer1Prescale();
+    if (prescale == 0) {
+        return;
+    }
+    timer1PrescaleCycles += elapsedCycles;
+    while (timer1PrescaleCycles >= prescale) {
+        timer1PrescaleCycles -= prescale;
+        timer1Clock();
+    }
+}
+
+// counts from TCNT1 until it reaches value
+static uint32_t countsUntil (
+    const uint16_t value)
+{
+    const uint16_t counts = value - TCNT1;
+    return (counts != 0) ? counts : 0x10000UL;
+}
+
+// cycles until the next timer, EEPROM, UART or watchdog event
+static uint64_t cyclesUntilNextEvent (void)
+{
+    uint64_t next = UINT64_MAX;
+    const uint16_t prescale = timer1Prescale();
+    if (prescale != 0) {
+        uint32_t counts = countsUntil(0);
+        if (countsUntil(OCR1A) < counts) {
+            counts = countsUntil(OCR1A);
+        }
+        if (countsUntil(OCR1B) < counts) {
+            counts = countsUntil(OCR1B);
+        }
+        next = ((uint64_t)counts * prescale) - timer1PrescaleCycles;
+    }
+    if (eepromProgramming && ((eepromReadyCycle - cycles) < next)) {
+        next = eepromReadyCycle - cycles;
+    }
+    if (txShifting && ((txDoneCycle - cycles) < next)) {
+        next = txDoneCycle - cycles;
+    }
+    if (rxdSending || rxReceiving) {
+        // RXD is followed a step at a time
+        next = 0;
+    }
+    if (wdtEnabled && !wdtExpired &&
+        ((wdtLastReset + wdtTimeoutCycles - cycles) < next)) {
+        next = wdtLastReset + wdtTimeoutCycles - cycles;
+    }
+    return next;
+}
+
+// moves time forward without any event happening on the way
+static void skipCycles (
+    const uint64_t skipped)
+{
+    cycles += skipped;
+    const uint16_t prescale = timer1Prescale();
+    if (prescale != 0) {
+        const uint64_t timerCycles = timer1PrescaleCycles + skipped;
+        TCNT1 += (uint16_t)(timerCycles / prescale);
+        timer1PrescaleCycles = timerCycles % prescale;
+    }
+}
+
+typedef void (*Vector)(void);
+
+// returns the highest priority interrupt that is enabled and pending,
+// clearing its flag if the hardware does so on entry to the vector
+static Vector pendingInterrupt (void)
+{
+    static const uint8_t pcintMask[3] = { 1 << PCIE0, 1 << PCIE1, 1 << PCIE2 };
+    const Vector pcintVectors[3] = { PCINT0_vect, PCINT1_vect, PCINT2_vect };
+    for (uint8_t i = 0; i < 3; ++i) {
+        if ((PCICR & pcifr.flags & pcintMask[i]) && (pcintVectors[i] != NULL)) {
+            pcifr.flags &= ~pcintMask[i];
+            return pcintVectors[i];
+        }
+    }
+
+    const uint8_t timer1Pending = TIMSK1 & tifr1.flags;
+    if ((timer1Pending & (1 << ICF1)) && (TIMER1_CAPT_vect != NULL)) {
+        tifr1.flags &= ~(1 << ICF1);
+        return TIMER1_CAPT_vect;
+    }
+    if ((timer1Pending & (1 << OCF1A)) && (TIMER1_COMPA_vect != NULL)) {
+        tifr1.flags &= ~(1 << OCF1A);
+        return TIMER1_COMPA_vect;
+    }
+    if ((timer1Pending & (1 << OCF1B)) && (TIMER1_COMPB_vect != NULL)) {
+        tifr1.flags &= ~(1 << OCF1B);
+        return TIMER1_COMPB_vect;
+    }
+    if ((timer1Pending & (1 << TOV1)) && (TIMER1_OVF_vect != NULL)) {
+        tifr1.flags &= ~(1 << TOV1);
+        return TIMER1_OVF_vect;
+    }
+
+    // USART and EEPROM interrupts are level triggered
+    if ((UCSR0B & (1 << RXCIE0)) && (UCSR0A & (1 << RXC0)) &&
+        (USART_RX_vect != NULL)) {
+        return USART_RX_vect;
+    }
+    if ((UCSR0B & (1 << UDRIE0)) && (UCSR0A & (1 << UDRE0)) &&
+        (USART_UDRE_vect != NULL)) {
+        return USART_UDRE_vect;
+    }
+    if ((UCSR0B & (1 << TXCIE0)) && (UCSR0A & (1 << TXC0)) &&
+        (USART_TX_vect != NULL)) {
+        UCSR0A &= ~(1 << TXC0);
+        return USART_TX_vect;
+    }
+    if ((eecr & (1 << EERIE)) && !(eecr & (1 << EEPE)) &&
+        (EE_READY_vect != NULL)) {
+        return EE_READY_vect;
+    }
+
+    return NULL;
+}
+
+static void serviceInterrupts (void)
+{
+    for (;;) {
+        serviceFlagRegister(&pcifr);
+        serviceFlagRegister(&tifr1);
+        serviceEEPROM();
+        serviceUART();
+        if (!(SREG & (1 << SREG_I))) {
+            return;
+        }
+        const Vector vector = pendingInterrupt();
+        if (vector == NULL) {
+            return;
+        }
+        // interrupts are disabled on entry and enabled again by reti
+        SREG &= ~(1 << SREG_I);
+        vector();
+        SREG |= (1 << SREG_I);
+    }
+}
+
+static void step (void)
+{
+    // apply flag writes before the timer sets new ones
+    serviceFlagRegister(&pcifr);
+    serviceFlagRegister(&tifr1);
+    cycles += HOSTHAL_CYCLES_PER_STEP;
+    serviceTimer1(HOSTHAL_CYCLES_PER_STEP);
+    serviceRXD();
+    serviceWatchdog();
+    serviceInterrupts();
+}
+
+void HostHAL_Initialize (void)
+{
+    SREG = 0;
+    PINB = 0;   DDRB = 0;   PORTB = 0;
+    PINC = 0;   DDRC = 0;   PORTC = 0;
+    PIND = 0;   DDRD = 0;   PORTD = 0;
+    PCICR = 0;
+    pcifr.flags = 0;
+    pcifr.accessed = false;
+    PCMSK0 = 0; PCMSK1 = 0; PCMSK2 = 0;
+    TCCR0A = 0; TCCR0B = 0; TCNT0 = 0;
+    OCR0A = 0;  OCR0B = 0;
+    TIMSK0 = 0; TIFR0 = 0;
+    TCCR1A = 0; TCCR1B = 0; TCCR1C = 0;
+    TCNT1 = 0;  OCR1A = 0;  OCR1B = 0;
+    ICR1 = 0;
+    TIMSK1 = 0;
+    tifr1.flags = 0;
+    tifr1.accessed = false;
+    EEAR = 0;
+    UCSR0A = (1 << UDRE0);
+    UCSR0B = 0;
+    UCSR0C = (1 << UCSZ01) | (1 << UCSZ00);
+    UBRR0 = 0;
+    WDTCSR = 0; MCUSR = 0;
+    GPIOR0 = 0; GPIOR1 = 0; GPIOR2 = 0;
+
+    cycles = 0;
+    timer1PrescaleCycles = 0;
+    eecr = 0;
+    eedr = 0;
+    eepromProgramming = false;
+    udr0 = UDR0_READ_MARK;
+    udr0Accessed = false;
+    rxData = 0;
+    txShifting = false;
+    rxdDriven = false;
+    rxdSending = false;
+    rxReceiving = false;
+    wdtEnabled = false;
+    wdtExpired = false;
+}
+
+uint64_t HostHAL_cycles (void)
+{
+    return cycles;
+}
+
+uint64_t HostHAL_microseconds (void)
+{
+    return cycles / (F_CPU / 1000000UL);
+}
+
+void HostHAL_advanceCycles (
+    const uint64_t elapsed)
+{
+    const uint64_t target = cycles + elapsed;
+    while (cycles < target) {
+        // nothing can happen before the next event, so skip to it
+        serviceInterrupts();
+        const uint64_t remaining = target - cycles;
+        const uint64_t untilEvent = cyclesUntilNextEvent();
+        const uint64_t quiet = (untilEvent < remaining) ? untilEvent : remaining;
+        if (quiet > HOSTHAL_CYCLES_PER_STEP) {
+            skipCycles(quiet - HOSTHAL_CYCLES_PER_STEP);
+        }
+        step();
+    }
+}
+
+void HostHAL_advanceMicroseconds (
+    const uint64_t microseconds)
+{
+    HostHAL_advanceCycles(microseconds * (F_CPU / 1000000UL));
+}
+
+void HostHAL_setPin (
+    volatile uint8_t* pinRegister,
+    const uint8_t pin,
+    const bool level)
+{
+    serviceFlagRegister(&pcifr);
+    serviceFlagRegister(&tifr1);
+    const uint8_t mask = (1 << pin);
+    const uint8_t oldPins = *pinRegister;
+    if (level) {
+        *pinRegister |= mask;
+    } else {
+        *pinRegister &= ~mask;
+    }
+    if (*pinRegister == oldPins) {
+        return;
+    }
+
+    if (pinRegister == &PINB) {
+        if (PCMSK0 & mask) {
+            pcifr.flags |= (1 << PCIF0);
+        }
+        if (pin == PB0) {
+            // ICP1. capture on the edge selected by ICES1
+            const bool risingEdge = (TCCR1B & (1 << ICES1)) != 0;
+            if (level == risingEdge) {
+                ICR1 = TCNT1;
+                tifr1.flags |= (1 << ICF1);
+            }
+        }
+    } else if (pinRegister == &PINC) {
+        if (PCMSK1 & mask) {
+            pcifr.flags |= (1 << PCIF1);
+        }
+    } else if (pinRegister == &PIND) {
+        if (PCMSK2 & mask) {
+            pcifr.flags |= (1 << PCIF2);
+        }
+    }
+    serviceInterrupts();
+}
+
+bool HostHAL_receiveUARTByte (
+    const uint8_t byte)
+{
+    serviceUART();
+    if (!(UCSR0B & (1 << RXEN0)) || (UCSR0A & (1 << RXC0))) {
+        return false;
+    }
+    receiveByte(byte);
+    serviceInterrupts();
+    return true;
+}
+
+bool HostHAL_sendUARTByte (
+    const uint8_t byte,
+    const uint32_t baud)
+{
+    if (rxdSending) {
+        return false;
+    }
+    if (!rxdDriven) {
+        // the line idles high
+        rxdDriven = true;
+        rxdLastLevel = true;
+        HostHAL_setPin(&PIND, PD0, true);
+    }
+    rxdByte = byte;
+    rxdBaud = baud;
+    rxdStartCycle = cycles;
+    rxdSending = true;
+    serviceRXD();
+    serviceInterrupts();
+    return true;
+}
+
+void HostHAL_setUARTOutputCB (
+    HostHAL_UARTOutputCB cb,
+    void* data)
+{
+    uartOutputCB = cb;
+    uartOutputData = data;
+}
+
+bool HostHAL_watchdogExpired (void)
+{
+    return wdtExpired;
+}
+
+uint8_t* HostHAL_eeprom (void)
+{
+    return eeprom;
+}
+
+bool HostHAL_loadEEPROM (
+    const char* filename)
+{
+    FILE* f = fopen(filename, "rb");
+    if (f == NULL) {
+        return false;
+    }
+    const bool loaded = fread(eeprom, 1, sizeof(eeprom), f) == sizeof(eeprom);
+    fclose(f);
+    return loaded;
+}
+
+bool HostHAL_saveEEPROM (
+    const char* filename)
+{
+    FILE* f = fopen(filename, "wb");
+    if (f == NULL) {
+        return false;
+    }
+    const bool saved = fwrite(eeprom, 1, sizeof(eeprom), f) == sizeof(eeprom);
+    fclose(f);
+    return saved;
+}
+
+volatile uint8_t* HostHAL_pcifr (void)
+{
+    return accessFlagRegister(&pcifr);
+}
+
+volatile uint8_t* HostHAL_tifr1 (void)
+{
+    return accessFlagRegister(&tifr1);
+}
+
+volatile uint8_t* HostHAL_eecr (void)
+{
+    serviceEEPROM();
+    if (eecr & (1 << EEPE)) {
+        // polling a busy EEPROM takes time
+        step();
+    }
+    return &eecr;
+}
+
+volatile uint8_t* HostHAL_eedr (void)
+{
+    serviceEEPROM();
+    return &eedr;
+}
+
+volatile uint32_t* HostHAL_udr0 (void)
+{
+    serviceUART();
+    udr0 = UDR0_READ_MARK | rxData;
+    udr0Accessed = true;
+    return &udr0;
+}
+
+//
+// <avr/wdt.h>
+//
+void wdt_enable (
+    const uint8_t timeout)
+{
+    // 16mS doubled for each step of the timeout
+    wdtTimeoutCycles = ((uint64_t)F_CPU / 1000 * 16) << timeout;
+    wdtLastReset = cycles;
+    wdtEnabled = true;
+}
+
+void wdt_disable (void)
+{
+    wdtEnabled = false;
+}
+
+void wdt_reset (void)
+{
+    wdtLastReset = cycles;
+}
+
+//
+// <avr/eeprom.h>
+//
+static uint8_t eepromReadByte (
+    const uintptr_t addr)
+{
+    eeprom_busy_wait();
+    EEAR = addr & E2END;
+    EECR |= (1 << EERE);
+    return EEDR;
+}
+
+static void eepromWriteByte (
+    const uintptr_t addr,
+    const uint8_t value,
+    const bool update)
+{
+    if (update && (eepromReadByte(addr) == value)) {
+        return;
+    }
+    eeprom_busy_wait();
+    const uint8_t sregSave = SREG;
+    cli();
+    EEAR = addr & E2END;
+    EEDR = value;
+    EECR &= ~((1 << EEPM1) | (1 << EEPM0));
+    EECR |= (1 << EEMPE);
+    EECR |= (1 << EEPE);
+    SREG = sregSave;
+}
+
+uint8_t eeprom_read_byte (const uint8_t* addr)
+{
+    return eepromReadByte((uintptr_t)addr);
+}
+
+uint16_t eeprom_read_word (const uint16_t* addr)
+{
+    uint16_t value;
+    eeprom_read_block(&value, addr, sizeof(value));
+    return value;
+}
+
+uint32_t eeprom_read_dword (const uint32_t* addr)
+{
+    uint32_t value;
+    eeprom_read_block(&value, addr, sizeof(value));
+    return value;
+}
+
+void eeprom_read_block (void* dst, const void* src, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        ((uint8_t*)dst)[i] = eepromReadByte((uintptr_t)src + i);
+    }
+}
+
+void eeprom_write_byte (uint8_t* addr, uint8_t value)
+{
+    eepromWriteByte((uintptr_t)addr, value, false);
+}
+
+void eeprom_write_word (uint16_t* addr, uint16_t value)
+{
+    eeprom_write_block(&value, addr, sizeof(value));
+}
+
+void eeprom_write_dword (uint32_t* addr, uint32_t value)
+{
+    eeprom_write_block(&value, addr, sizeof(value));
+}
+
+void eeprom_write_block (const void* src, void* dst, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        eepromWriteByte((uintptr_t)dst + i, ((const uint8_t*)src)[i], false);
+    }
+}
+
+void eeprom_update_byte (uint8_t* addr, uint8_t value)
+{
+    eepromWriteByte((uintptr_t)addr, value, true);
+}
+
+void eeprom_update_word (uint16_t* addr, uint16_t value)
+{
+    eeprom_update_block(&value, addr, sizeof(value));
+}
+
+void eeprom_update_dword (uint32_t* addr, uint32_t value)
+{
+    eeprom_update_block(&value, addr, sizeof(value));
+}
+
+void eeprom_update_block (const void* src, void* dst, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        eepromWriteByte((uintptr_t)dst + i, ((const uint8_t*)src)[i], true);
+    }
+}
@@ -0,0 +1,88 @@
+//
+//  Host HAL
+//
+//  Simulated ATmega328P peripherals for running the firmware modules
+//  natively on a Linux host. The AVR registers the firmware uses are
+//  plain variables (see avr/io.h in this directory) and interrupt
+//  service routines are ordinary functions that the HAL calls when
+//  their interrupt is enabled, flagged and global interrupts are on.
+//
+//  Simulated time only moves when the HAL is told to advance it.
+//  Timer 1, the EEPROM, the UART and the watchdog are modelled well
+//  enough for the firmware's use of them. Timer 0 just holds its
+//  registers; a simulation reads OCR0A/OCR0B to get the motor drive.
+//
+#ifndef HOSTHAL_H
+#define HOSTHAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// CPU cycles per simulation step. One timer 1 count at the firmware's
+// prescale of 64.
+#define HOSTHAL_CYCLES_PER_STEP 64
+
+// Callback for bytes the firmware transmits on the UART
+typedef void (*HostHAL_UARTOutputCB)(const uint8_t byte, void* data);
+
+// resets all registers and simulated time. EEPROM contents are kept
+extern void HostHAL_Initialize (void);
+
+// simulated CPU cycles since initialization
+extern uint64_t HostHAL_cycles (void);
+
+// simulated time since initialization, in microseconds
+extern uint64_t HostHAL_microseconds (void);
+
+// advances simulated time, running interrupts as they come due
+extern void HostHAL_advanceCycles (
+    const uint64_t cycles);
+
+extern void HostHAL_advanceMicroseconds (
+    const uint64_t microseconds);
+
+// drives an input pin. pinRegister is one of &PINB, &PINC or &PIND.
+// raises the pin change and timer 1 input capture interrupts as the
+// firmware has configured them
+extern void HostHAL_setPin (
+    volatile uint8_t* pinRegister,
+    const uint8_t pin,
+    const bool level);
+
+// feeds a byte to the UART receiver. returns false if the previous
+// byte hasn't been read yet (it would be overrun)
+extern bool HostHAL_receiveUARTByte (
+    const uint8_t byte);
+
+// sends a byte on RXD (PD0) at the given baud rate, for the firmware to
+// see the edges of. The UART receives what it samples at its own rate.
+// returns false if the previous byte hasn't been sent yet
+extern bool HostHAL_sendUARTByte (
+    const uint8_t byte,
+    const uint32_t baud);
+
+// simulated time to send or receive one byte at the configured baud rate
+extern uint32_t HostHAL_uartByteCycles (void);
+
+// the configured baud rate
+extern uint32_t HostHAL_uartBaud (void);
+
+extern void HostHAL_setUARTOutputCB (
+    HostHAL_UARTOutputCB cb,
+    void* data);
+
+// true once the watchdog has timed out. The firmware can't be reset
+// in-process, so the caller decides what to do about it
+extern bool HostHAL_watchdogExpired (void);
+
+// direct access to the simulated EEPROM, for loading and saving its
+// contents between runs
+extern uint8_t* HostHAL_eeprom (void);
+
+extern bool HostHAL_loadEEPROM (
+    const char* filename);
+
+extern bool HostHAL_saveEEPROM (
+    const char* filename);
+
+#endif  // HOSTHAL_H
@@ -0,0 +1,262 @@
+//
+//  Water Pump Controller, host build
+//
+//  Runs the firmware against the host HAL. The console is connected to
+//  stdin/stdout, or to a pseudo terminal with -y. Simulated time runs as
+//  fast as the host allows unless -r is given.
+//
+//  usage: WaterPumpHost [-r] [-p] [-t seconds] [-l loopCycles] [-c charMs]
+//                       [-b baud] [-e eepromFile] [-y ptyLink]
+//
+//  -r  run in real time
+//  -p  connect the pump simulator, so the plunger moves when driven
+//  -t  simulated seconds to run for (0 runs until interrupted)
+//  -l  simulated CPU cycles per pass through the main loop
+//  -c  minimum time between console input characters, in mS. Input is
+//      otherwise fed at the baud rate
+//  -b  baud rate of the simulated terminal. Input is sent on RXD at this
+//      rate, whatever the firmware's rate is, and output sent at another
+//      rate shows as '?'. Without it, input is fed straight to the UART
+//  -e  file holding the EEPROM contents. Loaded at startup and saved
+//      at exit
+//  -y  connect the console to a new pseudo terminal instead, and make
+//      ptyLink a symlink to it, for programs such as ModbusMaster that
+//      open a serial device. Bytes pass through unchanged, and input is
+//      sent on RXD at the -b rate or else the firmware's, so that
+//      anything timing the line sees real characters. Use with -r
+//
+// for posix_openpt
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <time.h>
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+
+#include "HostHAL.h"
+#include "PumpSimulator.h"
+#include "SystemTime.h"
+#include "EEPROMStorage.h"
+#include "Console.h"
+#include "BinaryProtocol.h"
+#include "PinChangeMonitor.h"
+#include "BaudRate.h"
+#include "ModbusSlave.h"
+#include "WaterPumpControl.h"
+#include "StatusStream.h"
+#include "Profiler.h"
+
+// default simulated cost of one pass through the main loop
+#define DEFAULT_MAINLOOP_CYCLES 2000
+
+// baud rate of the simulated terminal. 0 when it follows the firmware
+static uint32_t terminalBaud;
+
+// master side of the console's pseudo terminal. -1 for stdin/stdout
+static int ptyFd = -1;
+
+static void writeConsoleByte (
+    const uint8_t byte,
+    void* data)
+{
+    (void)data;
+    // a terminal reads garbage from a UART more than 5% off its rate
+    const uint32_t baud = HostHAL_uartBaud();
+    const bool readable = (terminalBaud == 0) ||
+        (((baud > terminalBaud) ? (baud - terminalBaud) : (terminalBaud - baud)) <
+            (terminalBaud / 20));
+    const char c = readable ? byte : '?';
+    if (ptyFd >= 0) {
+        // fails, and the byte is lost, while nothing has the terminal open
+        (void)!write(ptyFd, &c, 1);
+    } else {
+        putchar(c);
+        fflush(stdout);
+    }
+}
+
+// opens a pseudo terminal and links ptyLink to its slave side. returns
+// the master side, or -1
+static int openPty (
+    const char* ptyLink)
+{
+    const int fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((fd < 0) || (grantpt(fd) != 0) || (unlockpt(fd) != 0)) {
+        perror("posix_openpt");
+        return -1;
+    }
+    // raw, so that the line discipline doesn't echo the firmware's
+    // output back to it or translate line endings
+    struct termios tio;
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+    const char* slave = ptsname(fd);
+    unlink(ptyLink);
+    if ((slave == NULL) || (symlink(slave, ptyLink) != 0)) {
+        perror(ptyLink);
+        close(fd);
+        return -1;
+    }
+    fprintf(stderr, "console on %s (%s)\n", ptyLink, slave);
+    return fd;
+}
+
+static uint64_t wallMicroseconds (void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+// same as Initialize() in WaterPump.c. RAMSentinel is left out; it
+// guards the AVR stack, which the host doesn't share with .bss
+static void Initialize (void)
+{
+    wdt_enable(WDTO_500MS);
+
+    SystemTime_Initialize();
+    EEPROMStorage_Initialize();
+    Console_Initialize();
+    BinaryProtocol_Initialize();
+    PinChangeMonitor_Initialize();
+    BaudRate_Initialize();
+    ModbusSlave_Initialize();
+    WaterPumpControl_Initialize();
+    StatusStream_Initialize();
+    Profiler_Initialize();
+}
+
+int main (
+    int argc,
+    char* argv[])
+{
+    bool realTime = false;
+    bool simulatePump = false;
+    double seconds = 10.0;
+    uint32_t mainLoopCycles = DEFAULT_MAINLOOP_CYCLES;
+    uint64_t charCycles = 0;
+    const char* eepromFile = NULL;
+    const char* ptyLink = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "rpt:l:c:b:e:y:")) != -1) {
+        switch (opt) {
+            case 'r' :  realTime = true;                                 break;
+            case 'p' :  simulatePump = true;                             break;
+            case 't' :  seconds = atof(optarg);                          break;
+            case 'l' :  mainLoopCycles = strtoul(optarg, NULL, 0);       break;
+            case 'c' :  charCycles = atof(optarg) * (F_CPU / 1000);      break;
+            case 'b' :  terminalBaud = strtoul(optarg, NULL, 0);         break;
+            case 'e' :  eepromFile = optarg;                             break;
+            case 'y' :  ptyLink = optarg;                                break;
+            default :
+                fprintf(stderr,
+                    "usage: %s [-r] [-p] [-t seconds] [-l loopCycles] [-c charMs] "
+                    "[-b baud] [-e eepromFile] [-y ptyLink]\n", argv[0]);
+                return 1;
+        }
+    }
+    if ((ptyLink != NULL) && ((ptyFd = openPty(ptyLink)) < 0)) {
+        return 1;
+    }
+    const int inputFd = (ptyFd >= 0) ? ptyFd : STDIN_FILENO;
+
+    HostHAL_Initialize();
+    if (eepromFile != NULL) {
+        HostHAL_loadEEPROM(eepromFile);
+    }
+    HostHAL_setUARTOutputCB(writeConsoleByte, NULL);
+    if (simulatePump) {
+        PumpSimulator_params params;
+        PumpSimulator_defaultParams(&params);
+        PumpSimulator_Initialize(&params);
+    } else {
+        // tank not full
+        HostHAL_setPin(&PINC, PC4, true);
+    }
+
+    Initialize();
+
+    sei();
+
+    fcntl(inputFd, F_SETFL, fcntl(inputFd, F_GETFL) | O_NONBLOCK);
+    const uint64_t endCycle = (uint64_t)(seconds * F_CPU);
+    const uint64_t wallStart = wallMicroseconds();
+    uint64_t nextRxCycle = 0;
+    int pendingInput = -1;
+    bool inputOpen = true;
+
+    while ((seconds == 0) || (HostHAL_cycles() < endCycle)) {
+        // run all the tasks
+        Profiler_beginPass();
+        SystemTime_task();
+        Profiler_endTask(pi_systemTimeTask);
+        WaterPumpControl_task();
+        Profiler_endTask(pi_waterPumpControlTask);
+        Console_task();
+        Profiler_endTask(pi_consoleTask);
+        StatusStream_task();
+        Profiler_endTask(pi_statusStreamTask);
+
+        if (HostHAL_watchdogExpired()) {
+            fprintf(stderr, "\nwatchdog reset at %.3fs\n",
+                HostHAL_cycles() / (double)F_CPU);
+            break;
+        }
+
+        // feed console input at the baud rate
+        if (inputOpen && (pendingInput < 0)) {
+            char c;
+            const ssize_t n = read(inputFd, &c, 1);
+            if (n == 1) {
+                pendingInput = ((c == '\n') && (ptyFd < 0)) ? '\r' : (uint8_t)c;
+            } else if ((n == 0) && (ptyFd < 0)) {
+                inputOpen = false;
+            }
+            // the pty reads EIO while nothing has it open, which is
+            // the same as no input
+        }
+        const uint32_t rxdBaud = (terminalBaud != 0) ? terminalBaud
+            : ((ptyFd >= 0) ? HostHAL_uartBaud() : 0);
+        if ((pendingInput >= 0) && (HostHAL_cycles() >= nextRxCycle) &&
+            ((rxdBaud != 0)
+                ? HostHAL_sendUARTByte(pendingInput, rxdBaud)
+                : HostHAL_receiveUARTByte(pendingInput))) {
+            pendingInput = -1;
+            const uint64_t byteCycles = (rxdBaud != 0)
+                ? ((10ULL * F_CPU) / rxdBaud)
+                : HostHAL_uartByteCycles();
+            nextRxCycle = HostHAL_cycles() +
+                ((charCycles > byteCycles) ? charCycles : byteCycles);
+        }
+
+        if (simulatePump) {
+            PumpSimulator_advanceCycles(mainLoopCycles);
+        } else {
+            HostHAL_advanceCycles(mainLoopCycles);
+        }
+
+        if (realTime) {
+            const uint64_t simulated = HostHAL_microseconds();
+            const uint64_t wall = wallMicroseconds() - wallStart;
+            if (simulated > wall) {
+                usleep(simulated - wall);
+            }
+        }
+    }
+
+    if (eepromFile != NULL) {
+        EEPROMStorage_flush();
+        HostHAL_saveEEPROM(eepromFile);
+    }
+    if (ptyFd >= 0) {
+        unlink(ptyLink);
+    }
+    return 0;
+}
@@ -0,0 +1,234 @@
+//
+//  Modbus Master
+//
+//  A minimal Modbus RTU master for trying out the firmware's Modbus
+//  mode (see ModbusSlave.h) over a serial device, such as the pseudo
+//  terminal WaterPumpHost -y makes. Sends one request and prints the
+//  reply: a register and its value per line for reads, or "ok" for
+//  writes. Exits with 1 if the reply is an exception, is missing or
+//  is malformed.
+//
+//  usage: ModbusMaster [-a address] [-b baud] [-w timeoutMs] device
+//                      rh start count | ri start count |
+//                      wh register value | wm start value...
+//
+//  -a  slave address (default 1). 0 broadcasts, which gets no reply
+//  -b  baud rate of the device (default 4800)
+//  -w  time to wait for the reply (default 1000)
+//  rh  read holding registers      ri  read input registers
+//  wh  write a holding register    wm  write consecutive holding registers
+//
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <sys/select.h>
+
+#include "FrameCodec.h"
+
+#define MAX_FRAME 256
+
+// silence after which the reply is complete
+#define END_OF_FRAME_MS 50
+
+static const struct {
+    uint32_t baud;
+    speed_t speed;
+} speeds[] = {
+    { 4800, B4800 }, { 9600, B9600 }, { 19200, B19200 },
+    { 38400, B38400 }, { 57600, B57600 }, { 115200, B115200 }
+};
+
+static int openDevice (
+    const char* device,
+    const uint32_t baud)
+{
+    speed_t speed = 0;
+    for (size_t i = 0; i < (sizeof(speeds) / sizeof(speeds[0])); ++i) {
+        if (speeds[i].baud == baud) {
+            speed = speeds[i].speed;
+        }
+    }
+    if (speed == 0) {
+        fprintf(stderr, "unsupported baud rate %u\n", baud);
+        return -1;
+    }
+    const int fd = open(device, O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        perror(device);
+        return -1;
+    }
+    struct termios tio;
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        cfsetispeed(&tio, speed);
+        cfsetospeed(&tio, speed);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+    tcflush(fd, TCIOFLUSH);
+    return fd;
+}
+
+static void putWord (
+    uint8_t* frame,
+    size_t* length,
+    const uint16_t value)
+{
+    frame[(*length)++] = value >> 8;
+    frame[(*length)++] = value & 0xFF;
+}
+
+static uint16_t getWord (
+    const uint8_t* data)
+{
+    return (((uint16_t)data[0]) << 8) | data[1];
+}
+
+// reads a reply, which ends at END_OF_FRAME_MS of silence. returns its
+// length, 0 if nothing came within timeoutMs
+static size_t readReply (
+    const int fd,
+    uint8_t* reply,
+    const unsigned timeoutMs)
+{
+    size_t length = 0;
+    while (length < MAX_FRAME) {
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(fd, &readable);
+        const unsigned waitMs = (length == 0) ? timeoutMs : END_OF_FRAME_MS;
+        struct timeval timeout = { waitMs / 1000, (waitMs % 1000) * 1000 };
+        if (select(fd + 1, &readable, NULL, NULL, &timeout) <= 0) {
+            break;
+        }
+        const ssize_t n = read(fd, reply + length, MAX_FRAME - length);
+        if (n <= 0) {
+            break;
+        }
+        length += n;
+    }
+    return length;
+}
+
+static void usage (
+    const char* program)
+{
+    fprintf(stderr,
+        "usage: %s [-a address] [-b baud] [-w timeoutMs] device\n"
+        "           rh start count | ri start count |\n"
+        "           wh register value | wm start value...\n", program);
+}
+
+int main (
+    int argc,
+    char* argv[])
+{
+    uint8_t address = 1;
+    uint32_t baud = 4800;
+    unsigned timeoutMs = 1000;
+    int opt;
+    // + stops at the device, so that negative values aren't options
+    while ((opt = getopt(argc, argv, "+a:b:w:")) != -1) {
+        switch (opt) {
+            case 'a' :  address = strtoul(optarg, NULL, 0);     break;
+            case 'b' :  baud = strtoul(optarg, NULL, 0);        break;
+            case 'w' :  timeoutMs = strtoul(optarg, NULL, 0);   break;
+            default :
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if ((argc - optind) < 4) {
+        usage(argv[0]);
+        return 1;
+    }
+    const char* device = argv[optind];
+    const char* command = argv[optind + 1];
+    char** args = &argv[optind + 2];
+    const int numArgs = argc - optind - 2;
+
+    // build the request
+    uint8_t request[MAX_FRAME];
+    size_t length = 0;
+    request[length++] = address;
+    uint8_t function;
+    if ((strcmp(command, "rh") == 0) || (strcmp(command, "ri") == 0)) {
+        function = (command[1] == 'h') ? 0x03 : 0x04;
+        request[length++] = function;
+        putWord(request, &length, strtol(args[0], NULL, 0));
+        putWord(request, &length, strtol(args[1], NULL, 0));
+    } else if (strcmp(command, "wh") == 0) {
+        function = 0x06;
+        request[length++] = function;
+        putWord(request, &length, strtol(args[0], NULL, 0));
+        putWord(request, &length, strtol(args[1], NULL, 0));
+    } else if ((strcmp(command, "wm") == 0) && (numArgs <= 100)) {
+        function = 0x10;
+        request[length++] = function;
+        putWord(request, &length, strtol(args[0], NULL, 0));
+        putWord(request, &length, numArgs - 1);
+        request[length++] = 2 * (numArgs - 1);
+        for (int i = 1; i < numArgs; ++i) {
+            putWord(request, &length, strtol(args[i], NULL, 0));
+        }
+    } else {
+        usage(argv[0]);
+        return 1;
+    }
+    const uint16_t crc = FrameCodec_modbusCrc16(request, length);
+    request[length++] = crc & 0xFF;
+    request[length++] = crc >> 8;
+
+    const int fd = openDevice(device, baud);
+    if (fd < 0) {
+        return 1;
+    }
+    if (write(fd, request, length) != (ssize_t)length) {
+        perror(device);
+        return 1;
+    }
+    if (address == 0) {
+        printf("ok\n");
+        return 0;
+    }
+
+    uint8_t reply[MAX_FRAME];
+    const size_t replyLength = readReply(fd, reply, timeoutMs);
+    close(fd);
+    if (replyLength == 0) {
+        fprintf(stderr, "no reply\n");
+        return 1;
+    }
+    if ((replyLength < 5) || (FrameCodec_modbusCrc16(reply, replyLength) != 0) ||
+        (reply[0] != address)) {
+        fprintf(stderr, "bad reply (%zu bytes)\n", replyLength);
+        return 1;
+    }
+    if (reply[1] == (function | 0x80)) {
+        printf("exception %u\n", reply[2]);
+        return 1;
+    }
+    if ((function == 0x03) || (function == 0x04)) {
+        const uint16_t start = getWord(&request[2]);
+        const uint8_t byteCount = reply[2];
+        if ((reply[1] != function) || (replyLength != (size_t)(5 + byteCount))) {
+            fprintf(stderr, "bad reply (%zu bytes)\n", replyLength);
+            return 1;
+        }
+        for (uint8_t i = 0; i < (byteCount / 2); ++i) {
+            const uint16_t value = getWord(&reply[3 + (2 * i)]);
+            printf("%u %u (%d)\n", start + i, value, (int16_t)value);
+        }
+    } else if ((reply[1] == function) && (replyLength == 8)) {
+        printf("ok\n");
+    } else {
+        fprintf(stderr, "bad reply (%zu bytes)\n", replyLength);
+        return 1;
+    }
+    return 0;
+}
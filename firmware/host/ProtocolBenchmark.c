@@ -0,0 +1,285 @@
+//
+//  Protocol Benchmark
+//
+//  Polls the firmware over its simulated UART with the text console and
+//  with the binary protocol, and reports the bytes on the wire and the
+//  time each poll takes. The time runs from the first byte of the
+//  request to the last byte of the reply, at the console's baud rate,
+//  and bounds how often one link can poll.
+//
+//  usage: ProtocolBenchmark [-n polls] [-b baud] [-j]
+//
+//  -n  polls of each command with each protocol (default 20)
+//  -b  console baud rate (default the stored rate, 4800)
+//  -j  print one JSON object per command and protocol instead of a table
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+
+#include "HostHAL.h"
+#include "PumpLink.h"
+#include "SystemTime.h"
+#include "EEPROMStorage.h"
+#include "Console.h"
+#include "BinaryProtocol.h"
+#include "PinChangeMonitor.h"
+#include "BaudRate.h"
+#include "ModbusSlave.h"
+#include "WaterPumpControl.h"
+#include "StatusStream.h"
+
+#define MAINLOOP_CYCLES 2000
+
+// a poll that takes longer than this has failed
+#define POLL_TIMEOUT_SECONDS 5.0
+
+typedef enum Protocol_enum {
+    p_textEcho,
+    p_text,
+    p_binary,
+    p_numProtocols
+} Protocol;
+
+static const char* protocolNames[p_numProtocols] = {
+    "text, echo on",
+    "text, echo off",
+    "binary"
+};
+
+typedef struct PollResult_struct {
+    uint32_t polls;
+    uint32_t failures;
+    uint64_t requestBytes;
+    uint64_t replyBytes;
+    double seconds;
+} PollResult;
+
+// what the firmware has sent since the poll began
+static uint8_t output[1024];
+static size_t outputLength;
+static uint64_t lastOutputCycle;
+
+static void writeConsoleByte (
+    const uint8_t byte,
+    void* data)
+{
+    (void)data;
+    if (outputLength < sizeof(output)) {
+        output[outputLength++] = byte;
+    }
+    lastOutputCycle = HostHAL_cycles();
+}
+
+// same as Initialize() in WaterPump.c, less RAMSentinel
+static void Initialize (void)
+{
+    wdt_enable(WDTO_500MS);
+
+    SystemTime_Initialize();
+    EEPROMStorage_Initialize();
+    Console_Initialize();
+    BinaryProtocol_Initialize();
+    PinChangeMonitor_Initialize();
+    BaudRate_Initialize();
+    ModbusSlave_Initialize();
+    WaterPumpControl_Initialize();
+    StatusStream_Initialize();
+}
+
+static void runMainLoop (void)
+{
+    SystemTime_task();
+    WaterPumpControl_task();
+    Console_task();
+    StatusStream_task();
+    if (HostHAL_watchdogExpired()) {
+        fprintf(stderr, "watchdog reset at %.3fs\n",
+            HostHAL_cycles() / (double)F_CPU);
+        exit(1);
+    }
+    HostHAL_advanceCycles(MAINLOOP_CYCLES);
+}
+
+// true once a JSON line has been received, after any echo
+static bool textReplyComplete (void)
+{
+    size_t lineStart = 0;
+    for (size_t i = 0; (i + 1) < outputLength; ++i) {
+        if ((output[i] == '\r') && (output[i + 1] == '\n')) {
+            if (output[lineStart] == '{') {
+                return true;
+            }
+            lineStart = i + 2;
+        }
+    }
+    return false;
+}
+
+// true once the reply with the given sequence number has been decoded
+static bool binaryReplyComplete (
+    const uint8_t sequence,
+    bool* valid)
+{
+    PumpLink_decoder decoder;
+    PumpLink_initDecoder(&decoder);
+    PumpLink_frame frame;
+    for (size_t i = 0; i < outputLength; ++i) {
+        if (PumpLink_receiveByte(&decoder, output[i], &frame) &&
+            (frame.type == bpt_reply) && (frame.sequence == sequence)) {
+            *valid = (PumpLink_replyStatus(&frame) == bps_ok);
+            return true;
+        }
+    }
+    return false;
+}
+
+// sends a request and runs the firmware until the reply is in.
+// returns false if it didn't come
+static bool poll (
+    const Protocol protocol,
+    const char* command,
+    const uint8_t sequence,
+    PollResult* result)
+{
+    uint8_t request[PUMPLINK_MAX_REQUEST + 2];
+    size_t requestLength;
+    if (protocol == p_binary) {
+        requestLength = PumpLink_encodeCommand(
+            EEPROMStorage_busAddress(), sequence, command, request);
+    } else {
+        requestLength = snprintf((char*)request, sizeof(request), "%s\r", command);
+    }
+
+    outputLength = 0;
+    const uint64_t startCycle = HostHAL_cycles();
+    const uint64_t timeoutCycle = startCycle + (uint64_t)(POLL_TIMEOUT_SECONDS * F_CPU);
+    const uint64_t byteCycles = HostHAL_uartByteCycles();
+    uint64_t nextRxCycle = startCycle;
+    size_t sent = 0;
+    bool complete = false;
+    bool valid = true;
+    while (!complete && (HostHAL_cycles() < timeoutCycle)) {
+        runMainLoop();
+        if ((sent < requestLength) && (HostHAL_cycles() >= nextRxCycle) &&
+            HostHAL_receiveUARTByte(request[sent])) {
+            ++sent;
+            nextRxCycle = HostHAL_cycles() + byteCycles;
+        }
+        if (sent == requestLength) {
+            complete = (protocol == p_binary)
+                ? binaryReplyComplete(sequence, &valid)
+                : textReplyComplete();
+        }
+    }
+
+    ++result->polls;
+    if (!complete || !valid) {
+        ++result->failures;
+        return false;
+    }
+    result->requestBytes += requestLength;
+    result->replyBytes += outputLength;
+    // the last byte has left the UART one byte time after it was queued
+    result->seconds += (lastOutputCycle + byteCycles - startCycle) / (double)F_CPU;
+
+    // let the link go quiet between polls
+    for (int i = 0; i < 100; ++i) {
+        runMainLoop();
+    }
+    return true;
+}
+
+static void printResult (
+    const char* command,
+    const Protocol protocol,
+    const PollResult* r,
+    const bool json)
+{
+    const uint32_t polls = r->polls - r->failures;
+    const double requestBytes = (polls != 0) ? ((double)r->requestBytes / polls) : 0;
+    const double replyBytes = (polls != 0) ? ((double)r->replyBytes / polls) : 0;
+    const double ms = (polls != 0) ? (1000 * r->seconds / polls) : 0;
+    const double pollsPerSecond = (ms > 0) ? (1000 / ms) : 0;
+    if (json) {
+        printf("{\"command\":\"%s\",\"protocol\":\"%s\",\"polls\":%u,"
+            "\"failures\":%u,\"requestBytes\":%.1f,\"replyBytes\":%.1f,"
+            "\"msPerPoll\":%.1f,\"pollsPerSecond\":%.1f}\n",
+            command, protocolNames[protocol], r->polls, r->failures,
+            requestBytes, replyBytes, ms, pollsPerSecond);
+    } else {
+        printf("%-10s %-16s %8.1f %8.1f %10.1f %8.1f %8u\n",
+            command, protocolNames[protocol], requestBytes, replyBytes,
+            ms, pollsPerSecond, r->failures);
+    }
+}
+
+int main (
+    int argc,
+    char* argv[])
+{
+    int polls = 20;
+    uint32_t baud = 0;
+    bool json = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:b:j")) != -1) {
+        switch (opt) {
+            case 'n' :  polls = atoi(optarg);               break;
+            case 'b' :  baud = strtoul(optarg, NULL, 0);    break;
+            case 'j' :  json = true;                        break;
+            default :
+                fprintf(stderr, "usage: %s [-n polls] [-b baud] [-j]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    HostHAL_Initialize();
+    HostHAL_setUARTOutputCB(writeConsoleByte, NULL);
+    // tank not full
+    HostHAL_setPin(&PINC, PC4, true);
+
+    Initialize();
+
+    sei();
+
+    // let startup output go out
+    for (int i = 0; i < 1000; ++i) {
+        runMainLoop();
+    }
+    if (baud != 0) {
+        // the first poll confirms the new rate
+        if (!BaudRate_request(baud)) {
+            fprintf(stderr, "unsupported baud rate %u\n", baud);
+            return 1;
+        }
+        while (BaudRate_changePending()) {
+            runMainLoop();
+        }
+    }
+
+    static const char* commands[] = { "s", "settings" };
+    if (!json) {
+        printf("%-10s %-16s %8s %8s %10s %8s %8s\n", "command", "protocol",
+            "request", "reply", "ms/poll", "polls/s", "failures");
+    }
+    int status = 0;
+    uint8_t sequence = 0;
+    for (size_t c = 0; c < (sizeof(commands) / sizeof(commands[0])); ++c) {
+        for (Protocol protocol = 0; protocol < p_numProtocols; ++protocol) {
+            EEPROMStorage_setEcho(protocol == p_textEcho);
+            PollResult result = { 0 };
+            for (int i = 0; i < polls; ++i) {
+                poll(protocol, commands[c], sequence++, &result);
+            }
+            printResult(commands[c], protocol, &result, json);
+            if (result.failures != 0) {
+                status = 1;
+            }
+        }
+    }
+    return status;
+}
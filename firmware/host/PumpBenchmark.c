@@ -0,0 +1,357 @@
+//
+//  Pump Benchmark
+//
+//  Runs the firmware against the pump simulator through complete
+//  pumping runs and reports throughput, cycle time, overshoot, stalls
+//  and motor on time. Each run starts with the tank full and ends when
+//  the firmware has pumped mlToPump and the plunger has stopped, or
+//  times out. Stalls are those the firmware detected, and then the
+//  times the simulated motor was driven without turning.
+//
+//  usage: PumpBenchmark [-m ml] [-h head] [-p pwm] [-s speed] [-V volts]
+//                       [-n runs] [-c strokes] [-e eepromFile] [-j] [-v]
+//
+//  -m  mlToPump (default 2000)
+//  -h  static head in m of water (default 3)
+//  -p  motorPwm setting
+//  -s  plungerSpeed setting (0 for open loop PWM)
+//  -V  motor supply voltage
+//  -n  number of runs. Later runs use what the firmware learned in
+//      earlier ones
+//  -c  ends each run after this many syringe cycles, and fails if the
+//      firmware finished pumping before then. Checks that large volumes
+//      are pumped in full strokes without simulating all of them
+//  -e  file holding the EEPROM contents. Loaded at startup and saved
+//      at exit, so learned settings carry over between benchmarks
+//  -j  print one JSON object per run instead of a table
+//  -v  echo the firmware's console output to stderr
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+
+#include "HostHAL.h"
+#include "PumpSimulator.h"
+#include "SystemTime.h"
+#include "EEPROMStorage.h"
+#include "Console.h"
+#include "PinChangeMonitor.h"
+#include "BaudRate.h"
+#include "ModbusSlave.h"
+#include "WaterPumpControl.h"
+
+#define MAINLOOP_CYCLES 2000
+
+// the float drops once this much has been pumped out of the tank
+#define FLOAT_DROP_ML 100
+
+// ml per stroke the benchmark sets the plunger positions for
+#define STROKE_ML 50
+#define IN_POSITION 100
+
+#define RUN_TIMEOUT_SECONDS (6 * 3600.0)
+
+// the plunger must be still this long after pumping for the run to end
+#define SETTLE_SECONDS 0.5
+
+#define OVERSHOOT_SAMPLE_DELAY 0.1
+
+typedef struct RunResult_struct {
+    double seconds;
+    double volumePumped;
+    uint16_t firmwareVolume;
+    uint16_t cycles;
+    double cycleSecondsSum;
+    double cycleSecondsMin;
+    double cycleSecondsMax;
+    uint16_t overshootSamples;
+    double overshootSum;
+    int16_t overshootMax;
+    uint16_t stalls;            // detected by the firmware
+    uint16_t motorStalls;       // seen by the simulator
+    double motorOnSeconds;
+    double motorOnDutySeconds;
+    bool timedOut;
+    bool cycleLimitReached;
+} RunResult;
+
+static bool verbose;
+static int cycleLimit;
+
+static void writeConsoleByte (
+    const uint8_t byte,
+    void* data)
+{
+    (void)data;
+    if (verbose) {
+        fputc(byte, stderr);
+    }
+}
+
+static double simSeconds (void)
+{
+    return HostHAL_cycles() / (double)F_CPU;
+}
+
+// same as Initialize() in WaterPump.c, less RAMSentinel
+static void Initialize (void)
+{
+    wdt_enable(WDTO_500MS);
+
+    SystemTime_Initialize();
+    EEPROMStorage_Initialize();
+    Console_Initialize();
+    PinChangeMonitor_Initialize();
+    BaudRate_Initialize();
+    ModbusSlave_Initialize();
+    WaterPumpControl_Initialize();
+}
+
+static void runMainLoop (void)
+{
+    SystemTime_task();
+    WaterPumpControl_task();
+    Console_task();
+    if (HostHAL_watchdogExpired()) {
+        fprintf(stderr, "watchdog reset at %.3fs\n", simSeconds());
+        exit(1);
+    }
+    PumpSimulator_advanceCycles(MAINLOOP_CYCLES);
+}
+
+static void runPump (
+    const bool homingStroke,
+    RunResult* result)
+{
+    const PumpSimulator_stats* stats = PumpSimulator_getStats();
+    const PumpSimulator_stats startStats = *stats;
+    const double startTime = simSeconds();
+    const uint16_t mlToPump = EEPROMStorage_mlToPump();
+
+    *result = (RunResult){ .cycleSecondsMin = INFINITY };
+
+    PumpSimulator_setTankFull(true);
+
+    bool started = false;
+    double settledSince = -1;
+    double lastCycleEnd = startTime;
+    uint16_t strokes = stats->strokes;
+    uint16_t pushStrokes = stats->pushStrokes;
+    uint16_t strokesToSkip = homingStroke ? 1 : 0;
+    double overshootSampleTime = -1;
+    bool stalled = WaterPumpControl_plungerStalled();
+    double now = startTime;
+    for (;;) {
+        runMainLoop();
+        now = simSeconds();
+        if ((now - startTime) > RUN_TIMEOUT_SECONDS) {
+            result->timedOut = true;
+            break;
+        }
+
+        if (WaterPumpControl_plungerStalled() != stalled) {
+            stalled = !stalled;
+            if (stalled) {
+                ++result->stalls;
+            }
+        }
+
+        if (WaterPumpControl_volumeRemaining() != 0) {
+            started = true;
+        }
+        if ((stats->volumePumped - startStats.volumePumped) >= FLOAT_DROP_ML) {
+            PumpSimulator_setTankFull(false);
+        }
+
+        if (stats->strokes != strokes) {
+            strokes = stats->strokes;
+            if (strokesToSkip != 0) {
+                --strokesToSkip;
+            } else {
+                overshootSampleTime = now + OVERSHOOT_SAMPLE_DELAY;
+            }
+        }
+        if ((overshootSampleTime >= 0) && (now >= overshootSampleTime)) {
+            overshootSampleTime = -1;
+            const int16_t overshoot = WaterPumpControl_plungerOvershoot();
+            ++result->overshootSamples;
+            result->overshootSum += abs(overshoot);
+            if (abs(overshoot) > result->overshootMax) {
+                result->overshootMax = abs(overshoot);
+            }
+        }
+        if (stats->pushStrokes != pushStrokes) {
+            pushStrokes = stats->pushStrokes;
+            const double cycleSeconds = now - lastCycleEnd;
+            lastCycleEnd = now;
+            ++result->cycles;
+            result->cycleSecondsSum += cycleSeconds;
+            result->cycleSecondsMin = fmin(result->cycleSecondsMin, cycleSeconds);
+            result->cycleSecondsMax = fmax(result->cycleSecondsMax, cycleSeconds);
+            if ((cycleLimit != 0) && (result->cycles >= cycleLimit)) {
+                result->cycleLimitReached = true;
+                break;
+            }
+        }
+
+        const bool still = !PumpSimulator_motorDriven() &&
+            (PumpSimulator_motorSpeed() == 0);
+        if (started && (WaterPumpControl_volumeRemaining() == 0) && still) {
+            if (settledSince < 0) {
+                settledSince = now;
+            } else if ((now - settledSince) >= SETTLE_SECONDS) {
+                break;
+            }
+        } else {
+            settledSince = -1;
+        }
+    }
+
+    // a run that timed out took all the time it had
+    result->seconds = (result->timedOut ? now : lastCycleEnd) - startTime;
+    result->volumePumped = stats->volumePumped - startStats.volumePumped;
+    result->firmwareVolume = mlToPump - WaterPumpControl_volumeRemaining();
+    result->motorStalls = stats->stalls - startStats.stalls;
+    result->motorOnSeconds = stats->motorOnSeconds - startStats.motorOnSeconds;
+    result->motorOnDutySeconds =
+        stats->motorOnDutySeconds - startStats.motorOnDutySeconds;
+}
+
+static void printResult (
+    const uint8_t run,
+    const RunResult* r,
+    const bool json)
+{
+    const double mlPerHour = (r->seconds > 0)
+        ? (r->volumePumped * 3600 / r->seconds)
+        : 0;
+    const double cycleSeconds = (r->cycles != 0)
+        ? (r->cycleSecondsSum / r->cycles)
+        : 0;
+    const double overshoot = (r->overshootSamples != 0)
+        ? (r->overshootSum / r->overshootSamples)
+        : 0;
+    const double motorOnPct = (r->seconds > 0)
+        ? (100 * r->motorOnSeconds / r->seconds)
+        : 0;
+    if (json) {
+        printf("{\"run\":%u,\"timedOut\":%s,\"seconds\":%.1f,\"ml\":%.1f,"
+            "\"firmwareMl\":%u,\"mlPerHour\":%.0f,\"cycles\":%u,"
+            "\"cycleSeconds\":%.2f,\"cycleSecondsMin\":%.2f,"
+            "\"cycleSecondsMax\":%.2f,\"overshootAvg\":%.2f,"
+            "\"overshootMax\":%d,\"stalls\":%u,\"motorStalls\":%u,"
+            "\"motorOnSeconds\":%.1f,\"motorOnDutySeconds\":%.1f}\n",
+            run, r->timedOut ? "true" : "false", r->seconds, r->volumePumped,
+            r->firmwareVolume, mlPerHour, r->cycles, cycleSeconds,
+            (r->cycles != 0) ? r->cycleSecondsMin : 0, r->cycleSecondsMax,
+            overshoot, r->overshootMax, r->stalls, r->motorStalls,
+            r->motorOnSeconds, r->motorOnDutySeconds);
+    } else {
+        printf("run %u%s\n", run, r->timedOut ? " (timed out)" : "");
+        printf("  pumped           %.1f ml (firmware: %u ml)\n",
+            r->volumePumped, r->firmwareVolume);
+        printf("  run time         %.1f s\n", r->seconds);
+        printf("  throughput       %.0f ml/h\n", mlPerHour);
+        printf("  cycles           %u\n", r->cycles);
+        printf("  cycle time       %.2f s avg, %.2f min, %.2f max\n",
+            cycleSeconds, (r->cycles != 0) ? r->cycleSecondsMin : 0,
+            r->cycleSecondsMax);
+        printf("  overshoot        %.2f counts avg, %d max\n",
+            overshoot, r->overshootMax);
+        printf("  stalls           %u (motor driven but not turning: %u)\n",
+            r->stalls, r->motorStalls);
+        printf("  motor on         %.1f s (%.0f%%), %.1f s at full duty\n",
+            r->motorOnSeconds, motorOnPct, r->motorOnDutySeconds);
+    }
+}
+
+int main (
+    int argc,
+    char* argv[])
+{
+    PumpSimulator_params params;
+    PumpSimulator_defaultParams(&params);
+
+    int mlToPump = 2000;
+    int motorPwm = -1;
+    int plungerSpeed = -1;
+    int runs = 1;
+    const char* eepromFile = NULL;
+    bool json = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "m:h:p:s:V:n:c:e:jv")) != -1) {
+        switch (opt) {
+            case 'm' :  mlToPump = atoi(optarg);                 break;
+            case 'h' :  params.staticHead = atof(optarg);        break;
+            case 'p' :  motorPwm = atoi(optarg);                 break;
+            case 's' :  plungerSpeed = atoi(optarg);             break;
+            case 'V' :  params.supplyVolts = atof(optarg);       break;
+            case 'n' :  runs = atoi(optarg);                     break;
+            case 'c' :  cycleLimit = atoi(optarg);               break;
+            case 'e' :  eepromFile = optarg;                     break;
+            case 'j' :  json = true;                             break;
+            case 'v' :  verbose = true;                          break;
+            default :
+                fprintf(stderr,
+                    "usage: %s [-m ml] [-h head] [-p pwm] [-s speed] [-V volts] "
+                    "[-n runs] [-c strokes] [-e eepromFile] [-j] [-v]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    HostHAL_Initialize();
+    if (eepromFile != NULL) {
+        HostHAL_loadEEPROM(eepromFile);
+    }
+    HostHAL_setUARTOutputCB(writeConsoleByte, NULL);
+    PumpSimulator_Initialize(&params);
+
+    Initialize();
+
+    // plunger positions and volume scale for the simulated syringe
+    const double countsPerMl = PumpSimulator_countsPerMl();
+    EEPROMStorage_setPosPerMl(lround(countsPerMl));
+    EEPROMStorage_setPlungerInPos(IN_POSITION);
+    EEPROMStorage_setPlungerOutPos(IN_POSITION - lround(STROKE_ML * countsPerMl));
+    EEPROMStorage_setMlToPump(mlToPump);
+    if (motorPwm >= 0) {
+        EEPROMStorage_setMotorPwm(motorPwm);
+    }
+    if (plungerSpeed >= 0) {
+        EEPROMStorage_setPlungerSpeed(plungerSpeed);
+    }
+
+    sei();
+
+    if (!json) {
+        printf("%u ml, %.1f m head, %.1f V, motorPwm %u, plungerSpeed %u, "
+            "%.1f counts/ml\n",
+            EEPROMStorage_mlToPump(), params.staticHead, params.supplyVolts,
+            EEPROMStorage_motorPwm(), EEPROMStorage_plungerSpeed(), countsPerMl);
+    }
+    int status = 0;
+    for (int run = 1; run <= runs; ++run) {
+        RunResult result;
+        runPump(run == 1, &result);
+        printResult(run, &result, json);
+        if (result.timedOut) {
+            status = 1;
+            break;
+        }
+        if ((cycleLimit != 0) && !result.cycleLimitReached) {
+            fprintf(stderr, "finished after %u of %d cycles\n",
+                result.cycles, cycleLimit);
+            status = 1;
+            break;
+        }
+    }
+
+    if (eepromFile != NULL) {
+        EEPROMStorage_flush();
+        HostHAL_saveEEPROM(eepromFile);
+    }
+    return status;
+}
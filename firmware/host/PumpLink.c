@@ -0,0 +1,177 @@
+//
+//  Pump Link
+//
+#include "PumpLink.h"
+
+#include <string.h>
+#include "StatusStream.h"
+
+static uint16_t readWord (
+    const uint8_t* data)
+{
+    return data[0] | (data[1] << 8);
+}
+
+static uint32_t readLong (
+    const uint8_t* data)
+{
+    return readWord(data) | ((uint32_t)readWord(data + 2) << 16);
+}
+
+size_t PumpLink_encodeCommand (
+    const uint8_t address,
+    const uint8_t sequence,
+    const char* command,
+    uint8_t* request)
+{
+    const size_t commandLength = strlen(command);
+    if (commandLength > BINARYPROTOCOL_MAX_DATA) {
+        return 0;
+    }
+    uint8_t payload[BINARYPROTOCOL_MAX_PAYLOAD];
+    payload[BINARYPROTOCOL_ADDRESS] = address;
+    payload[BINARYPROTOCOL_SEQUENCE] = sequence;
+    payload[BINARYPROTOCOL_TYPE] = bpt_command;
+    memcpy(&payload[BINARYPROTOCOL_DATA], command, commandLength);
+    uint8_t length = BINARYPROTOCOL_DATA + commandLength;
+    const uint16_t crc = FrameCodec_crc16(payload, length);
+    payload[length++] = crc & 0xFF;
+    payload[length++] = crc >> 8;
+
+    request[0] = FRAMECODEC_DELIMITER;
+    const uint8_t encodedLength = FrameCodec_encode(payload, length, &request[1]);
+    request[encodedLength + 1] = FRAMECODEC_DELIMITER;
+    return encodedLength + 2;
+}
+
+void PumpLink_initDecoder (
+    PumpLink_decoder* decoder)
+{
+    memset(decoder, 0, sizeof(PumpLink_decoder));
+}
+
+bool PumpLink_receiveByte (
+    PumpLink_decoder* decoder,
+    const uint8_t byte,
+    PumpLink_frame* frame)
+{
+    if (byte != FRAMECODEC_DELIMITER) {
+        if (decoder->length < sizeof(decoder->buffer)) {
+            decoder->buffer[decoder->length++] = byte;
+        } else {
+            decoder->overflow = true;
+        }
+        return false;
+    }
+
+    // end of a frame, or the start of one after text or another frame
+    const size_t encodedLength = decoder->length;
+    const bool overflow = decoder->overflow;
+    decoder->length = 0;
+    decoder->overflow = false;
+    if ((encodedLength == 0) && !overflow) {
+        return false;
+    }
+    uint8_t payload[BINARYPROTOCOL_MAX_FRAME];
+    const uint8_t length = overflow
+        ? 0
+        : FrameCodec_decode(decoder->buffer, encodedLength, payload);
+    if (length < (BINARYPROTOCOL_HEADER_SIZE + BINARYPROTOCOL_CRC_SIZE)) {
+        // text between frames ends up here too
+        ++decoder->badFrames;
+        return false;
+    }
+    const uint8_t crcOffset = length - BINARYPROTOCOL_CRC_SIZE;
+    if ((readWord(&payload[crcOffset]) != FrameCodec_crc16(payload, crcOffset)) ||
+        ((crcOffset - BINARYPROTOCOL_DATA) > BINARYPROTOCOL_MAX_DATA)) {
+        ++decoder->badFrames;
+        return false;
+    }
+    ++decoder->frames;
+    frame->address = payload[BINARYPROTOCOL_ADDRESS];
+    frame->sequence = payload[BINARYPROTOCOL_SEQUENCE];
+    frame->type = payload[BINARYPROTOCOL_TYPE];
+    frame->dataLength = crcOffset - BINARYPROTOCOL_DATA;
+    memcpy(frame->data, &payload[BINARYPROTOCOL_DATA], frame->dataLength);
+    return true;
+}
+
+int PumpLink_replyStatus (
+    const PumpLink_frame* frame)
+{
+    if ((frame->type != bpt_reply) || (frame->dataLength == 0)) {
+        return -1;
+    }
+    return frame->data[0];
+}
+
+bool PumpLink_replyWord (
+    const PumpLink_frame* frame,
+    const uint8_t index,
+    uint16_t* value)
+{
+    const size_t offset = 1 + (2 * index);
+    if ((PumpLink_replyStatus(frame) != bps_ok) ||
+        ((offset + 2) > frame->dataLength)) {
+        return false;
+    }
+    *value = readWord(&frame->data[offset]);
+    return true;
+}
+
+bool PumpLink_parseStatus (
+    const PumpLink_frame* frame,
+    PumpLink_status* status)
+{
+    // status byte, t, pos, speed, volumeRemaining
+    if ((PumpLink_replyStatus(frame) != bps_ok) || (frame->dataLength != 11)) {
+        return false;
+    }
+    status->seconds = readLong(&frame->data[1]);
+    status->position = readWord(&frame->data[5]);
+    status->speed = readWord(&frame->data[7]);
+    status->volumeRemaining = readWord(&frame->data[9]);
+    return true;
+}
+
+bool PumpLink_parseStreamRecord (
+    const PumpLink_frame* frame,
+    PumpLink_streamRecord* record)
+{
+    if ((frame->type != bpt_streamRecord) || (frame->dataLength < 2)) {
+        return false;
+    }
+    memset(record, 0, sizeof(PumpLink_streamRecord));
+    record->event = frame->data[0];
+    record->fields = frame->data[1];
+    size_t offset = 2;
+    if (record->fields & sf_time) {
+        if ((offset + 4) > frame->dataLength) {
+            return false;
+        }
+        record->seconds = readLong(&frame->data[offset]);
+        offset += 4;
+    }
+    if (record->fields & sf_pos) {
+        if ((offset + 2) > frame->dataLength) {
+            return false;
+        }
+        record->position = readWord(&frame->data[offset]);
+        offset += 2;
+    }
+    if (record->fields & sf_speed) {
+        if ((offset + 2) > frame->dataLength) {
+            return false;
+        }
+        record->speed = readWord(&frame->data[offset]);
+        offset += 2;
+    }
+    if (record->fields & sf_vol) {
+        if ((offset + 2) > frame->dataLength) {
+            return false;
+        }
+        record->volumeRemaining = readWord(&frame->data[offset]);
+        offset += 2;
+    }
+    return offset == frame->dataLength;
+}
@@ -0,0 +1,94 @@
+//
+//  Pump Link
+//
+//  Host side of the binary protocol (see BinaryProtocol.h in the
+//  firmware), for bridges and test programs. Encodes command requests
+//  and decodes reply and stream record frames out of the byte stream
+//  from one or more pumps. Bytes between frames, such as text console
+//  output, are skipped.
+//
+#ifndef PUMPLINK_H
+#define PUMPLINK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "BinaryProtocol.h"
+
+// a request on the wire is at most this long
+#define PUMPLINK_MAX_REQUEST (BINARYPROTOCOL_MAX_FRAME + 2)
+
+typedef struct PumpLink_frame_struct {
+    uint8_t address;
+    uint8_t sequence;
+    uint8_t type;       // BinaryProtocol_type
+    uint8_t dataLength;
+    uint8_t data[BINARYPROTOCOL_MAX_DATA];
+} PumpLink_frame;
+
+typedef struct PumpLink_decoder_struct {
+    uint8_t buffer[BINARYPROTOCOL_MAX_FRAME];
+    size_t length;
+    bool overflow;
+    uint32_t frames;
+    uint32_t badFrames;
+} PumpLink_decoder;
+
+// status record, the reply to the s command
+typedef struct PumpLink_status_struct {
+    uint32_t seconds;
+    int16_t position;
+    uint8_t speed;
+    uint16_t volumeRemaining;
+} PumpLink_status;
+
+typedef struct PumpLink_streamRecord_struct {
+    uint8_t event;      // StatusStream_event
+    uint8_t fields;     // StatusStream_field bits. the others are 0
+    uint32_t seconds;
+    int16_t position;
+    uint8_t speed;
+    uint16_t volumeRemaining;
+} PumpLink_streamRecord;
+
+// writes a command request frame, delimiters included, to request,
+// which must hold PUMPLINK_MAX_REQUEST bytes. returns its length, or 0
+// if the command is too long
+extern size_t PumpLink_encodeCommand (
+    const uint8_t address,
+    const uint8_t sequence,
+    const char* command,
+    uint8_t* request);
+
+extern void PumpLink_initDecoder (
+    PumpLink_decoder* decoder);
+
+// feeds a received byte to the decoder. returns true when it completes
+// a frame with a good CRC, which is then in frame
+extern bool PumpLink_receiveByte (
+    PumpLink_decoder* decoder,
+    const uint8_t byte,
+    PumpLink_frame* frame);
+
+// status byte of a reply (BinaryProtocol_status), or -1 if the frame
+// isn't a reply
+extern int PumpLink_replyStatus (
+    const PumpLink_frame* frame);
+
+// reads the 16 bit value at index (counting 16 bit values) of a reply's
+// record. e.g. the settings record holds the settings in alphabetical
+// order of name, each 16 bit. baud is in hundreds of baud
+extern bool PumpLink_replyWord (
+    const PumpLink_frame* frame,
+    const uint8_t index,
+    uint16_t* value);
+
+extern bool PumpLink_parseStatus (
+    const PumpLink_frame* frame,
+    PumpLink_status* status);
+
+extern bool PumpLink_parseStreamRecord (
+    const PumpLink_frame* frame,
+    PumpLink_streamRecord* record);
+
+#endif  // PUMPLINK_H
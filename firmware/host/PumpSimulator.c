@@ -0,0 +1,286 @@
+//
+//  Pump Simulator
+//
+#include "PumpSimulator.h"
+
+#include <math.h>
+#include <avr/io.h>
+#include "HostHAL.h"
+
+// physics time step
+#define STEP_CYCLES 1000    // 50uS
+#define STEP_SECONDS ((double)STEP_CYCLES / F_CPU)
+
+// driven with the shaft turning slower than this counts toward a stall
+#define STALL_SPEED 0.5         // revolutions per second
+#define STALL_SECONDS 0.1
+
+#define WATER_KPA_PER_M 9.81
+
+// fraction of each tachometer pulse period the sensor output is low
+#define TACH_LOW_FRACTION 0.25
+
+static PumpSimulator_params p;
+static PumpSimulator_stats stats;
+
+static double pushLoad;         // N.m at the motor shaft
+static double drawLoad;
+static double countsPerMl;
+static double angle;            // motor shaft, radians. 0 at startPosition
+static double omega;            // motor shaft, radians per second
+static bool tankFull;
+static double stalledSeconds;
+static bool stalled;
+static bool moving;
+static double strokeStartPosition;
+
+void PumpSimulator_defaultParams (
+    PumpSimulator_params* params)
+{
+    // 12V gearmotor, about 6000 RPM at the motor shaft with no load
+    params->supplyVolts = 12.0;
+    params->motorResistance = 8.0;
+    params->motorKt = 0.018;
+    params->motorInertia = 2.0e-6;
+    params->motorFriction = 0.0008;
+    params->pulsesPerRev = 2;
+
+    params->gearRatio = 42.0;
+    params->gearEfficiency = 0.7;
+    params->threadLead = 25.4 / 20;     // 1/4-20
+    params->threadEfficiency = 0.3;
+
+    // 60ml syringe
+    params->syringeDiameter = 26.7;
+    params->sealFriction = 8.0;
+    params->valveCrackingPressure = 3.0;
+    params->staticHead = 3.0;
+    params->suctionHead = 0.3;
+    params->fullyInPosition = 400;
+    params->fullyOutPosition = -7200;
+
+    params->startPosition = 1000;
+}
+
+static double syringeArea (void)
+{
+    const double radius = p.syringeDiameter / 2;
+    return M_PI * radius * radius;      // mm^2
+}
+
+static double computeCountsPerMl (void)
+{
+    const double countsPerMm = (p.pulsesPerRev * p.gearRatio) / p.threadLead;
+    const double mmPerMl = 1000.0 / syringeArea();
+    return countsPerMm * mmPerMl;
+}
+
+double PumpSimulator_position (void)
+{
+    return p.startPosition + ((angle / (2 * M_PI)) * p.pulsesPerRev);
+}
+
+double PumpSimulator_motorSpeed (void)
+{
+    return omega / (2 * M_PI);
+}
+
+// fraction of the supply each motor terminal is driven at, from the
+// timer 0 PWM outputs or the port pins when PWM is off
+static double terminalDrive (
+    const uint8_t comShift,
+    const uint8_t ocr,
+    const uint8_t portPin)
+{
+    const bool pwmOn = ((TCCR0B & 7) != 0) && ((TCCR0A >> comShift) & 3);
+    if (pwmOn) {
+        return ocr / 255.0;
+    }
+    return (PORTD & (1 << portPin)) ? 1.0 : 0.0;
+}
+
+bool PumpSimulator_motorDriven (void)
+{
+    const double fwd = terminalDrive(COM0B0, OCR0B, PD5);
+    const double rev = terminalDrive(COM0A0, OCR0A, PD6);
+    return (fwd != rev);
+}
+
+// motor current. The driver can't return current to the supply, so
+// with the driven terminal off the motor coasts rather than brakes
+static double motorCurrent (void)
+{
+    const double fwd = terminalDrive(COM0B0, OCR0B, PD5);
+    const double rev = terminalDrive(COM0A0, OCR0A, PD6);
+    const double backEMF = p.motorKt * omega;
+    if ((fwd == 1.0) && (rev == 1.0)) {
+        // both terminals high shorts the motor: dynamic braking
+        return -backEMF / p.motorResistance;
+    }
+    const double volts = (fwd - rev) * p.supplyVolts;
+    const double current = (volts - backEMF) / p.motorResistance;
+    if (volts > 0) {
+        return (current > 0) ? current : 0;
+    } else if (volts < 0) {
+        return (current < 0) ? current : 0;
+    }
+    return 0;
+}
+
+// torque the plunger load puts on the motor shaft
+static double computeLoadTorque (
+    const bool pushing)
+{
+    const double areaM2 = syringeArea() * 1e-6;
+    const double kPa = pushing
+        ? (p.staticHead * WATER_KPA_PER_M) + p.valveCrackingPressure
+        : (p.suctionHead * WATER_KPA_PER_M) + p.valveCrackingPressure;
+    const double force = (kPa * 1000 * areaM2) + p.sealFriction;
+    const double rodTorque = force * (p.threadLead / 1000) / (2 * M_PI);
+    return (rodTorque / (p.gearRatio * p.gearEfficiency * p.threadEfficiency)) +
+        p.motorFriction;
+}
+
+double PumpSimulator_countsPerMl (void)
+{
+    return countsPerMl;
+}
+
+static double loadTorque (
+    const bool pushing)
+{
+    return pushing ? pushLoad : drawLoad;
+}
+
+static void updateSensors (void)
+{
+    const double pos = PumpSimulator_position();
+
+    // tachometer: low for part of each pulse period
+    double phase = fmod(pos, 1.0);
+    if (phase < 0) {
+        phase += 1.0;
+    }
+    HostHAL_setPin(&PINB, PB0, phase >= TACH_LOW_FRACTION);
+
+    // home position sensor sees the reflector ahead of home
+    HostHAL_setPin(&PIND, PD2, pos > 0);
+
+    // float sensor is low when the tank is full
+    HostHAL_setPin(&PINC, PC4, !tankFull);
+}
+
+static void stepModel (void)
+{
+    const double motorTorque = p.motorKt * motorCurrent();
+    double torque;
+    if (omega != 0) {
+        const double load = loadTorque(omega > 0);
+        torque = motorTorque - ((omega > 0) ? load : -load);
+    } else {
+        // at rest until the motor overcomes the load
+        const double load = loadTorque(motorTorque > 0);
+        torque = (fabs(motorTorque) > load)
+            ? motorTorque - ((motorTorque > 0) ? load : -load)
+            : 0;
+    }
+    const double lastOmega = omega;
+    omega += (torque / p.motorInertia) * STEP_SECONDS;
+    if ((lastOmega != 0) && ((lastOmega > 0) != (omega > 0))) {
+        // friction stops the motor rather than reversing it
+        omega = 0;
+    }
+
+    const double lastPos = PumpSimulator_position();
+    angle += omega * STEP_SECONDS;
+    double pos = PumpSimulator_position();
+    if ((pos > p.fullyInPosition) || (pos < p.fullyOutPosition)) {
+        // plunger hit the end of the syringe
+        pos = (pos > p.fullyInPosition) ? p.fullyInPosition : p.fullyOutPosition;
+        angle = ((pos - p.startPosition) / p.pulsesPerRev) * (2 * M_PI);
+        omega = 0;
+    }
+    if (pos > lastPos) {
+        // pushing. the inflow valve closes and water goes out
+        stats.volumePumped += (pos - lastPos) / countsPerMl;
+    }
+
+    const bool driven = PumpSimulator_motorDriven();
+    if (driven) {
+        const double fwd = terminalDrive(COM0B0, OCR0B, PD5);
+        const double rev = terminalDrive(COM0A0, OCR0A, PD6);
+        stats.motorOnSeconds += STEP_SECONDS;
+        stats.motorOnDutySeconds += fabs(fwd - rev) * STEP_SECONDS;
+    }
+
+    // stalls: driven but not turning
+    if (driven && (fabs(PumpSimulator_motorSpeed()) < STALL_SPEED)) {
+        stalledSeconds += STEP_SECONDS;
+        if (!stalled && (stalledSeconds >= STALL_SECONDS)) {
+            stalled = true;
+            ++stats.stalls;
+        }
+    } else {
+        stalledSeconds = 0;
+        stalled = false;
+    }
+
+    // strokes: moves that come to rest
+    if (!moving && (omega != 0)) {
+        moving = true;
+        strokeStartPosition = pos;
+    } else if (moving && (omega == 0)) {
+        moving = false;
+        ++stats.strokes;
+        if (pos > strokeStartPosition) {
+            ++stats.pushStrokes;
+        }
+    }
+
+    updateSensors();
+}
+
+void PumpSimulator_Initialize (
+    const PumpSimulator_params* params)
+{
+    p = *params;
+    pushLoad = computeLoadTorque(true);
+    drawLoad = computeLoadTorque(false);
+    countsPerMl = computeCountsPerMl();
+    angle = 0;
+    omega = 0;
+    tankFull = false;
+    stalledSeconds = 0;
+    stalled = false;
+    moving = false;
+    strokeStartPosition = p.startPosition;
+    stats.volumePumped = 0;
+    stats.motorOnSeconds = 0;
+    stats.motorOnDutySeconds = 0;
+    stats.stalls = 0;
+    stats.strokes = 0;
+    stats.pushStrokes = 0;
+    updateSensors();
+}
+
+void PumpSimulator_setTankFull (
+    const bool full)
+{
+    tankFull = full;
+    updateSensors();
+}
+
+void PumpSimulator_advanceCycles (
+    const uint64_t cycles)
+{
+    const uint64_t target = HostHAL_cycles() + cycles;
+    while (HostHAL_cycles() < target) {
+        HostHAL_advanceCycles(STEP_CYCLES);
+        stepModel();
+    }
+}
+
+const PumpSimulator_stats* PumpSimulator_getStats (void)
+{
+    return &stats;
+}
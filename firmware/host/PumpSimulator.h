@@ -0,0 +1,89 @@
+//
+//  Pump Simulator
+//
+//  Physical model of the pump mechanism for the host build: a DC
+//  gearmotor driven by the motor PWM, the gearhead, the 1/4-20 threaded
+//  rod, the syringe with its two check valves, and the static head the
+//  water is pumped against.
+//
+//  The motor drive is read from the timer 0 and PORTD registers the
+//  firmware writes. The model drives the tachometer (PB0), home
+//  position sensor (PD2) and float sensor (PC4) inputs through the
+//  host HAL.
+//
+//  Position is in odometer counts (tachometer pulses) from the home
+//  position sensor edge, positive toward the syringe's fully in end,
+//  which is the direction the firmware calls forward.
+//
+#ifndef PUMPSIMULATOR_H
+#define PUMPSIMULATOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct PumpSimulator_params_struct {
+    // motor
+    double supplyVolts;
+    double motorResistance;     // ohms
+    double motorKt;             // N.m/A, also V.s/rad back EMF
+    double motorInertia;        // kg.m^2, including the reflected load
+    double motorFriction;       // N.m at the motor shaft
+    uint8_t pulsesPerRev;       // tachometer pulses per motor revolution
+
+    // drive train
+    double gearRatio;
+    double gearEfficiency;
+    double threadLead;          // mm of travel per output shaft revolution
+    double threadEfficiency;
+
+    // syringe, valves and plumbing
+    double syringeDiameter;     // mm inside diameter
+    double sealFriction;        // N
+    double valveCrackingPressure;   // kPa, each valve
+    double staticHead;          // m of water the outflow is lifted
+    double suctionHead;         // m of water the inflow is lifted
+    double fullyInPosition;     // counts. mechanical limits of the plunger
+    double fullyOutPosition;
+
+    double startPosition;       // counts. plunger position at power-up
+} PumpSimulator_params;
+
+typedef struct PumpSimulator_stats_struct {
+    double volumePumped;        // ml pushed out through the outflow valve
+    double motorOnSeconds;      // time the motor was driven
+    double motorOnDutySeconds;  // time the motor was driven, weighted by duty
+    uint16_t stalls;            // times the motor was driven but didn't turn
+    uint16_t strokes;           // plunger moves that came to a stop
+    uint16_t pushStrokes;       // of which pushed water out
+} PumpSimulator_stats;
+
+// fills in parameters for the pump as built
+extern void PumpSimulator_defaultParams (
+    PumpSimulator_params* params);
+
+// sets up the model and the input pins. Call after HostHAL_Initialize
+extern void PumpSimulator_Initialize (
+    const PumpSimulator_params* params);
+
+// sets the float sensor state the tank presents
+extern void PumpSimulator_setTankFull (
+    const bool full);
+
+// advances simulated time, stepping the model and the HAL together
+extern void PumpSimulator_advanceCycles (
+    const uint64_t cycles);
+
+// odometer counts per ml for the modelled syringe and drive train
+extern double PumpSimulator_countsPerMl (void);
+
+extern double PumpSimulator_position (void);
+
+// motor shaft speed in revolutions per second
+extern double PumpSimulator_motorSpeed (void);
+
+// true while the motor is driven in either direction
+extern bool PumpSimulator_motorDriven (void);
+
+extern const PumpSimulator_stats* PumpSimulator_getStats (void);
+
+#endif  // PUMPSIMULATOR_H
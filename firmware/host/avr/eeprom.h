@@ -0,0 +1,33 @@
+//
+//  Host build replacement for <avr/eeprom.h>
+//
+//  EEMEM variables are placed in their own section, which HostHAL.c
+//  aligns to the EEPROM size, so the low bits of their addresses are
+//  their EEPROM addresses just as on the AVR.
+//
+#ifndef HOST_AVR_EEPROM_H
+#define HOST_AVR_EEPROM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <avr/io.h>
+
+#define EEMEM __attribute__((section("hosthal_eeprom")))
+
+#define eeprom_is_ready() bit_is_clear(EECR, EEPE)
+#define eeprom_busy_wait() loop_until_bit_is_clear(EECR, EEPE)
+
+extern uint8_t eeprom_read_byte (const uint8_t* addr);
+extern uint16_t eeprom_read_word (const uint16_t* addr);
+extern uint32_t eeprom_read_dword (const uint32_t* addr);
+extern void eeprom_read_block (void* dst, const void* src, size_t n);
+extern void eeprom_write_byte (uint8_t* addr, uint8_t value);
+extern void eeprom_write_word (uint16_t* addr, uint16_t value);
+extern void eeprom_write_dword (uint32_t* addr, uint32_t value);
+extern void eeprom_write_block (const void* src, void* dst, size_t n);
+extern void eeprom_update_byte (uint8_t* addr, uint8_t value);
+extern void eeprom_update_word (uint16_t* addr, uint16_t value);
+extern void eeprom_update_dword (uint32_t* addr, uint32_t value);
+extern void eeprom_update_block (const void* src, void* dst, size_t n);
+
+#endif  // HOST_AVR_EEPROM_H
@@ -0,0 +1,21 @@
+//
+//  Host build replacement for <avr/interrupt.h>
+//
+#ifndef HOST_AVR_INTERRUPT_H
+#define HOST_AVR_INTERRUPT_H
+
+#include <avr/io.h>
+
+#define sei() (SREG |= (1 << SREG_I))
+#define cli() (SREG &= (uint8_t)~(1 << SREG_I))
+#define reti() return
+
+// ISR attributes have no meaning on the host. The HAL runs one
+// interrupt at a time with interrupts disabled, like ISR_BLOCK.
+#define ISR_BLOCK
+#define ISR_NOBLOCK
+#define ISR_NAKED
+#define ISR(vector, ...) void vector (void); void vector (void)
+#define EMPTY_INTERRUPT(vector) void vector (void); void vector (void) { }
+
+#endif  // HOST_AVR_INTERRUPT_H
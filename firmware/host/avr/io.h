@@ -0,0 +1,211 @@
+//
+//  Host build replacement for <avr/io.h>
+//
+//  ATmega328P registers as variables defined in HostHAL.c. Only the
+//  registers and bits the firmware and CommonCode use are declared.
+//
+#ifndef HOST_AVR_IO_H
+#define HOST_AVR_IO_H
+
+#include <stdint.h>
+
+#define _BV(bit) (1 << (bit))
+#define bit_is_set(sfr, bit) ((sfr) & _BV(bit))
+#define bit_is_clear(sfr, bit) (!((sfr) & _BV(bit)))
+#define loop_until_bit_is_set(sfr, bit) do { } while (bit_is_clear(sfr, bit))
+#define loop_until_bit_is_clear(sfr, bit) do { } while (bit_is_set(sfr, bit))
+
+#define HOSTHAL_REG8(name) extern volatile uint8_t name;
+#define HOSTHAL_REG16(name) extern volatile uint16_t name;
+
+// status register
+HOSTHAL_REG8(SREG)
+#define SREG_I 7
+
+// I/O ports
+HOSTHAL_REG8(PINB) HOSTHAL_REG8(DDRB) HOSTHAL_REG8(PORTB)
+HOSTHAL_REG8(PINC) HOSTHAL_REG8(DDRC) HOSTHAL_REG8(PORTC)
+HOSTHAL_REG8(PIND) HOSTHAL_REG8(DDRD) HOSTHAL_REG8(PORTD)
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PC6 6
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+
+// Interrupt flag registers are cleared by writing a one, so they go
+// through the HAL. Reading one returns 0; the HAL clears a flag itself
+// when it runs the flag's interrupt.
+extern volatile uint8_t* HostHAL_pcifr (void);
+extern volatile uint8_t* HostHAL_tifr1 (void);
+#define PCIFR (*HostHAL_pcifr())
+#define TIFR1 (*HostHAL_tifr1())
+
+// pin change interrupts
+HOSTHAL_REG8(PCICR)
+HOSTHAL_REG8(PCMSK0) HOSTHAL_REG8(PCMSK1) HOSTHAL_REG8(PCMSK2)
+#define PCIE0 0
+#define PCIE1 1
+#define PCIE2 2
+#define PCIF0 0
+#define PCIF1 1
+#define PCIF2 2
+
+// timer 0
+HOSTHAL_REG8(TCCR0A) HOSTHAL_REG8(TCCR0B) HOSTHAL_REG8(TCNT0)
+HOSTHAL_REG8(OCR0A) HOSTHAL_REG8(OCR0B)
+HOSTHAL_REG8(TIMSK0) HOSTHAL_REG8(TIFR0)
+#define WGM00 0
+#define WGM01 1
+#define COM0B0 4
+#define COM0B1 5
+#define COM0A0 6
+#define COM0A1 7
+#define CS00 0
+#define CS01 1
+#define CS02 2
+#define WGM02 3
+#define TOIE0 0
+#define OCIE0A 1
+#define OCIE0B 2
+#define TOV0 0
+#define OCF0A 1
+#define OCF0B 2
+
+// timer 1
+HOSTHAL_REG8(TCCR1A) HOSTHAL_REG8(TCCR1B) HOSTHAL_REG8(TCCR1C)
+HOSTHAL_REG16(TCNT1) HOSTHAL_REG16(OCR1A) HOSTHAL_REG16(OCR1B)
+HOSTHAL_REG16(ICR1)
+HOSTHAL_REG8(TIMSK1)
+#define TCNT1L (((volatile uint8_t*)&TCNT1)[0])
+#define TCNT1H (((volatile uint8_t*)&TCNT1)[1])
+#define OCR1AL (((volatile uint8_t*)&OCR1A)[0])
+#define OCR1AH (((volatile uint8_t*)&OCR1A)[1])
+#define OCR1BL (((volatile uint8_t*)&OCR1B)[0])
+#define OCR1BH (((volatile uint8_t*)&OCR1B)[1])
+#define ICR1L (((volatile uint8_t*)&ICR1)[0])
+#define ICR1H (((volatile uint8_t*)&ICR1)[1])
+#define WGM10 0
+#define WGM11 1
+#define COM1B0 4
+#define COM1B1 5
+#define COM1A0 6
+#define COM1A1 7
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define WGM12 3
+#define WGM13 4
+#define ICES1 6
+#define ICNC1 7
+#define TOIE1 0
+#define OCIE1A 1
+#define OCIE1B 2
+#define ICIE1 5
+#define TOV1 0
+#define OCF1A 1
+#define OCF1B 2
+#define ICF1 5
+
+// EEPROM. EECR and EEDR are accessed through the HAL so that reads
+// and programming take effect when the firmware expects them to.
+extern volatile uint8_t* HostHAL_eecr (void);
+extern volatile uint8_t* HostHAL_eedr (void);
+#define EECR (*HostHAL_eecr())
+#define EEDR (*HostHAL_eedr())
+HOSTHAL_REG16(EEAR)
+#define EEARL (((volatile uint8_t*)&EEAR)[0])
+#define EEARH (((volatile uint8_t*)&EEAR)[1])
+#define EERE 0
+#define EEPE 1
+#define EEMPE 2
+#define EERIE 3
+#define EEPM0 4
+#define EEPM1 5
+#define E2END 0x3FF
+
+// USART 0. UDR0 goes through the HAL so it can tell a transmitted
+// byte from a read of the received one. Only the low byte of a read
+// is meaningful.
+extern volatile uint32_t* HostHAL_udr0 (void);
+#define UDR0 (*HostHAL_udr0())
+HOSTHAL_REG8(UCSR0A) HOSTHAL_REG8(UCSR0B) HOSTHAL_REG8(UCSR0C)
+HOSTHAL_REG16(UBRR0)
+#define UBRR0L (((volatile uint8_t*)&UBRR0)[0])
+#define UBRR0H (((volatile uint8_t*)&UBRR0)[1])
+#define MPCM0 0
+#define U2X0 1
+#define UPE0 2
+#define DOR0 3
+#define FE0 4
+#define UDRE0 5
+#define TXC0 6
+#define RXC0 7
+#define TXB80 0
+#define RXB80 1
+#define UCSZ02 2
+#define TXEN0 3
+#define RXEN0 4
+#define UDRIE0 5
+#define TXCIE0 6
+#define RXCIE0 7
+#define UCPOL0 0
+#define UCSZ00 1
+#define UCSZ01 2
+#define USBS0 3
+#define UPM00 4
+#define UPM01 5
+
+// watchdog, reset status and general purpose registers
+HOSTHAL_REG8(WDTCSR) HOSTHAL_REG8(MCUSR)
+HOSTHAL_REG8(GPIOR0) HOSTHAL_REG8(GPIOR1) HOSTHAL_REG8(GPIOR2)
+#define WDP0 0
+#define WDP1 1
+#define WDP2 2
+#define WDE 3
+#define WDCE 4
+#define WDP3 5
+#define WDIE 6
+#define WDIF 7
+#define PORF 0
+#define EXTRF 1
+#define BORF 2
+#define WDRF 3
+
+// interrupt vectors, implemented as functions named by the HAL
+#define INT0_vect HostHAL_INT0_vect
+#define INT1_vect HostHAL_INT1_vect
+#define PCINT0_vect HostHAL_PCINT0_vect
+#define PCINT1_vect HostHAL_PCINT1_vect
+#define PCINT2_vect HostHAL_PCINT2_vect
+#define WDT_vect HostHAL_WDT_vect
+#define TIMER1_CAPT_vect HostHAL_TIMER1_CAPT_vect
+#define TIMER1_COMPA_vect HostHAL_TIMER1_COMPA_vect
+#define TIMER1_COMPB_vect HostHAL_TIMER1_COMPB_vect
+#define TIMER1_OVF_vect HostHAL_TIMER1_OVF_vect
+#define TIMER0_COMPA_vect HostHAL_TIMER0_COMPA_vect
+#define TIMER0_COMPB_vect HostHAL_TIMER0_COMPB_vect
+#define TIMER0_OVF_vect HostHAL_TIMER0_OVF_vect
+#define USART_RX_vect HostHAL_USART_RX_vect
+#define USART_UDRE_vect HostHAL_USART_UDRE_vect
+#define USART_TX_vect HostHAL_USART_TX_vect
+#define EE_READY_vect HostHAL_EE_READY_vect
+
+#endif  // HOST_AVR_IO_H
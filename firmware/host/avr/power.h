@@ -0,0 +1,27 @@
+//
+//  Host build replacement for <avr/power.h>
+//
+#ifndef HOST_AVR_POWER_H
+#define HOST_AVR_POWER_H
+
+#define power_adc_enable() ((void)0)
+#define power_adc_disable() ((void)0)
+#define power_spi_enable() ((void)0)
+#define power_spi_disable() ((void)0)
+#define power_twi_enable() ((void)0)
+#define power_twi_disable() ((void)0)
+#define power_usart0_enable() ((void)0)
+#define power_usart0_disable() ((void)0)
+#define power_timer0_enable() ((void)0)
+#define power_timer0_disable() ((void)0)
+#define power_timer1_enable() ((void)0)
+#define power_timer1_disable() ((void)0)
+#define power_timer2_enable() ((void)0)
+#define power_timer2_disable() ((void)0)
+#define power_all_enable() ((void)0)
+#define power_all_disable() ((void)0)
+
+#define clock_div_1 0
+#define clock_prescale_set(div) ((void)(div))
+
+#endif  // HOST_AVR_POWER_H
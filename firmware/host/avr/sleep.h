@@ -0,0 +1,23 @@
+//
+//  Host build replacement for <avr/sleep.h>
+//
+//  Sleeping is a no-op; the caller of the HAL decides how time passes.
+//
+#ifndef HOST_AVR_SLEEP_H
+#define HOST_AVR_SLEEP_H
+
+#define SLEEP_MODE_IDLE 0
+#define SLEEP_MODE_ADC 1
+#define SLEEP_MODE_PWR_DOWN 2
+#define SLEEP_MODE_PWR_SAVE 3
+#define SLEEP_MODE_STANDBY 6
+#define SLEEP_MODE_EXT_STANDBY 7
+
+#define set_sleep_mode(mode) ((void)(mode))
+#define sleep_enable() ((void)0)
+#define sleep_disable() ((void)0)
+#define sleep_cpu() ((void)0)
+#define sleep_mode() ((void)0)
+#define sleep_bod_disable() ((void)0)
+
+#endif  // HOST_AVR_SLEEP_H
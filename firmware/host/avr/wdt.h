@@ -0,0 +1,24 @@
+//
+//  Host build replacement for <avr/wdt.h>
+//
+#ifndef HOST_AVR_WDT_H
+#define HOST_AVR_WDT_H
+
+#include <stdint.h>
+
+#define WDTO_15MS 0
+#define WDTO_30MS 1
+#define WDTO_60MS 2
+#define WDTO_120MS 3
+#define WDTO_250MS 4
+#define WDTO_500MS 5
+#define WDTO_1S 6
+#define WDTO_2S 7
+#define WDTO_4S 8
+#define WDTO_8S 9
+
+extern void wdt_enable (const uint8_t timeout);
+extern void wdt_disable (void);
+extern void wdt_reset (void);
+
+#endif  // HOST_AVR_WDT_H
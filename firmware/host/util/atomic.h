@@ -0,0 +1,32 @@
+//
+//  Host build replacement for <util/atomic.h>
+//
+//  Same construction as avr-libc's, on the simulated SREG.
+//
+#ifndef HOST_UTIL_ATOMIC_H
+#define HOST_UTIL_ATOMIC_H
+
+#include <stdint.h>
+#include <avr/interrupt.h>
+
+static __inline__ uint8_t HostHAL_iSeiRetVal (void) { sei(); return 1; }
+static __inline__ uint8_t HostHAL_iCliRetVal (void) { cli(); return 1; }
+static __inline__ void HostHAL_iSeiParam (const uint8_t* s) { (void)s; sei(); }
+static __inline__ void HostHAL_iCliParam (const uint8_t* s) { (void)s; cli(); }
+static __inline__ void HostHAL_iRestore (const uint8_t* s) { SREG = *s; }
+
+#define ATOMIC_BLOCK(type) \
+    for (type, HostHAL_ToDo = HostHAL_iCliRetVal(); HostHAL_ToDo; HostHAL_ToDo = 0)
+#define NONATOMIC_BLOCK(type) \
+    for (type, HostHAL_ToDo = HostHAL_iSeiRetVal(); HostHAL_ToDo; HostHAL_ToDo = 0)
+
+#define ATOMIC_RESTORESTATE \
+    uint8_t sreg_save __attribute__((__cleanup__(HostHAL_iRestore))) = SREG
+#define ATOMIC_FORCEON \
+    uint8_t sreg_save __attribute__((__cleanup__(HostHAL_iSeiParam))) = 0
+#define NONATOMIC_RESTORESTATE \
+    uint8_t sreg_save __attribute__((__cleanup__(HostHAL_iRestore))) = SREG
+#define NONATOMIC_FORCEOFF \
+    uint8_t sreg_save __attribute__((__cleanup__(HostHAL_iCliParam))) = 0
+
+#endif  // HOST_UTIL_ATOMIC_H
@@ -0,0 +1,15 @@
+//
+//  Host build replacement for <util/delay.h>
+//
+//  Busy waits advance simulated time instead of burning cycles.
+//
+#ifndef HOST_UTIL_DELAY_H
+#define HOST_UTIL_DELAY_H
+
+#include <stdint.h>
+#include "HostHAL.h"
+
+#define _delay_us(us) HostHAL_advanceCycles((uint64_t)((us) * (F_CPU / 1000000.0)))
+#define _delay_ms(ms) HostHAL_advanceCycles((uint64_t)((ms) * (F_CPU / 1000.0)))
+
+#endif  // HOST_UTIL_DELAY_H
@@ -0,0 +1,524 @@
+//
+//  Water Pump Controller, simavr benchmark
+//
+//  Runs the real firmware image (WaterPump.elf from the AVR build) on
+//  the simavr ATmega328P core one instruction at a time, and measures
+//  in CPU cycles:
+//
+//  - the time spent in each interrupt handler, counted from the vector
+//    table jump to the reti
+//  - each critical section in the main line code (interrupts disabled
+//    outside a handler), attributed to the function that disabled them
+//  - the latency from a falling tachometer edge on PB0 to the return of
+//    the handler that counts it
+//  - the main loop iteration time, between successive calls to
+//    SystemTime_task
+//
+//  The report is JSON with one value per line in a fixed order, so
+//  reports from two builds can be compared with diff. Synthetic edges
+//  are timed from a fixed seed so runs of the same build give the same
+//  report.
+//
+//  usage: SimavrBench [-s seconds] [-t tachPps] [-h homeHz] [-f] elfFile
+//
+//  -s  simulated seconds to run for (default 10)
+//  -t  tachometer pulses per second fed to PB0 (default 200, 0 for none)
+//  -h  home position sensor (PD2) toggles per second (default 5)
+//  -f  actuate the float sensor, so the firmware runs the pump
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libelf.h>
+#include <gelf.h>
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "avr_ioport.h"
+#include "avr_uart.h"
+
+#define MCU_NAME "atmega328p"
+#define MCU_FREQUENCY 20000000UL
+
+// ATmega328P vector table: 26 vectors of two words each
+#define VECTOR_COUNT 26
+#define VECTOR_SIZE 4
+#define VECTOR_TABLE_BYTES (VECTOR_COUNT * VECTOR_SIZE)
+
+#define VECTOR_RESET 0
+#define VECTOR_PCINT0 3
+#define VECTOR_PCINT1 4
+#define VECTOR_PCINT2 5
+#define VECTOR_TIMER1_CAPT 10
+#define VECTOR_TIMER1_COMPA 11
+
+#define OPCODE_RETI 0x9518
+
+// the deepest handler nesting tracked
+#define MAX_ISR_DEPTH 8
+
+static const char* const vectorNames[VECTOR_COUNT] = {
+    "RESET", "INT0", "INT1", "PCINT0", "PCINT1", "PCINT2", "WDT",
+    "TIMER2_COMPA", "TIMER2_COMPB", "TIMER2_OVF",
+    "TIMER1_CAPT", "TIMER1_COMPA", "TIMER1_COMPB", "TIMER1_OVF",
+    "TIMER0_COMPA", "TIMER0_COMPB", "TIMER0_OVF",
+    "SPI_STC", "USART_RX", "USART_UDRE", "USART_TX",
+    "ADC", "EE_READY", "ANALOG_COMP", "TWI", "SPM_READY"
+};
+
+// handlers always reported, whether they ran or not
+static const uint8_t reportedVectors[] = {
+    VECTOR_PCINT0, VECTOR_PCINT1, VECTOR_PCINT2,
+    VECTOR_TIMER1_CAPT, VECTOR_TIMER1_COMPA
+};
+
+// critical sections always reported, whether they ran or not
+static const char* const reportedSections[] = {
+    "TachometerOdometer_position", "TachometerOdometer_speed"
+};
+
+typedef struct CycleStats_struct {
+    uint32_t count;
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+} CycleStats;
+
+typedef struct Function_struct {
+    const char* name;
+    uint32_t address;
+    uint32_t size;
+    CycleStats criticalSections;
+} Function;
+
+typedef struct ActiveISR_struct {
+    uint8_t vector;
+    avr_cycle_count_t entryCycle;
+} ActiveISR;
+
+static Function* functions;
+static size_t functionCount;
+
+static CycleStats isrStats[VECTOR_COUNT];
+static ActiveISR isrStack[MAX_ISR_DEPTH];
+static uint8_t isrDepth;
+
+static bool criticalSectionOpen;
+static avr_cycle_count_t criticalSectionStart;
+static Function* criticalSectionFunction;
+
+static CycleStats tachLatency;
+static uint32_t tachEdges;
+static uint32_t tachEdgesMissed;
+static bool tachEdgePending;
+static avr_cycle_count_t tachEdgeCycle;
+
+static CycleStats mainLoop;
+static avr_cycle_count_t mainLoopLastEntry;
+static uint32_t resets;
+
+static void addSample (
+    const uint64_t cycles,
+    CycleStats* stats)
+{
+    if ((stats->count == 0) || (cycles < stats->min)) {
+        stats->min = cycles;
+    }
+    if (cycles > stats->max) {
+        stats->max = cycles;
+    }
+    stats->total += cycles;
+    ++stats->count;
+}
+
+static int compareFunctionAddress (
+    const void* a,
+    const void* b)
+{
+    const Function* fa = a;
+    const Function* fb = b;
+    return (fa->address > fb->address) - (fa->address < fb->address);
+}
+
+static int compareFunctionName (
+    const void* a,
+    const void* b)
+{
+    const Function* const* fa = a;
+    const Function* const* fb = b;
+    return strcmp((*fa)->name, (*fb)->name);
+}
+
+// reads the function symbols from the ELF file. simavr's own symbol
+// loading depends on how it was configured, so libelf is used directly
+static bool loadFunctions (
+    const char* elfFile)
+{
+    elf_version(EV_CURRENT);
+    const int fd = open(elfFile, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    Elf* elf = elf_begin(fd, ELF_C_READ, NULL);
+    if (elf == NULL) {
+        close(fd);
+        return false;
+    }
+    Elf_Scn* scn = NULL;
+    while ((scn = elf_nextscn(elf, scn)) != NULL) {
+        GElf_Shdr shdr;
+        if ((gelf_getshdr(scn, &shdr) == NULL) || (shdr.sh_type != SHT_SYMTAB)) {
+            continue;
+        }
+        Elf_Data* data = elf_getdata(scn, NULL);
+        const size_t symbolCount = shdr.sh_size / shdr.sh_entsize;
+        functions = calloc(symbolCount, sizeof(Function));
+        for (size_t i = 0; i < symbolCount; ++i) {
+            GElf_Sym sym;
+            if ((gelf_getsym(data, i, &sym) == NULL) ||
+                (GELF_ST_TYPE(sym.st_info) != STT_FUNC) ||
+                (sym.st_size == 0)) {
+                continue;
+            }
+            Function* f = &functions[functionCount++];
+            f->name = strdup(elf_strptr(elf, shdr.sh_link, sym.st_name));
+            f->address = sym.st_value;
+            f->size = sym.st_size;
+        }
+    }
+    elf_end(elf);
+    close(fd);
+    qsort(functions, functionCount, sizeof(Function), compareFunctionAddress);
+    return functionCount != 0;
+}
+
+// returns the function containing the given flash byte address
+static Function* functionAt (
+    const uint32_t address)
+{
+    size_t lo = 0;
+    size_t hi = functionCount;
+    while (lo < hi) {
+        const size_t mid = (lo + hi) / 2;
+        Function* f = &functions[mid];
+        if (address < f->address) {
+            hi = mid;
+        } else if (address >= (f->address + f->size)) {
+            lo = mid + 1;
+        } else {
+            return f;
+        }
+    }
+    return NULL;
+}
+
+static Function* functionNamed (
+    const char* name)
+{
+    for (size_t i = 0; i < functionCount; ++i) {
+        if (strcmp(functions[i].name, name) == 0) {
+            return &functions[i];
+        }
+    }
+    return NULL;
+}
+
+// tachometer handlers count the edge when they return
+static bool countsTachEdges (
+    const uint8_t vector)
+{
+    return (vector == VECTOR_TIMER1_CAPT) || (vector == VECTOR_PCINT0);
+}
+
+static void isrEntered (
+    const uint8_t vector,
+    const avr_cycle_count_t cycle)
+{
+    if (vector == VECTOR_RESET) {
+        // watchdog or crash reset. Start over on the handler nesting
+        ++resets;
+        isrDepth = 0;
+        criticalSectionOpen = false;
+        return;
+    }
+    if (isrDepth < MAX_ISR_DEPTH) {
+        isrStack[isrDepth].vector = vector;
+        isrStack[isrDepth].entryCycle = cycle;
+    }
+    ++isrDepth;
+}
+
+static void isrReturned (
+    const avr_cycle_count_t cycle)
+{
+    if (isrDepth == 0) {
+        return;
+    }
+    --isrDepth;
+    if (isrDepth >= MAX_ISR_DEPTH) {
+        return;
+    }
+    const ActiveISR* isr = &isrStack[isrDepth];
+    addSample(cycle - isr->entryCycle, &isrStats[isr->vector]);
+    if (tachEdgePending && countsTachEdges(isr->vector)) {
+        tachEdgePending = false;
+        addSample(cycle - tachEdgeCycle, &tachLatency);
+    }
+}
+
+static void tachEdge (
+    const avr_cycle_count_t cycle)
+{
+    ++tachEdges;
+    if (tachEdgePending) {
+        // the last edge hadn't been counted yet
+        ++tachEdgesMissed;
+    }
+    tachEdgePending = true;
+    tachEdgeCycle = cycle;
+}
+
+// small deterministic generator for the edge timing jitter, so the
+// edges don't keep the same phase to the system tick
+static uint32_t jitterState = 12345;
+static uint32_t jitter (
+    const uint32_t range)
+{
+    jitterState = (jitterState * 1103515245) + 12345;
+    return (range != 0) ? ((jitterState >> 8) % range) : 0;
+}
+
+static void printStats (
+    const char* indent,
+    const char* name,
+    const CycleStats* s,
+    const char* trailer)
+{
+    printf("%s\"%s\": {\n", indent, name);
+    printf("%s  \"count\": %u,\n", indent, s->count);
+    printf("%s  \"cyclesMin\": %llu,\n", indent, (unsigned long long)s->min);
+    printf("%s  \"cyclesAvg\": %llu,\n", indent,
+        (unsigned long long)((s->count != 0) ? ((s->total + (s->count / 2)) / s->count) : 0));
+    printf("%s  \"cyclesMax\": %llu,\n", indent, (unsigned long long)s->max);
+    printf("%s  \"cyclesTotal\": %llu\n", indent, (unsigned long long)s->total);
+    printf("%s}%s\n", indent, trailer);
+}
+
+static bool isReportedVector (
+    const uint8_t vector)
+{
+    for (size_t i = 0; i < sizeof(reportedVectors); ++i) {
+        if (reportedVectors[i] == vector) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void printReport (
+    const char* elfFile,
+    const double seconds,
+    const avr_cycle_count_t cycles,
+    const uint32_t tachPps,
+    const uint32_t homeHz,
+    const bool floatActuated)
+{
+    printf("{\n");
+    printf("  \"elf\": \"%s\",\n", elfFile);
+    printf("  \"mcu\": \"%s\",\n", MCU_NAME);
+    printf("  \"frequency\": %lu,\n", MCU_FREQUENCY);
+    printf("  \"seconds\": %g,\n", seconds);
+    printf("  \"cycles\": %llu,\n", (unsigned long long)cycles);
+    printf("  \"tachPulsesPerSecond\": %u,\n", tachPps);
+    printf("  \"homeTogglesPerSecond\": %u,\n", homeHz);
+    printf("  \"floatActuated\": %s,\n", floatActuated ? "true" : "false");
+    printf("  \"resets\": %u,\n", resets);
+
+    printf("  \"isr\": {\n");
+    uint8_t last = 0;
+    for (uint8_t v = 1; v < VECTOR_COUNT; ++v) {
+        if ((isrStats[v].count != 0) || isReportedVector(v)) {
+            last = v;
+        }
+    }
+    for (uint8_t v = 1; v < VECTOR_COUNT; ++v) {
+        if ((isrStats[v].count != 0) || isReportedVector(v)) {
+            printStats("    ", vectorNames[v], &isrStats[v], (v == last) ? "" : ",");
+        }
+    }
+    printf("  },\n");
+
+    // functions with critical sections, by name
+    Function** sections = calloc(functionCount, sizeof(Function*));
+    size_t sectionCount = 0;
+    for (size_t i = 0; i < functionCount; ++i) {
+        bool reported = (functions[i].criticalSections.count != 0);
+        for (size_t r = 0; r < (sizeof(reportedSections) / sizeof(reportedSections[0])); ++r) {
+            if (strcmp(functions[i].name, reportedSections[r]) == 0) {
+                reported = true;
+            }
+        }
+        if (reported) {
+            sections[sectionCount++] = &functions[i];
+        }
+    }
+    qsort(sections, sectionCount, sizeof(Function*), compareFunctionName);
+    printf("  \"criticalSections\": {\n");
+    for (size_t i = 0; i < sectionCount; ++i) {
+        printStats("    ", sections[i]->name, &sections[i]->criticalSections,
+            (i == (sectionCount - 1)) ? "" : ",");
+    }
+    printf("  },\n");
+    free(sections);
+
+    printf("  \"tachEdges\": %u,\n", tachEdges);
+    printf("  \"tachEdgesMissed\": %u,\n", tachEdgesMissed);
+    printStats("  ", "tachLatency", &tachLatency, ",");
+    printStats("  ", "mainLoop", &mainLoop, "");
+    printf("}\n");
+}
+
+int main (
+    int argc,
+    char* argv[])
+{
+    double seconds = 10;
+    uint32_t tachPps = 200;
+    uint32_t homeHz = 5;
+    bool floatActuated = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:t:h:f")) != -1) {
+        switch (opt) {
+            case 's' :  seconds = atof(optarg);         break;
+            case 't' :  tachPps = atoi(optarg);         break;
+            case 'h' :  homeHz = atoi(optarg);          break;
+            case 'f' :  floatActuated = true;           break;
+            default :
+                fprintf(stderr,
+                    "usage: %s [-s seconds] [-t tachPps] [-h homeHz] [-f] elfFile\n",
+                    argv[0]);
+                return 1;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "%s: no ELF file given\n", argv[0]);
+        return 1;
+    }
+    const char* elfFile = argv[optind];
+
+    elf_firmware_t firmware;
+    memset(&firmware, 0, sizeof(firmware));
+    if (elf_read_firmware(elfFile, &firmware) != 0) {
+        fprintf(stderr, "%s: can't read %s\n", argv[0], elfFile);
+        return 1;
+    }
+    if (!loadFunctions(elfFile)) {
+        fprintf(stderr, "%s: no function symbols in %s\n", argv[0], elfFile);
+        return 1;
+    }
+    // the AVR build doesn't embed the .mmcu section
+    strcpy(firmware.mmcu, MCU_NAME);
+    firmware.frequency = MCU_FREQUENCY;
+
+    avr_t* avr = avr_make_mcu_by_name(firmware.mmcu);
+    if (avr == NULL) {
+        fprintf(stderr, "%s: simavr doesn't know %s\n", argv[0], firmware.mmcu);
+        return 1;
+    }
+    avr_init(avr);
+    avr_load_firmware(avr, &firmware);
+    avr->log = LOG_NONE;
+
+    // keep the firmware's console output out of the report
+    uint32_t uartFlags = 0;
+    avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &uartFlags);
+    uartFlags &= ~AVR_UART_FLAG_STDIO;
+    avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &uartFlags);
+
+    avr_irq_t* tachPin = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), 0);
+    avr_irq_t* homePin = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'), 2);
+    avr_irq_t* floatPin = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('C'), 4);
+    avr_raise_irq(tachPin, 1);
+    avr_raise_irq(homePin, 0);
+    // the float sensor output is low when the tank is full
+    avr_raise_irq(floatPin, floatActuated ? 0 : 1);
+
+    const Function* mainLoopTask = functionNamed("SystemTime_task");
+    const uint32_t mainLoopAddress = (mainLoopTask != NULL) ? mainLoopTask->address : 0;
+
+    const avr_cycle_count_t endCycle = seconds * MCU_FREQUENCY;
+    const uint32_t tachPeriod = (tachPps != 0) ? (MCU_FREQUENCY / tachPps) : 0;
+    const uint32_t homePeriod = (homeHz != 0) ? (MCU_FREQUENCY / homeHz) : 0;
+    avr_cycle_count_t nextTachFall = (tachPeriod != 0) ? tachPeriod : UINT64_MAX;
+    avr_cycle_count_t nextTachRise = UINT64_MAX;
+    avr_cycle_count_t nextHomeToggle = (homePeriod != 0) ? homePeriod : UINT64_MAX;
+    bool homeLevel = false;
+
+    while (avr->cycle < endCycle) {
+        // external signals
+        if (avr->cycle >= nextTachFall) {
+            avr_raise_irq(tachPin, 0);
+            tachEdge(avr->cycle);
+            nextTachRise = avr->cycle + (tachPeriod / 4);
+            nextTachFall = avr->cycle + tachPeriod + jitter(tachPeriod / 8) - (tachPeriod / 16);
+        }
+        if (avr->cycle >= nextTachRise) {
+            avr_raise_irq(tachPin, 1);
+            nextTachRise = UINT64_MAX;
+        }
+        if (avr->cycle >= nextHomeToggle) {
+            homeLevel = !homeLevel;
+            avr_raise_irq(homePin, homeLevel);
+            nextHomeToggle = avr->cycle + homePeriod + jitter(homePeriod / 8);
+        }
+
+        const avr_flashaddr_t pc = avr->pc;
+        const uint16_t opcode = avr->flash[pc] | (avr->flash[pc + 1] << 8);
+        const bool interruptsWereEnabled = avr->sreg[S_I];
+
+        const int state = avr_run(avr);
+        if ((state == cpu_Done) || (state == cpu_Crashed)) {
+            fprintf(stderr, "%s: simulation stopped at cycle %llu, pc 0x%04x\n",
+                argv[0], (unsigned long long)avr->cycle, avr->pc);
+            break;
+        }
+
+        const avr_flashaddr_t newPc = avr->pc;
+        const bool interruptsEnabled = avr->sreg[S_I];
+        const bool enteredVector =
+            (newPc < VECTOR_TABLE_BYTES) && (pc >= VECTOR_TABLE_BYTES);
+
+        if (opcode == OPCODE_RETI) {
+            isrReturned(avr->cycle);
+        }
+        if (enteredVector) {
+            isrEntered(newPc / VECTOR_SIZE, avr->cycle);
+        } else if (isrDepth == 0) {
+            if (interruptsWereEnabled && !interruptsEnabled) {
+                criticalSectionOpen = true;
+                criticalSectionStart = avr->cycle;
+                criticalSectionFunction = functionAt(pc);
+            } else if (!interruptsWereEnabled && interruptsEnabled && criticalSectionOpen) {
+                criticalSectionOpen = false;
+                if (criticalSectionFunction != NULL) {
+                    addSample(avr->cycle - criticalSectionStart,
+                        &criticalSectionFunction->criticalSections);
+                }
+            }
+        }
+
+        if ((newPc == mainLoopAddress) && (pc != mainLoopAddress) && (mainLoopAddress != 0)) {
+            if (mainLoopLastEntry != 0) {
+                addSample(avr->cycle - mainLoopLastEntry, &mainLoop);
+            }
+            mainLoopLastEntry = avr->cycle;
+        }
+    }
+
+    printReport(elfFile, seconds, avr->cycle, tachPps, homeHz, floatActuated);
+    return 0;
+}
@@ -0,0 +1,317 @@
+//
+//  Baud Rate
+//
+//  How it works:
+//      The UART runs in double speed mode (U2X0), which keeps the rate
+//      error within 1.5% at every supported rate with a 20MHz clock.
+//      Autobaud timestamps the edges on RXD (PD0) with the free-running
+//      timer 1 count, using pin change notification. A carriage return
+//      (0x0D, sent LSB first after the start bit) has edges at bit times
+//      0, 1, 2, 3, 5 and 9, and no others until the next character, so
+//      the time from the first edge to the last is 9 bit times and the
+//      others have to fall in between at those places. No other
+//      character has this pattern at any rate. The measured bit time
+//      picks the nearest supported rate. The rate changes once RXD has
+//      been quiet for a
+//      character time at the slowest rate, so the UART has finished
+//      receiving what it made of the carriage return at the old rate.
+//      A requested rate is applied once the console's output has been
+//      idle for two byte times, the most the UART can still be holding
+//      after its transmit queue empties.
+//      Modbus frame end detection needs the edges on RXD too. A pin has
+//      one monitor, so the edges are passed on to ModbusSlave in Modbus
+//      mode. The monitor is only enabled while autobaud is detecting or
+//      in Modbus mode, so otherwise received characters cost no pin
+//      change interrupts.
+//
+#include "BaudRate.h"
+
+#include <stdlib.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include "SystemTime.h"
+#include "EEPROMStorage.h"
+#include "PinChangeMonitor.h"
+#include "ModbusSlave.h"
+
+#define RXD_PIN PD0
+
+// used if the stored rate isn't supported
+#define DEFAULT_RATE 4800
+
+// fastest first
+static const uint32_t supportedRates[] PROGMEM = {
+    115200, 57600, 38400, 19200, 9600, 4800
+};
+#define NUM_RATES (sizeof(supportedRates) / sizeof(uint32_t))
+#define SLOWEST_RATE 4800
+
+// a character at the slowest rate, measured 25% slow, in timer counts.
+// Falling edges further apart than this are in different characters
+#define MAX_CHARACTER_COUNTS \
+    ((10UL * 5 * SYSTEMTIME_COUNTS_PER_SECOND) / (4 * SLOWEST_RATE))
+
+// bit times of the edges of a carriage return, falling and rising in
+// turn. Its stop bit starts at the last one
+static const uint8_t carriageReturnEdges[] PROGMEM = { 0, 1, 2, 3, 5, 9 };
+#define CR_EDGES (sizeof(carriageReturnEdges))
+// one more edge shows that there was another in the character, or where
+// the next character started
+#define MAX_EDGES (CR_EDGES + 1)
+
+static uint32_t currentRate;
+// rate to change to once the output is idle. 0 when none is pending
+static uint32_t requestedRate;
+// output has been idle since idleSince (timer counts)
+static bool outputWasIdle;
+static uint16_t idleSince;
+// the current rate hasn't been confirmed, and is abandoned at
+// confirmDeadline
+static bool trialRate;
+static SystemTime_t confirmDeadline;
+
+// autobaud
+static PinChangeMonitor_t rxdChanges;
+static bool monitoring;
+static volatile bool detecting;
+static volatile uint8_t edgeCount;
+static volatile uint16_t edgeTimes[MAX_EDGES];
+static volatile uint16_t lastEdgeTime;
+
+static void setUARTRate (
+    const uint32_t rate)
+{
+    UCSR0A |= (1 << U2X0);
+    UBRR0 = (((F_CPU / 8) + (rate / 2)) / rate) - 1;
+    currentRate = rate;
+}
+
+static uint32_t storedRate (void)
+{
+    const uint32_t rate = EEPROMStorage_baudRate();
+    return BaudRate_isSupported(rate) ? rate : DEFAULT_RATE;
+}
+
+static void rxdChangeCB (
+    const bool pinState,
+    void* clientData)
+{
+    if (EEPROMStorage_modbus()) {
+        ModbusSlave_rxdChanged();
+    }
+    if (!detecting) {
+        return;
+    }
+    const uint16_t now = TCNT1;
+    lastEdgeTime = now;
+    if ((edgeCount == 0) ||
+        ((uint16_t)(now - edgeTimes[0]) > MAX_CHARACTER_COUNTS)) {
+        // a character starts with the falling edge of its start bit
+        edgeTimes[0] = now;
+        edgeCount = pinState ? 0 : 1;
+    } else if (edgeCount < MAX_EDGES) {
+        edgeTimes[edgeCount++] = now;
+    }
+}
+
+// enables the RXD monitor while it is needed, and disables it after
+static void updateMonitor (void)
+{
+    const bool needed = detecting || EEPROMStorage_modbus();
+    if (needed != monitoring) {
+        monitoring = needed;
+        if (needed) {
+            PinChangeMonitor_enable(&rxdChanges);
+        } else {
+            PinChangeMonitor_disable(&rxdChanges);
+        }
+    }
+}
+
+static void startDetecting (void)
+{
+    char SREGSave;
+    SREGSave = SREG;
+    cli();
+    edgeCount = 0;
+    detecting = true;
+    SREG = SREGSave;
+    updateMonitor();
+}
+
+// time from the first to the last edge of a carriage return, in
+// sixteenths of a timer count
+static uint32_t carriageReturnSpan (
+    const uint32_t rate)
+{
+    return (9UL * 16 * SYSTEMTIME_COUNTS_PER_SECOND) / rate;
+}
+
+// returns the rate of a carriage return received since the last call,
+// or 0 if there isn't one
+static uint32_t detectedRate (void)
+{
+    uint16_t times[MAX_EDGES];
+    uint8_t count;
+    uint16_t quietCounts;
+    char SREGSave;
+    SREGSave = SREG;
+    cli();
+    count = edgeCount;
+    for (uint8_t i = 0; i < count; ++i) {
+        times[i] = edgeTimes[i];
+    }
+    quietCounts = TCNT1 - lastEdgeTime;
+    if (quietCounts > MAX_CHARACTER_COUNTS) {
+        edgeCount = 0;
+    }
+    SREG = SREGSave;
+    if ((count < CR_EDGES) || (quietCounts <= MAX_CHARACTER_COUNTS)) {
+        return 0;
+    }
+
+    // 9 bit times. Edge positions are compared in ninths of a timer
+    // count, with a tolerance of 0.3 bit time and a count
+    const uint16_t span = times[CR_EDGES - 1] - times[0];
+    const int16_t tolerance = ((3 * span) / 10) + 9;
+    for (uint8_t i = 1; i < (CR_EDGES - 1); ++i) {
+        const int16_t position = 9 * (times[i] - times[0]);
+        const int16_t expected = pgm_read_byte(&carriageReturnEdges[i]) * span;
+        if (abs(position - expected) > tolerance) {
+            return 0;
+        }
+    }
+    if ((count == MAX_EDGES) &&
+        ((int16_t)(9 * (times[CR_EDGES] - times[0])) < ((int16_t)(10 * span) - tolerance))) {
+        // another edge before the end of the stop bit
+        return 0;
+    }
+
+    // nearest rate. the limits are halfway between adjacent rates' spans,
+    // and 25% beyond the fastest and slowest
+    const uint32_t measured = (uint32_t)span * 16;
+    uint32_t expected = carriageReturnSpan(pgm_read_dword(&supportedRates[0]));
+    if (measured < (expected - (expected / 4))) {
+        return 0;
+    }
+    for (uint8_t i = 0; i < NUM_RATES; ++i) {
+        const uint32_t rate = pgm_read_dword(&supportedRates[i]);
+        expected = carriageReturnSpan(rate);
+        const uint32_t limit = (i < (NUM_RATES - 1))
+            ? ((expected + carriageReturnSpan(pgm_read_dword(&supportedRates[i + 1]))) / 2)
+            : (expected + (expected / 4));
+        if (measured < limit) {
+            return rate;
+        }
+    }
+    return 0;
+}
+
+// switches to a rate, which has to be confirmed unless it is the
+// stored one. Autobaud stays on until it is
+static void beginTrial (
+    const uint32_t rate)
+{
+    setUARTRate(rate);
+    trialRate = (rate != storedRate());
+    if (trialRate) {
+        SystemTime_futureTime(BAUDRATE_CONFIRM_TIME, &confirmDeadline);
+    }
+    startDetecting();
+}
+
+void BaudRate_Initialize (void)
+{
+    requestedRate = 0;
+    outputWasIdle = false;
+    trialRate = false;
+    setUARTRate(storedRate());
+
+    PinChangeMonitor_monitorPin(IOPortBitfield_ps_d, RXD_PIN,
+        rxdChangeCB, NULL, &rxdChanges);
+    monitoring = false;
+    startDetecting();
+}
+
+bool BaudRate_isSupported (
+    const uint32_t rate)
+{
+    for (uint8_t i = 0; i < NUM_RATES; ++i) {
+        if (pgm_read_dword(&supportedRates[i]) == rate) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t BaudRate_current (void)
+{
+    return currentRate;
+}
+
+bool BaudRate_request (
+    const uint32_t rate)
+{
+    if (!BaudRate_isSupported(rate)) {
+        return false;
+    }
+    requestedRate = (rate != currentRate) ? rate : 0;
+    outputWasIdle = false;
+    return true;
+}
+
+bool BaudRate_changePending (void)
+{
+    return requestedRate != 0;
+}
+
+void BaudRate_linkConfirmed (void)
+{
+    if (trialRate) {
+        trialRate = false;
+        EEPROMStorage_setBaudRate(currentRate);
+    }
+    detecting = false;
+    updateMonitor();
+}
+
+bool BaudRate_task (
+    const bool outputIdle)
+{
+    // follows changes of the modbus setting
+    updateMonitor();
+
+    if (requestedRate != 0) {
+        const uint16_t now = SystemTime_timerCounts();
+        if (!outputIdle) {
+            outputWasIdle = false;
+        } else if (!outputWasIdle) {
+            outputWasIdle = true;
+            idleSince = now;
+        } else if ((uint16_t)(now - idleSince) >
+                   ((2UL * 10 * SYSTEMTIME_COUNTS_PER_SECOND) / currentRate)) {
+            beginTrial(requestedRate);
+            requestedRate = 0;
+            return true;
+        }
+        return false;
+    }
+
+    if (detecting) {
+        const uint32_t rate = detectedRate();
+        if ((rate != 0) && (rate != currentRate)) {
+            beginTrial(rate);
+            return true;
+        }
+    }
+
+    if (trialRate && SystemTime_timeHasArrived(&confirmDeadline)) {
+        // nothing valid came at the new rate. go back to the one that worked
+        trialRate = false;
+        setUARTRate(storedRate());
+        startDetecting();
+        return true;
+    }
+    return false;
+}
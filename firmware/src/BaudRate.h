@@ -0,0 +1,57 @@
+//
+//  Baud Rate
+//
+//  Sets the console UART's baud rate. At power-up it is the rate stored
+//  in EEPROM. It can be changed with "set baud", or detected from the
+//  first carriage return received at another rate (autobaud).
+//
+//  A new rate is only a trial until a valid command or binary frame is
+//  received at it, which stores it in EEPROM. If none arrives within
+//  BAUDRATE_CONFIRM_TIME the UART goes back to the stored rate, so a
+//  mistaken rate can't lock the console out.
+//
+#ifndef BAUDRATE_H
+#define BAUDRATE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// how long a new rate has to be confirmed in, in hundredths of a second
+#define BAUDRATE_CONFIRM_TIME 1000
+
+// sets the UART to the stored rate and starts watching RXD for a
+// carriage return. called once at power-up, after PinChangeMonitor.
+// RXD's pin change monitor is BaudRate's; in Modbus mode it passes the
+// edges on to ModbusSlave
+extern void BaudRate_Initialize (void);
+
+// true for the rates the UART can be set to: 4800, 9600, 19200, 38400,
+// 57600 and 115200
+extern bool BaudRate_isSupported (
+    const uint32_t rate);
+
+// the rate the UART is set to
+extern uint32_t BaudRate_current (void);
+
+// changes the rate once the reply to the current command has been sent.
+// returns false if the rate isn't supported
+extern bool BaudRate_request (
+    const uint32_t rate);
+
+// true from a request until the rate has changed. Output other than
+// replies waits, so that it isn't sent at the old rate and cut off
+extern bool BaudRate_changePending (void);
+
+// the console calls this when it receives a valid command or an intact
+// binary frame. Keeps a trial rate and stops autobaud
+extern void BaudRate_linkConfirmed (void);
+
+// applies a requested rate once outputIdle has been true for long enough
+// for the UART to finish sending, switches to a detected rate, and falls
+// back from a trial rate that wasn't confirmed. returns true if the rate
+// changed, which makes input received so far garbage.
+// called from Console_task
+extern bool BaudRate_task (
+    const bool outputIdle);
+
+#endif  // BAUDRATE_H
@@ -0,0 +1,206 @@
+//
+//  Binary Protocol
+//
+#include "BinaryProtocol.h"
+
+#include "Console.h"
+#include "CharString.h"
+#include "CommandProcessor.h"
+#include "EEPROMStorage.h"
+
+// request being received, COBS encoded. decoded in place
+static uint8_t rxFrame[BINARYPROTOCOL_MAX_FRAME];
+static uint8_t rxLength;
+static bool rxOverflow;
+
+// record being built, with room for the CRC. empty when none is open
+static uint8_t record[BINARYPROTOCOL_MAX_PAYLOAD];
+static uint8_t recordLength;
+static bool recordOverflow;
+
+// record encoded for the wire, with delimiters
+static uint8_t txFrame[BINARYPROTOCOL_MAX_FRAME + 2];
+
+static uint8_t streamSequence;
+static uint16_t framesReceived;
+static uint16_t badFrames;
+
+static void countFrame(
+    uint16_t* count)
+{
+    if (*count != UINT16_MAX) {
+        ++*count;
+    }
+}
+
+void BinaryProtocol_Initialize (void)
+{
+    rxLength = 0;
+    rxOverflow = false;
+    recordLength = 0;
+    recordOverflow = false;
+    streamSequence = 0;
+    framesReceived = 0;
+    badFrames = 0;
+}
+
+void BinaryProtocol_beginFrame (void)
+{
+    rxLength = 0;
+    rxOverflow = false;
+}
+
+bool BinaryProtocol_receiveByte (
+    const uint8_t byte)
+{
+    if (byte == FRAMECODEC_DELIMITER) {
+        return true;
+    }
+    if (rxLength < sizeof(rxFrame)) {
+        rxFrame[rxLength++] = byte;
+    } else {
+        rxOverflow = true;
+    }
+    return false;
+}
+
+static void beginRecord (
+    const uint8_t sequence,
+    const uint8_t type)
+{
+    record[BINARYPROTOCOL_ADDRESS] = EEPROMStorage_busAddress();
+    record[BINARYPROTOCOL_SEQUENCE] = sequence;
+    record[BINARYPROTOCOL_TYPE] = type;
+    recordLength = BINARYPROTOCOL_DATA;
+    recordOverflow = false;
+}
+
+// adds the CRC and writes the record to the console as a frame
+static void endRecord (void)
+{
+    const uint16_t crc = FrameCodec_crc16(record, recordLength);
+    record[recordLength++] = crc & 0xFF;
+    record[recordLength++] = crc >> 8;
+    txFrame[0] = FRAMECODEC_DELIMITER;
+    const uint8_t encodedLength = FrameCodec_encode(record, recordLength, &txFrame[1]);
+    txFrame[encodedLength + 1] = FRAMECODEC_DELIMITER;
+    Console_writeBytes(txFrame, encodedLength + 2);
+    recordLength = 0;
+}
+
+bool BinaryProtocol_executeFrame (void)
+{
+    if ((rxLength == 0) && !rxOverflow) {
+        // back to back delimiters
+        return false;
+    }
+    countFrame(&framesReceived);
+    const uint8_t length = rxOverflow ? 0 : FrameCodec_decode(rxFrame, rxLength, rxFrame);
+    rxLength = 0;
+    if (length < (BINARYPROTOCOL_HEADER_SIZE + BINARYPROTOCOL_CRC_SIZE)) {
+        countFrame(&badFrames);
+        return false;
+    }
+    const uint8_t crcOffset = length - BINARYPROTOCOL_CRC_SIZE;
+    const uint16_t crc = rxFrame[crcOffset] | (rxFrame[crcOffset + 1] << 8);
+    if (crc != FrameCodec_crc16(rxFrame, crcOffset)) {
+        countFrame(&badFrames);
+        return false;
+    }
+    const uint8_t address = rxFrame[BINARYPROTOCOL_ADDRESS];
+    if (((address != BINARYPROTOCOL_BROADCAST) &&
+         (address != EEPROMStorage_busAddress())) ||
+        (rxFrame[BINARYPROTOCOL_TYPE] != bpt_command)) {
+        return true;
+    }
+
+    // the command text goes through the command processor like a
+    // typed command, with its reply written into the record
+    CharString_clear(&CommandProcessor_incomingCommand);
+    for (uint8_t i = BINARYPROTOCOL_DATA; i < crcOffset; ++i) {
+        CharString_appendC(rxFrame[i], &CommandProcessor_incomingCommand);
+    }
+    beginRecord(rxFrame[BINARYPROTOCOL_SEQUENCE], bpt_reply);
+    BinaryProtocol_appendByte(bps_ok);
+    CharStringSpan_t command;
+    CharStringSpan_init(&CommandProcessor_incomingCommand, &command);
+    const bool validCommand = CommandProcessor_executeCommand(&command);
+    while (CommandProcessor_replyInProgress()) {
+        CommandProcessor_continueReply();
+    }
+    CharString_clear(&CommandProcessor_incomingCommand);
+
+    if (recordOverflow || !validCommand) {
+        recordLength = BINARYPROTOCOL_DATA;
+        BinaryProtocol_appendByte(recordOverflow ? bps_overflow : bps_error);
+    }
+    if (address == BINARYPROTOCOL_BROADCAST) {
+        recordLength = 0;
+    } else {
+        endRecord();
+    }
+    return true;
+}
+
+bool BinaryProtocol_recordOpen (void)
+{
+    return recordLength != 0;
+}
+
+void BinaryProtocol_appendByte (
+    const uint8_t value)
+{
+    if (recordLength < (BINARYPROTOCOL_HEADER_SIZE + BINARYPROTOCOL_MAX_DATA)) {
+        record[recordLength++] = value;
+    } else {
+        recordOverflow = true;
+    }
+}
+
+void BinaryProtocol_appendWord (
+    const uint16_t value)
+{
+    BinaryProtocol_appendByte(value & 0xFF);
+    BinaryProtocol_appendByte(value >> 8);
+}
+
+void BinaryProtocol_appendLong (
+    const uint32_t value)
+{
+    BinaryProtocol_appendWord(value & 0xFFFF);
+    BinaryProtocol_appendWord(value >> 16);
+}
+
+void BinaryProtocol_appendStringP (
+    PGM_P text)
+{
+    const size_t length = strlen_P(text);
+    BinaryProtocol_appendByte(length);
+    for (uint8_t i = 0; i < length; ++i) {
+        BinaryProtocol_appendByte(pgm_read_byte(text + i));
+    }
+}
+
+void BinaryProtocol_beginStreamRecord (
+    const uint8_t event,
+    const uint8_t fields)
+{
+    beginRecord(streamSequence++, bpt_streamRecord);
+    BinaryProtocol_appendByte(event);
+    BinaryProtocol_appendByte(fields);
+}
+
+void BinaryProtocol_endStreamRecord (void)
+{
+    endRecord();
+}
+
+uint16_t BinaryProtocol_framesReceived (void)
+{
+    return framesReceived;
+}
+
+uint16_t BinaryProtocol_badFrames (void)
+{
+    return badFrames;
+}
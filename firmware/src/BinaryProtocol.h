@@ -0,0 +1,116 @@
+//
+//  Binary Protocol
+//
+//  A compact, integrity checked alternative to the text console, for
+//  hosts polling one or more pumps. It shares the console's UART and
+//  the command processor's commands. A zero byte, which never appears
+//  in text, starts a binary request.
+//
+//  On the wire each frame is COBS encoded (see FrameCodec.h) between
+//  two zero bytes. Decoded, a frame is:
+//      address             BINARYPROTOCOL_BROADCAST or the busAddr setting
+//      sequence number     a reply has its request's. stream records
+//                          are numbered consecutively
+//      type                BinaryProtocol_type
+//      data                up to BINARYPROTOCOL_MAX_DATA bytes
+//      CRC16               of the bytes before it, low byte first
+//
+//  A command request's data is the text of a command. The reply is a
+//  status byte then the command's record. Records have a fixed layout:
+//  the values of the members of the command's JSON reply, in order,
+//  without names. Numbers are 16 bit, times are 32 bit seconds,
+//  booleans are a byte and strings are a length byte followed by the
+//  text, all low byte first. Settings are all 16 bit, so the baud
+//  setting is in hundreds of baud. Broadcast requests are carried out but
+//  not answered. Frames with a bad CRC or another address are ignored.
+//
+//  A stream started with a binary request sends stream records: an
+//  event byte (StatusStream_event), a byte of StatusStream_field bits,
+//  and the fields in the order t, p, s, v.
+//
+//  After a request, until the next text command, the pump sends no
+//  text of its own accord (see Console_binaryMode): events such as a
+//  stall are only reported by the stream, and a stream started with a
+//  text command sends stream records too.
+//
+#ifndef BINARYPROTOCOL_H
+#define BINARYPROTOCOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr/pgmspace.h>
+#include "FrameCodec.h"
+
+#define BINARYPROTOCOL_BROADCAST 0
+
+#define BINARYPROTOCOL_HEADER_SIZE 3
+#define BINARYPROTOCOL_CRC_SIZE 2
+#define BINARYPROTOCOL_MAX_DATA 44
+
+// offsets in a decoded frame
+#define BINARYPROTOCOL_ADDRESS 0
+#define BINARYPROTOCOL_SEQUENCE 1
+#define BINARYPROTOCOL_TYPE 2
+#define BINARYPROTOCOL_DATA 3
+
+#define BINARYPROTOCOL_MAX_PAYLOAD \
+    (BINARYPROTOCOL_HEADER_SIZE + BINARYPROTOCOL_MAX_DATA + BINARYPROTOCOL_CRC_SIZE)
+// most bytes of a frame on the wire, without delimiters
+#define BINARYPROTOCOL_MAX_FRAME FRAMECODEC_ENCODED_SIZE(BINARYPROTOCOL_MAX_PAYLOAD)
+// most bytes on the wire of a frame with dataLength bytes of data,
+// with both delimiters
+#define BINARYPROTOCOL_FRAME_SIZE(dataLength) \
+    (FRAMECODEC_ENCODED_SIZE(BINARYPROTOCOL_HEADER_SIZE + (dataLength) + \
+        BINARYPROTOCOL_CRC_SIZE) + 2)
+
+typedef enum BinaryProtocol_type_enum {
+    bpt_command = 0x01,         // request. data is command text
+    bpt_reply = 0x81,           // data is a status byte and a record
+    bpt_streamRecord = 0x82     // event, fields and the fields
+} BinaryProtocol_type;
+
+// first byte of a reply's data
+typedef enum BinaryProtocol_status_enum {
+    bps_ok,
+    bps_error,      // invalid command. no record
+    bps_overflow    // the record didn't fit in a frame. no record
+} BinaryProtocol_status;
+
+extern void BinaryProtocol_Initialize (void);
+
+// the console calls these for a request: beginFrame when it receives
+// the opening zero byte, receiveByte for each byte after it until that
+// returns true at the closing zero byte, then executeFrame when there
+// is room for the reply. executeFrame returns true if the frame was
+// intact, whoever it was addressed to
+extern void BinaryProtocol_beginFrame (void);
+extern bool BinaryProtocol_receiveByte (
+    const uint8_t byte);
+extern bool BinaryProtocol_executeFrame (void);
+
+// true while a record is being built. JSONWriter writes into it
+// instead of writing text
+extern bool BinaryProtocol_recordOpen (void);
+
+extern void BinaryProtocol_appendByte (
+    const uint8_t value);
+extern void BinaryProtocol_appendWord (
+    const uint16_t value);
+extern void BinaryProtocol_appendLong (
+    const uint32_t value);
+extern void BinaryProtocol_appendStringP (
+    PGM_P text);
+
+// stream records are opened, written with JSONWriter and closed with
+// endStreamRecord, which writes the frame to the console
+extern void BinaryProtocol_beginStreamRecord (
+    const uint8_t event,
+    const uint8_t fields);
+extern void BinaryProtocol_endStreamRecord (void);
+
+// frames received, and those ignored because they were malformed or had
+// a bad CRC. saturate at 65535
+extern uint16_t BinaryProtocol_framesReceived (void);
+extern uint16_t BinaryProtocol_badFrames (void);
+
+#endif  // BINARYPROTOCOL_H
@@ -1,212 +1,1145 @@
-//
-// Command processor
-//
-// Interprets and executes commands from the console
-//
-
-#include "CommandProcessor.h"
-
-#include <stdlib.h>
-#include <stdio.h>
-#include <avr/pgmspace.h>
-#include "SystemTime.h"
-#include "Console.h"
-#include "CharString.h"
-#include "StringScan.h"
-#include "StringInteger.h"
-#include "EEPROM_Util.h"
-#include "EEPROMStorage.h"
-#include "WaterPumpControl.h"
-#include "MSVS_AVR.h"
-
-#include <avr/io.h> // only for PWM test
-
-
-const char swver[] PROGMEM = "V1.0";
-
-static const char motorPwmP[]     PROGMEM = "motorPwm";
-static const char tCalOffsetP[]   PROGMEM = "tCalOffset";
-static const char posPerMlP[]     PROGMEM = "posPerMl";
-static const char inPosP[]        PROGMEM = "inPos";
-static const char outPosP[]       PROGMEM = "outPos";
-static const char mlToPumpP[]     PROGMEM = "mlToPump";
-
-CharString_define(80, CommandProcessor_incomingCommand)
-CharString_define(100, CommandProcessor_commandReply)
-
-static int16_t scanIntegerToken(
-    CharStringSpan_t* str,
-    bool* isValid)
-{
-    StringScan_skipWhitespace(str);
-    int16_t value = 0;
-    StringInteger_scan(str, isValid, &value, str);
-    return value;
-}
-
-static void beginJSON(
-    CharString_t* str)
-{
-    CharString_copyP(PSTR("{"), str);
-}
-
-static void continueJSON(
-    CharString_t* str)
-{
-    CharString_appendC(',', str);
-}
-
-static void endJSON(
-    CharString_t* str)
-{
-    CharString_appendC('}', str);
-}
-
-static void appendJSONIntValue(
-    PGM_P name,
-    const int16_t value,
-    const uint8_t decimalPlaces,
-    CharString_t* str)
-{
-    CharString_appendC('\"', str);
-    CharString_appendP(name, str);
-    CharString_appendP(PSTR("\":"), str);
-    StringInteger_appendDecimal(value, 1, decimalPlaces, str);
-}
-
-static void appendJSONTimeValue(
-    PGM_P name,
-    const SystemTime_t* time,
-    CharString_t* str)
-{
-    CharString_appendC('\"', str);
-    CharString_appendP(name, str);
-    CharString_appendP(PSTR("\":\""), str);
-    SystemTime_appendToString(time, str);
-    CharString_appendC('\"', str);
-}
-
-bool CommandProcessor_executeCommand(
-    const CharStringSpan_t* command,
-    CharString_t* reply)
-{
-    bool validCommand = true;
-
-    CharStringSpan_t cmd = *command;
-    CharStringSpan_t cmdToken;
-    StringScan_scanToken(&cmd, &cmdToken);
-    if (CharStringSpan_equalsNocaseP(&cmdToken, PSTR("s"))) {
-        SystemTime_t curTime;
-        SystemTime_getCurrentTime(&curTime);
-        beginJSON(reply);
-        appendJSONTimeValue(PSTR("t"), &curTime, reply);
-        continueJSON(reply);
-        appendJSONIntValue(PSTR("pos"), WaterPumpControl_plungerPosition(), 0, reply);
-        continueJSON(reply);
-        appendJSONIntValue(PSTR("speed"), WaterPumpControl_plungerSpeed(), 0, reply);
-        continueJSON(reply);
-        appendJSONIntValue(PSTR("volumeRemaining"), WaterPumpControl_volumeRemaining(), 0, reply);
-        endJSON(reply);
-    } else if (CharStringSpan_equalsNocaseP(&cmdToken, PSTR("settings"))) {
-        CharString_define(16, settingStr);
-        Console_printP(PSTR("{"));
-        CharString_copyP(PSTR("}"), &settingStr);
-        Console_printLineCS(&settingStr);
-    } else if (CharStringSpan_equalsNocaseP(&cmdToken, PSTR("set"))) {
-        StringScan_scanToken(&cmd, &cmdToken);
-        if (CharStringSpan_equalsNocaseP(&cmdToken, tCalOffsetP)) {
-            const int16_t tempCalOffset = scanIntegerToken(&cmd, &validCommand);
-            if (validCommand) {
-                EEPROMStorage_setTempCalOffset(tempCalOffset);
-            }
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, inPosP)) {
-            const int16_t pos = scanIntegerToken(&cmd, &validCommand);
-            if (validCommand) {
-                EEPROMStorage_setPlungerInPos(pos);
-            }
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, outPosP)) {
-            const int16_t pos = scanIntegerToken(&cmd, &validCommand);
-            if (validCommand) {
-                EEPROMStorage_setPlungerOutPos(pos);
-            }
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, posPerMlP)) {
-            const uint16_t posPerMl = scanIntegerToken(&cmd, &validCommand);
-            if (validCommand) {
-                EEPROMStorage_setPosPerMl(posPerMl);
-            }
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, mlToPumpP)) {
-            const uint16_t mlToPump = scanIntegerToken(&cmd, &validCommand);
-            if (validCommand) {
-                EEPROMStorage_setMlToPump(mlToPump);
-            }
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, motorPwmP)) {
-            const uint8_t pwm = scanIntegerToken(&cmd, &validCommand);
-            if (validCommand) {
-                EEPROMStorage_setMotorPwm(pwm);
-            }
-        } else {
-            validCommand = false;
-        }
-    } else if (CharStringSpan_equalsNocaseP(&cmdToken, PSTR("get"))) {
-        StringScan_scanToken(&cmd, &cmdToken);
-        if (CharStringSpan_equalsNocaseP(&cmdToken, tCalOffsetP)) {
-            beginJSON(reply);
-            appendJSONIntValue(tCalOffsetP, EEPROMStorage_tempCalOffset(), 0, reply);
-            endJSON(reply);
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, PSTR("params"))) {
-            beginJSON(reply);
-            appendJSONIntValue(inPosP, EEPROMStorage_plungerInPos(), 0, reply);
-            continueJSON(reply);
-            appendJSONIntValue(outPosP, EEPROMStorage_plungerOutPos(), 0, reply);
-            continueJSON(reply);
-            appendJSONIntValue(posPerMlP, EEPROMStorage_posPerMl(), 0, reply);
-            continueJSON(reply);
-            appendJSONIntValue(mlToPumpP, EEPROMStorage_mlToPump(), 0, reply);
-            endJSON(reply);
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, motorPwmP)) {
-            beginJSON(reply);
-            appendJSONIntValue(motorPwmP, EEPROMStorage_motorPwm(), 0, reply);
-            endJSON(reply);
-        } else {
-            validCommand = false;
-        }
-    } else if (CharStringSpan_equalsNocaseP(&cmdToken, PSTR("begin"))) {
-        WaterPumpControl_beginPumping();
-    } else if (CharStringSpan_equalsNocaseP(&cmdToken, PSTR("end"))) {
-        WaterPumpControl_endPumping();
-    } else if (CharStringSpan_equalsNocaseP(&cmdToken, PSTR("move"))) {
-        const int16_t pos = scanIntegerToken(&cmd, &validCommand);
-        if (validCommand) {
-            WaterPumpControl_movePlungerTo(pos);
-        }
-    } else if (CharStringSpan_equalsNocaseP(&cmdToken, PSTR("stop"))) {
-        WaterPumpControl_stopNow();
-    } else if (CharStringSpan_equalsNocaseP(&cmdToken, PSTR("eeread"))) {
-        const uint16_t eeAddr = scanIntegerToken(&cmd, &validCommand);
-        if (validCommand) {
-            beginJSON(reply);
-            appendJSONIntValue(PSTR("EEAddr"), eeAddr, 0, reply);
-            continueJSON(reply);
-            appendJSONIntValue(PSTR("EEVal"), EEPROM_read((uint8_t*)eeAddr), 0, reply);
-            endJSON(reply);
-        }
-    } else if (CharStringSpan_equalsNocaseP(&cmdToken, PSTR("eewrite"))) {
-        const uint16_t eeAddr = scanIntegerToken(&cmd, &validCommand);
-        if (validCommand) {
-            const uint16_t eeValue = scanIntegerToken(&cmd, &validCommand);
-            if (validCommand) {
-                EEPROM_write((uint8_t*)eeAddr, eeValue);
-            }
-        }
-    } else if (CharStringSpan_equalsNocaseP(&cmdToken, PSTR("ver"))) {
-        Console_printLineP(swver);
-    } else if (!CharStringSpan_isEmpty(&cmdToken)) {
-        validCommand = false;
-    }
-
-    if (!validCommand) {
-        CharString_copyP(PSTR("error"), reply);
-    }
-
-    return validCommand;
-}
+//
+// Command processor
+//
+// Interprets and executes commands from the console
+//
+
+#include "CommandProcessor.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <avr/pgmspace.h>
+#include "SystemTime.h"
+#include "Console.h"
+#include "CharString.h"
+#include "StringScan.h"
+#include "StringInteger.h"
+#include "EEPROMStorage.h"
+#include "WaterPumpControl.h"
+#include "Profiler.h"
+#include "JSONWriter.h"
+#include "StatusStream.h"
+#include "BinaryProtocol.h"
+#include "BaudRate.h"
+#include "ModbusSlave.h"
+#include "FrameCodec.h"
+#include "MSVS_AVR.h"
+
+#include <avr/io.h> // only for PWM test
+
+
+const char swver[] PROGMEM = "V1.0";
+
+#define COMMAND_LENGTH 80
+
+CharString_define(COMMAND_LENGTH, CommandProcessor_incomingCommand)
+
+// a reply too long to write at once is written a piece at a time by a
+// continuation, as the console has room. the continuation returns false
+// after writing the last piece
+typedef bool (*ReplyContinuation)(const uint8_t piece);
+static ReplyContinuation replyContinuation;
+static uint8_t replyPiece;
+
+// separates the commands of a batch
+#define BATCH_SEPARATOR ';'
+
+// a batch being carried out, one command per reply piece. The command
+// line is copied, because the console reads the next one into
+// incomingCommand during long replies
+CharString_define(COMMAND_LENGTH, batchCommands)
+static uint8_t batchPosition;       // index of the next command's text
+static bool batchValid;             // every command passed its check
+
+// while a batch is checked, command handlers check their arguments and
+// return whether they are valid without carrying the command out or
+// writing a reply
+static bool checkOnly;
+
+static int16_t scanIntegerToken(
+    CharStringSpan_t* str,
+    bool* isValid)
+{
+    StringScan_skipWhitespace(str);
+    int16_t value = 0;
+    StringInteger_scan(str, isValid, &value, str);
+    return value;
+}
+
+// scans a token of decimal digits, for values too big for
+// scanIntegerToken
+static uint32_t scanUnsignedLongToken(
+    CharStringSpan_t* str,
+    bool* isValid)
+{
+    CharStringSpan_t token;
+    StringScan_scanToken(str, &token);
+    *isValid = !CharStringSpan_isEmpty(&token) && (CharStringSpan_length(&token) <= 9);
+    uint32_t value = 0;
+    while (*isValid && !CharStringSpan_isEmpty(&token)) {
+        const char digit = CharStringSpan_front(&token);
+        if (isdigit(digit)) {
+            value = (value * 10) + (digit - '0');
+        } else {
+            *isValid = false;
+        }
+        CharStringSpan_incrBegin(&token);
+    }
+    return value;
+}
+
+// case insensitive comparison of a token with a name in program memory.
+// returns <0, 0 or >0, like strcasecmp
+static int8_t compareNocaseP(
+    const CharStringSpan_t* token,
+    PGM_P name)
+{
+    CharStringSpan_t rest = *token;
+    while (true) {
+        const char nameChar = tolower(pgm_read_byte(name++));
+        if (CharStringSpan_isEmpty(&rest)) {
+            return (nameChar == 0) ? 0 : -1;
+        }
+        const char tokenChar = tolower(CharStringSpan_front(&rest));
+        if (tokenChar != nameChar) {
+            return (tokenChar < nameChar) ? -1 : 1;
+        }
+        CharStringSpan_incrBegin(&rest);
+    }
+}
+
+// binary search of a table in program memory whose entries start with
+// a name, sorted in case insensitive alphabetical order. returns the
+// index of the entry or -1 if it isn't found
+static int8_t findByName(
+    const CharStringSpan_t* token,
+    const void* table,
+    const uint8_t numEntries,
+    const uint8_t entrySize)
+{
+    uint8_t low = 0;
+    uint8_t high = numEntries;
+    while (low < high) {
+        const uint8_t mid = (low + high) / 2;
+        const PGM_P name =
+            (PGM_P)pgm_read_ptr((const uint8_t*)table + (mid * entrySize));
+        const int8_t comparison = compareNocaseP(token, name);
+        if (comparison == 0) {
+            return mid;
+        } else if (comparison < 0) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+    return -1;
+}
+
+typedef enum SettingType_enum {
+    st_int16,
+    st_uint16,
+    st_uint8,
+    st_bool,
+    st_baudRate     // 32 bits. the setter checks the value itself
+} SettingType;
+
+// settings that "get <group>" reports together
+typedef enum SettingGroup_enum {
+    sg_none,
+    sg_params,
+    sg_speedCtl,
+    sg_profile
+} SettingGroup;
+
+// a setting stored by EEPROMStorage. set, get and the settings dump
+// are all driven by the settings table. The range set accepts is
+// EEPROMStorage's
+typedef struct SettingDescriptor_struct {
+    PGM_P name;
+    uint8_t type;       // SettingType
+    uint8_t group;      // SettingGroup
+    uint8_t modbusRegister; // ModbusSlave_holdingRegister
+    uint8_t stored;     // EEPROMStorage_setting
+    union {
+        int16_t (*int16)(void);
+        uint16_t (*uint16)(void);
+        uint8_t (*uint8)(void);
+        bool (*boolean)(void);
+        uint32_t (*uint32)(void);
+    } get;
+    union {
+        void (*int16)(const int16_t);
+        void (*uint16)(const uint16_t);
+        void (*uint8)(const uint8_t);
+        void (*boolean)(const bool);
+        bool (*baudRate)(const uint32_t);
+    } set;
+} SettingDescriptor;
+
+#define INT16_SETTING(name, group, reg, stored, getter, setter) \
+    { name, st_int16, group, reg, stored, { .int16 = getter }, { .int16 = setter } }
+#define UINT16_SETTING(name, group, reg, stored, getter, setter) \
+    { name, st_uint16, group, reg, stored, { .uint16 = getter }, { .uint16 = setter } }
+#define UINT8_SETTING(name, group, reg, stored, getter, setter) \
+    { name, st_uint8, group, reg, stored, { .uint8 = getter }, { .uint8 = setter } }
+#define BOOL_SETTING(name, group, reg, stored, getter, setter) \
+    { name, st_bool, group, reg, stored, { .boolean = getter }, { .boolean = setter } }
+#define BAUD_RATE_SETTING(name, group, reg, stored, getter, setter) \
+    { name, st_baudRate, group, reg, stored, { .uint32 = getter }, { .baudRate = setter } }
+
+static const char accelCountsP[]    PROGMEM = "accelCounts";
+static const char approachPctP[]    PROGMEM = "approachPct";
+static const char baudP[]           PROGMEM = "baud";
+static const char brakeGainFwdP[]   PROGMEM = "brakeGainFwd";
+static const char brakeGainRevP[]   PROGMEM = "brakeGainRev";
+static const char busAddrP[]        PROGMEM = "busAddr";
+static const char decelCountsP[]    PROGMEM = "decelCounts";
+static const char echoP[]           PROGMEM = "echo";
+static const char inPosP[]          PROGMEM = "inPos";
+static const char mlToPumpP[]       PROGMEM = "mlToPump";
+static const char modbusP[]         PROGMEM = "modbus";
+static const char motorPwmP[]       PROGMEM = "motorPwm";
+static const char outPosP[]         PROGMEM = "outPos";
+static const char plungerSpeedP[]   PROGMEM = "plungerSpeed";
+static const char posPerMlP[]       PROGMEM = "posPerMl";
+static const char rebootIntervalP[] PROGMEM = "rebootInterval";
+static const char speedKdP[]        PROGMEM = "speedKd";
+static const char speedKiP[]        PROGMEM = "speedKi";
+static const char speedKpP[]        PROGMEM = "speedKp";
+static const char tCalOffsetP[]     PROGMEM = "tCalOffset";
+
+// must be kept in case insensitive alphabetical order of name
+static const SettingDescriptor settingsTable[] PROGMEM = {
+    UINT16_SETTING(accelCountsP, sg_profile, mhr_accelCounts, es_profileAccelCounts,
+        EEPROMStorage_profileAccelCounts, EEPROMStorage_setProfileAccelCounts),
+    UINT8_SETTING(approachPctP, sg_profile, mhr_approachPct, es_profileApproachPct,
+        EEPROMStorage_profileApproachPct, EEPROMStorage_setProfileApproachPct),
+    BAUD_RATE_SETTING(baudP, sg_none, mhr_none, es_baudRate,
+        BaudRate_current, BaudRate_request),
+    UINT16_SETTING(brakeGainFwdP, sg_none, mhr_brakeGainFwd, es_brakeGainFwd,
+        EEPROMStorage_brakeGainFwd, EEPROMStorage_setBrakeGainFwd),
+    UINT16_SETTING(brakeGainRevP, sg_none, mhr_brakeGainRev, es_brakeGainRev,
+        EEPROMStorage_brakeGainRev, EEPROMStorage_setBrakeGainRev),
+    UINT8_SETTING(busAddrP, sg_none, mhr_busAddr, es_busAddress,
+        EEPROMStorage_busAddress, EEPROMStorage_setBusAddress),
+    UINT16_SETTING(decelCountsP, sg_profile, mhr_decelCounts, es_profileDecelCounts,
+        EEPROMStorage_profileDecelCounts, EEPROMStorage_setProfileDecelCounts),
+    BOOL_SETTING(echoP, sg_none, mhr_echo, es_echo,
+        EEPROMStorage_echo, EEPROMStorage_setEcho),
+    INT16_SETTING(inPosP, sg_params, mhr_inPos, es_plungerInPos,
+        EEPROMStorage_plungerInPos, EEPROMStorage_setPlungerInPos),
+    UINT16_SETTING(mlToPumpP, sg_params, mhr_mlToPump, es_mlToPump,
+        EEPROMStorage_mlToPump, EEPROMStorage_setMlToPump),
+    BOOL_SETTING(modbusP, sg_none, mhr_modbus, es_modbus,
+        EEPROMStorage_modbus, EEPROMStorage_setModbus),
+    UINT8_SETTING(motorPwmP, sg_none, mhr_motorPwm, es_motorPwm,
+        EEPROMStorage_motorPwm, EEPROMStorage_setMotorPwm),
+    INT16_SETTING(outPosP, sg_params, mhr_outPos, es_plungerOutPos,
+        EEPROMStorage_plungerOutPos, EEPROMStorage_setPlungerOutPos),
+    UINT16_SETTING(plungerSpeedP, sg_speedCtl, mhr_plungerSpeed, es_plungerSpeed,
+        EEPROMStorage_plungerSpeed, EEPROMStorage_setPlungerSpeed),
+    UINT16_SETTING(posPerMlP, sg_params, mhr_posPerMl, es_posPerMl,
+        EEPROMStorage_posPerMl, EEPROMStorage_setPosPerMl),
+    UINT16_SETTING(rebootIntervalP, sg_none, mhr_rebootInterval, es_rebootInterval,
+        EEPROMStorage_rebootInterval, EEPROMStorage_setRebootInterval),
+    UINT16_SETTING(speedKdP, sg_speedCtl, mhr_speedKd, es_speedKd,
+        EEPROMStorage_speedKd, EEPROMStorage_setSpeedKd),
+    UINT16_SETTING(speedKiP, sg_speedCtl, mhr_speedKi, es_speedKi,
+        EEPROMStorage_speedKi, EEPROMStorage_setSpeedKi),
+    UINT16_SETTING(speedKpP, sg_speedCtl, mhr_speedKp, es_speedKp,
+        EEPROMStorage_speedKp, EEPROMStorage_setSpeedKp),
+    INT16_SETTING(tCalOffsetP, sg_none, mhr_tCalOffset, es_tempCalOffset,
+        EEPROMStorage_tempCalOffset, EEPROMStorage_setTempCalOffset)
+};
+#define NUM_SETTINGS (sizeof(settingsTable) / sizeof(SettingDescriptor))
+
+static void loadSetting(
+    const uint8_t index,
+    SettingDescriptor* setting)
+{
+    memcpy_P(setting, &settingsTable[index], sizeof(SettingDescriptor));
+}
+
+static int32_t settingValue(
+    const SettingDescriptor* setting)
+{
+    switch (setting->type) {
+        case st_int16 :   return setting->get.int16();
+        case st_uint16 :  return setting->get.uint16();
+        case st_uint8 :   return setting->get.uint8();
+        case st_baudRate : return setting->get.uint32();
+        default :         return setting->get.boolean();
+    }
+}
+
+static void setSettingValue(
+    const SettingDescriptor* setting,
+    const int32_t value)
+{
+    switch (setting->type) {
+        case st_int16 :   setting->set.int16(value);          break;
+        case st_uint16 :  setting->set.uint16(value);         break;
+        case st_uint8 :   setting->set.uint8(value);          break;
+        default :         setting->set.boolean(value != 0);   break;
+    }
+}
+
+// true if setting the value switches the console between text commands
+// and Modbus. A batch can't: the rest of its reply couldn't be sent
+static bool switchesToModbus(
+    const SettingDescriptor* setting,
+    const int32_t value)
+{
+    return (setting->get.boolean == EEPROMStorage_modbus) &&
+        ((value != 0) != EEPROMStorage_modbus());
+}
+
+// true if set accepts the value for the setting
+static bool settingAccepts(
+    const SettingDescriptor* setting,
+    const int32_t value)
+{
+    return (setting->type != st_baudRate) &&
+        EEPROMStorage_settingInRange(setting->stored, value);
+}
+
+// finds the setting mapped to a Modbus holding register. returns false
+// if there isn't one
+static bool loadRegisterSetting(
+    const uint8_t reg,
+    SettingDescriptor* setting)
+{
+    for (uint8_t index = 0; index < NUM_SETTINGS; ++index) {
+        if (pgm_read_byte(&settingsTable[index].modbusRegister) == reg) {
+            loadSetting(index, setting);
+            return true;
+        }
+    }
+    return false;
+}
+
+// a holding register's value is the setting's, signed settings in
+// two's complement
+static int32_t registerSettingValue(
+    const SettingDescriptor* setting,
+    const uint16_t value)
+{
+    return (setting->type == st_int16) ? (int16_t)value : (int32_t)value;
+}
+
+static void writeSetting(
+    const uint8_t index)
+{
+    SettingDescriptor setting;
+    loadSetting(index, &setting);
+    if (setting.type == st_baudRate) {
+        // records hold 16 bit values, so a record has the rate in
+        // hundreds of baud
+        if (BinaryProtocol_recordOpen()) {
+            JSONWriter_intValue(setting.name, settingValue(&setting) / 100);
+        } else {
+            JSONWriter_longValue(setting.name, settingValue(&setting));
+        }
+    } else {
+        JSONWriter_intValue(setting.name, settingValue(&setting));
+    }
+}
+
+static void writeSettingsGroup(
+    const SettingGroup group)
+{
+    JSONWriter_beginObject(NULL);
+    for (uint8_t index = 0; index < NUM_SETTINGS; ++index) {
+        if (pgm_read_byte(&settingsTable[index].group) == group) {
+            writeSetting(index);
+        }
+    }
+    JSONWriter_endObject();
+}
+
+static void beginLongReply(
+    ReplyContinuation continuation)
+{
+    replyContinuation = continuation;
+    replyPiece = 0;
+}
+
+// settings dump, a setting per piece
+static bool writeSettingsPiece(
+    const uint8_t piece)
+{
+    if (piece == 0) {
+        JSONWriter_beginObject(NULL);
+    }
+    if (piece >= NUM_SETTINGS) {
+        JSONWriter_endObject();
+        return false;
+    }
+    writeSetting(piece);
+    return true;
+}
+bool CommandProcessor_readSettingRegister(
+    const uint8_t reg,
+    uint16_t* value)
+{
+    SettingDescriptor setting;
+    if (!loadRegisterSetting(reg, &setting)) {
+        return false;
+    }
+    *value = (uint16_t)settingValue(&setting);
+    return true;
+}
+
+bool CommandProcessor_settingRegisterAccepts(
+    const uint8_t reg,
+    const uint16_t value)
+{
+    SettingDescriptor setting;
+    return loadRegisterSetting(reg, &setting) &&
+        settingAccepts(&setting, registerSettingValue(&setting, value));
+}
+
+bool CommandProcessor_writeSettingRegister(
+    const uint8_t reg,
+    const uint16_t value)
+{
+    SettingDescriptor setting;
+    if (!loadRegisterSetting(reg, &setting)) {
+        return false;
+    }
+    const int32_t newValue = registerSettingValue(&setting, value);
+    if (!settingAccepts(&setting, newValue)) {
+        return false;
+    }
+    setSettingValue(&setting, newValue);
+    return true;
+}
+
+bool CommandProcessor_replyInProgress(void)
+{
+    return replyContinuation != NULL;
+}
+
+void CommandProcessor_continueReply(void)
+{
+    if ((replyContinuation != NULL) && !replyContinuation(replyPiece++)) {
+        replyContinuation = NULL;
+    }
+}
+
+void CommandProcessor_abortReply(void)
+{
+    if (replyContinuation != NULL) {
+        replyContinuation = NULL;
+        JSONWriter_abandon();
+    }
+    WaterPumpControl_hold(false);
+}
+
+#if PROFILING
+// timer counts, limited to 16 bits signed
+static int16_t profileCounts(
+    const uint32_t counts)
+{
+    return (counts < INT16_MAX) ? counts : INT16_MAX;
+}
+
+// longest time of each item, an item per piece
+static bool writeProfPiece(
+    const uint8_t piece)
+{
+    if (piece == 0) {
+        JSONWriter_beginObject(NULL);
+    }
+    if (piece >= pi_numItems) {
+        JSONWriter_endObject();
+        return false;
+    }
+    Profiler_stats stats;
+    Profiler_getStats(piece, true, &stats);
+    JSONWriter_intValue(Profiler_itemName(piece), profileCounts(stats.max));
+    return true;
+}
+
+// prof            longest time of each item, which are then reset
+// prof <item>     samples, min, mean, max and histogram of one item,
+//                 which are then reset
+// prof reset      resets all items
+static bool executeProfCommand(
+    CharStringSpan_t* args)
+{
+    CharStringSpan_t itemToken;
+    StringScan_scanToken(args, &itemToken);
+    Profiler_stats stats;
+    if (CharStringSpan_isEmpty(&itemToken)) {
+        if (checkOnly) {
+            // a long reply can't be part of a batch's reply
+            return false;
+        }
+        beginLongReply(writeProfPiece);
+        return true;
+    } else if (CharStringSpan_equalsNocaseP(&itemToken, PSTR("reset"))) {
+        if (!checkOnly) {
+            Profiler_reset();
+        }
+        return true;
+    }
+    for (uint8_t item = 0; item < pi_numItems; ++item) {
+        if (CharStringSpan_equalsNocaseP(&itemToken, Profiler_itemName(item))) {
+            if (checkOnly) {
+                return true;
+            }
+            Profiler_getStats(item, true, &stats);
+            JSONWriter_beginObject(NULL);
+            JSONWriter_intValue(PSTR("n"), stats.count);
+            JSONWriter_intValue(PSTR("min"),
+                (stats.count != 0) ? profileCounts(stats.min) : 0);
+            JSONWriter_intValue(PSTR("mean"),
+                (stats.count != 0) ? profileCounts(stats.total / stats.count) : 0);
+            JSONWriter_intValue(PSTR("max"), profileCounts(stats.max));
+            JSONWriter_beginArray(PSTR("hist"));
+            for (uint8_t bin = 0; bin < PROFILER_HISTOGRAM_BINS; ++bin) {
+                JSONWriter_intValue(NULL, stats.histogram[bin]);
+            }
+            JSONWriter_endArray();
+            JSONWriter_endObject();
+            return true;
+        }
+    }
+    return false;
+}
+#endif
+
+// commands take the rest of the command line as their arguments and
+// return false if they are invalid
+typedef bool (*CommandHandler)(CharStringSpan_t* args);
+
+typedef struct Command_struct {
+    PGM_P name;
+    CommandHandler handler;
+} Command;
+
+// reports for "get" that aren't single settings
+typedef struct GetItem_struct {
+    PGM_P name;
+    void (*write)(void);
+} GetItem;
+
+static void writeParams(void)
+{
+    writeSettingsGroup(sg_params);
+}
+
+static void writeSpeedCtl(void)
+{
+    writeSettingsGroup(sg_speedCtl);
+}
+
+static void writeProfile(void)
+{
+    writeSettingsGroup(sg_profile);
+}
+
+static void writeBrake(void)
+{
+    JSONWriter_beginObject(NULL);
+    JSONWriter_intValue(PSTR("gainFwd"), EEPROMStorage_brakeGainFwd());
+    JSONWriter_intValue(PSTR("gainRev"), EEPROMStorage_brakeGainRev());
+    JSONWriter_intValue(PSTR("overshoot"), WaterPumpControl_plungerOvershoot());
+    JSONWriter_endObject();
+}
+
+// console output lost because the UART couldn't keep up
+static void writeDropped(void)
+{
+    JSONWriter_beginObject(NULL);
+    JSONWriter_intValue(PSTR("telMsgs"), Console_droppedMessages(cp_telemetry));
+    JSONWriter_intValue(PSTR("telBytes"), Console_droppedBytes(cp_telemetry));
+    JSONWriter_intValue(PSTR("replyMsgs"), Console_droppedMessages(cp_reply));
+    JSONWriter_intValue(PSTR("replyBytes"), Console_droppedBytes(cp_reply));
+    JSONWriter_endObject();
+}
+
+// binary protocol and Modbus frames received, and those that were
+// malformed
+static void writeFrames(void)
+{
+    JSONWriter_beginObject(NULL);
+    JSONWriter_intValue(PSTR("rx"), BinaryProtocol_framesReceived());
+    JSONWriter_intValue(PSTR("bad"), BinaryProtocol_badFrames());
+    JSONWriter_intValue(PSTR("mbRx"), ModbusSlave_framesReceived());
+    JSONWriter_intValue(PSTR("mbBad"), ModbusSlave_badFrames());
+    JSONWriter_endObject();
+}
+
+// how the settings were found in EEPROM at power-up
+static void writeEEPROM(void)
+{
+    JSONWriter_beginObject(NULL);
+    JSONWriter_intValue(PSTR("version"), EEPROMStorage_loadedVersion());
+    JSONWriter_boolValue(PSTR("crcOk"), EEPROMStorage_loadedCrcOk());
+    JSONWriter_intValue(PSTR("defaulted"), EEPROMStorage_settingsDefaulted());
+    JSONWriter_boolValue(PSTR("unconfirmed"), EEPROMStorage_settingsUnconfirmed());
+    JSONWriter_endObject();
+}
+
+static const char brakeP[]    PROGMEM = "brake";
+static const char droppedP[]  PROGMEM = "dropped";
+static const char eepromP[]   PROGMEM = "eeprom";
+static const char framesP[]   PROGMEM = "frames";
+static const char paramsP[]   PROGMEM = "params";
+static const char profileP[]  PROGMEM = "profile";
+static const char speedCtlP[] PROGMEM = "speedCtl";
+
+// must be kept in case insensitive alphabetical order of name
+static const GetItem getItems[] PROGMEM = {
+    { brakeP,    writeBrake },
+    { droppedP,  writeDropped },
+    { eepromP,   writeEEPROM },
+    { framesP,   writeFrames },
+    { paramsP,   writeParams },
+    { profileP,  writeProfile },
+    { speedCtlP, writeSpeedCtl }
+};
+#define NUM_GET_ITEMS (sizeof(getItems) / sizeof(GetItem))
+
+static bool executeStatusCommand(
+    CharStringSpan_t* args)
+{
+    if (checkOnly) {
+        return true;
+    }
+    SystemTime_t curTime;
+    SystemTime_getCurrentTime(&curTime);
+    JSONWriter_beginObject(NULL);
+    JSONWriter_timeValue(PSTR("t"), &curTime);
+    JSONWriter_intValue(PSTR("pos"), WaterPumpControl_plungerPosition());
+    JSONWriter_intValue(PSTR("speed"), WaterPumpControl_plungerSpeed());
+    JSONWriter_intValue(PSTR("volumeRemaining"), WaterPumpControl_volumeRemaining());
+    JSONWriter_endObject();
+    return true;
+}
+
+static bool executeSettingsCommand(
+    CharStringSpan_t* args)
+{
+    if (checkOnly) {
+        // a long reply can't be part of a batch's reply
+        return false;
+    }
+    beginLongReply(writeSettingsPiece);
+    return true;
+}
+
+// set <setting> <value>
+static bool executeSetCommand(
+    CharStringSpan_t* args)
+{
+    CharStringSpan_t nameToken;
+    StringScan_scanToken(args, &nameToken);
+    const int8_t index =
+        findByName(&nameToken, settingsTable, NUM_SETTINGS, sizeof(SettingDescriptor));
+    if (index < 0) {
+        return false;
+    }
+    SettingDescriptor setting;
+    loadSetting(index, &setting);
+    bool isValid = true;
+    if (setting.type == st_baudRate) {
+        const uint32_t rate = scanUnsignedLongToken(args, &isValid);
+        return isValid &&
+            (checkOnly ? BaudRate_isSupported(rate) : setting.set.baudRate(rate));
+    }
+    // unsigned values can be above INT16_MAX
+    const int32_t value = (setting.type == st_int16)
+        ? scanIntegerToken(args, &isValid)
+        : (int32_t)scanUnsignedLongToken(args, &isValid);
+    if (!isValid || !settingAccepts(&setting, value)) {
+        return false;
+    }
+    if (checkOnly) {
+        // only batches are checked first
+        return !switchesToModbus(&setting, value);
+    }
+    setSettingValue(&setting, value);
+    return true;
+}
+
+// get <setting>, or get <item> for a group of settings or status
+static bool executeGetCommand(
+    CharStringSpan_t* args)
+{
+    CharStringSpan_t nameToken;
+    StringScan_scanToken(args, &nameToken);
+    int8_t index =
+        findByName(&nameToken, settingsTable, NUM_SETTINGS, sizeof(SettingDescriptor));
+    if (index >= 0) {
+        if (!checkOnly) {
+            JSONWriter_beginObject(NULL);
+            writeSetting(index);
+            JSONWriter_endObject();
+        }
+        return true;
+    }
+    index = findByName(&nameToken, getItems, NUM_GET_ITEMS, sizeof(GetItem));
+    if (index >= 0) {
+        if (!checkOnly) {
+            ((void (*)(void))pgm_read_ptr(&getItems[index].write))();
+        }
+        return true;
+    }
+    return false;
+}
+
+static bool executeBeginCommand(
+    CharStringSpan_t* args)
+{
+    if (!checkOnly) {
+        WaterPumpControl_beginPumping();
+    }
+    return true;
+}
+
+static bool executeEndCommand(
+    CharStringSpan_t* args)
+{
+    if (!checkOnly) {
+        WaterPumpControl_endPumping();
+    }
+    return true;
+}
+
+static bool executeMoveCommand(
+    CharStringSpan_t* args)
+{
+    bool isValid = true;
+    const int16_t pos = scanIntegerToken(args, &isValid);
+    if (isValid && !checkOnly) {
+        WaterPumpControl_movePlungerTo(pos);
+    }
+    return isValid;
+}
+
+static bool executeStopCommand(
+    CharStringSpan_t* args)
+{
+    if (!checkOnly) {
+        WaterPumpControl_stopNow();
+    }
+    return true;
+}
+
+static bool executeEEReadCommand(
+    CharStringSpan_t* args)
+{
+    bool isValid = true;
+    const uint16_t eeAddr = scanIntegerToken(args, &isValid);
+    if (isValid && !checkOnly) {
+        JSONWriter_beginObject(NULL);
+        JSONWriter_intValue(PSTR("EEAddr"), eeAddr);
+        JSONWriter_intValue(PSTR("EEVal"), EEPROMStorage_readByte(eeAddr));
+        JSONWriter_endObject();
+    }
+    return isValid;
+}
+
+static bool executeEEWriteCommand(
+    CharStringSpan_t* args)
+{
+    bool isValid = true;
+    const uint16_t eeAddr = scanIntegerToken(args, &isValid);
+    if (isValid) {
+        const uint16_t eeValue = scanIntegerToken(args, &isValid);
+        if (isValid && !checkOnly) {
+            EEPROMStorage_writeByte(eeAddr, eeValue);
+        }
+    }
+    return isValid;
+}
+
+// bulk EEPROM access is in chunks of up to this many bytes, each with
+// the CRC16 of its data (see FrameCodec.h)
+#define EE_CHUNK_SIZE 16
+#define EE_SIZE (E2END + 1)
+
+// range being dumped, a chunk per reply piece
+static uint16_t eeDumpAddress;
+static uint16_t eeDumpEnd;
+
+static bool eeRangeIsValid(
+    const int16_t address,
+    const int16_t length)
+{
+    return (address >= 0) && (length > 0) && (length <= (EE_SIZE - address));
+}
+
+static int8_t hexDigitValue(
+    const char c)
+{
+    if ((c >= '0') && (c <= '9')) {
+        return c - '0';
+    }
+    const char upper = toupper(c);
+    if ((upper >= 'A') && (upper <= 'F')) {
+        return 10 + (upper - 'A');
+    }
+    return -1;
+}
+
+static bool writeEEDumpPiece(
+    const uint8_t piece)
+{
+    uint8_t data[EE_CHUNK_SIZE];
+    const uint16_t remaining = eeDumpEnd - eeDumpAddress;
+    const uint8_t length =
+        (remaining < EE_CHUNK_SIZE) ? remaining : EE_CHUNK_SIZE;
+    for (uint8_t i = 0; i < length; ++i) {
+        data[i] = EEPROMStorage_readByte(eeDumpAddress + i);
+    }
+    JSONWriter_beginObject(NULL);
+    JSONWriter_intValue(PSTR("addr"), eeDumpAddress);
+    JSONWriter_bytesValue(PSTR("data"), data, length);
+    JSONWriter_intValue(PSTR("crc"), FrameCodec_crc16(data, length));
+    JSONWriter_endObject();
+    eeDumpAddress += length;
+    return eeDumpAddress < eeDumpEnd;
+}
+
+// eedump <addr> <len>      a line per 16 byte chunk:
+//                          {"addr":a,"data":"<hex>","crc":c}
+static bool executeEEDumpCommand(
+    CharStringSpan_t* args)
+{
+    bool isValid = true;
+    const int16_t eeAddr = scanIntegerToken(args, &isValid);
+    int16_t length = 0;
+    if (isValid) {
+        length = scanIntegerToken(args, &isValid);
+    }
+    if (!isValid || !eeRangeIsValid(eeAddr, length) || checkOnly) {
+        // a long reply can't be part of a batch
+        return false;
+    }
+    eeDumpAddress = eeAddr;
+    eeDumpEnd = eeAddr + length;
+    beginLongReply(writeEEDumpPiece);
+    return true;
+}
+
+// eeload <addr> <hex> [crc]    writes a chunk of up to 16 bytes, such as
+//                              a line of eedump output. Nothing is written
+//                              if the crc is given and doesn't match.
+//                              Bytes that already hold their value are
+//                              skipped; the reply has how many weren't.
+//                              Settings take effect once their block is
+//                              whole, with a good CRC, as it is after the
+//                              last of its eedump lines; the reply's
+//                              settings member says if they did
+static bool executeEELoadCommand(
+    CharStringSpan_t* args)
+{
+    bool isValid = true;
+    const int16_t eeAddr = scanIntegerToken(args, &isValid);
+    if (!isValid) {
+        return false;
+    }
+    CharStringSpan_t hexToken;
+    StringScan_scanToken(args, &hexToken);
+    const uint8_t numDigits = CharStringSpan_length(&hexToken);
+    if (((numDigits % 2) != 0) || (numDigits > (2 * EE_CHUNK_SIZE))) {
+        return false;
+    }
+    const uint8_t length = numDigits / 2;
+    if (!eeRangeIsValid(eeAddr, length)) {
+        return false;
+    }
+    uint8_t data[EE_CHUNK_SIZE];
+    for (uint8_t i = 0; i < length; ++i) {
+        const int8_t high = hexDigitValue(CharStringSpan_front(&hexToken));
+        CharStringSpan_incrBegin(&hexToken);
+        const int8_t low = hexDigitValue(CharStringSpan_front(&hexToken));
+        CharStringSpan_incrBegin(&hexToken);
+        if ((high < 0) || (low < 0)) {
+            return false;
+        }
+        data[i] = (high << 4) | low;
+    }
+    StringScan_skipWhitespace(args);
+    if (!CharStringSpan_isEmpty(args)) {
+        const uint32_t crc = scanUnsignedLongToken(args, &isValid);
+        if (!isValid || (crc != FrameCodec_crc16(data, length))) {
+            return false;
+        }
+    }
+    if (checkOnly) {
+        return true;
+    }
+    uint8_t written = 0;
+    for (uint8_t i = 0; i < length; ++i) {
+        if (EEPROMStorage_updateByte(eeAddr + i, data[i])) {
+            ++written;
+        }
+    }
+    const bool settingsLoaded = EEPROMStorage_overlapsSettings(eeAddr, length) &&
+        EEPROMStorage_reloadSettings();
+    JSONWriter_beginObject(NULL);
+    JSONWriter_intValue(PSTR("addr"), eeAddr);
+    JSONWriter_intValue(PSTR("written"), written);
+    JSONWriter_boolValue(PSTR("settings"), settingsLoaded);
+    JSONWriter_endObject();
+    return true;
+}
+
+static const char timeFieldP[]  PROGMEM = "t";
+static const char posFieldP[]   PROGMEM = "p";
+static const char speedFieldP[] PROGMEM = "s";
+static const char volFieldP[]   PROGMEM = "v";
+
+// status stream fields by record member name. must be kept in case
+// insensitive alphabetical order of name
+typedef struct StreamField_struct {
+    PGM_P name;
+    uint8_t field;
+} StreamField;
+static const StreamField streamFields[] PROGMEM = {
+    { posFieldP,   sf_pos },
+    { speedFieldP, sf_speed },
+    { timeFieldP,  sf_time },
+    { volFieldP,   sf_vol }
+};
+#define NUM_STREAM_FIELDS (sizeof(streamFields) / sizeof(StreamField))
+
+// stream <ms> [fields]    pushes a status record every ms milliseconds,
+//                         with the given fields (t p s v), or p s v.
+//                         records are binary if this is a binary request
+// stream 0                stops
+static bool executeStreamCommand(
+    CharStringSpan_t* args)
+{
+    bool isValid = true;
+    const int16_t intervalMs = scanIntegerToken(args, &isValid);
+    if (!isValid) {
+        return false;
+    }
+    if (intervalMs == 0) {
+        if (!checkOnly) {
+            StatusStream_stop();
+        }
+        return true;
+    }
+    if ((intervalMs < STATUSSTREAM_MIN_INTERVAL) ||
+        (intervalMs > STATUSSTREAM_MAX_INTERVAL)) {
+        return false;
+    }
+    uint8_t fields = 0;
+    CharStringSpan_t fieldToken;
+    StringScan_scanToken(args, &fieldToken);
+    while (!CharStringSpan_isEmpty(&fieldToken)) {
+        const int8_t index = findByName(&fieldToken,
+            streamFields, NUM_STREAM_FIELDS, sizeof(StreamField));
+        if (index < 0) {
+            return false;
+        }
+        fields |= pgm_read_byte(&streamFields[index].field);
+        StringScan_scanToken(args, &fieldToken);
+    }
+    if (checkOnly) {
+        return true;
+    }
+    StatusStream_start(intervalMs,
+        (fields != 0) ? fields : STATUSSTREAM_DEFAULT_FIELDS,
+        BinaryProtocol_recordOpen());
+    return true;
+}
+
+static bool executeVersionCommand(
+    CharStringSpan_t* args)
+{
+    if (checkOnly) {
+        return true;
+    }
+    JSONWriter_textLineP(swver);
+    return true;
+}
+
+static const char beginP[]    PROGMEM = "begin";
+static const char eedumpP[]   PROGMEM = "eedump";
+static const char eeloadP[]   PROGMEM = "eeload";
+static const char eereadP[]   PROGMEM = "eeread";
+static const char eewriteP[]  PROGMEM = "eewrite";
+static const char endP[]      PROGMEM = "end";
+static const char getP[]      PROGMEM = "get";
+static const char moveP[]     PROGMEM = "move";
+#if PROFILING
+static const char profP[]     PROGMEM = "prof";
+#endif
+static const char statusP[]   PROGMEM = "s";
+static const char setP[]      PROGMEM = "set";
+static const char settingsP[] PROGMEM = "settings";
+static const char stopP[]     PROGMEM = "stop";
+static const char streamP[]   PROGMEM = "stream";
+static const char verP[]      PROGMEM = "ver";
+
+// must be kept in case insensitive alphabetical order of name
+static const Command commands[] PROGMEM = {
+    { beginP,    executeBeginCommand },
+    { eedumpP,   executeEEDumpCommand },
+    { eeloadP,   executeEELoadCommand },
+    { eereadP,   executeEEReadCommand },
+    { eewriteP,  executeEEWriteCommand },
+    { endP,      executeEndCommand },
+    { getP,      executeGetCommand },
+    { moveP,     executeMoveCommand },
+#if PROFILING
+    { profP,     executeProfCommand },
+#endif
+    { statusP,   executeStatusCommand },
+    { setP,      executeSetCommand },
+    { settingsP, executeSettingsCommand },
+    { stopP,     executeStopCommand },
+    { streamP,   executeStreamCommand },
+    { verP,      executeVersionCommand }
+};
+#define NUM_COMMANDS (sizeof(commands) / sizeof(Command))
+
+// runs a command. returns false if it is invalid
+static bool runCommand(
+    const CharStringSpan_t* command)
+{
+    bool validCommand = true;
+
+    CharStringSpan_t args = *command;
+    CharStringSpan_t cmdToken;
+    StringScan_scanToken(&args, &cmdToken);
+    if (!CharStringSpan_isEmpty(&cmdToken)) {
+        const int8_t index =
+            findByName(&cmdToken, commands, NUM_COMMANDS, sizeof(Command));
+        if (index >= 0) {
+            const CommandHandler handler =
+                (CommandHandler)pgm_read_ptr(&commands[index].handler);
+            validCommand = handler(&args);
+        } else {
+            validCommand = false;
+        }
+    }
+    return validCommand;
+}
+
+// copies the next command of the batch that isn't blank into
+// commandText. returns false when there are no more
+static bool nextBatchCommand(
+    CharString_t* commandText)
+{
+    const uint8_t length = CharString_length(&batchCommands);
+    while (batchPosition < length) {
+        CharString_clear(commandText);
+        while (batchPosition < length) {
+            const char c = CharString_at(&batchCommands, batchPosition++);
+            if (c == BATCH_SEPARATOR) {
+                break;
+            }
+            CharString_appendC(c, commandText);
+        }
+        CharStringSpan_t command;
+        CharStringSpan_init(commandText, &command);
+        StringScan_skipWhitespace(&command);
+        if (!CharStringSpan_isEmpty(&command)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// a batch's reply is an array with an element for each command: its
+// reply, or true if it doesn't have one. If any command failed its
+// check none are carried out, and the elements are whether each passed
+static bool writeBatchPiece(
+    const uint8_t piece)
+{
+    if (piece == 0) {
+        batchPosition = 0;
+        JSONWriter_beginArray(NULL);
+    }
+    CharString_define(COMMAND_LENGTH, commandText);
+    if (!nextBatchCommand(&commandText)) {
+        JSONWriter_endArray();
+        WaterPumpControl_hold(false);
+        return false;
+    }
+    CharStringSpan_t command;
+    CharStringSpan_init(&commandText, &command);
+    const uint8_t valueCount = JSONWriter_valueCount();
+    checkOnly = !batchValid;
+    const bool validCommand = runCommand(&command);
+    checkOnly = false;
+    if (!batchValid) {
+        JSONWriter_boolValue(NULL, validCommand);
+    } else if (!validCommand) {
+        // failed although it passed its check
+        JSONWriter_textLineP(PSTR("error"));
+    } else if (JSONWriter_valueCount() == valueCount) {
+        JSONWriter_boolValue(NULL, true);
+    }
+    return true;
+}
+
+// <command>;<command>...   checks every command, then carries them out
+//                          a reply piece at a time. The pump is held
+//                          meanwhile, so that it doesn't act on some of
+//                          the batch's changes without the others
+static bool executeBatch(
+    const CharStringSpan_t* command)
+{
+    CharString_clear(&batchCommands);
+    CharStringSpan_t rest = *command;
+    while (!CharStringSpan_isEmpty(&rest)) {
+        CharString_appendC(CharStringSpan_front(&rest), &batchCommands);
+        CharStringSpan_incrBegin(&rest);
+    }
+
+    CharString_define(COMMAND_LENGTH, commandText);
+    batchPosition = 0;
+    batchValid = true;
+    checkOnly = true;
+    while (batchValid && nextBatchCommand(&commandText)) {
+        CharStringSpan_t batchCommand;
+        CharStringSpan_init(&commandText, &batchCommand);
+        batchValid = runCommand(&batchCommand);
+    }
+    checkOnly = false;
+
+    if (batchValid) {
+        WaterPumpControl_hold(true);
+    }
+    beginLongReply(writeBatchPiece);
+    return batchValid;
+}
+
+static bool isBatch(
+    const CharStringSpan_t* command)
+{
+    CharStringSpan_t rest = *command;
+    while (!CharStringSpan_isEmpty(&rest)) {
+        if (CharStringSpan_front(&rest) == BATCH_SEPARATOR) {
+            return true;
+        }
+        CharStringSpan_incrBegin(&rest);
+    }
+    return false;
+}
+
+bool CommandProcessor_executeCommand(
+    const CharStringSpan_t* command)
+{
+    if (isBatch(command)) {
+        return executeBatch(command);
+    }
+
+    const bool validCommand = runCommand(command);
+    if (!validCommand) {
+        JSONWriter_textLineP(PSTR("error"));
+    }
+
+    return validCommand;
+}
@@ -1,26 +1,49 @@
-//
-// Command processor
-//
-// Interprets and executes commands from the console
-//
-
-#ifndef COMMANDPROCESSOR_H
-#define COMMANDPROCESSOR_H
-
-#include <stdint.h>
-#include <stdbool.h>
-#include <string.h>
-#include <stddef.h>
-#include "CharStringSpan.h"
-
-// buffer that clients can use to accumulate command characters
-extern CharString_t CommandProcessor_incomingCommand;
-
-// output from commands is put into this string
-extern CharString_t CommandProcessor_commandReply;
-
-extern bool CommandProcessor_executeCommand (
-    const CharStringSpan_t* command,
-    CharString_t* reply);
-
+//
+// Command processor
+//
+// Interprets and executes commands from the console
+//
+
+#ifndef COMMANDPROCESSOR_H
+#define COMMANDPROCESSOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stddef.h>
+#include "CharStringSpan.h"
+
+// buffer that clients can use to accumulate command characters
+extern CharString_t CommandProcessor_incomingCommand;
+
+// replies are written to the console as they are produced
+extern bool CommandProcessor_executeCommand (
+    const CharStringSpan_t* command);
+
+// Modbus holding register access to the settings (see ModbusSlave.h).
+// read and write return false if no setting is mapped to the register,
+// and write also if set wouldn't accept the value. Signed settings are
+// two's complement
+extern bool CommandProcessor_readSettingRegister (
+    const uint8_t reg,
+    uint16_t* value);
+extern bool CommandProcessor_settingRegisterAccepts (
+    const uint8_t reg,
+    const uint16_t value);
+extern bool CommandProcessor_writeSettingRegister (
+    const uint8_t reg,
+    const uint16_t value);
+
+// true while a reply that is too long to write at once is being written
+extern bool CommandProcessor_replyInProgress (void);
+
+// writes the next piece of a long reply. call when the console has
+// written out the previous piece
+extern void CommandProcessor_continueReply (void);
+
+// drops the rest of a long reply, for when the console stops taking
+// text commands. A batch being carried out stops where it is, and the
+// pump is no longer held for it
+extern void CommandProcessor_abortReply (void);
+
 #endif  // COMMANDPROCESSOR_H
\ No newline at end of file
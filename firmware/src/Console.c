@@ -1,123 +1,639 @@
-//
-//  Console interface
-//
-//  How it works:
-//     Collects incoming characters from the UART until a cr is received
-//     and then passes the string to the command processor.
-//     Puts message strings out to the UART
-//
-//  I/O Pin assignments
-//
-#include "Console.h"
-
-#include "SystemTime.h"
-#include "CommandProcessor.h"
-#include "EEPROMStorage.h"
-#include "UART_async.h"
-#include <avr/io.h>
-#include <avr/pgmspace.h>
-#include "MSVS_AVR.h"
-
-#define ANSI_ESCAPE_SEQUENCE(EscapeSeq)  "\33[" EscapeSeq
-#define ESC_CURSOR_POS(Line, Column)    ANSI_ESCAPE_SEQUENCE(#Line ";" #Column "H")
-#define ESC_ERASE_LINE                  ANSI_ESCAPE_SEQUENCE("K")
-#define ESC_CURSOR_POS_RESTORE          ANSI_ESCAPE_SEQUENCE("u")
-
-const char PROGMEM crP[] = { 13,0 };
-const char PROGMEM crlfP[] = { 13,10,0 };
-
-ByteQueue_define(16, rxQueue, static);
-ByteQueue_define(80, txQueue, static);
-
-void Console_Initialize (void)
-{
-    UART_init(true, &rxQueue, &txQueue);
-    UART_set_baud_rate(4800);
-}
-
-void Console_task (void)
-{
-    char cmdByte;
-    if (UART_read_byte(&cmdByte)) {
-        switch (cmdByte) {
-            case '\r' : {
-                // command complete. execute it
-                Console_printP(crlfP);
-                CharStringSpan_t command;
-                CharStringSpan_init(&CommandProcessor_incomingCommand, &command);
-                CommandProcessor_executeCommand(&command, &CommandProcessor_commandReply);
-                if (!CharString_isEmpty(&CommandProcessor_commandReply)) {
-                    Console_printLineCS(&CommandProcessor_commandReply);
-                    CharString_clear(&CommandProcessor_commandReply);
-                }
-                CharString_clear(&CommandProcessor_incomingCommand);
-                }
-                break;
-            case 0x7f :
-                // delete last char
-                CharString_truncate(CharString_length(&CommandProcessor_incomingCommand) - 1,
-                    &CommandProcessor_incomingCommand);
-                break;
-            default : 
-                // command not complete yet. append to command buffer
-                CharString_appendC(cmdByte, &CommandProcessor_incomingCommand);
-                break;
-        }
-        // echo current command
-        Console_printP(crP);
-        Console_printCS(&CommandProcessor_incomingCommand);
-        Console_print(ESC_ERASE_LINE);
-    }
-}
-
-void Console_print (
-	const char* text)
-{
-    // not checking if write was successful.
-    // will need to revisit this. Maybe console has
-    // a buffer to hold text that didn't get written.
-    // Would need a console task to push it out.
-    UART_write_string(text);
-}
-
-void Console_printLine (
-	const char* text)
-{
-    Console_print(text);
-    Console_printNewline();
-}
-
-void Console_printCS (
-    const CharString_t* text)
-{
-    UART_write_stringCS(text);
-}
-
-void Console_printLineCS (
-	const CharString_t* text)
-{
-    Console_printCS(text);
-    Console_printNewline();
-}
-
-void Console_printNewline (void)
-{
-    Console_printP(PSTR("\r\n"));
-}
-
-void Console_printP (
-	PGM_P text)
-{
-    // not checking if write was successful.
-    // will need to revisit this. Maybe console has
-    // a buffer to hold text that didn't get written.
-    // Would need a console task to push it out.
-    UART_write_stringP(text);
-}
-
-void Console_printLineP (
-	PGM_P text)
-{
-    Console_printP(text);
-    Console_printNewline();
-}
+//
+//  Console interface
+//
+//  How it works:
+//     Collects incoming characters from the UART until a cr is received
+//     and then passes the string to the command processor. A zero byte
+//     starts a binary protocol request instead, which is passed to
+//     BinaryProtocol as it is received.
+//     Puts message strings out to the UART. Messages that don't fit in
+//     the UART transmit queue wait in a backlog and are sent from
+//     Console_task as the queue drains. There is a backlog for each
+//     output priority; replies to commands go out ahead of telemetry.
+//     A message is never interleaved with another one. A message that
+//     doesn't fit in its backlog is dropped and counted.
+//     While a baud rate change waits for the reply to be sent, telemetry
+//     waits in its backlog so that it goes out at the new rate.
+//     In Modbus mode ModbusSlave handles the input instead, and text
+//     output is dropped so that it can't corrupt the bus.
+//     Likewise after a binary protocol request, text other than replies
+//     to text commands is dropped until the next text command, so that
+//     it can't corrupt the frames of a host polling in binary.
+//
+//  I/O Pin assignments
+//
+#include "Console.h"
+
+#include "SystemTime.h"
+#include "CommandProcessor.h"
+#include "EEPROMStorage.h"
+#include "BinaryProtocol.h"
+#include "BaudRate.h"
+#include "ModbusSlave.h"
+#include "UART_async.h"
+#include <string.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include "MSVS_AVR.h"
+
+#define ANSI_ESCAPE_SEQUENCE(EscapeSeq)  "\33[" EscapeSeq
+#define ESC_CURSOR_POS(Line, Column)    ANSI_ESCAPE_SEQUENCE(#Line ";" #Column "H")
+#define ESC_ERASE_LINE                  ANSI_ESCAPE_SEQUENCE("K")
+#define ESC_CURSOR_POS_RESTORE          ANSI_ESCAPE_SEQUENCE("u")
+
+const char PROGMEM crP[] = { 13,0 };
+const char PROGMEM crlfP[] = { 13,10,0 };
+// moves back over the last character and blanks it
+const char PROGMEM rubOutP[] = { 8,' ',8,0 };
+
+// ctrl-R redraws the command being typed, e.g. after a status message
+// was printed in the middle of it
+#define REDRAW_CHAR 0x12
+
+#define TX_QUEUE_SIZE 112
+#define TELEMETRY_BACKLOG_SIZE 80
+#define REPLY_BACKLOG_SIZE 48
+
+// most times a backlogged message is repeated instead of stored again
+#define MAX_REPEATS 255
+
+// free space in txQueue a command, or the next piece of a long reply,
+// waits for before it runs. Replies are written as they are produced, so
+// with the reply backlog this has to hold the longest reply or piece,
+// prof <item>, with room to spare for ending a reply early (see JSONWriter)
+#define REPLY_ROOM 96
+
+ByteQueue_define(16, rxQueue, static);
+ByteQueue_define(TX_QUEUE_SIZE, txQueue, static);
+
+// messages waiting for room in txQueue. Each entry is a text length byte,
+// a byte holding the number of times the text is still to be sent, and
+// the text. A message identical to the last one in the backlog just adds
+// a repeat, so repeated lines take no more room but are all still sent
+typedef struct OutputBacklog_struct {
+    char* buffer;
+    uint8_t capacity;
+    uint8_t head;           // index of the first entry
+    uint8_t length;         // bytes in use
+    uint8_t lastEntry;      // index of the last entry
+    uint8_t sent;           // bytes of the first entry's text sent
+    uint16_t droppedMessages;
+    uint16_t droppedBytes;
+} OutputBacklog;
+
+static char telemetryBacklogBuffer[TELEMETRY_BACKLOG_SIZE];
+static char replyBacklogBuffer[REPLY_BACKLOG_SIZE];
+static OutputBacklog backlogs[cp_numPriorities];
+
+// backlog whose first entry has been partly sent. it has to finish
+// before anything else is sent
+static OutputBacklog* partlySent;
+
+// priority of output being written
+static Console_priority outputPriority;
+
+// a complete command is waiting for room for its reply
+static bool commandWaiting;
+// the waiting command is a binary protocol request
+static bool commandIsFrame;
+// a binary protocol request is being received
+static bool receivingFrame;
+// the modbus setting, as of the last Console_task
+static bool modbusMode;
+// the last command was a binary protocol request
+static bool binaryMode;
+
+// text of a message being written: from RAM, program memory or a
+// CharString, optionally followed by a newline
+typedef enum MessageSource_enum {
+    ms_ram,
+    ms_progmem,
+    ms_charString
+} MessageSource;
+typedef struct Message_struct {
+    MessageSource source;
+    const void* text;
+    uint8_t length;         // without the newline
+    bool newline;
+} Message;
+
+void Console_Initialize (void)
+{
+    // the baud rate is set by BaudRate_Initialize
+    UART_init(true, &rxQueue, &txQueue);
+
+    backlogs[cp_telemetry] = (OutputBacklog){
+        .buffer = telemetryBacklogBuffer, .capacity = TELEMETRY_BACKLOG_SIZE };
+    backlogs[cp_reply] = (OutputBacklog){
+        .buffer = replyBacklogBuffer, .capacity = REPLY_BACKLOG_SIZE };
+    partlySent = NULL;
+    outputPriority = cp_telemetry;
+    commandWaiting = false;
+    commandIsFrame = false;
+    receivingFrame = false;
+    modbusMode = EEPROMStorage_modbus();
+    binaryMode = false;
+
+    if (EEPROMStorage_settingsUnconfirmed()) {
+        Console_printLineP(PSTR("bad settings CRC: plunger settings defaulted"));
+    }
+}
+
+static uint8_t messageLength (
+    const Message* msg)
+{
+    return msg->length + (msg->newline ? 2 : 0);
+}
+
+static char messageByte (
+    const Message* msg,
+    const uint8_t index)
+{
+    if (index >= msg->length) {
+        return pgm_read_byte(&crlfP[index - msg->length]);
+    }
+    switch (msg->source) {
+        case ms_progmem :
+            return pgm_read_byte(((PGM_P)msg->text) + index);
+        case ms_charString :
+            return CharString_at((const CharString_t*)msg->text, index);
+        default :
+            return ((const char*)msg->text)[index];
+    }
+}
+
+// index into the backlog buffer, wrapped around
+static uint8_t backlogIndex (
+    const OutputBacklog* backlog,
+    const uint16_t index)
+{
+    return (index < backlog->capacity) ? index : (index - backlog->capacity);
+}
+
+static char* backlogByte (
+    OutputBacklog* backlog,
+    const uint8_t entry,
+    const uint8_t offset)
+{
+    return &backlog->buffer[backlogIndex(backlog, ((uint16_t)entry) + offset)];
+}
+
+static bool lastEntryMatches (
+    OutputBacklog* backlog,
+    const Message* msg,
+    const uint8_t start)
+{
+    const uint8_t length = messageLength(msg) - start;
+    const uint8_t entry = backlog->lastEntry;
+    if ((backlog->length == 0) ||
+        (*backlogByte(backlog, entry, 0) != (char)length) ||
+        ((uint8_t)*backlogByte(backlog, entry, 1) == MAX_REPEATS)) {
+        return false;
+    }
+    for (uint8_t i = 0; i < length; ++i) {
+        if (*backlogByte(backlog, entry, 2 + i) != messageByte(msg, start + i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// returns true if the message from start on will fit in the backlog
+static bool backlogHasRoom (
+    OutputBacklog* backlog,
+    const Message* msg,
+    const uint8_t start)
+{
+    return lastEntryMatches(backlog, msg, start) ||
+        ((((uint16_t)backlog->length) + 2 + (messageLength(msg) - start)) <=
+            backlog->capacity);
+}
+
+// adds the message from start on to the backlog. call backlogHasRoom first
+static void addToBacklog (
+    OutputBacklog* backlog,
+    const Message* msg,
+    const uint8_t start)
+{
+    if (lastEntryMatches(backlog, msg, start)) {
+        ++*backlogByte(backlog, backlog->lastEntry, 1);
+        return;
+    }
+    const uint8_t length = messageLength(msg) - start;
+    const uint8_t entry = backlogIndex(backlog,
+        ((uint16_t)backlog->head) + backlog->length);
+    *backlogByte(backlog, entry, 0) = length;
+    *backlogByte(backlog, entry, 1) = 1;
+    for (uint8_t i = 0; i < length; ++i) {
+        *backlogByte(backlog, entry, 2 + i) = messageByte(msg, start + i);
+    }
+    backlog->lastEntry = entry;
+    backlog->length += 2 + length;
+}
+
+static void countDropped (
+    OutputBacklog* backlog,
+    const uint8_t length)
+{
+    if (backlog->droppedMessages != UINT16_MAX) {
+        ++backlog->droppedMessages;
+    }
+    backlog->droppedBytes = (backlog->droppedBytes < (UINT16_MAX - length))
+        ? (backlog->droppedBytes + length)
+        : UINT16_MAX;
+}
+
+// sends as much of the first backlog entry as fits in txQueue. returns
+// true if the entry (with all its repeats) has been sent
+static bool sendBacklogEntry (
+    OutputBacklog* backlog)
+{
+    uint8_t space = ByteQueue_spaceRemaining(&txQueue);
+    const uint8_t entry = backlog->head;
+    const uint8_t length = *backlogByte(backlog, entry, 0);
+    char* repeats = backlogByte(backlog, entry, 1);
+    while (*repeats != 0) {
+        while (backlog->sent < length) {
+            if (space == 0) {
+                if (backlog->sent != 0) {
+                    partlySent = backlog;
+                }
+                return false;
+            }
+            UART_write_byte(*backlogByte(backlog, entry, 2 + backlog->sent));
+            ++backlog->sent;
+            --space;
+        }
+        backlog->sent = 0;
+        --*repeats;
+    }
+    backlog->head = backlogIndex(backlog, ((uint16_t)entry) + 2 + length);
+    backlog->length -= 2 + length;
+    partlySent = NULL;
+    return true;
+}
+
+// sends what fits of the backlogs, a partly sent message first, then
+// replies, then telemetry. Telemetry is held back while a command waits
+// for room for its reply or a baud rate change is pending. returns true
+// if they are all empty
+static bool sendBacklogs (void)
+{
+    if ((partlySent != NULL) && !sendBacklogEntry(partlySent)) {
+        return false;
+    }
+    for (int8_t priority = cp_numPriorities - 1; priority >= 0; --priority) {
+        if ((priority == cp_telemetry) &&
+            (commandWaiting || BaudRate_changePending())) {
+            return false;
+        }
+        OutputBacklog* backlog = &backlogs[priority];
+        while (backlog->length != 0) {
+            if (!sendBacklogEntry(backlog)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// returns true if nothing of the current priority or higher is waiting
+static bool nothingWaitingAhead (void)
+{
+    if ((partlySent != NULL) ||
+        ((outputPriority == cp_telemetry) && BaudRate_changePending())) {
+        return false;
+    }
+    for (uint8_t priority = outputPriority; priority < cp_numPriorities; ++priority) {
+        if (backlogs[priority].length != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void writeMessage (
+    const Message* msg)
+{
+    OutputBacklog* backlog = &backlogs[outputPriority];
+    const uint8_t length = messageLength(msg);
+    sendBacklogs();
+    if (nothingWaitingAhead()) {
+        // send what fits now, and backlog the rest
+        const uint8_t space = ByteQueue_spaceRemaining(&txQueue);
+        const uint8_t sendNow = (length < space) ? length : space;
+        if ((sendNow < length) && !backlogHasRoom(backlog, msg, sendNow)) {
+            countDropped(backlog, length);
+            return;
+        }
+        for (uint8_t i = 0; i < sendNow; ++i) {
+            UART_write_byte(messageByte(msg, i));
+        }
+        if (sendNow < length) {
+            addToBacklog(backlog, msg, sendNow);
+            if (sendNow != 0) {
+                // the rest of this message goes next
+                partlySent = backlog;
+            }
+        }
+    } else if (backlogHasRoom(backlog, msg, 0)) {
+        addToBacklog(backlog, msg, 0);
+    } else {
+        countDropped(backlog, length);
+    }
+}
+
+// true if text output is dropped: all of it in Modbus mode, output
+// while carrying out a binary request, and output other than replies in
+// binary mode
+static bool textDropped (void)
+{
+    return modbusMode ||
+        ((outputPriority == cp_reply) ? commandIsFrame : binaryMode);
+}
+
+static void writeRAM (
+    const char* text,
+    const bool newline)
+{
+    if (textDropped()) {
+        return;
+    }
+    const size_t length = strlen(text);
+    const Message msg = { ms_ram, text, (length < 250) ? length : 250, newline };
+    writeMessage(&msg);
+}
+
+static void writeP (
+    PGM_P text,
+    const bool newline)
+{
+    if (textDropped()) {
+        return;
+    }
+    const size_t length = strlen_P(text);
+    const Message msg = { ms_progmem, text, (length < 250) ? length : 250, newline };
+    writeMessage(&msg);
+}
+
+static void writeCS (
+    const CharString_t* text,
+    const bool newline)
+{
+    if (textDropped()) {
+        return;
+    }
+    const uint8_t length = CharString_length(text);
+    const Message msg = { ms_charString, text, (length < 250) ? length : 250, newline };
+    writeMessage(&msg);
+}
+
+// redraws the command being typed
+static void echoCommandLine (void)
+{
+    Console_printP(crP);
+    Console_printCS(&CommandProcessor_incomingCommand);
+    Console_print(ESC_ERASE_LINE);
+}
+
+// true when no reply output is waiting
+static bool replySent (void)
+{
+    return (partlySent == NULL) && (backlogs[cp_reply].length == 0);
+}
+
+static void executeCommand (void)
+{
+    outputPriority = cp_reply;
+    bool linkWorks;
+    if (commandIsFrame) {
+        linkWorks = BinaryProtocol_executeFrame();
+        if (linkWorks) {
+            // a host is polling in binary
+            binaryMode = true;
+        }
+    } else {
+        CharStringSpan_t command;
+        CharStringSpan_init(&CommandProcessor_incomingCommand, &command);
+        // an empty line is too easily made of noise to show the link works
+        const bool empty = CharStringSpan_isEmpty(&command);
+        linkWorks = CommandProcessor_executeCommand(&command) && !empty;
+        CharString_clear(&CommandProcessor_incomingCommand);
+        if (!empty) {
+            binaryMode = false;
+        }
+    }
+    outputPriority = cp_telemetry;
+    if (linkWorks) {
+        BaudRate_linkConfirmed();
+    }
+}
+
+// after a baud rate change, what was received at the old rate is garbage
+static void discardInput (void)
+{
+    char cmdByte;
+    while (UART_read_byte(&cmdByte)) {
+    }
+    CharString_clear(&CommandProcessor_incomingCommand);
+    commandWaiting = false;
+    receivingFrame = false;
+    ModbusSlave_discardInput();
+}
+
+void Console_task (void)
+{
+    // retry output that didn't fit in txQueue
+    sendBacklogs();
+
+    const bool outputIdle = ByteQueue_isEmpty(&txQueue) && replySent() &&
+        !CommandProcessor_replyInProgress() && !commandWaiting;
+    if (BaudRate_task(outputIdle)) {
+        discardInput();
+    }
+
+    if (EEPROMStorage_modbus() != modbusMode) {
+        // what was received is in the other protocol
+        modbusMode = EEPROMStorage_modbus();
+        discardInput();
+        // a long reply can't be finished in Modbus
+        CommandProcessor_abortReply();
+    }
+    if (modbusMode) {
+        outputPriority = cp_reply;
+        ModbusSlave_task();
+        outputPriority = cp_telemetry;
+        return;
+    }
+
+    if (CommandProcessor_replyInProgress()) {
+        if (replySent() && (ByteQueue_spaceRemaining(&txQueue) >= REPLY_ROOM)) {
+            outputPriority = cp_reply;
+            CommandProcessor_continueReply();
+            outputPriority = cp_telemetry;
+        }
+        // the next command can be read during a long reply if it isn't
+        // echoed into the middle of it. keeps rxQueue from overflowing
+        // when a client sends commands without waiting for replies
+        if (commandWaiting || EEPROMStorage_echo()) {
+            return;
+        }
+    } else if (commandWaiting) {
+        // input waits until the command has run
+        if (replySent() && (ByteQueue_spaceRemaining(&txQueue) >= REPLY_ROOM)) {
+            commandWaiting = false;
+            executeCommand();
+        }
+        return;
+    }
+
+    char cmdByte;
+    if (receivingFrame) {
+        while (UART_read_byte(&cmdByte)) {
+            if (BinaryProtocol_receiveByte(cmdByte)) {
+                receivingFrame = false;
+                commandIsFrame = true;
+                commandWaiting = true;
+                break;
+            }
+        }
+    } else if (UART_read_byte(&cmdByte)) {
+        // output while handling input is a reply
+        outputPriority = cp_reply;
+        // echo is incremental: only the change to the command line is sent
+        const bool echo = EEPROMStorage_echo();
+        switch (cmdByte) {
+            case '\r' : {
+                // command complete. it runs when there's room for the reply
+                if (echo) {
+                    Console_printP(crlfP);
+                }
+                commandIsFrame = false;
+                commandWaiting = true;
+                }
+                break;
+            case FRAMECODEC_DELIMITER :
+                // binary request. text typed so far is abandoned
+                CharString_clear(&CommandProcessor_incomingCommand);
+                BinaryProtocol_beginFrame();
+                receivingFrame = true;
+                break;
+            case 0x08 :
+            case 0x7f : {
+                // delete last char
+                const uint8_t length = CharString_length(&CommandProcessor_incomingCommand);
+                if (length != 0) {
+                    CharString_truncate(length - 1, &CommandProcessor_incomingCommand);
+                    if (echo) {
+                        Console_printP(rubOutP);
+                    }
+                }
+                }
+                break;
+            case REDRAW_CHAR :
+                if (echo) {
+                    echoCommandLine();
+                }
+                break;
+            default : {
+                // command not complete yet. append to command buffer
+                const uint8_t length = CharString_length(&CommandProcessor_incomingCommand);
+                CharString_appendC(cmdByte, &CommandProcessor_incomingCommand);
+                if (echo && (CharString_length(&CommandProcessor_incomingCommand) != length)) {
+                    const char echoStr[2] = { cmdByte, 0 };
+                    Console_print(echoStr);
+                }
+                }
+                break;
+        }
+        outputPriority = cp_telemetry;
+    }
+}
+
+void Console_writeBytes (
+    const uint8_t* data,
+    const uint8_t length)
+{
+    const Message msg = { ms_ram, data, length, false };
+    writeMessage(&msg);
+}
+
+bool Console_hasRoomFor (
+    const uint8_t length)
+{
+    return !modbusMode &&
+        !CommandProcessor_replyInProgress() && !commandWaiting &&
+        !BaudRate_changePending() &&
+        (partlySent == NULL) &&
+        (backlogs[cp_telemetry].length == 0) && (backlogs[cp_reply].length == 0) &&
+        (ByteQueue_spaceRemaining(&txQueue) >= length);
+}
+
+bool Console_binaryMode (void)
+{
+    return binaryMode;
+}
+
+uint8_t Console_room (void)
+{
+    const OutputBacklog* backlog = &backlogs[outputPriority];
+    const uint8_t backlogSpace = backlog->capacity - backlog->length;
+    uint16_t room = (backlogSpace > 2) ? (backlogSpace - 2) : 0;
+    if (nothingWaitingAhead()) {
+        room += ByteQueue_spaceRemaining(&txQueue);
+    }
+    return (room < UINT8_MAX) ? room : UINT8_MAX;
+}
+
+uint16_t Console_droppedMessages (
+    const Console_priority priority)
+{
+    return backlogs[priority].droppedMessages;
+}
+
+uint16_t Console_droppedBytes (
+    const Console_priority priority)
+{
+    return backlogs[priority].droppedBytes;
+}
+
+void Console_print (
+	const char* text)
+{
+    writeRAM(text, false);
+}
+
+void Console_printLine (
+	const char* text)
+{
+    writeRAM(text, true);
+}
+
+void Console_printCS (
+    const CharString_t* text)
+{
+    writeCS(text, false);
+}
+
+void Console_printLineCS (
+	const CharString_t* text)
+{
+    writeCS(text, true);
+}
+
+void Console_printNewline (void)
+{
+    writeP(PSTR(""), true);
+}
+
+void Console_printP (
+	PGM_P text)
+{
+    writeP(text, false);
+}
+
+void Console_printLineP (
+	PGM_P text)
+{
+    writeP(text, true);
+}
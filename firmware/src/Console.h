@@ -1,23 +1,61 @@
-//
-//  Console
-//
-//  This unit responds to characters from the serial port and
-//  sends replies
-//
-#ifndef CONSOLE_H
-#define CONSOLE_H
-
-#include <stdint.h>
-#include <stdbool.h>
-#include <avr/pgmspace.h>
-#include "ConsoleInterface.h"
-
-// sets up control pins. called once at power-up
-extern void Console_Initialize (void);
-
-// reads commands from FromUSB_Buffer and writes responses to
-// ToUSB_Buffer.
-// called in each iteration of the mainloop
-extern void Console_task (void);
-
-#endif  // Console_H
+//
+//  Console
+//
+//  This unit responds to characters from the serial port and
+//  sends replies
+//
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr/pgmspace.h>
+#include "ConsoleInterface.h"
+
+// output priorities. Output written while Console_task handles input
+// (echo and command replies) is a reply; everything else is telemetry.
+// Replies that have to wait for the UART go out ahead of waiting telemetry
+typedef enum Console_priority_enum {
+    cp_telemetry,
+    cp_reply,
+    cp_numPriorities
+} Console_priority;
+
+// sets up control pins. called once at power-up
+extern void Console_Initialize (void);
+
+// reads commands from FromUSB_Buffer and writes responses to
+// ToUSB_Buffer.
+// called in each iteration of the mainloop
+extern void Console_task (void);
+
+// writes bytes that aren't text, such as binary protocol frames, as
+// one message
+extern void Console_writeBytes (
+    const uint8_t* data,
+    const uint8_t length);
+
+// true when that many bytes of telemetry would go straight to the UART,
+// with no output waiting ahead of them and no long reply in progress.
+// For output that must not be cut short by a full backlog. Always false
+// in Modbus mode
+extern bool Console_hasRoomFor (
+    const uint8_t length);
+
+// true from a binary protocol request until the next text command.
+// Meanwhile text other than replies to text commands is dropped
+extern bool Console_binaryMode (void);
+
+// bytes of output that can be written now as one message, at the
+// priority of the output being written, without it being dropped. A
+// message that has to wait takes two bytes more
+extern uint8_t Console_room (void);
+
+// messages and bytes of output dropped because they didn't fit in the
+// backlog for their priority. saturate at 65535
+extern uint16_t Console_droppedMessages (
+    const Console_priority priority);
+extern uint16_t Console_droppedBytes (
+    const Console_priority priority);
+
+#endif  // Console_H
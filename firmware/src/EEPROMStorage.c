@@ -1,112 +1,781 @@
-//
-// EEPROM Storage
-//
-
-#include "EEPROMStorage.h"
-
-#include "EEPROM_Util.h"
-#include "CharString.h"
-#include "avr/pgmspace.h"
-
-// This prevents the MSVC editor from tripping over EEMEM in definitions
-#ifndef EEMEM
-#define EEMEM
-#endif
-
-uint8_t EEMEM ee_initFlag = 1; // initialization flag. Unprogrammed EE comes up as all one's
-
-int16_t EEMEM ee_plungerInPos;
-int16_t EEMEM ee_plungerOutPos;
-uint16_t EEMEM ee_posPerMl;
-uint16_t EEMEM ee_mlToPump;
-uint8_t EEMEM ee_motorPwm;
-int16_t EEMEM ee_tempCalOffset;
-uint16_t EEMEM ee_rebootInterval;   // one day
-
-void EEPROMStorage_Initialize (void)
-{
-    // check if EE has been initialized
-    const uint8_t initFlag = EEPROM_read((uint8_t*)&ee_initFlag);
-    const uint8_t initLevel = (initFlag == 0xFF) ? 0 : initFlag;
-
-    if (initLevel < 1) {
-        // EE has not been initialized. Initialize to default settings now.
-
-        EEPROMStorage_setPlungerInPos(50);
-        EEPROMStorage_setPlungerOutPos(-50);
-        EEPROMStorage_setMotorPwm(100);
-        EEPROMStorage_setPosPerMl(117);
-        EEPROMStorage_setMlToPump(2000);
-        EEPROMStorage_setTempCalOffset(-266);
-        EEPROMStorage_setRebootInterval(1440);
-
-        // register that EEPROM is initialized
-        EEPROM_write((uint8_t*)&ee_initFlag, 1);
-    }
-}
-
-void EEPROMStorage_setPlungerInPos(const int16_t pos)
-{
-    EEPROM_writeWord((uint16_t*)&ee_plungerInPos, (uint16_t)pos);
-}
-int16_t EEPROMStorage_plungerInPos(void)
-{
-    return (int16_t)EEPROM_readWord((uint16_t*)&ee_plungerInPos);
-}
-void EEPROMStorage_setPlungerOutPos(const int16_t pos)
-{
-    EEPROM_writeWord((uint16_t*)&ee_plungerOutPos, (uint16_t)pos);
-}
-int16_t EEPROMStorage_plungerOutPos(void)
-{
-    return (int16_t)EEPROM_readWord((uint16_t*)&ee_plungerOutPos);
-}
-
-void EEPROMStorage_setPosPerMl(const uint16_t posPerMl)
-{
-    EEPROM_writeWord((uint16_t*)&ee_posPerMl, posPerMl);
-}
-uint16_t EEPROMStorage_posPerMl(void)
-{
-    return EEPROM_readWord((uint16_t*)&ee_posPerMl);
-}
-
-void EEPROMStorage_setMlToPump(const uint16_t mlToPump)
-{
-    EEPROM_writeWord((uint16_t*)&ee_mlToPump, mlToPump);
-}
-uint16_t EEPROMStorage_mlToPump(void)
-{
-    return EEPROM_readWord((uint16_t*)&ee_mlToPump);
-}
-
-void EEPROMStorage_setMotorPwm(const uint8_t pwm)
-{
-    EEPROM_write((uint8_t*)&ee_motorPwm, pwm);
-}
-uint8_t EEPROMStorage_motorPwm(void)
-{
-    return EEPROM_read((uint8_t*)&ee_motorPwm);
-}
-
-void EEPROMStorage_setTempCalOffset(const int16_t offset)
-{
-    EEPROM_writeWord((uint16_t*)&ee_tempCalOffset, (uint16_t)offset);
-}
-
-int16_t EEPROMStorage_tempCalOffset(void)
-{
-    return (int16_t)EEPROM_readWord((uint16_t*)&ee_tempCalOffset);
-}
-
-void EEPROMStorage_setRebootInterval(
-    const uint16_t rebootMinutes)
-{
-    EEPROM_writeWord(&ee_rebootInterval, rebootMinutes);
-}
-
-uint16_t EEPROMStorage_rebootInterval(void)
-{
-    return EEPROM_readWord(&ee_rebootInterval);
-}
-
+//
+// EEPROM Storage
+//
+// How it works:
+//     The settings are kept in one block at a fixed address: a header,
+//     then the settings in the order of SettingsBlock. The header has
+//     the block's version, its length and the CRC16 of the settings (see
+//     FrameCodec.h). Settings are only ever added at the end, so an
+//     older block is the start of a newer one.
+//     The block is read and checked once, at power-up. Settings that a
+//     stored block doesn't have yet take their defaults, as does any
+//     setting outside its range. If anything changed, the block is
+//     written back.
+//     Setting a value writes its bytes and then the new CRC, so a
+//     brown-out part way through leaves a bad CRC. Then the settings
+//     that move the plunger take their defaults too, and the block is
+//     left as it is until a setting is written. That confirms the
+//     settings in use, and writes them all with a good CRC.
+//     The magic byte that marks a block as written goes last of all, so
+//     until a migration has finished the settings it is from are still
+//     there to migrate.
+//     Before version 9 the settings were separate EEMEM variables, at
+//     addresses the linker chose, and ee_initFlag held the level they
+//     had been initialized to. They are only read, to migrate from them.
+//
+
+#include "EEPROMStorage.h"
+
+#include "EEPROM_Util.h"
+#include "CharString.h"
+#include "avr/pgmspace.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+#include "FrameCodec.h"
+#include "Profiler.h"
+
+// This prevents the MSVC editor from tripping over EEMEM in definitions
+#ifndef EEMEM
+#define EEMEM
+#endif
+
+// the settings before version 9. These must not be changed, or the
+// linker could move them
+uint8_t EEMEM ee_initFlag = 1; // initialization flag. Unprogrammed EE comes up as all one's
+
+int16_t EEMEM ee_plungerInPos;
+int16_t EEMEM ee_plungerOutPos;
+uint16_t EEMEM ee_posPerMl;
+uint16_t EEMEM ee_mlToPump;
+uint8_t EEMEM ee_motorPwm;
+int16_t EEMEM ee_tempCalOffset;
+uint16_t EEMEM ee_rebootInterval;   // one day
+uint16_t EEMEM ee_plungerSpeed;
+uint16_t EEMEM ee_speedKp;
+uint16_t EEMEM ee_speedKi;
+uint16_t EEMEM ee_speedKd;
+uint16_t EEMEM ee_profileAccelCounts;
+uint16_t EEMEM ee_profileDecelCounts;
+uint8_t EEMEM ee_profileApproachPct;
+uint16_t EEMEM ee_brakeGainFwd;
+uint16_t EEMEM ee_brakeGainRev;
+uint8_t EEMEM ee_echo;
+uint8_t EEMEM ee_busAddress;
+uint32_t EEMEM ee_baudRate;
+uint8_t EEMEM ee_modbus;
+
+#define SETTINGS_VERSION 9
+// versions before this were ee_initFlag levels
+#define FIRST_BLOCK_VERSION 9
+
+#define SETTINGS_MAGIC 0x5A
+// clear of the EEMEM variables, which start at 0
+#define SETTINGS_ADDRESS 0x80
+
+typedef struct SettingsHeader_struct {
+    uint8_t magic;      // SETTINGS_MAGIC once the block has been written
+    uint8_t version;    // of the firmware that wrote the block
+    uint8_t length;     // bytes of settings after the header
+    uint16_t crc;       // CRC16 of those bytes
+} __attribute__((packed)) SettingsHeader;
+
+// the settings as they are stored. New settings go at the end
+typedef struct SettingsBlock_struct {
+    int16_t plungerInPos;
+    int16_t plungerOutPos;
+    uint16_t posPerMl;
+    uint16_t mlToPump;
+    uint8_t motorPwm;
+    int16_t tempCalOffset;
+    uint16_t rebootInterval;
+    uint16_t plungerSpeed;
+    uint16_t speedKp;
+    uint16_t speedKi;
+    uint16_t speedKd;
+    uint16_t profileAccelCounts;
+    uint16_t profileDecelCounts;
+    uint8_t profileApproachPct;
+    uint16_t brakeGainFwd;
+    uint16_t brakeGainRev;
+    bool echo;
+    uint8_t busAddress;
+    uint32_t baudRate;
+    bool modbus;
+} __attribute__((packed)) SettingsBlock;
+
+#define SETTINGS_BODY_ADDRESS (SETTINGS_ADDRESS + sizeof(SettingsHeader))
+
+// RAM copy of the settings. Reads come from here, writes go through
+// to EEPROM
+static SettingsBlock settings;
+
+// bools are st_uint8 with a range of 0 to 1
+typedef enum SettingType_enum {
+    st_int16,
+    st_uint16,
+    st_uint8,
+    st_uint32
+} SettingType;
+
+// how each setting is checked at power-up, and the range set checks
+typedef struct SettingField_struct {
+    uint8_t offset;         // in SettingsBlock
+    uint8_t type;           // SettingType
+    uint8_t version;        // the version that added it
+    const void* legacy;     // its EEMEM variable before version 9
+    int32_t min;            // range a stored value must be in
+    int32_t max;
+    int32_t defaultValue;
+    bool moves;             // moves the plunger: not kept if the CRC is bad
+} SettingField;
+
+#define SETTING_FIELD(name, type, version, legacy, min, max, defaultValue, moves) \
+    [es_##name] = { offsetof(SettingsBlock, name), type, version, &legacy, \
+        min, max, defaultValue, moves }
+
+// indexed by EEPROMStorage_setting
+static const SettingField settingFields[es_numSettings] PROGMEM = {
+    SETTING_FIELD(plungerInPos, st_int16, 1, ee_plungerInPos, INT16_MIN, INT16_MAX, 50, true),
+    SETTING_FIELD(plungerOutPos, st_int16, 1, ee_plungerOutPos, INT16_MIN, INT16_MAX, -50, true),
+    SETTING_FIELD(posPerMl, st_uint16, 1, ee_posPerMl, 1, UINT16_MAX, 117, true),
+    SETTING_FIELD(mlToPump, st_uint16, 1, ee_mlToPump, 0, UINT16_MAX, 2000, true),
+    SETTING_FIELD(motorPwm, st_uint8, 1, ee_motorPwm, 0, UINT8_MAX, 100, true),
+    SETTING_FIELD(tempCalOffset, st_int16, 1, ee_tempCalOffset, INT16_MIN, INT16_MAX, -266, false),
+    SETTING_FIELD(rebootInterval, st_uint16, 1, ee_rebootInterval, 1, UINT16_MAX, 1440, false),
+    SETTING_FIELD(plungerSpeed, st_uint16, 2, ee_plungerSpeed, 0, INT16_MAX, 0, true),
+    SETTING_FIELD(speedKp, st_uint16, 2, ee_speedKp, 0, UINT16_MAX, 256, true),
+    SETTING_FIELD(speedKi, st_uint16, 2, ee_speedKi, 0, UINT16_MAX, 32, true),
+    SETTING_FIELD(speedKd, st_uint16, 2, ee_speedKd, 0, UINT16_MAX, 0, true),
+    SETTING_FIELD(profileAccelCounts, st_uint16, 3, ee_profileAccelCounts, 0, UINT16_MAX, 0, true),
+    SETTING_FIELD(profileDecelCounts, st_uint16, 3, ee_profileDecelCounts, 0, UINT16_MAX, 0, true),
+    SETTING_FIELD(profileApproachPct, st_uint8, 3, ee_profileApproachPct, 10, 100, 40, true),
+    SETTING_FIELD(brakeGainFwd, st_uint16, 4, ee_brakeGainFwd, 0, UINT16_MAX, 0, true),
+    SETTING_FIELD(brakeGainRev, st_uint16, 4, ee_brakeGainRev, 0, UINT16_MAX, 0, true),
+    SETTING_FIELD(echo, st_uint8, 5, ee_echo, 0, 1, 1, false),
+    SETTING_FIELD(busAddress, st_uint8, 6, ee_busAddress, 1, 247, 1, false),
+    SETTING_FIELD(baudRate, st_uint32, 7, ee_baudRate, 4800, 115200, 4800, false),
+    SETTING_FIELD(modbus, st_uint8, 8, ee_modbus, 0, 1, 0, false)
+};
+#define NUM_SETTING_FIELDS es_numSettings
+
+// incremented whenever a setting is written
+static uint8_t generation;
+
+// what was found at power-up
+static uint8_t loadedVersion;
+static bool loadedCrcOk;
+static uint8_t settingsDefaulted;
+// the stored block had a bad CRC, and no setting has been written since
+static bool settingsUnconfirmed;
+// bytes of settings the stored block has
+static uint8_t storedLength;
+
+// write-behind queue. Byte writes are queued and programmed one at a
+// time from the EEPROM ready interrupt, so setting a value doesn't block
+// for the 3.3mS per byte programming time. A write to an address that is
+// already queued replaces the queued value, and bytes that already hold
+// the value are skipped.
+#define WRITE_QUEUE_SIZE 16     // must be a power of 2
+typedef struct PendingWrite_struct {
+    uint16_t address;
+    uint8_t value;
+} PendingWrite;
+static PendingWrite writeQueue[WRITE_QUEUE_SIZE];
+static volatile uint8_t writeQueueHead;
+static volatile uint8_t writeQueueCount;
+
+// starts programming the next queued byte that differs from what is in
+// EEPROM. returns false if there was nothing to program.
+// must be called with interrupts disabled and the EEPROM ready
+static bool startNextWrite (void)
+{
+    while (writeQueueCount != 0) {
+        const uint16_t address = writeQueue[writeQueueHead].address;
+        const uint8_t value = writeQueue[writeQueueHead].value;
+        writeQueueHead = (writeQueueHead + 1) & (WRITE_QUEUE_SIZE - 1);
+        --writeQueueCount;
+
+        EEAR = address;
+        EECR |= (1 << EERE);
+        if (EEDR != value) {
+            EEDR = value;
+            EECR |= (1 << EEMPE);
+            EECR |= (1 << EEPE);
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool eepromBusy (void)
+{
+    return (EECR & (1 << EEPE)) != 0;
+}
+
+static void queueWriteByte (
+    const uint16_t address,
+    const uint8_t value)
+{
+    char SREGSave;
+    SREGSave = SREG;
+    cli();
+
+    // replace the value if this address is already queued
+    for (uint8_t i = 0; i < writeQueueCount; ++i) {
+        PendingWrite* pending =
+            &writeQueue[(writeQueueHead + i) & (WRITE_QUEUE_SIZE - 1)];
+        if (pending->address == address) {
+            pending->value = value;
+            SREG = SREGSave;
+            return;
+        }
+    }
+
+    while (writeQueueCount == WRITE_QUEUE_SIZE) {
+        // wait for room. programs the oldest entry here if the
+        // interrupt can't (e.g. during initialization)
+        if (!eepromBusy()) {
+            startNextWrite();
+        }
+        SREG = SREGSave;
+        cli();
+    }
+    PendingWrite* pending = &writeQueue[
+        (writeQueueHead + writeQueueCount) & (WRITE_QUEUE_SIZE - 1)];
+    pending->address = address;
+    pending->value = value;
+    ++writeQueueCount;
+    EECR |= (1 << EERIE);   // enable EEPROM ready interrupt
+
+    SREG = SREGSave;
+}
+
+static void queueWriteWord (
+    const uint16_t address,
+    const uint16_t value)
+{
+    queueWriteByte(address, value & 0xFF);
+    queueWriteByte(address + 1, value >> 8);
+}
+
+// writes a byte if it doesn't already hold the value. returns true if a
+// write was queued
+static bool updateByte (
+    const uint16_t address,
+    const uint8_t value)
+{
+    uint8_t current = 0;
+    bool read = false;
+    do {
+        char SREGSave;
+        SREGSave = SREG;
+        cli();
+        // a queued value is what the byte will hold
+        for (uint8_t i = 0; i < writeQueueCount; ++i) {
+            PendingWrite* pending =
+                &writeQueue[(writeQueueHead + i) & (WRITE_QUEUE_SIZE - 1)];
+            if (pending->address == address) {
+                const bool changed = pending->value != value;
+                pending->value = value;
+                SREG = SREGSave;
+                return changed;
+            }
+        }
+        // the EEPROM can't be read while a byte is being programmed
+        if (!eepromBusy()) {
+            EEAR = address;
+            EECR |= (1 << EERE);
+            current = EEDR;
+            read = true;
+        }
+        SREG = SREGSave;
+    } while (!read);
+
+    if (current == value) {
+        return false;
+    }
+    queueWriteByte(address, value);
+    return true;
+}
+
+static uint16_t settingsCrc (void)
+{
+    return FrameCodec_crc16((const uint8_t*)&settings, sizeof(settings));
+}
+
+// writes the whole block, skipping bytes that already hold their value.
+// The magic byte goes last, so the block isn't taken as written until
+// the rest of it is
+static void writeBlock (void)
+{
+    const uint8_t* bytes = (const uint8_t*)&settings;
+    for (uint8_t i = 0; i < sizeof(settings); ++i) {
+        updateByte(SETTINGS_BODY_ADDRESS + i, bytes[i]);
+    }
+    const uint16_t crc = settingsCrc();
+    updateByte(SETTINGS_ADDRESS + offsetof(SettingsHeader, version), SETTINGS_VERSION);
+    updateByte(SETTINGS_ADDRESS + offsetof(SettingsHeader, length), sizeof(settings));
+    updateByte(SETTINGS_ADDRESS + offsetof(SettingsHeader, crc), crc & 0xFF);
+    updateByte(SETTINGS_ADDRESS + offsetof(SettingsHeader, crc) + 1, crc >> 8);
+    updateByte(SETTINGS_ADDRESS + offsetof(SettingsHeader, magic), SETTINGS_MAGIC);
+}
+
+// queues a setting's bytes from the RAM copy, then the block's new CRC.
+// The first setting written after a bad CRC writes the whole block
+static void writeSetting (
+    const uint8_t offset,
+    const uint8_t size)
+{
+    if (settingsUnconfirmed) {
+        settingsUnconfirmed = false;
+        writeBlock();
+    } else {
+        const uint8_t* bytes = (const uint8_t*)&settings;
+        for (uint8_t i = offset; i < (offset + size); ++i) {
+            queueWriteByte(SETTINGS_BODY_ADDRESS + i, bytes[i]);
+        }
+        queueWriteWord(SETTINGS_ADDRESS + offsetof(SettingsHeader, crc), settingsCrc());
+    }
+    ++generation;
+}
+#define WRITE_SETTING(name) \
+    writeSetting(offsetof(SettingsBlock, name), sizeof(settings.name))
+
+// reads the block into the RAM copy, as far as this version's settings
+// go, and whether its CRC is good. returns its version, or 0 if a block
+// hasn't been written
+static uint8_t readBlock (
+    bool* crcOk)
+{
+    SettingsHeader header;
+    for (uint8_t i = 0; i < sizeof(header); ++i) {
+        ((uint8_t*)&header)[i] = EEPROM_read((uint8_t*)(SETTINGS_ADDRESS + i));
+    }
+    if ((header.magic != SETTINGS_MAGIC) || (header.version < FIRST_BLOCK_VERSION)) {
+        return 0;
+    }
+    uint16_t crc = FRAMECODEC_CRC16_INITIAL;
+    for (uint8_t i = 0; i < header.length; ++i) {
+        const uint8_t value = EEPROM_read((uint8_t*)(SETTINGS_BODY_ADDRESS + i));
+        crc = FrameCodec_crc16Update(crc, value);
+        if (i < sizeof(settings)) {
+            ((uint8_t*)&settings)[i] = value;
+        }
+    }
+    *crcOk = (crc == header.crc);
+    storedLength = header.length;
+    return header.version;
+}
+
+// the level the EEMEM variables were initialized to, 0 if none
+static uint8_t legacyVersion (void)
+{
+    const uint8_t initFlag = EEPROM_read((uint8_t*)&ee_initFlag);
+    return (initFlag < FIRST_BLOCK_VERSION) ? initFlag : 0;
+}
+
+static uint8_t settingSize (
+    const uint8_t type)
+{
+    switch (type) {
+        case st_uint8 :     return 1;
+        case st_uint32 :    return 4;
+        default :           return 2;
+    }
+}
+
+// migration steps, each from the version before it. Settings a version
+// added don't need a step: checkSettings gives them their defaults
+static void migrate (
+    const uint8_t version)
+{
+    if (version < 9) {
+        // version 9 moved the settings from their EEMEM variables into
+        // the block
+        for (uint8_t index = 0; index < NUM_SETTING_FIELDS; ++index) {
+            SettingField field;
+            memcpy_P(&field, &settingFields[index], sizeof(SettingField));
+            if (field.version <= version) {
+                for (uint8_t i = 0; i < settingSize(field.type); ++i) {
+                    ((uint8_t*)&settings)[field.offset + i] =
+                        EEPROM_read((uint8_t*)field.legacy + i);
+                }
+            }
+        }
+    }
+}
+
+// the value of a setting in the RAM copy
+static int32_t settingValue (
+    const SettingField* field)
+{
+    const uint8_t* bytes = ((const uint8_t*)&settings) + field->offset;
+    const uint16_t low = bytes[0] | (((uint16_t)bytes[1]) << 8);
+    switch (field->type) {
+        case st_int16 :     return (int16_t)low;
+        case st_uint16 :    return low;
+        case st_uint8 :     return bytes[0];
+        default :
+            return (int32_t)(low | (((uint32_t)bytes[2]) << 16) |
+                (((uint32_t)bytes[3]) << 24));
+    }
+}
+
+// gives the settings that weren't stored in the given version, or are
+// out of range, their defaults, and those that move the plunger too if
+// the CRC was bad. returns how many there were
+static uint8_t checkSettings (
+    const uint8_t version,
+    const bool crcBad)
+{
+    uint8_t defaulted = 0;
+    for (uint8_t index = 0; index < NUM_SETTING_FIELDS; ++index) {
+        SettingField field;
+        memcpy_P(&field, &settingFields[index], sizeof(SettingField));
+        const uint8_t size = settingSize(field.type);
+        const bool stored = (version >= FIRST_BLOCK_VERSION)
+            ? ((field.offset + size) <= storedLength)
+            : (field.version <= version);
+        if (!stored || (crcBad && field.moves) ||
+            (settingValue(&field) < field.min) ||
+            (settingValue(&field) > field.max)) {
+            // low byte first
+            uint32_t value = (uint32_t)field.defaultValue;
+            for (uint8_t i = 0; i < size; ++i) {
+                ((uint8_t*)&settings)[field.offset + i] = value & 0xFF;
+                value >>= 8;
+            }
+            ++defaulted;
+        }
+    }
+    return defaulted;
+}
+
+void EEPROMStorage_Initialize (void)
+{
+    writeQueueHead = 0;
+    writeQueueCount = 0;
+
+    loadedCrcOk = false;
+    storedLength = 0;
+    uint8_t version = readBlock(&loadedCrcOk);
+    if (version == 0) {
+        version = legacyVersion();
+    }
+    loadedVersion = version;
+    migrate(version);
+    // settings migrated from before the block have no CRC to check
+    settingsUnconfirmed = (version >= FIRST_BLOCK_VERSION) && !loadedCrcOk;
+    settingsDefaulted = checkSettings(version, settingsUnconfirmed);
+    if (!settingsUnconfirmed &&
+        ((version != SETTINGS_VERSION) || (settingsDefaulted != 0))) {
+        writeBlock();
+    }
+}
+
+bool EEPROMStorage_settingInRange (
+    const EEPROMStorage_setting setting,
+    const int32_t value)
+{
+    return (setting < es_numSettings) &&
+        (value >= (int32_t)pgm_read_dword(&settingFields[setting].min)) &&
+        (value <= (int32_t)pgm_read_dword(&settingFields[setting].max));
+}
+
+bool EEPROMStorage_overlapsSettings (
+    const uint16_t address,
+    const uint8_t length)
+{
+    return (address < (SETTINGS_BODY_ADDRESS + sizeof(settings))) &&
+        ((address + length) > SETTINGS_ADDRESS);
+}
+
+bool EEPROMStorage_reloadSettings (void)
+{
+    EEPROMStorage_flush();
+    SettingsBlock current;
+    memcpy(&current, &settings, sizeof(settings));
+    bool crcOk = false;
+    const uint8_t version = readBlock(&crcOk);
+    if ((version == 0) || !crcOk) {
+        memcpy(&settings, &current, sizeof(settings));
+        return false;
+    }
+    migrate(version);
+    settingsUnconfirmed = false;
+    if ((checkSettings(version, false) != 0) || (version != SETTINGS_VERSION)) {
+        writeBlock();
+    }
+    ++generation;
+    return true;
+}
+
+void EEPROMStorage_flush (void)
+{
+    bool idle;
+    do {
+        char SREGSave;
+        SREGSave = SREG;
+        cli();
+        idle = !eepromBusy() && (writeQueueCount == 0);
+        if (!eepromBusy()) {
+            // in case interrupts are disabled
+            startNextWrite();
+        }
+        SREG = SREGSave;
+    } while (!idle);
+}
+
+uint8_t EEPROMStorage_readByte (
+    const uint16_t address)
+{
+    EEPROMStorage_flush();
+    return EEPROM_read((uint8_t*)address);
+}
+
+void EEPROMStorage_writeByte (
+    const uint16_t address,
+    const uint8_t value)
+{
+    queueWriteByte(address, value);
+}
+
+bool EEPROMStorage_updateByte (
+    const uint16_t address,
+    const uint8_t value)
+{
+    return updateByte(address, value);
+}
+
+uint8_t EEPROMStorage_generation (void)
+{
+    return generation;
+}
+
+uint8_t EEPROMStorage_loadedVersion (void)
+{
+    return loadedVersion;
+}
+
+bool EEPROMStorage_loadedCrcOk (void)
+{
+    return loadedCrcOk;
+}
+
+uint8_t EEPROMStorage_settingsDefaulted (void)
+{
+    return settingsDefaulted;
+}
+
+bool EEPROMStorage_settingsUnconfirmed (void)
+{
+    return settingsUnconfirmed;
+}
+
+void EEPROMStorage_setPlungerInPos(const int16_t pos)
+{
+    settings.plungerInPos = pos;
+    WRITE_SETTING(plungerInPos);
+}
+int16_t EEPROMStorage_plungerInPos(void)
+{
+    return settings.plungerInPos;
+}
+void EEPROMStorage_setPlungerOutPos(const int16_t pos)
+{
+    settings.plungerOutPos = pos;
+    WRITE_SETTING(plungerOutPos);
+}
+int16_t EEPROMStorage_plungerOutPos(void)
+{
+    return settings.plungerOutPos;
+}
+
+void EEPROMStorage_setPosPerMl(const uint16_t posPerMl)
+{
+    settings.posPerMl = posPerMl;
+    WRITE_SETTING(posPerMl);
+}
+uint16_t EEPROMStorage_posPerMl(void)
+{
+    return settings.posPerMl;
+}
+
+void EEPROMStorage_setMlToPump(const uint16_t mlToPump)
+{
+    settings.mlToPump = mlToPump;
+    WRITE_SETTING(mlToPump);
+}
+uint16_t EEPROMStorage_mlToPump(void)
+{
+    return settings.mlToPump;
+}
+
+void EEPROMStorage_setMotorPwm(const uint8_t pwm)
+{
+    settings.motorPwm = pwm;
+    WRITE_SETTING(motorPwm);
+}
+uint8_t EEPROMStorage_motorPwm(void)
+{
+    return settings.motorPwm;
+}
+
+void EEPROMStorage_setPlungerSpeed(const uint16_t speed)
+{
+    settings.plungerSpeed = speed;
+    WRITE_SETTING(plungerSpeed);
+}
+uint16_t EEPROMStorage_plungerSpeed(void)
+{
+    return settings.plungerSpeed;
+}
+
+void EEPROMStorage_setSpeedKp(const uint16_t kp)
+{
+    settings.speedKp = kp;
+    WRITE_SETTING(speedKp);
+}
+uint16_t EEPROMStorage_speedKp(void)
+{
+    return settings.speedKp;
+}
+void EEPROMStorage_setSpeedKi(const uint16_t ki)
+{
+    settings.speedKi = ki;
+    WRITE_SETTING(speedKi);
+}
+uint16_t EEPROMStorage_speedKi(void)
+{
+    return settings.speedKi;
+}
+void EEPROMStorage_setSpeedKd(const uint16_t kd)
+{
+    settings.speedKd = kd;
+    WRITE_SETTING(speedKd);
+}
+uint16_t EEPROMStorage_speedKd(void)
+{
+    return settings.speedKd;
+}
+
+void EEPROMStorage_setProfileAccelCounts(const uint16_t counts)
+{
+    settings.profileAccelCounts = counts;
+    WRITE_SETTING(profileAccelCounts);
+}
+uint16_t EEPROMStorage_profileAccelCounts(void)
+{
+    return settings.profileAccelCounts;
+}
+void EEPROMStorage_setProfileDecelCounts(const uint16_t counts)
+{
+    settings.profileDecelCounts = counts;
+    WRITE_SETTING(profileDecelCounts);
+}
+uint16_t EEPROMStorage_profileDecelCounts(void)
+{
+    return settings.profileDecelCounts;
+}
+void EEPROMStorage_setProfileApproachPct(const uint8_t pct)
+{
+    settings.profileApproachPct = pct;
+    WRITE_SETTING(profileApproachPct);
+}
+uint8_t EEPROMStorage_profileApproachPct(void)
+{
+    return settings.profileApproachPct;
+}
+
+void EEPROMStorage_setBrakeGainFwd(const uint16_t gain)
+{
+    settings.brakeGainFwd = gain;
+    WRITE_SETTING(brakeGainFwd);
+}
+uint16_t EEPROMStorage_brakeGainFwd(void)
+{
+    return settings.brakeGainFwd;
+}
+void EEPROMStorage_setBrakeGainRev(const uint16_t gain)
+{
+    settings.brakeGainRev = gain;
+    WRITE_SETTING(brakeGainRev);
+}
+uint16_t EEPROMStorage_brakeGainRev(void)
+{
+    return settings.brakeGainRev;
+}
+
+void EEPROMStorage_setEcho(const bool echo)
+{
+    settings.echo = echo;
+    WRITE_SETTING(echo);
+}
+bool EEPROMStorage_echo(void)
+{
+    return settings.echo;
+}
+
+void EEPROMStorage_setBusAddress(const uint8_t address)
+{
+    settings.busAddress = address;
+    WRITE_SETTING(busAddress);
+}
+uint8_t EEPROMStorage_busAddress(void)
+{
+    return settings.busAddress;
+}
+
+void EEPROMStorage_setBaudRate(const uint32_t rate)
+{
+    settings.baudRate = rate;
+    WRITE_SETTING(baudRate);
+}
+uint32_t EEPROMStorage_baudRate(void)
+{
+    return settings.baudRate;
+}
+
+void EEPROMStorage_setModbus(const bool modbus)
+{
+    settings.modbus = modbus;
+    WRITE_SETTING(modbus);
+}
+bool EEPROMStorage_modbus(void)
+{
+    return settings.modbus;
+}
+
+void EEPROMStorage_setTempCalOffset(const int16_t offset)
+{
+    settings.tempCalOffset = offset;
+    WRITE_SETTING(tempCalOffset);
+}
+
+int16_t EEPROMStorage_tempCalOffset(void)
+{
+    return settings.tempCalOffset;
+}
+
+void EEPROMStorage_setRebootInterval(
+    const uint16_t rebootMinutes)
+{
+    settings.rebootInterval = rebootMinutes;
+    WRITE_SETTING(rebootInterval);
+}
+
+uint16_t EEPROMStorage_rebootInterval(void)
+{
+    return settings.rebootInterval;
+}
+
+ISR(EE_READY_vect, ISR_BLOCK)
+{
+    Profiler_isrBegin();
+    if (!startNextWrite()) {
+        // queue drained
+        EECR &= ~(1 << EERIE);
+    }
+    Profiler_isrEnd(pi_eeReady);
+}
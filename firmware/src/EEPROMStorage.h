@@ -1,48 +1,179 @@
-//
-// EEPROM Storage
-//
-// Storage of non-volatile settings and data
-//
-
-#ifndef EEPROMSTORAGE_H
-#define EEPROMSTORAGE_H
-
-#include <stdint.h>
-#include <stdbool.h>
-#include <string.h>
-#include <stddef.h>
-
-extern void EEPROMStorage_Initialize (void);
-
-// console echo state
-extern void EEPROMStorage_setEcho(const bool echo);
-extern bool EEPROMStorage_echo();
-
-// units are odometer counts
-extern void EEPROMStorage_setPlungerInPos(const int16_t pos);
-extern int16_t EEPROMStorage_plungerInPos(void);
-extern void EEPROMStorage_setPlungerOutPos(const int16_t pos);
-extern int16_t EEPROMStorage_plungerOutPos(void);
-
-// ratio of odometer counts to ml
-extern void EEPROMStorage_setPosPerMl(const uint16_t posPerMl);
-extern uint16_t EEPROMStorage_posPerMl(void);
-
-// volume of water to pump when tank is full (units: ml)
-extern void EEPROMStorage_setMlToPump(const uint16_t mlToPump);
-extern uint16_t EEPROMStorage_mlToPump(void);
-
-// pwm: 0..255, which is 0 to  100% duty cycle
-extern void EEPROMStorage_setMotorPwm(const uint8_t pwm);
-extern uint8_t EEPROMStorage_motorPwm(void);
-
-// internal temperature sensor calibration offset
-extern void EEPROMStorage_setTempCalOffset(const int16_t offset);
-extern int16_t EEPROMStorage_tempCalOffset(void);
-
-// how long to go since last reboot. units are minutes
-extern void EEPROMStorage_setRebootInterval(
-    const uint16_t rebootMinutes);
-extern uint16_t EEPROMStorage_rebootInterval(void);
-
+//
+// EEPROM Storage
+//
+// Storage of non-volatile settings and data
+//
+// Settings are copied into RAM at initialization, so reading them
+// doesn't wait on the EEPROM. Setting them writes through to EEPROM
+// via a queue that is programmed in the background
+//
+// The stored settings are a versioned block with a CRC. Initialization
+// migrates them from older versions, and puts back the default of any
+// setting that is missing or out of range. If the CRC is bad, the
+// settings that move the plunger take their defaults too
+//
+
+#ifndef EEPROMSTORAGE_H
+#define EEPROMSTORAGE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stddef.h>
+
+extern void EEPROMStorage_Initialize (void);
+
+// waits until all queued EEPROM writes have been programmed
+extern void EEPROMStorage_flush (void);
+
+// raw byte access. reading waits for queued writes to finish
+extern uint8_t EEPROMStorage_readByte (
+    const uint16_t address);
+extern void EEPROMStorage_writeByte (
+    const uint16_t address,
+    const uint8_t value);
+// writes a byte only if it doesn't already hold the value (or have it
+// queued), so unchanged bytes neither wait for room in the write queue
+// nor wear the EEPROM. returns true if a write was queued
+extern bool EEPROMStorage_updateByte (
+    const uint16_t address,
+    const uint8_t value);
+
+// true if any of the bytes from address on are in the settings block
+extern bool EEPROMStorage_overlapsSettings (
+    const uint16_t address,
+    const uint8_t length);
+
+// takes the settings from EEPROM again, after raw writes to their block,
+// the way initialization does. Only a whole block, one with a good CRC,
+// is taken; otherwise the settings are left as they were and false is
+// returned
+extern bool EEPROMStorage_reloadSettings (void);
+
+// how the settings were found at initialization: the version they were
+// stored in (0 if there were none), whether the block's CRC was good
+// (false for settings migrated from before the block), and how many
+// settings took their defaults
+extern uint8_t EEPROMStorage_loadedVersion (void);
+extern bool EEPROMStorage_loadedCrcOk (void);
+extern uint8_t EEPROMStorage_settingsDefaulted (void);
+
+// the block's CRC was bad at initialization, and no setting has been
+// written since. The block isn't written back until one is, which
+// confirms the settings in use
+extern bool EEPROMStorage_settingsUnconfirmed (void);
+
+// the stored settings. Their ranges and defaults are kept here, and
+// the console's set and Modbus writes check values against them
+typedef enum EEPROMStorage_setting_enum {
+    es_plungerInPos,
+    es_plungerOutPos,
+    es_posPerMl,
+    es_mlToPump,
+    es_motorPwm,
+    es_tempCalOffset,
+    es_rebootInterval,
+    es_plungerSpeed,
+    es_speedKp,
+    es_speedKi,
+    es_speedKd,
+    es_profileAccelCounts,
+    es_profileDecelCounts,
+    es_profileApproachPct,
+    es_brakeGainFwd,
+    es_brakeGainRev,
+    es_echo,
+    es_busAddress,
+    es_baudRate,
+    es_modbus,
+    es_numSettings
+} EEPROMStorage_setting;
+
+// true if the value is in the setting's range
+extern bool EEPROMStorage_settingInRange (
+    const EEPROMStorage_setting setting,
+    const int32_t value);
+
+// changes (and wraps around) whenever a setting is written. Clients that
+// derive values from settings can recompute them only when it changes
+extern uint8_t EEPROMStorage_generation (void);
+
+// console echo state. when off, typed characters aren't echoed, for
+// automated clients
+extern void EEPROMStorage_setEcho(const bool echo);
+extern bool EEPROMStorage_echo(void);
+
+// address of this pump for the binary protocol. 1..247
+extern void EEPROMStorage_setBusAddress(const uint8_t address);
+extern uint8_t EEPROMStorage_busAddress(void);
+
+// console baud rate. BaudRate stores it once it has been confirmed
+extern void EEPROMStorage_setBaudRate(const uint32_t rate);
+extern uint32_t EEPROMStorage_baudRate(void);
+
+// the console speaks Modbus RTU instead of text commands and binary
+// protocol frames
+extern void EEPROMStorage_setModbus(const bool modbus);
+extern bool EEPROMStorage_modbus(void);
+
+// units are odometer counts
+extern void EEPROMStorage_setPlungerInPos(const int16_t pos);
+extern int16_t EEPROMStorage_plungerInPos(void);
+extern void EEPROMStorage_setPlungerOutPos(const int16_t pos);
+extern int16_t EEPROMStorage_plungerOutPos(void);
+
+// ratio of odometer counts to ml
+extern void EEPROMStorage_setPosPerMl(const uint16_t posPerMl);
+extern uint16_t EEPROMStorage_posPerMl(void);
+
+// volume of water to pump when tank is full (units: ml)
+extern void EEPROMStorage_setMlToPump(const uint16_t mlToPump);
+extern uint16_t EEPROMStorage_mlToPump(void);
+
+// pwm: 0..255, which is 0 to  100% duty cycle
+extern void EEPROMStorage_setMotorPwm(const uint8_t pwm);
+extern uint8_t EEPROMStorage_motorPwm(void);
+
+// closed loop plunger speed. units: tachometer pulses per second.
+// 0 runs the motor open loop at motorPwm. At most INT16_MAX, as the
+// regulator works in signed speeds
+extern void EEPROMStorage_setPlungerSpeed(const uint16_t speed);
+extern uint16_t EEPROMStorage_plungerSpeed(void);
+
+// speed regulator gains. units: 1/256 pwm per pulse per second
+extern void EEPROMStorage_setSpeedKp(const uint16_t kp);
+extern uint16_t EEPROMStorage_speedKp(void);
+extern void EEPROMStorage_setSpeedKi(const uint16_t ki);
+extern uint16_t EEPROMStorage_speedKi(void);
+extern void EEPROMStorage_setSpeedKd(const uint16_t kd);
+extern uint16_t EEPROMStorage_speedKd(void);
+
+// trapezoidal motion profile of closed loop moves. The speed ramps up
+// over accelCounts odometer counts after the start of a move and down
+// over decelCounts counts before the target, between approachPct
+// (10..100) percent and 100 percent of plungerSpeed. both counts 0
+// disables the profile. Open loop moves run at motorPwm throughout
+extern void EEPROMStorage_setProfileAccelCounts(const uint16_t counts);
+extern uint16_t EEPROMStorage_profileAccelCounts(void);
+extern void EEPROMStorage_setProfileDecelCounts(const uint16_t counts);
+extern uint16_t EEPROMStorage_profileDecelCounts(void);
+extern void EEPROMStorage_setProfileApproachPct(const uint8_t pct);
+extern uint8_t EEPROMStorage_profileApproachPct(void);
+
+// learned braking distance model, per direction of travel.
+// braking distance = gain * speed (pulses per second) / 256 odometer counts
+extern void EEPROMStorage_setBrakeGainFwd(const uint16_t gain);
+extern uint16_t EEPROMStorage_brakeGainFwd(void);
+extern void EEPROMStorage_setBrakeGainRev(const uint16_t gain);
+extern uint16_t EEPROMStorage_brakeGainRev(void);
+
+// internal temperature sensor calibration offset
+extern void EEPROMStorage_setTempCalOffset(const int16_t offset);
+extern int16_t EEPROMStorage_tempCalOffset(void);
+
+// how long to go since last reboot. units are minutes
+extern void EEPROMStorage_setRebootInterval(
+    const uint16_t rebootMinutes);
+extern uint16_t EEPROMStorage_rebootInterval(void);
+
 #endif		// EEPROMSTORAGE
\ No newline at end of file
@@ -0,0 +1,91 @@
+//
+//  Frame Codec
+//
+#include "FrameCodec.h"
+
+uint8_t FrameCodec_encode (
+    const uint8_t* in,
+    const uint8_t length,
+    uint8_t* out)
+{
+    // each run of non-zero bytes is preceded by a code byte holding its
+    // length plus one. a run of 254 bytes has no zero after it
+    uint8_t codePos = 0;
+    uint8_t outPos = 1;
+    uint8_t code = 1;
+    for (uint8_t i = 0; i < length; ++i) {
+        if (in[i] == 0) {
+            out[codePos] = code;
+            codePos = outPos++;
+            code = 1;
+        } else {
+            out[outPos++] = in[i];
+            if (++code == 0xFF) {
+                out[codePos] = code;
+                codePos = outPos++;
+                code = 1;
+            }
+        }
+    }
+    out[codePos] = code;
+    return outPos;
+}
+
+uint8_t FrameCodec_decode (
+    const uint8_t* in,
+    const uint8_t length,
+    uint8_t* out)
+{
+    uint8_t inPos = 0;
+    uint8_t outPos = 0;
+    while (inPos < length) {
+        const uint8_t code = in[inPos++];
+        if ((code == 0) || (((uint16_t)inPos + code - 1) > length)) {
+            return 0;
+        }
+        for (uint8_t i = 1; i < code; ++i) {
+            out[outPos++] = in[inPos++];
+        }
+        if ((code != 0xFF) && (inPos < length)) {
+            out[outPos++] = 0;
+        }
+    }
+    return outPos;
+}
+
+uint16_t FrameCodec_crc16Update (
+    uint16_t crc,
+    const uint8_t byte)
+{
+    // bitwise rather than table driven, to save flash
+    crc ^= ((uint16_t)byte) << 8;
+    for (uint8_t bit = 0; bit < 8; ++bit) {
+        crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+    }
+    return crc;
+}
+
+uint16_t FrameCodec_crc16 (
+    const uint8_t* data,
+    uint8_t length)
+{
+    uint16_t crc = FRAMECODEC_CRC16_INITIAL;
+    while (length-- != 0) {
+        crc = FrameCodec_crc16Update(crc, *data++);
+    }
+    return crc;
+}
+
+uint16_t FrameCodec_modbusCrc16 (
+    const uint8_t* data,
+    uint8_t length)
+{
+    uint16_t crc = 0xFFFF;
+    while (length-- != 0) {
+        crc ^= *data++;
+        for (uint8_t bit = 0; bit < 8; ++bit) {
+            crc = (crc & 0x0001) ? ((crc >> 1) ^ 0xA001) : (crc >> 1);
+        }
+    }
+    return crc;
+}
@@ -0,0 +1,55 @@
+//
+//  Frame Codec
+//
+//  COBS (Consistent Overhead Byte Stuffing) framing and CRC16 for the
+//  binary protocol, and the CRC of Modbus RTU frames. COBS removes all
+//  zero bytes from a frame, so a zero byte can mark where frames begin
+//  and end. Plain C without AVR dependencies, so host programs can
+//  share it.
+//
+#ifndef FRAMECODEC_H
+#define FRAMECODEC_H
+
+#include <stdint.h>
+
+// marks the start and end of a frame on the wire
+#define FRAMECODEC_DELIMITER 0x00
+
+// most bytes length bytes of data can take when encoded
+#define FRAMECODEC_ENCODED_SIZE(length) ((length) + ((length) / 254) + 1)
+
+// COBS encodes length bytes of in into out, which must hold
+// FRAMECODEC_ENCODED_SIZE(length) bytes. returns the encoded length.
+// delimiters are not added
+extern uint8_t FrameCodec_encode (
+    const uint8_t* in,
+    const uint8_t length,
+    uint8_t* out);
+
+// decodes a COBS encoded frame, without delimiters. out may be the same
+// buffer as in. returns the decoded length, or 0 if the frame is
+// malformed
+extern uint8_t FrameCodec_decode (
+    const uint8_t* in,
+    const uint8_t length,
+    uint8_t* out);
+
+// CRC-16/CCITT-FALSE: polynomial 0x1021, initial value 0xFFFF
+extern uint16_t FrameCodec_crc16 (
+    const uint8_t* data,
+    uint8_t length);
+
+// the same CRC a byte at a time, for data that isn't in one buffer.
+// start with FRAMECODEC_CRC16_INITIAL
+#define FRAMECODEC_CRC16_INITIAL 0xFFFF
+extern uint16_t FrameCodec_crc16Update (
+    uint16_t crc,
+    const uint8_t byte);
+
+// CRC-16/MODBUS: reflected polynomial 0xA001, initial value 0xFFFF.
+// sent low byte first
+extern uint16_t FrameCodec_modbusCrc16 (
+    const uint8_t* data,
+    uint8_t length);
+
+#endif  // FRAMECODEC_H
@@ -0,0 +1,355 @@
+//
+//  JSON Writer
+//
+#include "JSONWriter.h"
+
+#include "Console.h"
+#include "CharString.h"
+#include "BinaryProtocol.h"
+
+// deepest nesting of objects and arrays
+#define MAX_DEPTH 8
+
+static uint8_t depth;
+// bit n is set while nothing has been written at depth n+1
+static uint8_t emptyLevels;
+// bit n is set if depth n+1 is an array
+static uint8_t arrayLevels;
+// output was ended early
+static bool truncated;
+// values and members begun, wrapping around
+static uint8_t valueCount;
+
+// longest member name, with the comma, quotes and colon
+#define MAX_MEMBER_TEXT 24
+
+// appends the comma before a member or element if it isn't the first,
+// and the member name if there is one
+static void beginValue (
+    PGM_P name,
+    CharString_t* str)
+{
+    if (depth != 0) {
+        const uint8_t levelBit = 1 << (depth - 1);
+        if (emptyLevels & levelBit) {
+            emptyLevels &= ~levelBit;
+        } else {
+            CharString_appendC(',', str);
+        }
+    }
+    if (name != NULL) {
+        CharString_appendC('\"', str);
+        CharString_appendP(name, str);
+        CharString_appendP(PSTR("\":"), str);
+    }
+}
+
+// room kept for ending output early: a closing bracket for each level,
+// ,"truncated":true} and the line end, as one message
+#define TRUNCATION_ROOM (MAX_DEPTH + 22)
+
+// most text written before a value: the comma, and the name in quotes
+// with the colon
+static uint8_t memberLength (
+    PGM_P name)
+{
+    return (name != NULL) ? (strlen_P(name) + 4) : 1;
+}
+
+// closes the open levels and ends the outermost one with a truncated
+// member (or element, if it's an array)
+static void endTruncated (void)
+{
+    CharString_define(MAX_DEPTH + 20, marker);
+    for (uint8_t level = depth; level > 1; --level) {
+        const bool isArray = (level <= MAX_DEPTH) &&
+            ((arrayLevels & (1 << (level - 1))) != 0);
+        CharString_appendC(isArray ? ']' : '}', &marker);
+    }
+    const uint8_t truncatedDepth = depth;
+    depth = 1;
+    if (arrayLevels & 1) {
+        beginValue(NULL, &marker);
+        CharString_appendP(PSTR("\"truncated\"]"), &marker);
+    } else {
+        beginValue(PSTR("truncated"), &marker);
+        CharString_appendP(PSTR("true}"), &marker);
+    }
+    depth = truncatedDepth;
+    Console_printLineCS(&marker);
+    truncated = true;
+}
+
+// true if text of that length, written as that many messages, fits in
+// the console output with TRUNCATION_ROOM to spare. If it doesn't, the
+// output is ended early
+static bool hasRoomFor (
+    const uint16_t length,
+    const uint8_t messages)
+{
+    if (truncated) {
+        return false;
+    }
+    if ((depth == 0) ||
+        ((length + (2 * messages) + TRUNCATION_ROOM) <= Console_room())) {
+        return true;
+    }
+    endTruncated();
+    return false;
+}
+
+static void beginLevel (
+    PGM_P name,
+    const char opening)
+{
+    if (depth == 0) {
+        truncated = false;
+    }
+    if (hasRoomFor(memberLength(name) + 1, 1)) {
+        CharString_define(MAX_MEMBER_TEXT, member);
+        beginValue(name, &member);
+        CharString_appendC(opening, &member);
+        Console_printCS(&member);
+    }
+    if (depth < MAX_DEPTH) {
+        const uint8_t levelBit = 1 << depth;
+        emptyLevels |= levelBit;
+        if (opening == '[') {
+            arrayLevels |= levelBit;
+        } else {
+            arrayLevels &= ~levelBit;
+        }
+    }
+    ++depth;
+}
+
+static void endLevel (
+    PGM_P closing)
+{
+    // the outermost closing has the room kept for ending early
+    const bool write = (depth <= 1) ? !truncated : hasRoomFor(1, 1);
+    if (depth != 0) {
+        --depth;
+    }
+    if (!write) {
+        return;
+    }
+    if (depth == 0) {
+        Console_printLineP(closing);
+    } else {
+        Console_printP(closing);
+    }
+}
+
+void JSONWriter_beginObject (
+    PGM_P name)
+{
+    ++valueCount;
+    if (BinaryProtocol_recordOpen()) {
+        return;
+    }
+    if (depth == 0) {
+        emptyLevels = 0;
+    }
+    beginLevel(name, '{');
+}
+
+void JSONWriter_endObject (void)
+{
+    if (BinaryProtocol_recordOpen()) {
+        return;
+    }
+    endLevel(PSTR("}"));
+}
+
+void JSONWriter_beginArray (
+    PGM_P name)
+{
+    ++valueCount;
+    if (BinaryProtocol_recordOpen()) {
+        return;
+    }
+    beginLevel(name, '[');
+}
+
+void JSONWriter_endArray (void)
+{
+    if (BinaryProtocol_recordOpen()) {
+        return;
+    }
+    endLevel(PSTR("]"));
+}
+
+static void writeNumber (
+    PGM_P name,
+    const int32_t value)
+{
+    // digits are produced least significant first
+    char digits[11];
+    uint8_t i = sizeof(digits);
+    uint32_t magnitude = (value < 0) ? (0 - (uint32_t)value) : (uint32_t)value;
+    do {
+        digits[--i] = '0' + (magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    if (!hasRoomFor(memberLength(name) + 1 + (sizeof(digits) - i), 1)) {
+        return;
+    }
+
+    CharString_define(MAX_MEMBER_TEXT + 12, member);
+    beginValue(name, &member);
+    if (value < 0) {
+        CharString_appendC('-', &member);
+    }
+    while (i < sizeof(digits)) {
+        CharString_appendC(digits[i++], &member);
+    }
+    Console_printCS(&member);
+}
+
+void JSONWriter_intValue (
+    PGM_P name,
+    const int32_t value)
+{
+    ++valueCount;
+    if (BinaryProtocol_recordOpen()) {
+        BinaryProtocol_appendWord(value);
+    } else {
+        writeNumber(name, value);
+    }
+}
+
+void JSONWriter_longValue (
+    PGM_P name,
+    const int32_t value)
+{
+    ++valueCount;
+    if (BinaryProtocol_recordOpen()) {
+        BinaryProtocol_appendLong(value);
+    } else {
+        writeNumber(name, value);
+    }
+}
+
+void JSONWriter_boolValue (
+    PGM_P name,
+    const bool value)
+{
+    ++valueCount;
+    if (BinaryProtocol_recordOpen()) {
+        BinaryProtocol_appendByte(value);
+        return;
+    }
+    if (!hasRoomFor(memberLength(name) + 5, 1)) {
+        return;
+    }
+    CharString_define(MAX_MEMBER_TEXT + 6, member);
+    beginValue(name, &member);
+    CharString_appendP(value ? PSTR("true") : PSTR("false"), &member);
+    Console_printCS(&member);
+}
+
+void JSONWriter_stringValueP (
+    PGM_P name,
+    PGM_P value)
+{
+    ++valueCount;
+    if (BinaryProtocol_recordOpen()) {
+        BinaryProtocol_appendStringP(value);
+        return;
+    }
+    if (!hasRoomFor(memberLength(name) + strlen_P(value) + 2, 3)) {
+        return;
+    }
+    CharString_define(MAX_MEMBER_TEXT, member);
+    beginValue(name, &member);
+    CharString_appendC('\"', &member);
+    Console_printCS(&member);
+    Console_printP(value);
+    Console_printP(PSTR("\""));
+}
+
+static char hexDigit (
+    const uint8_t value)
+{
+    return (value < 10) ? ('0' + value) : ('A' + (value - 10));
+}
+
+void JSONWriter_bytesValue (
+    PGM_P name,
+    const uint8_t* data,
+    const uint8_t length)
+{
+    ++valueCount;
+    if (BinaryProtocol_recordOpen()) {
+        BinaryProtocol_appendByte(length);
+        for (uint8_t i = 0; i < length; ++i) {
+            BinaryProtocol_appendByte(data[i]);
+        }
+        return;
+    }
+    if (!hasRoomFor(memberLength(name) + (2 * length) + 2, 2 + (length / 8))) {
+        return;
+    }
+    CharString_define(MAX_MEMBER_TEXT, member);
+    beginValue(name, &member);
+    CharString_appendC('\"', &member);
+    Console_printCS(&member);
+    // the digits are written 8 bytes at a time, with room for the
+    // closing quote
+    CharString_define(17, digits);
+    for (uint8_t i = 0; i < length; ++i) {
+        if (CharString_length(&digits) == 16) {
+            Console_printCS(&digits);
+            CharString_clear(&digits);
+        }
+        CharString_appendC(hexDigit(data[i] >> 4), &digits);
+        CharString_appendC(hexDigit(data[i] & 0x0F), &digits);
+    }
+    CharString_appendC('\"', &digits);
+    Console_printCS(&digits);
+}
+
+void JSONWriter_timeValue (
+    PGM_P name,
+    const SystemTime_t* time)
+{
+    ++valueCount;
+    if (BinaryProtocol_recordOpen()) {
+        BinaryProtocol_appendLong(time->seconds);
+        return;
+    }
+    if (!hasRoomFor(memberLength(name) + 14, 1)) {
+        return;
+    }
+    CharString_define(MAX_MEMBER_TEXT + 14, member);
+    beginValue(name, &member);
+    CharString_appendC('\"', &member);
+    SystemTime_appendToString(time, &member);
+    CharString_appendC('\"', &member);
+    Console_printCS(&member);
+}
+
+void JSONWriter_textLineP (
+    PGM_P text)
+{
+    ++valueCount;
+    if (BinaryProtocol_recordOpen()) {
+        BinaryProtocol_appendStringP(text);
+    } else if (depth != 0) {
+        JSONWriter_stringValueP(NULL, text);
+    } else {
+        Console_printLineP(text);
+    }
+}
+
+uint8_t JSONWriter_valueCount (void)
+{
+    return valueCount;
+}
+
+void JSONWriter_abandon (void)
+{
+    depth = 0;
+    truncated = false;
+}
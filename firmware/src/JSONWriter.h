@@ -0,0 +1,79 @@
+//
+//  JSON Writer
+//
+//  Writes JSON straight to the console output, a member at a time,
+//  without building it up in a buffer first. Member names are in
+//  program memory. Commas between members and between array elements
+//  are written automatically. Ending the outermost object ends the line.
+//
+//  Pass NULL as the name for array elements and for the outermost object.
+//
+//  Output isn't cut short silently: if a member won't fit in the console
+//  output with room to spare, the open arrays and objects are closed
+//  there and the outermost object ends with "truncated":true. Nothing
+//  more is written until the outermost object ends.
+//
+//  While a binary protocol record is open (see BinaryProtocol.h) the
+//  values are written into it instead, without names or punctuation.
+//
+#ifndef JSONWRITER_H
+#define JSONWRITER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <avr/pgmspace.h>
+#include "SystemTime.h"
+
+extern void JSONWriter_beginObject (
+    PGM_P name);
+extern void JSONWriter_endObject (void);
+
+extern void JSONWriter_beginArray (
+    PGM_P name);
+extern void JSONWriter_endArray (void);
+
+// takes any 16 bit value, signed or unsigned
+extern void JSONWriter_intValue (
+    PGM_P name,
+    const int32_t value);
+
+// a 32 bit value. Takes 4 bytes in a binary record
+extern void JSONWriter_longValue (
+    PGM_P name,
+    const int32_t value);
+
+extern void JSONWriter_boolValue (
+    PGM_P name,
+    const bool value);
+
+extern void JSONWriter_stringValueP (
+    PGM_P name,
+    PGM_P value);
+
+// bytes as a string of hex digits, two per byte. A length byte followed
+// by the bytes in a binary record
+extern void JSONWriter_bytesValue (
+    PGM_P name,
+    const uint8_t* data,
+    const uint8_t length);
+
+// time as a "D:HH:MM:SS" string
+extern void JSONWriter_timeValue (
+    PGM_P name,
+    const SystemTime_t* time);
+
+// a line of plain text in place of a JSON reply. Inside an array or
+// object it is written as a string instead
+extern void JSONWriter_textLineP (
+    PGM_P text);
+
+// changes whenever a value, member, object or array is begun, so a
+// caller can tell whether anything was written
+extern uint8_t JSONWriter_valueCount (void);
+
+// forgets the open objects and arrays of a reply that won't be
+// finished, so the next one starts at the outermost level
+extern void JSONWriter_abandon (void);
+
+#endif  // JSONWRITER_H
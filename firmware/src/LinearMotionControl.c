@@ -1,319 +1,714 @@
-//
-//  LinearMotion Control
-//
-//  This unit controls a DC gearmotor connected to a threaded rod. A nut on
-//  the threaded rod provides linear motion.
-//  The gearmotor is has a tachometer / odomoter, and there is a home position
-//  sensor that detects when the nut reaches the home position.
-//
-
-#include "LinearMotionControl.h"
-
-#include "SystemTime.h"
-#include "Console.h"
-#include "StringInteger.h"
-#include <avr/io.h>
-#include "MSVS_AVR.h"
-
-#include "Console.h"
-
-#define DEBUG_TRACE 0
-
-#define MOTOR_STARTUP_TIMEOUT_TIME 100
-
-#define M1A_PIN PD5
-#define M1A_PORT PORTD
-#define M1A_DIR DDRD
-#define M1B_PIN PD6
-#define M1B_PORT PORTD
-#define M1B_DIR DDRD
-
-static void setupPhaseCorrectPWM(void) {
-    TCCR0A = (TCCR0A & 0x3F) | 2 << COM0A0; // set to Clear OC0A on Compare Match when up-counting
-    TCCR0A = (TCCR0A & 0xCF) | 2 << COM0B0; // set to Clear OC0B on Compare Match when up-counting
-    TCCR0A = (TCCR0A & 0xFC) | 1 << WGM00;  // set PWM, Phase Correct bits WGM00 and WGM01
-    TCCR0B = (TCCR0B & 0xF7) | 0 << WGM02;  // set PWM, Phase Correct bits WGM02
-    TCCR0B = (TCCR0B & 0xF8) | 3 << CS00;   // set prescaler to div 64
-}
-static void motorForward(const uint8_t motorPWM) {
-#if 0
-    M1A_PORT |= (1 << M1A_PIN);
-    M1B_PORT &= ~(1 << M1B_PIN);
-#else
-#if DEBUG_TRACE
-    CharString_define(50, msg);
-    CharString_copyP(PSTR("fwd pwm: "), &msg);
-    StringInteger_appendDecimal(motorPWM, 0, 0, &msg);
-    Console_printLineCS(&msg);
-#endif
-    setupPhaseCorrectPWM();
-    // pwm pin OC0B (PD5)
-    OCR0A = 0;
-    OCR0B = motorPWM;
-#endif
-}
-
-static void motorReverse(const uint8_t motorPWM) {
-#if 0
-    M1A_PORT &= ~(1 << M1A_PIN);
-    M1B_PORT |= (1 << M1B_PIN);
-#else
-#if DEBUG_TRACE
-    CharString_define(50, msg);
-    CharString_copyP(PSTR("rev pwm: "), &msg);
-    StringInteger_appendDecimal(motorPWM, 0, 0, &msg);
-    Console_printLineCS(&msg);
-#endif
-    // pwm pin OCR0A (PD6)
-    setupPhaseCorrectPWM();
-    OCR0A = motorPWM;
-    OCR0B = 0;
-#endif
-}
-
-static void motorBrake (void) {
-    // turn off pwm
-    TCCR0A = 0;
-    TCCR0B = 0;
-    // turn on MIA and M1B
-    M1A_PORT |= (1 << M1A_PIN);
-    M1B_PORT |= (1 << M1B_PIN);
-}
-
-static void motorCoast(void) {
-    TCCR0A = 0;
-    TCCR0B = 0;
-    // turn off MIA and M1B
-    M1A_PORT &= ~(1 << M1A_PIN);
-    M1B_PORT &= ~(1 << M1B_PIN);
-}
-
-static void brakeToStop(
-    LinearMotionControl_t* _this)
-{
-    motorBrake();
-    _this->state = lmcs_brakingToStop;
-#if DEBUG_TRACE
-    Console_printLineP(PSTR("braking"));
-#endif
-}
-
-static void handleStall(
-    LinearMotionControl_t* _this)
-{
-    CharString_define(40, msg);
-    CharString_appendP(PSTR("stall detected in state: "), &msg);
-    StringInteger_appendDecimal(_this->state, 1, 0, &msg);
-    Console_printLineCS(&msg);
-
-    motorCoast();
-    _this->state = lmcs_stalled;
-}
-
-static void homePositionSensorChangeCB(
-    const bool pinState,
-    void* clientData)
-{
-    LinearMotionControl_t* lmc = (LinearMotionControl_t*)clientData;
-    TachometerOdometer_resetPositionToZero(&lmc->to);
-    lmc->foundHomePosition = true;
-    // Console_printLineP(PSTR("home"));
-}
-
-void LinearMotionControl_init(
-    const IOPortBitfield_PortSelection tachometerOdometerPort,
-    const uint8_t tachometerOdometerPin,
-    const IOPortBitfield_PortSelection homePositionSensorPort,
-    const uint8_t homePositionSensorPin,
-    LinearMotionControl_t* _this)
-{
-    _this->command = lmcc_none;
-    _this->targetPosition = 0;
-    _this->motorPWM = 0;
-    _this->state = lmcs_stopped;
-    TachometerOdometer_init(tachometerOdometerPort, tachometerOdometerPin, &_this->to);
-    IOPortBitfield_init(homePositionSensorPort, homePositionSensorPin, 1, false,
-        &_this->homePositionSensorInput);
-    PinChangeMonitor_monitorPin(homePositionSensorPort, homePositionSensorPin,
-        homePositionSensorChangeCB, _this,
-        &_this->homePositionSensorInputChangeMonitor);
-    PinChangeMonitor_enable(&_this->homePositionSensorInputChangeMonitor);
-    _this->foundHomePosition = false;
-
-    // set up motor driver pins - make them outputs
-    M1A_DIR |= (1 << M1A_PIN);
-    M1B_DIR |= (1 << M1B_PIN);
-    motorCoast();
-}
-
-bool LinearMotionControl_moveToPosition(
-    const int16_t newPosition,
-    const uint8_t motorPWM,
-    LinearMotionControl_t* _this)
-{
-    if (_this->foundHomePosition) {
-        _this->command = lmcc_moveToPosition;
-        _this->targetPosition = newPosition;
-        _this->motorPWM = motorPWM;
-        return true;
-    }
-    return false;
-}
-
-void LinearMotionControl_brakeToStop(
-    LinearMotionControl_t* _this)
-{
-    brakeToStop(_this);
-}
-
-bool LinearMotionControl_isStopped(
-    LinearMotionControl_t* _this)
-{
-    return ((_this->state == lmcs_stopped) ||
-            (_this->state == lmcs_stalled));
-}
-
-void LinearMotionControl_findHomePosition(
-    const uint8_t motorPWM,
-    LinearMotionControl_t* _this)
-{
-    _this->foundHomePosition = false;
-    _this->command = lmcc_findHomePosition;
-    _this->motorPWM = motorPWM;
-}
-
-int16_t LinearMotionControl_position(
-    LinearMotionControl_t* _this)
-{
-    return TachometerOdometer_position(&_this->to);
-}
-uint8_t LinearMotionControl_speed(
-    LinearMotionControl_t* _this)
-{
-    return TachometerOdometer_speed(&_this->to);
-}
-
-bool LinearMotionControl_homePositionIsKnown(
-    LinearMotionControl_t* _this)
-{
-    return _this->foundHomePosition;
-}
-
-void LinearMotionControl_task(
-    LinearMotionControl_t* _this)
-{
-    switch (_this->state) {
-        case lmcs_stopped:
-            switch (_this->command) {
-                case lmcc_moveToPosition: {
-                    // see where we are relative to new position
-                    const int16_t currentPosition = TachometerOdometer_position(&_this->to);
-                    if (_this->targetPosition > currentPosition) {
-                        // move forward
-                        TachometerOdometer_setDirection(tod_forward, &_this->to);
-                        motorForward(_this->motorPWM);
-                        SystemTime_futureTime(MOTOR_STARTUP_TIMEOUT_TIME, &_this->timeoutTimer);
-                        _this->state = lmcs_startingToMoveToPosition;
-                    } else if (_this->targetPosition < currentPosition) {
-                        // move reverse
-                        TachometerOdometer_setDirection(tod_reverse, &_this->to);
-                        motorReverse(_this->motorPWM);
-                        SystemTime_futureTime(MOTOR_STARTUP_TIMEOUT_TIME, &_this->timeoutTimer);
-                        _this->state = lmcs_startingToMoveToPosition;
-                    }
-                    }
-                    break;
-                case lmcc_findHomePosition:
-                    if (IOPortBitfield_readAsBool(&_this->homePositionSensorInput)) {
-                        // carriage position is currently ahead of home position
-                        // search in reverse
-                        TachometerOdometer_setDirection(tod_reverse, &_this->to);
-                        motorReverse(_this->motorPWM);
-                    } else {
-                        // carriage position is currently behind home position
-                        // search forward
-                        TachometerOdometer_setDirection(tod_forward, &_this->to);
-                        motorForward(_this->motorPWM);
-                    }
-                    SystemTime_futureTime(MOTOR_STARTUP_TIMEOUT_TIME, &_this->timeoutTimer);
-                    _this->state = lmcs_startingToSearchForHomePosition;
-                    break;
-                default:
-                    break;
-            }
-            _this->command = lmcc_none;
-            break;
-        case lmcs_startingToMoveToPosition:
-            if (TachometerOdometer_speed(&_this->to) != 0) {
-                // we have sucessfully begun moving
-                _this->state = lmcs_movingToPosition;
-            } else if (SystemTime_timeHasArrived(&_this->timeoutTimer)) {
-                // motor did not start moving in time
-                handleStall(_this);
-            }
-            break;
-        case lmcs_movingToPosition: {
-            const TachometerOdometer_direction_t dir =
-                TachometerOdometer_direction(&_this->to);
-            const int16_t pos = TachometerOdometer_position(&_this->to);
-            if (((dir == tod_forward) && (pos >= _this->targetPosition)) ||
-                ((dir == tod_reverse) && (pos <= _this->targetPosition))) {
-#if DEBUG_TRACE
-                CharString_define(40, msg);
-                CharString_appendP(PSTR("reached "), &msg);
-                StringInteger_appendDecimal(pos, 1, 0, &msg);
-                CharString_appendP(PSTR(", target: "), &msg);
-                StringInteger_appendDecimal(_this->targetPosition, 1, 0, &msg);
-                CharString_appendP(PSTR(", speed: "), &msg);
-                StringInteger_appendDecimal(speed, 1, 0, &msg);
-                Console_printLineCS(&msg);
-#endif
-                brakeToStop(_this);
-            } else if (TachometerOdometer_speed(&_this->to) == 0) {
-                handleStall(_this);
-            }
-            }
-            break;
-        case lmcs_brakingToStop:
-            if (TachometerOdometer_speed(&_this->to) == 0) {
-                motorCoast();
-#if DEBUG_TRACE
-                CharString_define(40, msg);
-                CharString_appendP(PSTR("stopped at "), &msg);
-                StringInteger_appendDecimal(
-                    TachometerOdometer_position(&_this->to), 1, 0, &msg);
-                Console_printLineCS(&msg);
-#endif
-                _this->state = lmcs_stopped;
-            }
-            break;
-        case lmcs_startingToSearchForHomePosition:
-            if (TachometerOdometer_speed(&_this->to) != 0) {
-                // we have sucessfully begun searching
-                _this->state = lmcs_searchingForHomePosition;
-            } else if (SystemTime_timeHasArrived(&_this->timeoutTimer)) {
-                // motor did not start moving in time
-                handleStall(_this);
-            }
-            break;
-        case lmcs_searchingForHomePosition:
-            if (_this->foundHomePosition) {
-#if DEBUG_TRACE
-                CharString_define(40, msg);
-                CharString_appendP(PSTR("homing speed: "), &msg);
-                StringInteger_appendDecimal(
-                    TachometerOdometer_speed(&_this->to), 1, 0, &msg);
-                Console_printLineCS(&msg);
-#endif
-                brakeToStop(_this);
-            } else if (TachometerOdometer_speed(&_this->to) == 0) {
-                handleStall(_this);
-            }
-            break;
-        case lmcs_stalled:
-            break;
-        default:
-            break;
-    }
-}
-
+//
+//  LinearMotion Control
+//
+//  This unit controls a DC gearmotor connected to a threaded rod. A nut on
+//  the threaded rod provides linear motion.
+//  The gearmotor is has a tachometer / odomoter, and there is a home position
+//  sensor that detects when the nut reaches the home position.
+//
+
+#include "LinearMotionControl.h"
+
+#include "SystemTime.h"
+#include "EEPROMStorage.h"
+#include "Console.h"
+#include "StringInteger.h"
+#include <avr/io.h>
+#include "MSVS_AVR.h"
+
+#include "Console.h"
+
+#define DEBUG_TRACE 0
+
+#define MOTOR_STARTUP_TIMEOUT_TIME 100
+
+// speed regulator runs at 50Hz
+#define SPEED_REGULATION_TICKS (SYSTEMTIME_TICKS_PER_SECOND / 50)
+#define MAX_PWM_FIXED (255L << 8)
+#define MAX_SPEED_ERROR 2047
+
+// slowest approach speed of a motion profile. The tachometer reads
+// stopped below 5 pulses per second
+#define MIN_PROFILE_SPEED 10
+
+// braking distance model learning rate is 1/(2^BRAKE_GAIN_SHIFT)
+#define BRAKE_GAIN_SHIFT 2
+
+// the motor is considered stopped after braking when there has been
+// no tachometer pulse for this long (units: timer 1 counts, 50mS)
+#define BRAKE_SETTLE_COUNTS (SYSTEMTIME_COUNTS_PER_SECOND / 20)
+
+#define M1A_PIN PD5
+#define M1A_PORT PORTD
+#define M1A_DIR DDRD
+#define M1B_PIN PD6
+#define M1B_PORT PORTD
+#define M1B_DIR DDRD
+
+static void setupPhaseCorrectPWM(void) {
+    TCCR0A = (TCCR0A & 0x3F) | 2 << COM0A0; // set to Clear OC0A on Compare Match when up-counting
+    TCCR0A = (TCCR0A & 0xCF) | 2 << COM0B0; // set to Clear OC0B on Compare Match when up-counting
+    TCCR0A = (TCCR0A & 0xFC) | 1 << WGM00;  // set PWM, Phase Correct bits WGM00 and WGM01
+    TCCR0B = (TCCR0B & 0xF7) | 0 << WGM02;  // set PWM, Phase Correct bits WGM02
+    TCCR0B = (TCCR0B & 0xF8) | 3 << CS00;   // set prescaler to div 64
+}
+static void motorForward(const uint8_t motorPWM) {
+#if 0
+    M1A_PORT |= (1 << M1A_PIN);
+    M1B_PORT &= ~(1 << M1B_PIN);
+#else
+#if DEBUG_TRACE
+    CharString_define(50, msg);
+    CharString_copyP(PSTR("fwd pwm: "), &msg);
+    StringInteger_appendDecimal(motorPWM, 0, 0, &msg);
+    Console_printLineCS(&msg);
+#endif
+    setupPhaseCorrectPWM();
+    // pwm pin OC0B (PD5)
+    OCR0A = 0;
+    OCR0B = motorPWM;
+#endif
+}
+
+static void motorReverse(const uint8_t motorPWM) {
+#if 0
+    M1A_PORT &= ~(1 << M1A_PIN);
+    M1B_PORT |= (1 << M1B_PIN);
+#else
+#if DEBUG_TRACE
+    CharString_define(50, msg);
+    CharString_copyP(PSTR("rev pwm: "), &msg);
+    StringInteger_appendDecimal(motorPWM, 0, 0, &msg);
+    Console_printLineCS(&msg);
+#endif
+    // pwm pin OCR0A (PD6)
+    setupPhaseCorrectPWM();
+    OCR0A = motorPWM;
+    OCR0B = 0;
+#endif
+}
+
+// changes the duty cycle without reconfiguring the timer
+static void motorSetPWM(
+    const TachometerOdometer_direction_t dir,
+    const uint8_t motorPWM)
+{
+    if (dir == tod_forward) {
+        OCR0B = motorPWM;
+    } else {
+        OCR0A = motorPWM;
+    }
+}
+
+static void motorBrake (void) {
+    // turn off pwm
+    TCCR0A = 0;
+    TCCR0B = 0;
+    // turn on MIA and M1B
+    M1A_PORT |= (1 << M1A_PIN);
+    M1B_PORT |= (1 << M1B_PIN);
+}
+
+static void motorCoast(void) {
+    TCCR0A = 0;
+    TCCR0B = 0;
+    // turn off MIA and M1B
+    M1A_PORT &= ~(1 << M1A_PIN);
+    M1B_PORT &= ~(1 << M1B_PIN);
+}
+
+static void brakeToStop(
+    LinearMotionControl_t* _this)
+{
+    motorBrake();
+    _this->brakingForTarget = false;
+    _this->state = lmcs_brakingToStop;
+#if DEBUG_TRACE
+    Console_printLineP(PSTR("braking"));
+#endif
+}
+
+static void clearQueue(
+    LinearMotionControl_t* _this)
+{
+    _this->segmentsCount = 0;
+    if (_this->command == lmcc_moveToPosition) {
+        _this->command = lmcc_none;
+    }
+}
+
+static void handleStall(
+    LinearMotionControl_t* _this)
+{
+    clearQueue(_this);
+
+    CharString_define(40, msg);
+    CharString_appendP(PSTR("stall detected in state: "), &msg);
+    StringInteger_appendDecimal(_this->state, 1, 0, &msg);
+    Console_printLineCS(&msg);
+
+    motorCoast();
+    _this->state = lmcs_stalled;
+}
+
+static void speedRegulationNotificationCB(
+    void* clientData)
+{
+    LinearMotionControl_t* lmc = (LinearMotionControl_t*)clientData;
+    lmc->speedRegulationDue = true;
+}
+
+// PID speed regulator. The integral term is clamped to the PWM range and
+// only accumulates while the output is not saturated in the direction of
+// the error, so it doesn't wind up while the motor is starting or stalled.
+// The derivative acts on the measured speed so target changes don't kick
+static void regulateSpeed(
+    LinearMotionControl_t* _this)
+{
+    const uint16_t pps = TachometerOdometer_pulsesPerSecond(&_this->to);
+    const int16_t speed = (pps > INT16_MAX) ? INT16_MAX : pps;
+    int16_t error = (int16_t)_this->targetSpeed - speed;
+    if (error > MAX_SPEED_ERROR) {
+        error = MAX_SPEED_ERROR;
+    } else if (error < -MAX_SPEED_ERROR) {
+        error = -MAX_SPEED_ERROR;
+    }
+    int16_t speedChange = speed - _this->lastSpeed;
+    if (speedChange > MAX_SPEED_ERROR) {
+        speedChange = MAX_SPEED_ERROR;
+    } else if (speedChange < -MAX_SPEED_ERROR) {
+        speedChange = -MAX_SPEED_ERROR;
+    }
+    _this->lastSpeed = speed;
+
+    int32_t integral = _this->speedIntegral + ((int32_t)_this->speedKi * error);
+    if (integral > MAX_PWM_FIXED) {
+        integral = MAX_PWM_FIXED;
+    } else if (integral < 0) {
+        integral = 0;
+    }
+    int32_t output = integral +
+        ((int32_t)_this->speedKp * error) -
+        ((int32_t)_this->speedKd * speedChange);
+    if (output > MAX_PWM_FIXED) {
+        output = MAX_PWM_FIXED;
+        if (error > 0) {
+            integral = _this->speedIntegral;
+        }
+    } else if (output < 0) {
+        output = 0;
+        if (error < 0) {
+            integral = _this->speedIntegral;
+        }
+    }
+    _this->speedIntegral = integral;
+    _this->motorPWM = output >> 8;
+    motorSetPWM(TachometerOdometer_direction(&_this->to), _this->motorPWM);
+}
+
+static uint16_t distance(
+    const int16_t from,
+    const int16_t to)
+{
+    return (to > from) ? (to - from) : (from - to);
+}
+
+// returns how far the profile is between the approach value (0) and
+// the cruise value (255) at the current position
+static uint8_t profileLevel(
+    LinearMotionControl_t* _this)
+{
+    const int16_t pos = TachometerOdometer_position(&_this->to);
+    uint8_t level = 255;
+    const uint16_t travelled = distance(_this->startPosition, pos);
+    if (travelled < _this->profileAccelCounts) {
+        level = (((uint32_t)travelled) * 255) / _this->profileAccelCounts;
+    }
+    const uint16_t remaining = distance(pos, _this->targetPosition);
+    if (remaining < _this->profileDecelCounts) {
+        const uint8_t decelLevel =
+            (((uint32_t)remaining) * 255) / _this->profileDecelCounts;
+        if (decelLevel < level) {
+            level = decelLevel;
+        }
+    }
+    return level;
+}
+
+// the profile's speed regulator target at the current position. The
+// approach speed is kept fast enough for the tachometer to measure, or
+// the plunger would be taken for stalled
+static uint16_t profileSpeed(
+    LinearMotionControl_t* _this)
+{
+    const uint16_t cruiseSpeed = _this->cruiseSpeed;
+    uint16_t approachSpeed =
+        (((uint32_t)cruiseSpeed) * _this->profileApproachPct) / 100;
+    if (approachSpeed < MIN_PROFILE_SPEED) {
+        approachSpeed =
+            (cruiseSpeed < MIN_PROFILE_SPEED) ? cruiseSpeed : MIN_PROFILE_SPEED;
+    }
+    return approachSpeed +
+        ((((uint32_t)(cruiseSpeed - approachSpeed)) * profileLevel(_this)) / 255);
+}
+
+// the profile only shapes closed loop moves. The position based ramp
+// only advances once the plunger moves, and open loop there's nothing
+// to make it move at less than the cruise PWM, so open loop moves run
+// at the cruise PWM throughout
+static bool hasMotionProfile(
+    LinearMotionControl_t* _this)
+{
+    return (_this->cruiseSpeed != 0) &&
+        ((_this->profileAccelCounts != 0) || (_this->profileDecelCounts != 0));
+}
+
+// predicted odometer counts travelled after braking at the current speed
+static int16_t predictedBrakingDistance(
+    const TachometerOdometer_direction_t dir,
+    LinearMotionControl_t* _this)
+{
+    const uint32_t brakingDistance =
+        (((uint32_t)_this->brakeGain[dir]) *
+         TachometerOdometer_pulsesPerSecond(&_this->to)) >> 8;
+    return (brakingDistance > INT16_MAX) ? INT16_MAX : brakingDistance;
+}
+
+static void brakeForTarget(
+    LinearMotionControl_t* _this)
+{
+    const uint16_t speed = TachometerOdometer_pulsesPerSecond(&_this->to);
+    brakeToStop(_this);
+    _this->brakingForTarget = true;
+    _this->brakePosition = TachometerOdometer_position(&_this->to);
+    _this->brakeSpeed = speed;
+}
+
+// updates the braking distance model with the distance travelled after
+// braking for the target. The model is a per-direction gain (distance is
+// proportional to speed at the brake point), tracked with an exponential
+// moving average and written to EEPROM when it has moved by more
+// than 1/16
+static void learnBrakingDistance(
+    LinearMotionControl_t* _this)
+{
+    const TachometerOdometer_direction_t dir =
+        TachometerOdometer_direction(&_this->to);
+    const int16_t pos = TachometerOdometer_position(&_this->to);
+    int16_t brakingDistance;
+    if (dir == tod_forward) {
+        _this->lastOvershoot = pos - _this->targetPosition;
+        brakingDistance = pos - _this->brakePosition;
+    } else {
+        _this->lastOvershoot = _this->targetPosition - pos;
+        brakingDistance = _this->brakePosition - pos;
+    }
+    if ((_this->brakeSpeed == 0) || (brakingDistance < 0)) {
+        return;
+    }
+
+    uint32_t observed = (((uint32_t)brakingDistance) << 8) / _this->brakeSpeed;
+    if (observed > UINT16_MAX) {
+        observed = UINT16_MAX;
+    }
+    const uint16_t oldGain = _this->brakeGain[dir];
+    uint16_t gain;
+    if (oldGain == 0) {
+        // first observation
+        gain = observed;
+    } else {
+        gain = oldGain +
+            ((((int32_t)observed) - oldGain) / (1 << BRAKE_GAIN_SHIFT));
+    }
+    _this->brakeGain[dir] = gain;
+
+    const uint16_t storedGain = (dir == tod_forward)
+        ? EEPROMStorage_brakeGainFwd()
+        : EEPROMStorage_brakeGainRev();
+    const uint16_t change = (gain > storedGain)
+        ? (gain - storedGain)
+        : (storedGain - gain);
+    if (change > (storedGain / 16)) {
+        if (dir == tod_forward) {
+            EEPROMStorage_setBrakeGainFwd(gain);
+        } else {
+            EEPROMStorage_setBrakeGainRev(gain);
+        }
+    }
+}
+
+static void homePositionSensorChangeCB(
+    const bool pinState,
+    void* clientData)
+{
+    LinearMotionControl_t* lmc = (LinearMotionControl_t*)clientData;
+    TachometerOdometer_resetPositionToZero(&lmc->to);
+    lmc->foundHomePosition = true;
+    // Console_printLineP(PSTR("home"));
+}
+
+void LinearMotionControl_init(
+    const IOPortBitfield_PortSelection tachometerOdometerPort,
+    const uint8_t tachometerOdometerPin,
+    const IOPortBitfield_PortSelection homePositionSensorPort,
+    const uint8_t homePositionSensorPin,
+    LinearMotionControl_t* _this)
+{
+    _this->command = lmcc_none;
+    _this->startPosition = 0;
+    _this->targetPosition = 0;
+    _this->motorPWM = 0;
+    _this->cruiseSpeed = 0;
+    _this->profileAccelCounts = 0;
+    _this->profileDecelCounts = 0;
+    _this->profileApproachPct = 100;
+    _this->targetSpeed = 0;
+    _this->speedIntegral = 0;
+    _this->lastSpeed = 0;
+    _this->speedRegulationDue = false;
+    _this->brakeGain[tod_forward] = EEPROMStorage_brakeGainFwd();
+    _this->brakeGain[tod_reverse] = EEPROMStorage_brakeGainRev();
+    _this->brakingForTarget = false;
+    _this->brakePosition = 0;
+    _this->brakeSpeed = 0;
+    _this->lastOvershoot = 0;
+    _this->segmentsHead = 0;
+    _this->segmentsCount = 0;
+    _this->dwell = 0;
+    _this->segmentsCompleted = 0;
+    _this->completedSegmentTravel = 0;
+    _this->state = lmcs_stopped;
+    TachometerOdometer_init(tachometerOdometerPort, tachometerOdometerPin, &_this->to);
+    IOPortBitfield_init(homePositionSensorPort, homePositionSensorPin, 1, false,
+        &_this->homePositionSensorInput);
+    PinChangeMonitor_monitorPin(homePositionSensorPort, homePositionSensorPin,
+        homePositionSensorChangeCB, _this,
+        &_this->homePositionSensorInputChangeMonitor);
+    PinChangeMonitor_enable(&_this->homePositionSensorInputChangeMonitor);
+    _this->foundHomePosition = false;
+
+    // set up motor driver pins - make them outputs
+    M1A_DIR |= (1 << M1A_PIN);
+    M1B_DIR |= (1 << M1B_PIN);
+    motorCoast();
+
+    SystemTime_registerForTickNotification(SPEED_REGULATION_TICKS,
+        speedRegulationNotificationCB, _this, &_this->speedRegulationNotification);
+}
+
+bool LinearMotionControl_moveToPosition(
+    const int16_t newPosition,
+    const uint8_t motorPWM,
+    LinearMotionControl_t* _this)
+{
+    return LinearMotionControl_moveToPositionAtSpeed(newPosition, motorPWM, 0, _this);
+}
+
+bool LinearMotionControl_moveToPositionAtSpeed(
+    const int16_t newPosition,
+    const uint8_t motorPWM,
+    const uint16_t speed,
+    LinearMotionControl_t* _this)
+{
+    clearQueue(_this);
+    return LinearMotionControl_queueMove(newPosition, motorPWM, speed, 0, _this);
+}
+
+bool LinearMotionControl_queueMove(
+    const int16_t newPosition,
+    const uint8_t motorPWM,
+    const uint16_t speed,
+    const uint8_t dwell,
+    LinearMotionControl_t* _this)
+{
+    if (_this->foundHomePosition &&
+        (_this->segmentsCount < LINEARMOTIONCONTROL_QUEUE_SIZE)) {
+        LinearMotionControl_segment_t* segment = &_this->segments[
+            (_this->segmentsHead + _this->segmentsCount) % LINEARMOTIONCONTROL_QUEUE_SIZE];
+        segment->targetPosition = newPosition;
+        segment->speed = speed;
+        segment->motorPWM = motorPWM;
+        segment->dwell = dwell;
+        ++_this->segmentsCount;
+        return true;
+    }
+    return false;
+}
+
+uint8_t LinearMotionControl_segmentsCompleted(
+    LinearMotionControl_t* _this)
+{
+    return _this->segmentsCompleted;
+}
+
+int16_t LinearMotionControl_completedSegmentTravel(
+    LinearMotionControl_t* _this)
+{
+    return _this->completedSegmentTravel;
+}
+
+void LinearMotionControl_brakeToStop(
+    LinearMotionControl_t* _this)
+{
+    clearQueue(_this);
+    brakeToStop(_this);
+}
+
+bool LinearMotionControl_isStopped(
+    LinearMotionControl_t* _this)
+{
+    return ((_this->state == lmcs_stopped) &&
+            (_this->segmentsCount == 0) &&
+            (_this->command == lmcc_none)) ||
+           (_this->state == lmcs_stalled);
+}
+
+bool LinearMotionControl_isStalled(
+    LinearMotionControl_t* _this)
+{
+    return _this->state == lmcs_stalled;
+}
+
+void LinearMotionControl_findHomePosition(
+    const uint8_t motorPWM,
+    LinearMotionControl_t* _this)
+{
+    clearQueue(_this);
+    _this->foundHomePosition = false;
+    _this->command = lmcc_findHomePosition;
+    _this->motorPWM = motorPWM;
+    _this->targetSpeed = 0;
+    _this->profileAccelCounts = 0;
+    _this->profileDecelCounts = 0;
+}
+
+int16_t LinearMotionControl_position(
+    LinearMotionControl_t* _this)
+{
+    return TachometerOdometer_position(&_this->to);
+}
+uint8_t LinearMotionControl_speed(
+    LinearMotionControl_t* _this)
+{
+    return TachometerOdometer_speed(&_this->to);
+}
+
+int16_t LinearMotionControl_lastOvershoot(
+    LinearMotionControl_t* _this)
+{
+    return _this->lastOvershoot;
+}
+
+bool LinearMotionControl_homePositionIsKnown(
+    LinearMotionControl_t* _this)
+{
+    return _this->foundHomePosition;
+}
+
+static void completeSegment(
+    const int16_t position,
+    LinearMotionControl_t* _this)
+{
+    _this->completedSegmentTravel = position - _this->startPosition;
+    ++_this->segmentsCompleted;
+    if (_this->dwell != 0) {
+        SystemTime_futureTime(_this->dwell, &_this->dwellTimer);
+    }
+}
+
+// makes the next queued segment the pending command once the dwell
+// after the previous segment is over
+static void startNextSegment(
+    LinearMotionControl_t* _this)
+{
+    if ((_this->command != lmcc_none) ||
+        (_this->segmentsCount == 0) ||
+        ((_this->dwell != 0) && !SystemTime_timeHasArrived(&_this->dwellTimer))) {
+        return;
+    }
+
+    const LinearMotionControl_segment_t* segment =
+        &_this->segments[_this->segmentsHead];
+    _this->segmentsHead = (_this->segmentsHead + 1) % LINEARMOTIONCONTROL_QUEUE_SIZE;
+    --_this->segmentsCount;
+
+    _this->command = lmcc_moveToPosition;
+    _this->targetPosition = segment->targetPosition;
+    _this->motorPWM = segment->motorPWM;
+    _this->targetSpeed = segment->speed;
+    _this->cruiseSpeed = segment->speed;
+    _this->dwell = segment->dwell;
+    _this->profileAccelCounts = EEPROMStorage_profileAccelCounts();
+    _this->profileDecelCounts = EEPROMStorage_profileDecelCounts();
+    _this->profileApproachPct = EEPROMStorage_profileApproachPct();
+    if (_this->profileApproachPct > 100) {
+        _this->profileApproachPct = 100;
+    }
+    if (segment->speed != 0) {
+        _this->speedKp = EEPROMStorage_speedKp();
+        _this->speedKi = EEPROMStorage_speedKi();
+        _this->speedKd = EEPROMStorage_speedKd();
+        // start the integral at the starting PWM so there's no bump
+        _this->speedIntegral = ((int32_t)segment->motorPWM) << 8;
+        _this->lastSpeed = 0;
+    }
+}
+
+// acts on a pending command. called when stopped
+static void startCommand(
+    LinearMotionControl_t* _this)
+{
+    switch (_this->command) {
+        case lmcc_moveToPosition: {
+            // see where we are relative to new position
+            const int16_t currentPosition = TachometerOdometer_position(&_this->to);
+            _this->startPosition = currentPosition;
+            if (hasMotionProfile(_this)) {
+                _this->targetSpeed = profileSpeed(_this);
+            }
+            if (_this->targetPosition > currentPosition) {
+                // move forward
+                TachometerOdometer_setDirection(tod_forward, &_this->to);
+                motorForward(_this->motorPWM);
+                SystemTime_futureTime(MOTOR_STARTUP_TIMEOUT_TIME, &_this->timeoutTimer);
+                _this->state = lmcs_startingToMoveToPosition;
+            } else if (_this->targetPosition < currentPosition) {
+                // move reverse
+                TachometerOdometer_setDirection(tod_reverse, &_this->to);
+                motorReverse(_this->motorPWM);
+                SystemTime_futureTime(MOTOR_STARTUP_TIMEOUT_TIME, &_this->timeoutTimer);
+                _this->state = lmcs_startingToMoveToPosition;
+            } else {
+                // already there
+                completeSegment(currentPosition, _this);
+            }
+            }
+            break;
+        case lmcc_findHomePosition:
+            if (IOPortBitfield_readAsBool(&_this->homePositionSensorInput)) {
+                // carriage position is currently ahead of home position
+                // search in reverse
+                TachometerOdometer_setDirection(tod_reverse, &_this->to);
+                motorReverse(_this->motorPWM);
+            } else {
+                // carriage position is currently behind home position
+                // search forward
+                TachometerOdometer_setDirection(tod_forward, &_this->to);
+                motorForward(_this->motorPWM);
+            }
+            SystemTime_futureTime(MOTOR_STARTUP_TIMEOUT_TIME, &_this->timeoutTimer);
+            _this->state = lmcs_startingToSearchForHomePosition;
+            break;
+        default:
+            break;
+    }
+    _this->command = lmcc_none;
+}
+
+void LinearMotionControl_task(
+    LinearMotionControl_t* _this)
+{
+    if (hasMotionProfile(_this) &&
+        ((_this->state == lmcs_startingToMoveToPosition) ||
+         (_this->state == lmcs_movingToPosition))) {
+        _this->targetSpeed = profileSpeed(_this);
+    }
+    if (_this->speedRegulationDue) {
+        _this->speedRegulationDue = false;
+        if ((_this->targetSpeed != 0) &&
+            ((_this->state == lmcs_startingToMoveToPosition) ||
+             (_this->state == lmcs_movingToPosition))) {
+            regulateSpeed(_this);
+        }
+    }
+
+    switch (_this->state) {
+        case lmcs_stopped:
+            startNextSegment(_this);
+            startCommand(_this);
+            break;
+        case lmcs_startingToMoveToPosition:
+            if (TachometerOdometer_speed(&_this->to) != 0) {
+                // we have sucessfully begun moving
+                _this->state = lmcs_movingToPosition;
+            } else if (SystemTime_timeHasArrived(&_this->timeoutTimer)) {
+                // motor did not start moving in time
+                handleStall(_this);
+            }
+            break;
+        case lmcs_movingToPosition: {
+            const TachometerOdometer_direction_t dir =
+                TachometerOdometer_direction(&_this->to);
+            const int16_t pos = TachometerOdometer_position(&_this->to);
+            const int16_t remaining = (dir == tod_forward)
+                ? (_this->targetPosition - pos)
+                : (pos - _this->targetPosition);
+            // brake early by the distance we expect to travel while braking
+            if (remaining <= predictedBrakingDistance(dir, _this)) {
+#if DEBUG_TRACE
+                CharString_define(40, msg);
+                CharString_appendP(PSTR("reached "), &msg);
+                StringInteger_appendDecimal(pos, 1, 0, &msg);
+                CharString_appendP(PSTR(", target: "), &msg);
+                StringInteger_appendDecimal(_this->targetPosition, 1, 0, &msg);
+                CharString_appendP(PSTR(", speed: "), &msg);
+                StringInteger_appendDecimal(speed, 1, 0, &msg);
+                Console_printLineCS(&msg);
+#endif
+                brakeForTarget(_this);
+            } else if (TachometerOdometer_speed(&_this->to) == 0) {
+                handleStall(_this);
+            }
+            }
+            break;
+        case lmcs_brakingToStop:
+            if (TachometerOdometer_countsSinceLastPulse(&_this->to) >=
+                BRAKE_SETTLE_COUNTS) {
+                motorCoast();
+#if DEBUG_TRACE
+                CharString_define(40, msg);
+                CharString_appendP(PSTR("stopped at "), &msg);
+                StringInteger_appendDecimal(
+                    TachometerOdometer_position(&_this->to), 1, 0, &msg);
+                Console_printLineCS(&msg);
+#endif
+                _this->state = lmcs_stopped;
+                if (_this->brakingForTarget) {
+                    learnBrakingDistance(_this);
+                    completeSegment(TachometerOdometer_position(&_this->to), _this);
+                    // chain straight into the next segment
+                    startNextSegment(_this);
+                    startCommand(_this);
+                }
+            }
+            break;
+        case lmcs_startingToSearchForHomePosition:
+            if (TachometerOdometer_speed(&_this->to) != 0) {
+                // we have sucessfully begun searching
+                _this->state = lmcs_searchingForHomePosition;
+            } else if (SystemTime_timeHasArrived(&_this->timeoutTimer)) {
+                // motor did not start moving in time
+                handleStall(_this);
+            }
+            break;
+        case lmcs_searchingForHomePosition:
+            if (_this->foundHomePosition) {
+#if DEBUG_TRACE
+                CharString_define(40, msg);
+                CharString_appendP(PSTR("homing speed: "), &msg);
+                StringInteger_appendDecimal(
+                    TachometerOdometer_speed(&_this->to), 1, 0, &msg);
+                Console_printLineCS(&msg);
+#endif
+                brakeToStop(_this);
+            } else if (TachometerOdometer_speed(&_this->to) == 0) {
+                handleStall(_this);
+            }
+            break;
+        case lmcs_stalled:
+            break;
+        default:
+            break;
+    }
+}
+
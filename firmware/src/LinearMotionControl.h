@@ -1,75 +1,154 @@
-//
-//  Linear Motion Control
-//
-#ifndef LINEARMOTIONCONTROL_H
-#define LINEARMOTIONCONTROL_H
-
-#include <stdint.h>
-#include <stdbool.h>
-#include "TachometerOdometer.h"
-#include "IOPortBitfield.h"
-#include "PinChangeMonitor.h"
-#include "SystemTime.h"
-
-typedef enum {
-    lmcc_none,
-    lmcc_moveToPosition,
-    lmcc_findHomePosition
-} LinearMotionControl_command;
-
-typedef enum {
-    lmcs_stopped,
-    lmcs_startingToMoveToPosition,
-    lmcs_movingToPosition,
-    lmcs_brakingToStop,
-    lmcs_startingToSearchForHomePosition,
-    lmcs_searchingForHomePosition,
-    lmcs_stalled
-} LinearMotionControl_state;
-
-typedef struct LinearMotionControl_struct {
-    LinearMotionControl_command command;
-    int16_t targetPosition;
-    uint8_t motorPWM;
-    LinearMotionControl_state state;
-    TachometerOdometer_t to;
-    IOPortBitfield_t homePositionSensorInput;
-    PinChangeMonitor_t homePositionSensorInputChangeMonitor;
-    bool foundHomePosition;
-    SystemTime_t timeoutTimer;
-} LinearMotionControl_t;
-
-extern void LinearMotionControl_init(
-    const IOPortBitfield_PortSelection tachometerOdometerPort,
-    const uint8_t tachometerOdometerPin,
-    const IOPortBitfield_PortSelection homePositionSensorPort,
-    const uint8_t homePositionSensorPin,
-    LinearMotionControl_t* _this);
-
-extern bool LinearMotionControl_moveToPosition(
-    const int16_t newPosition,
-    const uint8_t motorPWM,    // 0 to 255
-    LinearMotionControl_t* _this);
-
-extern void LinearMotionControl_brakeToStop(
-    LinearMotionControl_t* _this);
-
-extern bool LinearMotionControl_isStopped(
-    LinearMotionControl_t* _this);
-
-extern void LinearMotionControl_findHomePosition(
-    const uint8_t motorPWM,    // 0 to 255
-    LinearMotionControl_t* _this);
-
-extern int16_t LinearMotionControl_position(
-    LinearMotionControl_t* _this);
-extern uint8_t LinearMotionControl_speed(
-    LinearMotionControl_t* _this);
-
-extern bool LinearMotionControl_homePositionIsKnown (
-    LinearMotionControl_t* _this);
-
-extern void LinearMotionControl_task(
-    LinearMotionControl_t* _this);
-
+//
+//  Linear Motion Control
+//
+#ifndef LINEARMOTIONCONTROL_H
+#define LINEARMOTIONCONTROL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "TachometerOdometer.h"
+#include "IOPortBitfield.h"
+#include "PinChangeMonitor.h"
+#include "SystemTime.h"
+
+typedef enum {
+    lmcc_none,
+    lmcc_moveToPosition,
+    lmcc_findHomePosition
+} LinearMotionControl_command;
+
+typedef enum {
+    lmcs_stopped,
+    lmcs_startingToMoveToPosition,
+    lmcs_movingToPosition,
+    lmcs_brakingToStop,
+    lmcs_startingToSearchForHomePosition,
+    lmcs_searchingForHomePosition,
+    lmcs_stalled
+} LinearMotionControl_state;
+
+// a queued move
+typedef struct LinearMotionControl_segment_struct {
+    int16_t targetPosition;
+    uint16_t speed;         // pulses per second. 0 for open loop at motorPWM
+    uint8_t motorPWM;
+    uint8_t dwell;          // hundredths of a second to wait after stopping
+} LinearMotionControl_segment_t;
+
+#define LINEARMOTIONCONTROL_QUEUE_SIZE 4
+
+typedef struct LinearMotionControl_struct {
+    LinearMotionControl_command command;
+    int16_t startPosition;
+    int16_t targetPosition;
+    uint8_t motorPWM;
+    uint16_t cruiseSpeed;
+    uint16_t profileAccelCounts;    // trapezoidal closed loop profile. both 0 for none
+    uint16_t profileDecelCounts;
+    uint8_t profileApproachPct;
+    uint16_t targetSpeed;       // pulses per second. 0 runs open loop at motorPWM
+    uint16_t speedKp;           // regulator gains. units: 1/256 pwm per pulse per second
+    uint16_t speedKi;
+    uint16_t speedKd;
+    int32_t speedIntegral;      // units: 1/256 pwm
+    int16_t lastSpeed;
+    volatile bool speedRegulationDue;
+    SystemTime_notificationDescriptor speedRegulationNotification;
+    uint16_t brakeGain[2];      // braking distance model, indexed by direction. units: 1/256 counts per pulse per second
+    bool brakingForTarget;
+    int16_t brakePosition;
+    uint16_t brakeSpeed;
+    int16_t lastOvershoot;      // final position past the target on the last move
+    LinearMotionControl_segment_t segments[LINEARMOTIONCONTROL_QUEUE_SIZE];
+    uint8_t segmentsHead;
+    uint8_t segmentsCount;
+    uint8_t dwell;              // dwell after the current segment
+    SystemTime_t dwellTimer;
+    uint8_t segmentsCompleted;  // increments (and wraps) each time a segment reaches its target
+    int16_t completedSegmentTravel;
+    LinearMotionControl_state state;
+    TachometerOdometer_t to;
+    IOPortBitfield_t homePositionSensorInput;
+    PinChangeMonitor_t homePositionSensorInputChangeMonitor;
+    bool foundHomePosition;
+    SystemTime_t timeoutTimer;
+} LinearMotionControl_t;
+
+extern void LinearMotionControl_init(
+    const IOPortBitfield_PortSelection tachometerOdometerPort,
+    const uint8_t tachometerOdometerPin,
+    const IOPortBitfield_PortSelection homePositionSensorPort,
+    const uint8_t homePositionSensorPin,
+    LinearMotionControl_t* _this);
+
+// moveToPosition and moveToPositionAtSpeed discard any queued moves and
+// move to the new position once the current move is done
+extern bool LinearMotionControl_moveToPosition(
+    const int16_t newPosition,
+    const uint8_t motorPWM,    // 0 to 255
+    LinearMotionControl_t* _this);
+
+// moves to the new position, regulating the motor PWM to hold the
+// given speed (units: tachometer pulses per second). motorPWM is the
+// starting PWM. Speed regulator gains and motion profile are taken
+// from EEPROMStorage. With a motion profile, motorPWM (open loop) or
+// speed (closed loop) is the cruise value
+extern bool LinearMotionControl_moveToPositionAtSpeed(
+    const int16_t newPosition,
+    const uint8_t motorPWM,    // 0 to 255
+    const uint16_t speed,
+    LinearMotionControl_t* _this);
+
+// adds a move to the queue. Queued moves are started one after
+// another, the next one starting in the same LinearMotionControl_task
+// call that the previous one stops (after its dwell). Returns false if
+// the queue is full or the home position is not known
+extern bool LinearMotionControl_queueMove(
+    const int16_t newPosition,
+    const uint8_t motorPWM,    // 0 to 255
+    const uint16_t speed,      // 0 for open loop
+    const uint8_t dwell,       // hundredths of a second
+    LinearMotionControl_t* _this);
+
+// number of moves that have reached their target. Wraps around
+extern uint8_t LinearMotionControl_segmentsCompleted(
+    LinearMotionControl_t* _this);
+
+// odometer counts moved during the last move that reached its target
+extern int16_t LinearMotionControl_completedSegmentTravel(
+    LinearMotionControl_t* _this);
+
+// braking also discards any queued moves
+extern void LinearMotionControl_brakeToStop(
+    LinearMotionControl_t* _this);
+
+// true when stopped (or stalled) with no moves pending
+extern bool LinearMotionControl_isStopped(
+    LinearMotionControl_t* _this);
+
+// true once a move or home search has been abandoned because the motor
+// stalled. further moves are ignored after that
+extern bool LinearMotionControl_isStalled(
+    LinearMotionControl_t* _this);
+
+extern void LinearMotionControl_findHomePosition(
+    const uint8_t motorPWM,    // 0 to 255
+    LinearMotionControl_t* _this);
+
+extern int16_t LinearMotionControl_position(
+    LinearMotionControl_t* _this);
+extern uint8_t LinearMotionControl_speed(
+    LinearMotionControl_t* _this);
+
+// odometer counts past the target the last move stopped at.
+// negative if it stopped short
+extern int16_t LinearMotionControl_lastOvershoot(
+    LinearMotionControl_t* _this);
+
+extern bool LinearMotionControl_homePositionIsKnown (
+    LinearMotionControl_t* _this);
+
+extern void LinearMotionControl_task(
+    LinearMotionControl_t* _this);
+
 #endif  /* LINEARMOTIONCONTROL_H */
\ No newline at end of file
@@ -0,0 +1,351 @@
+//
+//  Modbus RTU Slave
+//
+//  How it works:
+//      An RTU frame ends with at least 3.5 character times of silence on
+//      the line. Rather than have the main loop watch for that, every
+//      edge on RXD (PD0) is timestamped with the free-running timer 1
+//      count by pin change notification (passed on by BaudRate, whose
+//      monitor the pin has), and a one-shot system time
+//      notification is started for the silence if one isn't already
+//      pending. When it comes due it checks the time since the last
+//      edge: if there was an edge since it was started, it is restarted
+//      for the rest of the silence, otherwise the frame has ended. The
+//      last edge of a character can be as early as its start bit, so
+//      the silence is timed from there as 9 bit times plus 3.5
+//      characters, or plus the spec's fixed 1750uS above 19200 baud.
+//      Console_task drains the UART into the frame buffer, and
+//      answers the request once the end of the frame has been seen.
+//
+#include "ModbusSlave.h"
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "SystemTime.h"
+#include "EEPROMStorage.h"
+#include "CommandProcessor.h"
+#include "WaterPumpControl.h"
+#include "BaudRate.h"
+#include "Console.h"
+#include "FrameCodec.h"
+#include "UART_async.h"
+
+// address, function, 4 bytes of start and quantity, a byte count,
+// 2 bytes per register and the CRC
+#define MAX_FRAME (7 + (2 * MODBUSSLAVE_MAX_WRITE) + 2)
+#define MIN_FRAME 4
+
+// function codes
+#define FC_READ_HOLDING_REGISTERS  0x03
+#define FC_READ_INPUT_REGISTERS    0x04
+#define FC_WRITE_SINGLE_REGISTER   0x06
+#define FC_WRITE_MULTIPLE_REGISTERS 0x10
+#define FC_EXCEPTION               0x80
+
+// exception codes
+#define EX_ILLEGAL_FUNCTION     0x01
+#define EX_ILLEGAL_DATA_ADDRESS 0x02
+#define EX_ILLEGAL_DATA_VALUE   0x03
+
+// request being received. the response is built in its place
+static uint8_t frame[MAX_FRAME];
+static uint8_t frameLength;
+static bool frameOverflow;
+
+static uint16_t framesReceived;
+static uint16_t badFrames;
+
+// end of frame detection
+static SystemTime_notificationDescriptor silenceTimer;
+static volatile uint16_t lastEdgeTime;
+static volatile bool frameEnded;
+// silence that ends a frame, in timer counts, and the rate it is for
+static volatile uint16_t silenceCounts;
+static uint32_t silenceRate;
+
+static void countFrame(
+    uint16_t* count)
+{
+    if (*count != UINT16_MAX) {
+        ++*count;
+    }
+}
+
+static void silenceTimerCB(
+    void* clientData)
+{
+    const uint16_t quiet = TCNT1 - lastEdgeTime;
+    if (quiet < silenceCounts) {
+        SystemTime_registerForOneShotNotification(
+            ((silenceCounts - quiet) + (COUNTS_PER_TICK - 1)) / COUNTS_PER_TICK,
+            silenceTimerCB, NULL, &silenceTimer);
+    } else {
+        frameEnded = true;
+    }
+}
+
+void ModbusSlave_rxdChanged(void)
+{
+    lastEdgeTime = TCNT1;
+    if (!SystemTime_notificationIsPending(&silenceTimer)) {
+        SystemTime_registerForOneShotNotification(
+            (silenceCounts + (COUNTS_PER_TICK - 1)) / COUNTS_PER_TICK,
+            silenceTimerCB, NULL, &silenceTimer);
+    }
+}
+
+// times the silence for the UART's baud rate
+static void updateSilence(void)
+{
+    const uint32_t rate = BaudRate_current();
+    if (rate == silenceRate) {
+        return;
+    }
+    silenceRate = rate;
+    const uint16_t counts = (rate > 19200)
+        ? ((9UL * SYSTEMTIME_COUNTS_PER_SECOND) / rate) +
+              ((1750UL * SYSTEMTIME_COUNTS_PER_SECOND) / 1000000)
+        : (((9 + 35) * SYSTEMTIME_COUNTS_PER_SECOND) / rate);
+    char SREGSave;
+    SREGSave = SREG;
+    cli();
+    silenceCounts = counts;
+    SREG = SREGSave;
+}
+
+void ModbusSlave_Initialize(void)
+{
+    frameLength = 0;
+    frameOverflow = false;
+    framesReceived = 0;
+    badFrames = 0;
+    frameEnded = false;
+    silenceRate = 0;
+    updateSilence();
+}
+
+void ModbusSlave_discardInput(void)
+{
+    char SREGSave;
+    SREGSave = SREG;
+    cli();
+    frameEnded = false;
+    SREG = SREGSave;
+    frameLength = 0;
+    frameOverflow = false;
+}
+
+static uint16_t getWord(
+    const uint8_t index)
+{
+    return (((uint16_t)frame[index]) << 8) | frame[index + 1];
+}
+
+static void putWord(
+    const uint8_t index,
+    const uint16_t value)
+{
+    frame[index] = value >> 8;
+    frame[index + 1] = value & 0xFF;
+}
+
+static bool readInputRegister(
+    const uint8_t reg,
+    uint16_t* value)
+{
+    switch (reg) {
+        case mir_state :
+            *value = WaterPumpControl_pumpingState();
+            break;
+        case mir_position :
+            *value = (uint16_t)WaterPumpControl_plungerPosition();
+            break;
+        case mir_speed :
+            *value = WaterPumpControl_plungerSpeed();
+            break;
+        case mir_volumeRemaining :
+            *value = WaterPumpControl_volumeRemaining();
+            break;
+        case mir_flags :
+            *value = (WaterPumpControl_tankFull() ? mf_tankFull : 0) |
+                (WaterPumpControl_plungerStalled() ? mf_stalled : 0);
+            break;
+        case mir_uptimeHigh :
+            *value = SystemTime_uptime() >> 16;
+            break;
+        case mir_uptimeLow :
+            *value = SystemTime_uptime() & 0xFFFF;
+            break;
+        default :
+            return false;
+    }
+    return true;
+}
+
+// read holding or input registers. returns the response length, or an
+// exception code with the top bit set
+static uint8_t executeRead(
+    const bool holding)
+{
+    if (frameLength != 6) {
+        return FC_EXCEPTION | EX_ILLEGAL_DATA_VALUE;
+    }
+    const uint16_t start = getWord(2);
+    const uint16_t quantity = getWord(4);
+    if ((quantity == 0) || (quantity > MODBUSSLAVE_MAX_READ)) {
+        return FC_EXCEPTION | EX_ILLEGAL_DATA_VALUE;
+    }
+    const uint16_t numRegisters = holding ? mhr_numRegisters : mir_numRegisters;
+    if ((start >= numRegisters) || (quantity > (numRegisters - start))) {
+        return FC_EXCEPTION | EX_ILLEGAL_DATA_ADDRESS;
+    }
+    // the values overwrite the request
+    for (uint8_t i = 0; i < quantity; ++i) {
+        uint16_t value;
+        const bool valid = holding
+            ? CommandProcessor_readSettingRegister(start + i, &value)
+            : readInputRegister(start + i, &value);
+        if (!valid) {
+            return FC_EXCEPTION | EX_ILLEGAL_DATA_ADDRESS;
+        }
+        putWord(3 + (2 * i), value);
+    }
+    frame[2] = 2 * quantity;
+    return 3 + (2 * quantity);
+}
+
+static uint8_t executeWriteSingle(void)
+{
+    if (frameLength != 6) {
+        return FC_EXCEPTION | EX_ILLEGAL_DATA_VALUE;
+    }
+    const uint16_t reg = getWord(2);
+    if (reg >= mhr_numRegisters) {
+        return FC_EXCEPTION | EX_ILLEGAL_DATA_ADDRESS;
+    }
+    if (!CommandProcessor_writeSettingRegister(reg, getWord(4))) {
+        return FC_EXCEPTION | EX_ILLEGAL_DATA_VALUE;
+    }
+    // the response echoes the request
+    return 6;
+}
+
+static uint8_t executeWriteMultiple(void)
+{
+    if (frameLength < 7) {
+        return FC_EXCEPTION | EX_ILLEGAL_DATA_VALUE;
+    }
+    const uint16_t start = getWord(2);
+    const uint16_t quantity = getWord(4);
+    if ((quantity == 0) || (quantity > MODBUSSLAVE_MAX_WRITE) ||
+        (frame[6] != (2 * quantity)) || (frameLength != (7 + (2 * quantity)))) {
+        return FC_EXCEPTION | EX_ILLEGAL_DATA_VALUE;
+    }
+    if ((start >= mhr_numRegisters) || (quantity > (mhr_numRegisters - start))) {
+        return FC_EXCEPTION | EX_ILLEGAL_DATA_ADDRESS;
+    }
+    // check every value before writing any
+    for (uint8_t i = 0; i < quantity; ++i) {
+        if (!CommandProcessor_settingRegisterAccepts(start + i, getWord(7 + (2 * i)))) {
+            return FC_EXCEPTION | EX_ILLEGAL_DATA_VALUE;
+        }
+    }
+    for (uint8_t i = 0; i < quantity; ++i) {
+        CommandProcessor_writeSettingRegister(start + i, getWord(7 + (2 * i)));
+    }
+    // the response is the start and quantity
+    return 6;
+}
+
+static void executeFrame(void)
+{
+    if (frameOverflow || (frameLength < MIN_FRAME) ||
+        (FrameCodec_modbusCrc16(frame, frameLength) != 0)) {
+        // the CRC of a frame, CRC included, is 0
+        countFrame(&badFrames);
+        return;
+    }
+    countFrame(&framesReceived);
+    // good CRC at this rate, whoever it is for
+    BaudRate_linkConfirmed();
+
+    const uint8_t address = frame[0];
+    if ((address != MODBUSSLAVE_BROADCAST) &&
+        (address != EEPROMStorage_busAddress())) {
+        return;
+    }
+    frameLength -= 2;
+    const uint8_t function = frame[1];
+    uint8_t result;
+    switch (function) {
+        case FC_READ_HOLDING_REGISTERS :
+        case FC_READ_INPUT_REGISTERS :
+            if (address == MODBUSSLAVE_BROADCAST) {
+                // nothing to read back
+                return;
+            }
+            result = executeRead(function == FC_READ_HOLDING_REGISTERS);
+            break;
+        case FC_WRITE_SINGLE_REGISTER :
+            result = executeWriteSingle();
+            break;
+        case FC_WRITE_MULTIPLE_REGISTERS :
+            result = executeWriteMultiple();
+            break;
+        default :
+            result = FC_EXCEPTION | EX_ILLEGAL_FUNCTION;
+            break;
+    }
+    if (address == MODBUSSLAVE_BROADCAST) {
+        return;
+    }
+
+    uint8_t length = result;
+    if ((result & FC_EXCEPTION) != 0) {
+        frame[1] = function | FC_EXCEPTION;
+        frame[2] = result & ~FC_EXCEPTION;
+        length = 3;
+    }
+    const uint16_t crc = FrameCodec_modbusCrc16(frame, length);
+    frame[length++] = crc & 0xFF;
+    frame[length++] = crc >> 8;
+    Console_writeBytes(frame, length);
+}
+
+void ModbusSlave_task(void)
+{
+    updateSilence();
+
+    // the frame is what was received before its end was seen
+    bool ended;
+    char SREGSave;
+    SREGSave = SREG;
+    cli();
+    char byte;
+    while (UART_read_byte(&byte)) {
+        if (frameLength < sizeof(frame)) {
+            frame[frameLength++] = byte;
+        } else {
+            frameOverflow = true;
+        }
+    }
+    ended = frameEnded;
+    frameEnded = false;
+    SREG = SREGSave;
+
+    if (ended && ((frameLength != 0) || frameOverflow)) {
+        executeFrame();
+        frameLength = 0;
+        frameOverflow = false;
+    }
+}
+
+uint16_t ModbusSlave_framesReceived(void)
+{
+    return framesReceived;
+}
+
+uint16_t ModbusSlave_badFrames(void)
+{
+    return badFrames;
+}
@@ -0,0 +1,96 @@
+//
+//  Modbus RTU Slave
+//
+//  When the modbus setting is on, the console UART speaks Modbus RTU
+//  instead of text commands and binary protocol frames, so the pump can
+//  sit on a bus with PLCs and SCADA masters. Text output is suppressed.
+//  The slave address is the busAddr setting; requests to address 0 are
+//  broadcasts, which are carried out but not answered.
+//
+//  Supported functions:
+//      03  read holding registers      the settings, ModbusSlave_holdingRegister
+//      04  read input registers        pump status, ModbusSlave_inputRegister
+//      06  write single register
+//      16  write multiple registers    all or none are written
+//  Exceptions: 01 illegal function, 02 illegal data address (a register
+//  in the range has no value), 03 illegal data value (a bad quantity,
+//  or a value the setting doesn't accept).
+//
+//  Settings are written as "set" would: signed settings are two's
+//  complement and values outside the setting's range are rejected.
+//  Writing 0 to mhr_modbus goes back to the text console.
+//
+#ifndef MODBUSSLAVE_H
+#define MODBUSSLAVE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MODBUSSLAVE_BROADCAST 0
+
+// most registers read by one request. keeps the reply in the console's
+// transmit queue
+#define MODBUSSLAVE_MAX_READ 29
+#define MODBUSSLAVE_MAX_WRITE 27
+
+// holding registers. each is the setting of the same name
+typedef enum ModbusSlave_holdingRegister_enum {
+    mhr_inPos,
+    mhr_outPos,
+    mhr_posPerMl,
+    mhr_mlToPump,
+    mhr_motorPwm,
+    mhr_plungerSpeed,
+    mhr_speedKp,
+    mhr_speedKi,
+    mhr_speedKd,
+    mhr_accelCounts,
+    mhr_decelCounts,
+    mhr_approachPct,
+    mhr_brakeGainFwd,
+    mhr_brakeGainRev,
+    mhr_tCalOffset,
+    mhr_rebootInterval,
+    mhr_echo,
+    mhr_busAddr,
+    mhr_modbus,
+    mhr_numRegisters,
+    mhr_none = 0xFF     // for settings that don't fit in a register
+} ModbusSlave_holdingRegister;
+
+// input registers
+typedef enum ModbusSlave_inputRegister_enum {
+    mir_state,              // WaterPumpControl_state
+    mir_position,           // plunger position (odometer counts), signed
+    mir_speed,              // plunger speed (tachometer pulses per 200mS)
+    mir_volumeRemaining,    // ml
+    mir_flags,              // ModbusSlave_flag bits
+    mir_uptimeHigh,         // seconds since power-up, high word first
+    mir_uptimeLow,
+    mir_numRegisters
+} ModbusSlave_inputRegister;
+
+typedef enum ModbusSlave_flag_enum {
+    mf_tankFull = (1 << 0),
+    mf_stalled  = (1 << 1)
+} ModbusSlave_flag;
+
+// called once at power-up
+extern void ModbusSlave_Initialize (void);
+
+// times the silence after an edge on RXD. called by BaudRate from the
+// pin change interrupt in Modbus mode
+extern void ModbusSlave_rxdChanged (void);
+
+// forgets any part of a request received so far
+extern void ModbusSlave_discardInput (void);
+
+// collects received bytes, and answers a request once the silence after
+// it has been timed. called from Console_task in Modbus mode
+extern void ModbusSlave_task (void);
+
+// requests with a good CRC, and frames with a bad one. saturate at 65535
+extern uint16_t ModbusSlave_framesReceived (void);
+extern uint16_t ModbusSlave_badFrames (void);
+
+#endif  // MODBUSSLAVE_H
@@ -0,0 +1,105 @@
+//
+//  Profiler
+//
+#include "Profiler.h"
+
+#include <string.h>
+#include <avr/interrupt.h>
+#include "SystemTime.h"
+
+#if PROFILING
+
+Profiler_stats Profiler_itemStats[pi_numItems];
+
+static bool passStarted;
+static uint16_t passStart;     // timer counts at the start of this pass
+static uint16_t taskStart;     // timer counts at the end of the last task
+
+static const char systemTimeTaskP[]      PROGMEM = "sys";
+static const char waterPumpControlTaskP[] PROGMEM = "pump";
+static const char consoleTaskP[]         PROGMEM = "con";
+static const char statusStreamTaskP[]    PROGMEM = "stream";
+static const char mainLoopP[]            PROGMEM = "loop";
+static const char timer1CompAP[]         PROGMEM = "compA";
+static const char timer1CompBP[]         PROGMEM = "compB";
+static const char timer1CaptP[]          PROGMEM = "capt";
+static const char eeReadyP[]             PROGMEM = "eeReady";
+
+static PGM_P const itemNames[pi_numItems] PROGMEM = {
+    systemTimeTaskP,
+    waterPumpControlTaskP,
+    consoleTaskP,
+    statusStreamTaskP,
+    mainLoopP,
+    timer1CompAP,
+    timer1CompBP,
+    timer1CaptP,
+    eeReadyP
+};
+
+static void resetStats(
+    Profiler_stats* stats)
+{
+    memset(stats, 0, sizeof(Profiler_stats));
+    stats->min = UINT16_MAX;
+}
+
+void Profiler_Initialize (void)
+{
+    passStarted = false;
+    Profiler_reset();
+}
+
+void Profiler_beginPass (void)
+{
+    const uint16_t now = SystemTime_timerCounts();
+    if (passStarted) {
+        Profiler_record(pi_mainLoop, now - passStart);
+    }
+    passStarted = true;
+    passStart = now;
+    taskStart = now;
+}
+
+void Profiler_endTask (
+    const Profiler_item task)
+{
+    const uint16_t now = SystemTime_timerCounts();
+    Profiler_record(task, now - taskStart);
+    taskStart = now;
+}
+
+PGM_P Profiler_itemName (
+    const Profiler_item item)
+{
+    return (PGM_P)pgm_read_ptr(&itemNames[item]);
+}
+
+void Profiler_getStats (
+    const Profiler_item item,
+    const bool reset,
+    Profiler_stats* stats)
+{
+    // interrupt handlers update their own stats
+    char SREGSave;
+    SREGSave = SREG;
+    cli();
+    *stats = Profiler_itemStats[item];
+    if (reset) {
+        resetStats(&Profiler_itemStats[item]);
+    }
+    SREG = SREGSave;
+}
+
+void Profiler_reset (void)
+{
+    for (uint8_t i = 0; i < pi_numItems; ++i) {
+        char SREGSave;
+        SREGSave = SREG;
+        cli();
+        resetStats(&Profiler_itemStats[i]);
+        SREG = SREGSave;
+    }
+}
+
+#endif  // PROFILING
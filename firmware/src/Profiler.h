@@ -0,0 +1,134 @@
+//
+//  Profiler
+//
+//  Measures the time spent in each main loop task, each whole pass
+//  through the main loop, and each interrupt handler, in timer 1 counts
+//  (units: 1/SYSTEMTIME_COUNTS_PER_SECOND, 3.2uS). Task times include
+//  any interrupt handlers that ran during the task.
+//
+//  For each item it keeps the number of samples, min, total and max, and
+//  a histogram with bins a factor of four apart: under 4 counts, under
+//  16, under 64, under 256, under 1024 and the rest. When an item's
+//  sample count reaches PROFILER_COUNT_LIMIT its count, total and
+//  histogram are halved, so sampling carries on with older samples
+//  weighing less.
+//
+//  Profiling is built in unless PROFILING is 0 (make PROFILING=0), so
+//  that prof can show task starvation on a pump in service. The stats
+//  take about 200 bytes of RAM. Without it the calls compile to nothing,
+//  and interrupt handlers don't pay for it.
+//
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#ifndef PROFILING
+#define PROFILING 1
+#endif
+
+#define PROFILER_HISTOGRAM_BINS 6
+#define PROFILER_COUNT_LIMIT INT16_MAX
+
+typedef enum Profiler_item_enum {
+    // main loop tasks
+    pi_systemTimeTask,
+    pi_waterPumpControlTask,
+    pi_consoleTask,
+    pi_statusStreamTask,
+    pi_mainLoop,            // a whole pass through the main loop
+    // interrupt handlers
+    pi_timer1CompA,
+    pi_timer1CompB,
+    pi_timer1Capt,
+    pi_eeReady,
+    pi_numItems
+} Profiler_item;
+
+typedef struct Profiler_stats_struct {
+    uint16_t count;
+    uint16_t min;
+    uint16_t max;
+    uint32_t total;
+    uint16_t histogram[PROFILER_HISTOGRAM_BINS];
+} Profiler_stats;
+
+#if PROFILING
+
+// for Profiler_record(). use the functions below to read the stats
+extern Profiler_stats Profiler_itemStats[pi_numItems];
+
+extern void Profiler_Initialize (void);
+
+// call at the top of the main loop. Records the time since the last call
+// as a main loop pass
+extern void Profiler_beginPass (void);
+
+// call after each main loop task. Records the time since the end of the
+// last task, or since the start of the pass
+extern void Profiler_endTask (
+    const Profiler_item task);
+
+// adds a sample. Interrupt handlers call it with interrupts disabled;
+// inline so that they don't have to save the registers a call clobbers
+static inline void Profiler_record (
+    const Profiler_item item,
+    const uint16_t counts)
+{
+    Profiler_stats* stats = &Profiler_itemStats[item];
+    if (stats->count == PROFILER_COUNT_LIMIT) {
+        stats->count >>= 1;
+        stats->total >>= 1;
+        for (uint8_t bin = 0; bin < PROFILER_HISTOGRAM_BINS; ++bin) {
+            stats->histogram[bin] >>= 1;
+        }
+    }
+    ++stats->count;
+    stats->total += counts;
+    if (counts < stats->min) {
+        stats->min = counts;
+    }
+    if (counts > stats->max) {
+        stats->max = counts;
+    }
+    uint8_t bin = 0;
+    uint16_t binLimit = 4;
+    while ((bin < (PROFILER_HISTOGRAM_BINS - 1)) && (counts >= binLimit)) {
+        ++bin;
+        binLimit <<= 2;
+    }
+    ++stats->histogram[bin];
+}
+
+// put Profiler_isrBegin() at the top of an interrupt handler and
+// Profiler_isrEnd() at the bottom
+#define Profiler_isrBegin() const uint16_t profilerISRStart = TCNT1
+#define Profiler_isrEnd(item) Profiler_record((item), TCNT1 - profilerISRStart)
+
+// returns the item's name, as used by the prof command
+extern PGM_P Profiler_itemName (
+    const Profiler_item item);
+
+// copies an item's stats, and resets them if reset is true
+extern void Profiler_getStats (
+    const Profiler_item item,
+    const bool reset,
+    Profiler_stats* stats);
+
+// resets all the stats
+extern void Profiler_reset (void);
+
+#else
+
+#define Profiler_Initialize()
+#define Profiler_beginPass()
+#define Profiler_endTask(task)
+#define Profiler_isrBegin()
+#define Profiler_isrEnd(item)
+
+#endif  // PROFILING
+
+#endif  // PROFILER_H
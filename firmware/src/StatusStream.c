@@ -0,0 +1,182 @@
+//
+//  Status Stream
+//
+#include "StatusStream.h"
+
+#include <avr/pgmspace.h>
+#include "SystemTime.h"
+#include "Console.h"
+#include "JSONWriter.h"
+#include "WaterPumpControl.h"
+#include "BinaryProtocol.h"
+
+// events waiting to be written. must be a power of 2
+#define EVENT_QUEUE_SIZE 4
+
+static uint8_t streamFields;    // 0 when not streaming
+static bool streamBinary;
+static SystemTime_notificationDescriptor intervalNotification;
+static volatile bool recordDue;
+
+static StatusStream_event eventQueue[EVENT_QUEUE_SIZE];
+static uint8_t eventQueueHead;
+static uint8_t eventQueueCount;
+
+static const char homeFoundP[]   PROGMEM = "home";
+static const char strokeStartP[] PROGMEM = "strokeStart";
+static const char strokeEndP[]   PROGMEM = "strokeEnd";
+static const char stallP[]       PROGMEM = "stall";
+
+// indexed by StatusStream_event - 1
+static PGM_P const eventNames[] PROGMEM = {
+    homeFoundP,
+    strokeStartP,
+    strokeEndP,
+    stallP
+};
+
+// longest text of each part of a record, including the member name
+// and comma
+#define BRACES_LENGTH 4     // {} and CR LF
+#define EVENT_LENGTH 19     // "e":"strokeStart",
+#define TIME_LENGTH 18      // "t":"D:HH:MM:SS",
+#define POS_LENGTH 11       // "p":-32768,
+#define SPEED_LENGTH 8      // "s":255,
+#define VOL_LENGTH 10       // "v":65535
+
+// data of a binary record with all fields: event, fields, t, p, s, v
+#define BINARY_RECORD_DATA 12
+
+static void intervalNotificationCB(
+    void* clientData)
+{
+    recordDue = true;
+}
+
+void StatusStream_Initialize (void)
+{
+    streamFields = 0;
+    streamBinary = false;
+    recordDue = false;
+    eventQueueHead = 0;
+    eventQueueCount = 0;
+}
+
+void StatusStream_start (
+    const uint16_t intervalMs,
+    const uint8_t fields,
+    const bool binary)
+{
+    streamFields = fields;
+    streamBinary = binary;
+    recordDue = true;   // first record right away
+    SystemTime_registerForTickNotification(
+        ((uint32_t)intervalMs * SYSTEMTIME_TICKS_PER_SECOND) / 1000,
+        intervalNotificationCB, NULL, &intervalNotification);
+}
+
+void StatusStream_stop (void)
+{
+    SystemTime_cancelNotification(&intervalNotification);
+    streamFields = 0;
+    recordDue = false;
+    eventQueueCount = 0;
+}
+
+void StatusStream_notifyEvent (
+    const StatusStream_event event)
+{
+    if ((streamFields != 0) && (eventQueueCount < EVENT_QUEUE_SIZE)) {
+        eventQueue[(eventQueueHead + eventQueueCount) & (EVENT_QUEUE_SIZE - 1)] = event;
+        ++eventQueueCount;
+    }
+}
+
+// records are binary if the stream was started with a binary request,
+// or a host has polled in binary since, when text would be dropped
+static bool binaryRecords(void)
+{
+    return streamBinary || Console_binaryMode();
+}
+
+static uint8_t recordLength(
+    const StatusStream_event event,
+    const bool binary)
+{
+    if (binary) {
+        return BINARYPROTOCOL_FRAME_SIZE(BINARY_RECORD_DATA);
+    }
+    uint8_t length = BRACES_LENGTH;
+    if (event != se_none) {
+        length += EVENT_LENGTH;
+    }
+    if (streamFields & sf_time) {
+        length += TIME_LENGTH;
+    }
+    if (streamFields & sf_pos) {
+        length += POS_LENGTH;
+    }
+    if (streamFields & sf_speed) {
+        length += SPEED_LENGTH;
+    }
+    if (streamFields & sf_vol) {
+        length += VOL_LENGTH;
+    }
+    return length;
+}
+
+// writes a record if it fits in the UART output now. returns false if
+// it didn't
+static bool writeRecord(
+    const StatusStream_event event)
+{
+    const bool binary = binaryRecords();
+    if (!Console_hasRoomFor(recordLength(event, binary))) {
+        return false;
+    }
+    if (binary) {
+        BinaryProtocol_beginStreamRecord(event, streamFields);
+    }
+    // in a binary record the event is in the header
+    JSONWriter_beginObject(NULL);
+    if ((event != se_none) && !binary) {
+        JSONWriter_stringValueP(PSTR("e"),
+            (PGM_P)pgm_read_ptr(&eventNames[event - 1]));
+    }
+    if (streamFields & sf_time) {
+        SystemTime_t curTime;
+        SystemTime_getCurrentTime(&curTime);
+        JSONWriter_timeValue(PSTR("t"), &curTime);
+    }
+    if (streamFields & sf_pos) {
+        JSONWriter_intValue(PSTR("p"), WaterPumpControl_plungerPosition());
+    }
+    if (streamFields & sf_speed) {
+        JSONWriter_intValue(PSTR("s"), WaterPumpControl_plungerSpeed());
+    }
+    if (streamFields & sf_vol) {
+        JSONWriter_intValue(PSTR("v"), WaterPumpControl_volumeRemaining());
+    }
+    JSONWriter_endObject();
+    if (binary) {
+        BinaryProtocol_endStreamRecord();
+    }
+    return true;
+}
+
+void StatusStream_task (void)
+{
+    if (streamFields == 0) {
+        return;
+    }
+    if (eventQueueCount != 0) {
+        if (writeRecord(eventQueue[eventQueueHead])) {
+            eventQueueHead = (eventQueueHead + 1) & (EVENT_QUEUE_SIZE - 1);
+            --eventQueueCount;
+            // the event record has the current status too
+            recordDue = false;
+        }
+    } else if (recordDue && writeRecord(se_none)) {
+        recordDue = false;
+    }
+}
@@ -0,0 +1,68 @@
+//
+//  Status Stream
+//
+//  Pushes a compact status record to the console at a fixed interval,
+//  and immediately when the pump changes state, so the host doesn't
+//  have to poll with the s command. Records are JSON with one letter
+//  member names:
+//      e   event that caused the record, if any
+//      t   time, D:HH:MM:SS
+//      p   plunger position (odometer counts)
+//      s   plunger speed (tachometer pulses per 200mS)
+//      v   volume remaining to pump (ml)
+//
+//  Records are binary protocol stream records instead if the stream was
+//  started with a binary request, or while the console is in binary
+//  mode (see Console_binaryMode).
+//
+//  A record is only written when it can go to the UART whole. Periodic
+//  records that come due while the UART is busy are merged into one.
+//
+#ifndef STATUSSTREAM_H
+#define STATUSSTREAM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// fields of a record. bits for StatusStream_start()
+typedef enum StatusStream_field_enum {
+    sf_time  = (1 << 0),
+    sf_pos   = (1 << 1),
+    sf_speed = (1 << 2),
+    sf_vol   = (1 << 3)
+} StatusStream_field;
+
+#define STATUSSTREAM_DEFAULT_FIELDS (sf_pos | sf_speed | sf_vol)
+
+// interval limits, in milliseconds
+#define STATUSSTREAM_MIN_INTERVAL 50
+#define STATUSSTREAM_MAX_INTERVAL 10000
+
+typedef enum StatusStream_event_enum {
+    se_none,
+    se_homeFound,
+    se_strokeStart,
+    se_strokeEnd,
+    se_stall
+} StatusStream_event;
+
+extern void StatusStream_Initialize (void);
+
+// starts streaming the given fields every intervalMs milliseconds,
+// replacing any stream already running. binary streams send binary
+// protocol stream records instead of JSON
+extern void StatusStream_start (
+    const uint16_t intervalMs,
+    const uint8_t fields,
+    const bool binary);
+
+extern void StatusStream_stop (void);
+
+// queues a record for an event. ignored unless streaming
+extern void StatusStream_notifyEvent (
+    const StatusStream_event event);
+
+// called in each iteration of the mainloop
+extern void StatusStream_task (void);
+
+#endif  // STATUSSTREAM_H
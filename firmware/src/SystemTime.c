@@ -1,322 +1,443 @@
-//
-//  System Time
-//
-//  Uses AtMega328P 16 bit timer/counter 1
-//
-#include "SystemTime.h"
-
-#include <avr/io.h>
-#include <avr/interrupt.h>
-#include <avr/wdt.h>
-#include <avr/power.h>
-#include <avr/sleep.h>
-#include "StringInteger.h"
-#include "Console.h"
-#include "EEPROMStorage.h"
-
-#define DEBUG_TRACE 1
-
-static volatile uint8_t tickCounter;
-static volatile SystemTime_t currentTime;
-static volatile uint32_t secondsSinceStartup;
-static int32_t timeAdjustment;
-static bool shuttingDown;
-static volatile SystemTime_notificationDescriptor *rootNotificationDesc;
-#if TICK_STATS
-static volatile uint8_t ticksPerMainloop = 0;
-static uint8_t minTicksPerMainloop;
-static uint8_t maxTicksPerMainloop;
-static volatile uint8_t maxCountsPerTick;
-#endif
-
-void SystemTime_Initialize (void)
-{
-    tickCounter = 0;
-    currentTime.seconds = 0;
-    currentTime.hundredths = 0;
-    secondsSinceStartup = 0;
-    timeAdjustment = 0;
-    shuttingDown = false;
-    rootNotificationDesc = NULL;
-
-#if TICK_STATS
-    ticksPerMainloop = 0;
-    minTicksPerMainloop = 255;
-    maxTicksPerMainloop = 0;
-    maxCountsPerTick = 0;
-#endif
-
-    // set up timer1 to fire interrupt at SYSTEMTIME_TICKS_PER_SECOND
-    TCCR1B = (TCCR1B & 0xF8) | 3; // prescale by 64
-    TCCR1B = (TCCR1B & 0xE7) | (1 << 3); // set CTC mode
-    OCR1A = (F_CPU / 64) / SYSTEMTIME_TICKS_PER_SECOND;
-    TCNT1 = 0;  // start the time counter at 0
-    TIFR1 |= (1 << OCF1A);  // "clear" the timer compare flag
-    TIMSK1 |= (1 << OCIE1A);// enable timer compare match interrupt
-}
-
-void SystemTime_registerForTickNotification(
-    const uint16_t scaleFactor,
-    SystemTime_TickNotificationCB notificationCB,
-    void* notificationData,
-    SystemTime_notificationDescriptor* notificationDesc)
-{
-    notificationDesc->next = rootNotificationDesc;
-    notificationDesc->scaleFactor = scaleFactor;
-    notificationDesc->numTicksRemaining = 1;
-    notificationDesc->notificationCB = notificationCB;
-    notificationDesc->notificationData = notificationData;
-    rootNotificationDesc = notificationDesc;
-}
-
-void SystemTime_getCurrentTime (
-    SystemTime_t *curTime)
-{
-    // we disable interrupts during read of secondsSinceReset because
-    // it is updated in an interrupt handler
-    char SREGSave;
-    SREGSave = SREG;
-    cli();
-    curTime->seconds = currentTime.seconds;
-    curTime->hundredths = currentTime.hundredths;
-    SREG = SREGSave;
-}
-
-uint32_t SystemTime_uptime (void)
-{
-    uint32_t uptime;
-
-    char SREGSave;
-    SREGSave = SREG;
-    cli();
-    uptime = secondsSinceStartup;
-    SREG = SREGSave;
-
-    return uptime;
-}
-
-/*
-void SystemTime_setTimeAdjustment (
-    const uint32_t *newTime)
-{
-    char SREGSave;
-    SREGSave = SREG;
-    cli();
-    timeAdjustment = *newTime - currentTime.seconds;
-    SREG = SREGSave;
-#if DEBUG_TRACE
-    {
-        CharString_define(20, msg);
-        CharString_copyP(PSTR("Tadj: "), &msg);
-        StringUtils_appendDecimal32(timeAdjustment, 1, 0, &msg);
-        Console_printCS(&msg);
-    }
-#endif
-}
-
-void SystemTime_applyTimeAdjustment ()
-{
-    char SREGSave;
-
-    SREGSave = SREG;
-    cli();
-    currentTime.seconds += timeAdjustment;
-    timeAdjustment = 0;
-    SREG = SREGSave;
-}
-
-void SystemTime_sleepFor (
-    const uint16_t seconds)
-{
-    uint32_t calibratedSeconds = 
-        (((uint32_t)seconds) * EEPROMStorage_watchdogTimerCal()) / 100;
-    uint16_t secondsRemaining = calibratedSeconds;
-    while (secondsRemaining > 0) {
-        uint8_t wdtTimeout;
-        uint8_t secondsThisLoop;
-        if (secondsRemaining >= 8) {
-            wdtTimeout = WDTO_8S;
-            secondsThisLoop = 8;
-        } else if (secondsRemaining >= 4) {
-            wdtTimeout = WDTO_4S;
-            secondsThisLoop = 4;
-        } else if (secondsRemaining >= 2) {
-            wdtTimeout = WDTO_2S;
-            secondsThisLoop = 2;
-        } else {
-            wdtTimeout = WDTO_1S;
-            secondsThisLoop = 1;
-        }
-        secondsRemaining -= secondsThisLoop;
-        wdt_enable(wdtTimeout);
-        WDTCSR |= (1 << WDIE);
-        set_sleep_mode(SLEEP_MODE_PWR_DOWN);
-        cli();
-        sleep_enable();
-        sleep_bod_disable();
-
-        sei();
-        sleep_cpu();
-        sleep_disable();
-        sei();
-    }
-    cli();
-    currentTime.seconds += seconds;
-    secondsSinceStartup += seconds;
-    sei();
-}
-*/
-void SystemTime_commenceShutdown (void)
-{
-    if (!shuttingDown) {
-        shuttingDown = true;
-        // store reboot time
-        SystemTime_t curTime;
-        SystemTime_getCurrentTime(&curTime);
-        curTime.seconds += timeAdjustment;    // apply time adjustment
-        curTime.seconds += 8;  // account for watchdog time
-
-        Console_printP(PSTR("shutting down..."));
-        wdt_enable(WDTO_8S);
-        wdt_reset();
-    }
-}
-
-bool SystemTime_shuttingDown (void)
-{
-    return shuttingDown;
-}
-
-void SystemTime_task (void)
-{
-    // reset the watchdog timer
-    if (shuttingDown) {
-//        LED_OUTPORT |= (1 << LED_PIN);
-    } else {
-        wdt_reset();
-
-        // reboot if it's been more than the stored reboot interval
-        // since startup
-        const uint32_t uptime = SystemTime_uptime();
-        const uint32_t rebootIntervalSeconds =
-            (((uint32_t)EEPROMStorage_rebootInterval()) * 60);
-        if (uptime > rebootIntervalSeconds) {
-            SystemTime_commenceShutdown();
-        }
-
-#if TICK_STATS
-        char SREGSave;
-        SREGSave = SREG;
-        cli();
-        // update tick count status
-        if (ticksPerMainloop < minTicksPerMainloop) {
-            minTicksPerMainloop = ticksPerMainloop;
-        }
-        if (ticksPerMainloop > maxTicksPerMainloop) {
-            maxTicksPerMainloop = ticksPerMainloop;
-        }
-        ticksPerMainloop = 0;
-        SREG = SREGSave;
-#endif
-    }
-}
-
-uint8_t SystemTime_timerCounts(void)
-{
-    return TCNT1;
-}
-
-uint8_t SystemTime_dayOfWeek (
-    const SystemTime_t *time)
-{
-    return (time->seconds / 86400L) % 7;
-}
-
-uint8_t SystemTime_hours (
-    const SystemTime_t *time)
-{
-    return (time->seconds / 3600) % 24;
-}
-
-uint8_t SystemTime_minutes (
-    const SystemTime_t *time)
-{
-    return (time->seconds / 60) % 60;
-}
-
-uint8_t SystemTime_seconds (
-    const SystemTime_t *time)
-{
-    return time->seconds % 60;
-}
-
-void SystemTime_appendToString (
-    const SystemTime_t *time,
-    CharString_t* timeString)
-{
-    // append day of week
-    StringInteger_appendDecimal(SystemTime_dayOfWeek(time), 1, 0, timeString);
-    CharString_appendP(PSTR(":"), timeString);
-
-    // append hours
-    StringInteger_appendDecimal(SystemTime_hours(time), 2, 0, timeString);
-    CharString_appendP(PSTR(":"), timeString);
-
-    // append minutes
-    StringInteger_appendDecimal(SystemTime_minutes(time), 2, 0, timeString);
-    CharString_appendP(PSTR(":"), timeString);
-
-    // append seconds
-    StringInteger_appendDecimal(SystemTime_seconds(time), 2, 0, timeString);
-}
-
-#if TICK_STATS
-void SystemTime_getTickStats(
-    uint8_t* minTicks,
-    uint8_t* maxTicks,
-    uint8_t* maxCounts)
-{
-    *minTicks = minTicksPerMainloop;
-    *maxTicks = maxTicksPerMainloop;
-    *maxCounts = maxCountsPerTick;
-    minTicksPerMainloop = 255;
-    maxTicksPerMainloop = 0;
-    maxCountsPerTick = 0;
-}
-#endif
-
-ISR(TIMER1_COMPA_vect, ISR_BLOCK)
-{
-    ++tickCounter;
-    if (tickCounter >= (SYSTEMTIME_TICKS_PER_SECOND / 100)) {
-        tickCounter = 0;
-        ++currentTime.hundredths;
-        if (currentTime.hundredths >= 100) {
-            currentTime.hundredths = 0;
-            ++currentTime.seconds;
-            ++secondsSinceStartup;
-        }
-    }
-
-    volatile SystemTime_notificationDescriptor* next = rootNotificationDesc;
-    while (next != NULL) {
-        if (--next->numTicksRemaining == 0) {
-            next->numTicksRemaining = next->scaleFactor;
-            next->notificationCB(next->notificationData);
-        }
-        next = next->next;
-    }
-
-#if TICK_STATS
-    if (ticksPerMainloop < 255) {
-        ++ticksPerMainloop;
-    }
-    if (TCNT0 > maxCountsPerTick) {
-        maxCountsPerTick = TCNT0;
-    }
-#endif
-}
-
-ISR(WDT_vect, ISR_BLOCK)
-{
-}
+//
+//  System Time
+//
+//  Uses AtMega328P 16 bit timer/counter 1
+//
+#include "SystemTime.h"
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+#include <avr/power.h>
+#include <avr/sleep.h>
+#include "StringInteger.h"
+#include "Console.h"
+#include "EEPROMStorage.h"
+#include "Profiler.h"
+
+#define DEBUG_TRACE 1
+
+// the clock is advanced by timer 1 compare match A every hundredth
+// of a second. Tick notifications are serviced by compare match B, which
+// is reprogrammed to the deadline of the first pending notification.
+#define COUNTS_PER_HUNDREDTH (SYSTEMTIME_COUNTS_PER_SECOND / 100)
+// longest step compare match B is programmed for, so that the 16 bit
+// compare register never has to represent more than half a wraparound
+#define MAX_NOTIFICATION_STEP 0x8000
+
+static volatile SystemTime_t currentTime;
+static volatile uint32_t secondsSinceStartup;
+static int32_t timeAdjustment;
+static bool shuttingDown;
+static SystemTime_notificationDescriptor *rootNotificationDesc;
+static uint16_t notificationBase;   // timer counts that rootNotificationDesc->countsRemaining is measured from
+static uint16_t notificationStep;   // counts past notificationBase that compare match B is programmed for
+
+void SystemTime_Initialize (void)
+{
+    currentTime.seconds = 0;
+    currentTime.hundredths = 0;
+    secondsSinceStartup = 0;
+    timeAdjustment = 0;
+    shuttingDown = false;
+    rootNotificationDesc = NULL;
+    notificationBase = 0;
+    notificationStep = 0;
+
+    // set up timer1 to fire interrupt every hundredth of a second.
+    // the timer free-runs (normal mode) and the ISR advances OCR1A,
+    // so the count can also be used for input capture timestamps
+    // and for scheduling notifications on compare match B
+    TCCR1A = 0;
+    TCCR1B = (TCCR1B & 0xF8) | 3; // prescale by 64
+    TCCR1B = (TCCR1B & 0xE7);     // set normal mode
+    OCR1A = COUNTS_PER_HUNDREDTH;
+    TCNT1 = 0;  // start the time counter at 0
+    TIFR1 |= (1 << OCF1A);  // "clear" the timer compare flag
+    TIMSK1 |= (1 << OCIE1A);// enable timer compare match interrupt
+}
+
+// links the descriptor into the pending list. offset is in timer counts
+// relative to notificationBase. must be called with interrupts disabled
+static void insertNotification(
+    uint32_t offset,
+    SystemTime_notificationDescriptor* notificationDesc)
+{
+    SystemTime_notificationDescriptor** link = &rootNotificationDesc;
+    while ((*link != NULL) && ((*link)->countsRemaining <= offset)) {
+        offset -= (*link)->countsRemaining;
+        link = &(*link)->next;
+    }
+    notificationDesc->countsRemaining = offset;
+    notificationDesc->next = *link;
+    if (*link != NULL) {
+        (*link)->countsRemaining -= offset;
+    }
+    *link = notificationDesc;
+    notificationDesc->pending = true;
+}
+
+// removes the descriptor from the pending list. its remaining counts are
+// handed on to the descriptor after it. must be called with interrupts disabled
+static void removeNotification(
+    SystemTime_notificationDescriptor* notificationDesc)
+{
+    SystemTime_notificationDescriptor** link = &rootNotificationDesc;
+    while (*link != NULL) {
+        if (*link == notificationDesc) {
+            *link = notificationDesc->next;
+            if (*link != NULL) {
+                (*link)->countsRemaining += notificationDesc->countsRemaining;
+            }
+            break;
+        }
+        link = &(*link)->next;
+    }
+    notificationDesc->pending = false;
+    if (rootNotificationDesc == NULL) {
+        TIMSK1 &= ~(1 << OCIE1B);
+    }
+}
+
+static void programNotificationCompare(void)
+{
+    const uint32_t countsRemaining = rootNotificationDesc->countsRemaining;
+    notificationStep = (countsRemaining < MAX_NOTIFICATION_STEP)
+        ? countsRemaining
+        : MAX_NOTIFICATION_STEP;
+    OCR1B = notificationBase + notificationStep;
+}
+
+static void startNotification(
+    const uint16_t ticks,
+    const uint16_t scaleFactor,
+    SystemTime_TickNotificationCB notificationCB,
+    void* notificationData,
+    SystemTime_notificationDescriptor* notificationDesc)
+{
+    char SREGSave;
+    SREGSave = SREG;
+    cli();
+    if (notificationDesc->pending) {
+        removeNotification(notificationDesc);
+    }
+    notificationDesc->scaleFactor = scaleFactor;
+    notificationDesc->notificationCB = notificationCB;
+    notificationDesc->notificationData = notificationData;
+
+    const uint16_t now = TCNT1;
+    if (rootNotificationDesc == NULL) {
+        notificationBase = now;
+        TIFR1 |= (1 << OCF1B);  // "clear" the timer compare flag
+        TIMSK1 |= (1 << OCIE1B);
+    }
+    // at least one tick, so the compare value is always in the future
+    const uint32_t offset = ((uint16_t)(now - notificationBase)) +
+        (((uint32_t)((ticks != 0) ? ticks : 1)) * COUNTS_PER_TICK);
+    insertNotification(offset, notificationDesc);
+    if (rootNotificationDesc == notificationDesc) {
+        // new first deadline
+        programNotificationCompare();
+    }
+    SREG = SREGSave;
+}
+
+void SystemTime_registerForTickNotification(
+    const uint16_t scaleFactor,
+    SystemTime_TickNotificationCB notificationCB,
+    void* notificationData,
+    SystemTime_notificationDescriptor* notificationDesc)
+{
+    startNotification(scaleFactor, scaleFactor,
+        notificationCB, notificationData, notificationDesc);
+}
+
+void SystemTime_registerForOneShotNotification(
+    const uint16_t ticks,
+    SystemTime_TickNotificationCB notificationCB,
+    void* notificationData,
+    SystemTime_notificationDescriptor* notificationDesc)
+{
+    startNotification(ticks, 0,
+        notificationCB, notificationData, notificationDesc);
+}
+
+void SystemTime_cancelNotification(
+    SystemTime_notificationDescriptor* notificationDesc)
+{
+    // a cancelled first notification leaves compare match B programmed
+    // for its deadline. that just causes one early wakeup, since the
+    // next descriptor inherits its remaining counts
+    char SREGSave;
+    SREGSave = SREG;
+    cli();
+    if (notificationDesc->pending) {
+        removeNotification(notificationDesc);
+    }
+    SREG = SREGSave;
+}
+
+bool SystemTime_notificationIsPending(
+    const SystemTime_notificationDescriptor* notificationDesc)
+{
+    return notificationDesc->pending;
+}
+
+void SystemTime_getCurrentTime (
+    SystemTime_t *curTime)
+{
+    // we disable interrupts during read of secondsSinceReset because
+    // it is updated in an interrupt handler
+    char SREGSave;
+    SREGSave = SREG;
+    cli();
+    curTime->seconds = currentTime.seconds;
+    curTime->hundredths = currentTime.hundredths;
+    SREG = SREGSave;
+}
+
+uint32_t SystemTime_uptime (void)
+{
+    uint32_t uptime;
+
+    char SREGSave;
+    SREGSave = SREG;
+    cli();
+    uptime = secondsSinceStartup;
+    SREG = SREGSave;
+
+    return uptime;
+}
+
+/*
+void SystemTime_setTimeAdjustment (
+    const uint32_t *newTime)
+{
+    char SREGSave;
+    SREGSave = SREG;
+    cli();
+    timeAdjustment = *newTime - currentTime.seconds;
+    SREG = SREGSave;
+#if DEBUG_TRACE
+    {
+        CharString_define(20, msg);
+        CharString_copyP(PSTR("Tadj: "), &msg);
+        StringUtils_appendDecimal32(timeAdjustment, 1, 0, &msg);
+        Console_printCS(&msg);
+    }
+#endif
+}
+
+void SystemTime_applyTimeAdjustment ()
+{
+    char SREGSave;
+
+    SREGSave = SREG;
+    cli();
+    currentTime.seconds += timeAdjustment;
+    timeAdjustment = 0;
+    SREG = SREGSave;
+}
+
+void SystemTime_sleepFor (
+    const uint16_t seconds)
+{
+    uint32_t calibratedSeconds = 
+        (((uint32_t)seconds) * EEPROMStorage_watchdogTimerCal()) / 100;
+    uint16_t secondsRemaining = calibratedSeconds;
+    while (secondsRemaining > 0) {
+        uint8_t wdtTimeout;
+        uint8_t secondsThisLoop;
+        if (secondsRemaining >= 8) {
+            wdtTimeout = WDTO_8S;
+            secondsThisLoop = 8;
+        } else if (secondsRemaining >= 4) {
+            wdtTimeout = WDTO_4S;
+            secondsThisLoop = 4;
+        } else if (secondsRemaining >= 2) {
+            wdtTimeout = WDTO_2S;
+            secondsThisLoop = 2;
+        } else {
+            wdtTimeout = WDTO_1S;
+            secondsThisLoop = 1;
+        }
+        secondsRemaining -= secondsThisLoop;
+        wdt_enable(wdtTimeout);
+        WDTCSR |= (1 << WDIE);
+        set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+        cli();
+        sleep_enable();
+        sleep_bod_disable();
+
+        sei();
+        sleep_cpu();
+        sleep_disable();
+        sei();
+    }
+    cli();
+    currentTime.seconds += seconds;
+    secondsSinceStartup += seconds;
+    sei();
+}
+*/
+void SystemTime_commenceShutdown (void)
+{
+    if (!shuttingDown) {
+        shuttingDown = true;
+        // store reboot time
+        SystemTime_t curTime;
+        SystemTime_getCurrentTime(&curTime);
+        curTime.seconds += timeAdjustment;    // apply time adjustment
+        curTime.seconds += 8;  // account for watchdog time
+
+        Console_printP(PSTR("shutting down..."));
+        // make sure settings are in EEPROM before the reset
+        EEPROMStorage_flush();
+        wdt_enable(WDTO_8S);
+        wdt_reset();
+    }
+}
+
+bool SystemTime_shuttingDown (void)
+{
+    return shuttingDown;
+}
+
+void SystemTime_task (void)
+{
+    // reset the watchdog timer
+    if (shuttingDown) {
+//        LED_OUTPORT |= (1 << LED_PIN);
+    } else {
+        wdt_reset();
+
+        // reboot if it's been more than the stored reboot interval
+        // since startup
+        const uint32_t uptime = SystemTime_uptime();
+        const uint32_t rebootIntervalSeconds =
+            (((uint32_t)EEPROMStorage_rebootInterval()) * 60);
+        if (uptime > rebootIntervalSeconds) {
+            SystemTime_commenceShutdown();
+        }
+
+    }
+}
+
+uint16_t SystemTime_timerCounts(void)
+{
+    uint16_t counts;
+
+    // 16 bit timer register read uses the shared TEMP register
+    char SREGSave;
+    SREGSave = SREG;
+    cli();
+    counts = TCNT1;
+    SREG = SREGSave;
+
+    return counts;
+}
+
+uint8_t SystemTime_dayOfWeek (
+    const SystemTime_t *time)
+{
+    return (time->seconds / 86400L) % 7;
+}
+
+uint8_t SystemTime_hours (
+    const SystemTime_t *time)
+{
+    return (time->seconds / 3600) % 24;
+}
+
+uint8_t SystemTime_minutes (
+    const SystemTime_t *time)
+{
+    return (time->seconds / 60) % 60;
+}
+
+uint8_t SystemTime_seconds (
+    const SystemTime_t *time)
+{
+    return time->seconds % 60;
+}
+
+void SystemTime_appendToString (
+    const SystemTime_t *time,
+    CharString_t* timeString)
+{
+    // append day of week
+    StringInteger_appendDecimal(SystemTime_dayOfWeek(time), 1, 0, timeString);
+    CharString_appendP(PSTR(":"), timeString);
+
+    // append hours
+    StringInteger_appendDecimal(SystemTime_hours(time), 2, 0, timeString);
+    CharString_appendP(PSTR(":"), timeString);
+
+    // append minutes
+    StringInteger_appendDecimal(SystemTime_minutes(time), 2, 0, timeString);
+    CharString_appendP(PSTR(":"), timeString);
+
+    // append seconds
+    StringInteger_appendDecimal(SystemTime_seconds(time), 2, 0, timeString);
+}
+
+ISR(TIMER1_COMPA_vect, ISR_BLOCK)
+{
+    Profiler_isrBegin();
+
+    // schedule the next hundredth
+    OCR1A += COUNTS_PER_HUNDREDTH;
+
+    ++currentTime.hundredths;
+    if (currentTime.hundredths >= 100) {
+        currentTime.hundredths = 0;
+        ++currentTime.seconds;
+        ++secondsSinceStartup;
+    }
+
+    Profiler_isrEnd(pi_timer1CompA);
+}
+
+ISR(TIMER1_COMPB_vect, ISR_BLOCK)
+{
+    Profiler_isrBegin();
+
+    // the compare flag can be left over from a compare value that was
+    // replaced by an earlier deadline, so check the time rather than
+    // trusting the flag. this also services deadlines that the callbacks
+    // made us miss (they won't match again until wraparound)
+    while ((rootNotificationDesc != NULL) &&
+           ((uint16_t)(TCNT1 - notificationBase) >= notificationStep)) {
+        TIFR1 |= (1 << OCF1B);  // "clear" the timer compare flag
+        notificationBase += notificationStep;
+        rootNotificationDesc->countsRemaining -= notificationStep;
+
+        // notify everything that is due
+        while ((rootNotificationDesc != NULL) &&
+               (rootNotificationDesc->countsRemaining == 0)) {
+            SystemTime_notificationDescriptor* due = rootNotificationDesc;
+            rootNotificationDesc = due->next;
+            if (due->scaleFactor != 0) {
+                // periodic. next deadline is measured from this deadline
+                // so the period does not drift
+                insertNotification(
+                    ((uint32_t)due->scaleFactor) * COUNTS_PER_TICK, due);
+            } else {
+                due->pending = false;
+            }
+            due->notificationCB(due->notificationData);
+        }
+
+        if (rootNotificationDesc == NULL) {
+            TIMSK1 &= ~(1 << OCIE1B);
+        } else {
+            programNotificationCompare();
+        }
+    }
+
+    Profiler_isrEnd(pi_timer1CompB);
+}
+
+ISR(WDT_vect, ISR_BLOCK)
+{
+}
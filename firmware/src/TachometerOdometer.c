@@ -1,113 +1,203 @@
-//
-//  Tachometer and Odometer
-//
-//  How it works:
-//      Registers for pin change notification on the sensor pin to detect
-//      shaft motion. Also registers for system tick notification to get
-//      speed (the number of sensor pin pulses during a tick notification
-//      interval is the speed). The interval is 200mS
-//
-
-#include "TachometerOdometer.h"
-
-#include <avr/interrupt.h>
-
-static void pinChangeNotificationCB(
-    const bool pinState,
-    void* clientData)
-{
-    if (!pinState) {    // only counting falling edges
-        TachometerOdometer_t* to = (TachometerOdometer_t*)clientData;
-        if (to->pulsesThisInterval < 255) {
-            ++to->pulsesThisInterval;
-        }
-        if (to->dir == tod_forward) {
-            ++to->position;
-        } else {
-            --to->position;
-        }
-    }
-}
-
-void intervalNotificationCB(
-    void* clientData)
-{
-    TachometerOdometer_t* to = (TachometerOdometer_t*)clientData;
-    to->speed = to->pulsesThisInterval;
-    to->pulsesThisInterval = 0;
-}
-
-void TachometerOdometer_init(
-    const IOPortBitfield_PortSelection sensorPort,
-    const uint8_t sensorPin,
-    TachometerOdometer_t* _this)
-{
-    _this->pulsesThisInterval = 0;
-    _this->speed = 0;
-    _this->dir = tod_forward;
-    _this->position = 0;
-    PinChangeMonitor_monitorPin(sensorPort, sensorPin,
-        pinChangeNotificationCB, _this, &_this->sensorPinChanges);
-    PinChangeMonitor_enable(&_this->sensorPinChanges);
-    SystemTime_registerForTickNotification(SYSTEMTIME_TICKS_PER_SECOND / 5,
-        intervalNotificationCB, _this, &_this->intervalNotification);
-}
-
-void TachometerOdometer_setDirection(
-    const TachometerOdometer_direction_t dir,
-    volatile TachometerOdometer_t* _this)
-{
-    // we disable interrupts during setting of direction because
-    // it is read in an interrupt handler
-    char SREGSave;
-    SREGSave = SREG;
-    cli();
-    _this->dir = dir;
-    SREG = SREGSave;
-}
-
-void TachometerOdometer_resetPositionToZero(
-    volatile TachometerOdometer_t* _this)
-{
-    // we disable interrupts during clearing of position because
-    // it is updated in an interrupt handler
-    char SREGSave;
-    SREGSave = SREG;
-    cli();
-    _this->position = 0;
-    SREG = SREGSave;
-}
-
-TachometerOdometer_direction_t TachometerOdometer_direction(
-    volatile TachometerOdometer_t* _this)
-{
-    return _this->dir;
-}
-
-int16_t TachometerOdometer_position(
-    volatile TachometerOdometer_t* _this)
-{
-    int16_t pos;
-    // we disable interrupts during read of position because
-    // it is updated in an interrupt handler
-    char SREGSave;
-    SREGSave = SREG;
-    cli();
-    pos = _this->position;
-    SREG = SREGSave;
-    return pos;
-}
-
-uint8_t TachometerOdometer_speed(
-    volatile TachometerOdometer_t* _this)
-{
-    uint8_t speed;
-    // we disable interrupts during read of speed because
-    // it is updated in an interrupt handler
-    char SREGSave;
-    SREGSave = SREG;
-    cli();
-    speed = _this->speed;
-    SREG = SREGSave;
-    return speed;
-}
+//
+//  Tachometer and Odometer
+//
+//  How it works:
+//      Timestamps each falling edge of the sensor with the free-running
+//      timer 1 count. Speed is the reciprocal of the time between the last
+//      two edges. When the sensor is on PB0 (ICP1) the input capture unit
+//      latches the timestamp in hardware and the capture interrupt only has
+//      to record it. Otherwise pin change notification is used and the
+//      timer is read in the notification callback.
+//      Also registers for system tick notification to detect when the shaft
+//      has stopped (no pulse for 200mS)
+//
+
+#include "TachometerOdometer.h"
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "Profiler.h"
+
+// how often the stopped check runs
+#define INTERVAL_TICKS (SYSTEMTIME_TICKS_PER_SECOND / 50)
+// number of intervals without a pulse after which the shaft is considered
+// stopped (200mS). Must be shorter than the 16 bit timer wraparound (~210mS)
+#define STOPPED_INTERVALS 10
+
+#define ICP1_PIN PB0
+
+// the tachometer/odometer that owns the input capture unit
+static volatile TachometerOdometer_t* inputCaptureTO = NULL;
+
+static void recordPulse(
+    const uint16_t pulseTime,
+    volatile TachometerOdometer_t* to)
+{
+    if (to->intervalsSinceLastPulse < STOPPED_INTERVALS) {
+        to->pulsePeriod = pulseTime - to->lastPulseTime;
+    }
+    to->lastPulseTime = pulseTime;
+    to->intervalsSinceLastPulse = 0;
+    if (to->dir == tod_forward) {
+        ++to->position;
+    } else {
+        --to->position;
+    }
+}
+
+static void pinChangeNotificationCB(
+    const bool pinState,
+    void* clientData)
+{
+    if (!pinState) {    // only counting falling edges
+        recordPulse(TCNT1, (TachometerOdometer_t*)clientData);
+    }
+}
+
+void intervalNotificationCB(
+    void* clientData)
+{
+    TachometerOdometer_t* to = (TachometerOdometer_t*)clientData;
+    if (to->intervalsSinceLastPulse < STOPPED_INTERVALS) {
+        if (++to->intervalsSinceLastPulse == STOPPED_INTERVALS) {
+            to->pulsePeriod = 0;
+        }
+    }
+}
+
+void TachometerOdometer_init(
+    const IOPortBitfield_PortSelection sensorPort,
+    const uint8_t sensorPin,
+    TachometerOdometer_t* _this)
+{
+    _this->lastPulseTime = 0;
+    _this->pulsePeriod = 0;
+    _this->intervalsSinceLastPulse = STOPPED_INTERVALS;
+    _this->dir = tod_forward;
+    _this->position = 0;
+    if ((sensorPort == IOPortBitfield_ps_b) && (sensorPin == ICP1_PIN) &&
+        (inputCaptureTO == NULL)) {
+        inputCaptureTO = _this;
+        DDRB &= ~(1 << ICP1_PIN);
+        TCCR1B |= (1 << ICNC1);     // enable input capture noise canceler
+        TCCR1B &= ~(1 << ICES1);    // capture on falling edge
+        TIFR1 |= (1 << ICF1);       // "clear" the input capture flag
+        TIMSK1 |= (1 << ICIE1);     // enable input capture interrupt
+    } else {
+        PinChangeMonitor_monitorPin(sensorPort, sensorPin,
+            pinChangeNotificationCB, _this, &_this->sensorPinChanges);
+        PinChangeMonitor_enable(&_this->sensorPinChanges);
+    }
+    SystemTime_registerForTickNotification(INTERVAL_TICKS,
+        intervalNotificationCB, _this, &_this->intervalNotification);
+}
+
+void TachometerOdometer_setDirection(
+    const TachometerOdometer_direction_t dir,
+    volatile TachometerOdometer_t* _this)
+{
+    // we disable interrupts during setting of direction because
+    // it is read in an interrupt handler
+    char SREGSave;
+    SREGSave = SREG;
+    cli();
+    _this->dir = dir;
+    SREG = SREGSave;
+}
+
+void TachometerOdometer_resetPositionToZero(
+    volatile TachometerOdometer_t* _this)
+{
+    // we disable interrupts during clearing of position because
+    // it is updated in an interrupt handler
+    char SREGSave;
+    SREGSave = SREG;
+    cli();
+    _this->position = 0;
+    SREG = SREGSave;
+}
+
+TachometerOdometer_direction_t TachometerOdometer_direction(
+    volatile TachometerOdometer_t* _this)
+{
+    return _this->dir;
+}
+
+int16_t TachometerOdometer_position(
+    volatile TachometerOdometer_t* _this)
+{
+    int16_t pos;
+    // we disable interrupts during read of position because
+    // it is updated in an interrupt handler
+    char SREGSave;
+    SREGSave = SREG;
+    cli();
+    pos = _this->position;
+    SREG = SREGSave;
+    return pos;
+}
+
+// returns the time between the last two pulses, or the time since the
+// last pulse if that is longer (the shaft is slowing down). returns 0
+// when stopped
+static uint16_t pulsePeriod(
+    volatile TachometerOdometer_t* _this)
+{
+    uint16_t period;
+    uint16_t sinceLastPulse;
+    // we disable interrupts during read of period because
+    // it is updated in an interrupt handler
+    char SREGSave;
+    SREGSave = SREG;
+    cli();
+    period = _this->pulsePeriod;
+    sinceLastPulse = TCNT1 - _this->lastPulseTime;
+    SREG = SREGSave;
+    if ((period != 0) && (sinceLastPulse > period)) {
+        period = sinceLastPulse;
+    }
+    return period;
+}
+
+uint8_t TachometerOdometer_speed(
+    volatile TachometerOdometer_t* _this)
+{
+    const uint16_t period = pulsePeriod(_this);
+    if (period == 0) {
+        return 0;
+    }
+    const uint16_t speed = (SYSTEMTIME_COUNTS_PER_SECOND / 5) / period;
+    return (speed > 255) ? 255 : speed;
+}
+
+uint16_t TachometerOdometer_pulsesPerSecond(
+    volatile TachometerOdometer_t* _this)
+{
+    const uint16_t period = pulsePeriod(_this);
+    if (period == 0) {
+        return 0;
+    }
+    const uint32_t pps = SYSTEMTIME_COUNTS_PER_SECOND / period;
+    return (pps > 65535) ? 65535 : pps;
+}
+
+uint16_t TachometerOdometer_countsSinceLastPulse(
+    volatile TachometerOdometer_t* _this)
+{
+    uint16_t sinceLastPulse = 65535;
+    char SREGSave;
+    SREGSave = SREG;
+    cli();
+    if (_this->intervalsSinceLastPulse < STOPPED_INTERVALS) {
+        sinceLastPulse = TCNT1 - _this->lastPulseTime;
+    }
+    SREG = SREGSave;
+    return sinceLastPulse;
+}
+
+ISR(TIMER1_CAPT_vect, ISR_BLOCK)
+{
+    Profiler_isrBegin();
+    recordPulse(ICR1, inputCaptureTO);
+    Profiler_isrEnd(pi_timer1Capt);
+}
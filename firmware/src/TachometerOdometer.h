@@ -1,61 +1,76 @@
-//
-//  Tachometer and Odometer
-//
-//  What it does:
-//      counts pulses from a sensor on a motor shaft to measure speed
-//      and position. Position is simply number of shaft rotations.
-//      The sensor is expected to generate pin changes.
-//
-//  How to use it:
-//      define a TachometerOdometer "object" and construct it
-//
-//      // example - define a tachometer/odometer for sensor on pin PB1
-//      TachometerOdometer_t* to;
-//      TachometerOdometer_init(IOPortBitfield_ps_b, 1, &to);
-//
-
-#ifndef TACHOMETERODOMETER_H
-#define TACHOMETERODOMETER_H
-
-#include <stdint.h>
-#include <stdbool.h>
-#include "PinChangeMonitor.h"
-#include "SystemTime.h"
-
-typedef enum TachometerOdometer_direction_enum {
-    tod_forward,    // increasing position
-    tod_reverse     // decreasing position
-} TachometerOdometer_direction_t;
-
-typedef struct TachometerOdometer_struct {
-    uint8_t pulsesThisInterval;
-    uint8_t speed;
-    TachometerOdometer_direction_t dir;
-    int16_t position;
-    PinChangeMonitor_t sensorPinChanges;
-    SystemTime_notificationDescriptor intervalNotification;
-} TachometerOdometer_t;
-
-// direction defaults to d_forward
-extern void TachometerOdometer_init(
-    const IOPortBitfield_PortSelection sensorPort,
-    const uint8_t sensorPin,
-    TachometerOdometer_t* _this);
-
-extern void TachometerOdometer_setDirection(
-    const TachometerOdometer_direction_t dir,
-    volatile TachometerOdometer_t* _this);
-
-extern void TachometerOdometer_resetPositionToZero(
-    volatile TachometerOdometer_t* _this);
-
-extern TachometerOdometer_direction_t TachometerOdometer_direction(
-    volatile TachometerOdometer_t* _this);
-
-extern int16_t TachometerOdometer_position(
-    volatile TachometerOdometer_t* _this);
-
-extern uint8_t TachometerOdometer_speed(
-    volatile TachometerOdometer_t* _this);
-
-#endif      /* TACHOMETERODOMETER_H */
+//
+//  Tachometer and Odometer
+//
+//  What it does:
+//      counts pulses from a sensor on a motor shaft to measure speed
+//      and position. Position is simply number of shaft rotations.
+//      Speed is measured from the time between successive pulses, so it
+//      is updated on every pulse.
+//      The sensor is expected to generate pin changes. If the sensor is on
+//      PB0 (ICP1) the timer 1 input capture unit timestamps the pulses,
+//      otherwise pin change notification is used.
+//
+//  How to use it:
+//      define a TachometerOdometer "object" and construct it
+//
+//      // example - define a tachometer/odometer for sensor on pin PB1
+//      TachometerOdometer_t* to;
+//      TachometerOdometer_init(IOPortBitfield_ps_b, 1, &to);
+//
+
+#ifndef TACHOMETERODOMETER_H
+#define TACHOMETERODOMETER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "PinChangeMonitor.h"
+#include "SystemTime.h"
+
+typedef enum TachometerOdometer_direction_enum {
+    tod_forward,    // increasing position
+    tod_reverse     // decreasing position
+} TachometerOdometer_direction_t;
+
+typedef struct TachometerOdometer_struct {
+    uint16_t lastPulseTime;         // timer 1 counts at last falling edge
+    uint16_t pulsePeriod;           // timer 1 counts between the last two falling edges. 0 when stopped
+    uint8_t intervalsSinceLastPulse;
+    TachometerOdometer_direction_t dir;
+    int16_t position;
+    PinChangeMonitor_t sensorPinChanges;
+    SystemTime_notificationDescriptor intervalNotification;
+} TachometerOdometer_t;
+
+// direction defaults to d_forward
+extern void TachometerOdometer_init(
+    const IOPortBitfield_PortSelection sensorPort,
+    const uint8_t sensorPin,
+    TachometerOdometer_t* _this);
+
+extern void TachometerOdometer_setDirection(
+    const TachometerOdometer_direction_t dir,
+    volatile TachometerOdometer_t* _this);
+
+extern void TachometerOdometer_resetPositionToZero(
+    volatile TachometerOdometer_t* _this);
+
+extern TachometerOdometer_direction_t TachometerOdometer_direction(
+    volatile TachometerOdometer_t* _this);
+
+extern int16_t TachometerOdometer_position(
+    volatile TachometerOdometer_t* _this);
+
+// units: pulses per 200mS
+extern uint8_t TachometerOdometer_speed(
+    volatile TachometerOdometer_t* _this);
+
+// units: pulses per second
+extern uint16_t TachometerOdometer_pulsesPerSecond(
+    volatile TachometerOdometer_t* _this);
+
+// timer 1 counts since the last pulse (units: 1/SYSTEMTIME_COUNTS_PER_SECOND).
+// returns 65535 when stopped
+extern uint16_t TachometerOdometer_countsSinceLastPulse(
+    volatile TachometerOdometer_t* _this);
+
+#endif      /* TACHOMETERODOMETER_H */
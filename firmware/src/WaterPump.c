@@ -1,56 +1,72 @@
-//
-//  Water Pump Controller
-//
-//  This program controls a water pump that uses a linear actuator to push
-//  and pull a syringe plunger.
-//
-//
-#include <inttypes.h>
-#include <avr/interrupt.h>
-#include <avr/wdt.h>
-
-#include "intlimit.h"
-#include "SystemTime.h"
-#include "EEPROMStorage.h"
-#include "Console.h"
-#include "PinChangeMonitor.h"
-#include "WaterPumpControl.h"
-#include "RAMSentinel.h"
-
-/** Configures the board hardware and chip peripherals for the demo's functionality. */
-static void Initialize (void)
-{
-    // enable watchdog timer
-    wdt_enable(WDTO_500MS);
-
-    SystemTime_Initialize();
-    EEPROMStorage_Initialize();
-    Console_Initialize();
-    PinChangeMonitor_Initialize();
-    WaterPumpControl_Initialize();
-    RAMSentinel_Initialize();
-}
- 
-int main (void)
-{
-    Initialize();
-
-    sei();
-
-    for (;;) {
-        // run all the tasks
-        SystemTime_task();
-        WaterPumpControl_task();
-        Console_task();
-
-        if (!RAMSentinel_sentinelIntact()) {
-            SystemTime_commenceShutdown();
-        }
-
-#if COUNT_MAJOR_CYCLES
-        ++majorCycleCounter;
-#endif
-    }
-
-    return (0);
-}
+//
+//  Water Pump Controller
+//
+//  This program controls a water pump that uses a linear actuator to push
+//  and pull a syringe plunger.
+//
+//
+#include <inttypes.h>
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+
+#include "intlimit.h"
+#include "SystemTime.h"
+#include "EEPROMStorage.h"
+#include "Console.h"
+#include "BinaryProtocol.h"
+#include "PinChangeMonitor.h"
+#include "BaudRate.h"
+#include "ModbusSlave.h"
+#include "WaterPumpControl.h"
+#include "StatusStream.h"
+#include "RAMSentinel.h"
+#include "Profiler.h"
+
+/** Configures the board hardware and chip peripherals for the demo's functionality. */
+static void Initialize (void)
+{
+    // enable watchdog timer
+    wdt_enable(WDTO_500MS);
+
+    SystemTime_Initialize();
+    EEPROMStorage_Initialize();
+    Console_Initialize();
+    BinaryProtocol_Initialize();
+    PinChangeMonitor_Initialize();
+    BaudRate_Initialize();
+    ModbusSlave_Initialize();
+    WaterPumpControl_Initialize();
+    StatusStream_Initialize();
+    RAMSentinel_Initialize();
+    Profiler_Initialize();
+}
+ 
+int main (void)
+{
+    Initialize();
+
+    sei();
+
+    for (;;) {
+        // run all the tasks
+        Profiler_beginPass();
+        SystemTime_task();
+        Profiler_endTask(pi_systemTimeTask);
+        WaterPumpControl_task();
+        Profiler_endTask(pi_waterPumpControlTask);
+        Console_task();
+        Profiler_endTask(pi_consoleTask);
+        StatusStream_task();
+        Profiler_endTask(pi_statusStreamTask);
+
+        if (!RAMSentinel_sentinelIntact()) {
+            SystemTime_commenceShutdown();
+        }
+
+#if COUNT_MAJOR_CYCLES
+        ++majorCycleCounter;
+#endif
+    }
+
+    return (0);
+}
@@ -1,183 +1,335 @@
-//
-//  Water Pump Control
-//
-//  Uses pin PC4 for water level float sensor (QTR-1A reflectance sensor)
-//
-#include "WaterPumpControl.h"
-
-#include "avr/io.h"
-#include "LinearMotionControl.h"
-#include "EEPROMStorage.h"
-
-#include "Console.h"
-#include "StringInteger.h"
-#include "MSVS_AVR.h"
-#define DEBUG_TRACE 1
-
-#define FLOAT_SENSOR_DIR DDRC
-#define FLOAT_SENSOR_INPORT PINC
-#define FLOAT_SENSOR_OUTPORT PORTC
-#define FLOAT_SENSOR_PIN PC4
-
-typedef enum pumpingState_enum {
-    ps_idle,
-    ps_findingHomePosition,
-    ps_drawingWaterIn,
-    ps_pushingWaterOut
-} pumpingState;
-
-static bool floatSensorLast;
-
-static pumpingState state;
-static bool runPump;
-static uint16_t volumeRemainingToPump;   // units: ml
-static int16_t plungerOutPosition;
-static LinearMotionControl_t syringePlunger;
-
-// returns true when the float sensor is actuated (float ball in range)
-static bool readFloatSensor(void)
-{
-    return (FLOAT_SENSOR_INPORT & (1 << FLOAT_SENSOR_PIN)) == 0;
-}
-
-void WaterPumpControl_Initialize(void)
-{
-    // set up float sensor pin
-    FLOAT_SENSOR_DIR &= ~(1 << FLOAT_SENSOR_PIN);
-    // enable pull-up in case sensor is disconnected
-    FLOAT_SENSOR_OUTPORT |= (1 << FLOAT_SENSOR_PIN);
-    floatSensorLast = false;
-
-    state = ps_idle;
-    runPump = false;
-    volumeRemainingToPump = 0;
-
-    LinearMotionControl_init(
-        IOPortBitfield_ps_b, 0, // tachometer/odomerter sensor pin
-        IOPortBitfield_ps_d, 2, // home position sensor pin
-        &syringePlunger);
-}
-
-void WaterPumpControl_beginPumping(void)
-{
-    if (!runPump) {
-#if DEBUG_TRACE
-        Console_printLineP(PSTR("starting pump"));
-#endif
-        volumeRemainingToPump = EEPROMStorage_mlToPump();
-        runPump = true;
-    }
-}
-
-void WaterPumpControl_endPumping(void)
-{
-    runPump = false;
-}
-
-void WaterPumpControl_stopNow(void)
-{
-    LinearMotionControl_brakeToStop(&syringePlunger);
-    runPump = false;
-    state = ps_idle;
-}
-
-void WaterPumpControl_movePlungerTo(
-    const int16_t pos)
-{
-    LinearMotionControl_moveToPosition(pos, EEPROMStorage_motorPwm(), &syringePlunger);
-}
-
-int16_t WaterPumpControl_plungerPosition(void)
-{
-    return LinearMotionControl_position(&syringePlunger);
-}
-
-uint8_t WaterPumpControl_plungerSpeed(void)
-{
-    return LinearMotionControl_speed(&syringePlunger);
-}
-
-uint16_t WaterPumpControl_volumeRemaining(void)
-{
-    return volumeRemainingToPump;
-}
-
-void WaterPumpControl_task(void)
-{
-    // check float sensor
-    const bool floatSensor = readFloatSensor();
-    if (floatSensor != floatSensorLast) {
-        // float sensor state changed
-        floatSensorLast = floatSensor;
-
-        if (floatSensor) {
-            // float sensor actuated
-            WaterPumpControl_beginPumping();
-        }
-    }
-
-    switch (state) {
-        case ps_idle:
-            if (runPump) {
-                if (!LinearMotionControl_homePositionIsKnown(&syringePlunger)) {
-                    LinearMotionControl_findHomePosition(EEPROMStorage_motorPwm(), &syringePlunger);
-                    state = ps_findingHomePosition;
-                } else {
-                    LinearMotionControl_moveToPosition(
-                        EEPROMStorage_plungerOutPos(), EEPROMStorage_motorPwm(), &syringePlunger);
-                    state = ps_drawingWaterIn;
-                }
-            }
-            break;
-        case ps_findingHomePosition:
-            if (LinearMotionControl_homePositionIsKnown(&syringePlunger) &&
-                LinearMotionControl_isStopped(&syringePlunger)) {
-                LinearMotionControl_moveToPosition(
-                    EEPROMStorage_plungerOutPos(), EEPROMStorage_motorPwm(), &syringePlunger);
-                state = ps_drawingWaterIn;
-            }
-            break;
-        case ps_drawingWaterIn:
-            if (LinearMotionControl_isStopped(&syringePlunger) &&
-                (LinearMotionControl_position(&syringePlunger) <=
-                    EEPROMStorage_plungerOutPos())) {
-                plungerOutPosition = LinearMotionControl_position(&syringePlunger);
-                LinearMotionControl_moveToPosition(
-                    EEPROMStorage_plungerInPos(), EEPROMStorage_motorPwm(), &syringePlunger);
-                state = ps_pushingWaterOut;
-            }
-            break;
-        case ps_pushingWaterOut:
-            if (LinearMotionControl_isStopped(&syringePlunger) &&
-                (LinearMotionControl_position(&syringePlunger) >=
-                    EEPROMStorage_plungerInPos())) {
-                const int16_t plungerTravel =
-                    LinearMotionControl_position(&syringePlunger) - plungerOutPosition;
-                const uint16_t volumePumped = plungerTravel / EEPROMStorage_posPerMl();
-
-                if (volumePumped > volumeRemainingToPump) {
-                    volumeRemainingToPump = 0;
-                    runPump = false;
-                } else {
-                    volumeRemainingToPump -= volumePumped;
-                }
-#if DEBUG_TRACE
-                CharString_define(40, msg);
-                CharString_appendP(PSTR("pumped "), &msg);
-                StringInteger_appendDecimal(volumePumped, 1, 0, &msg);
-                CharString_appendP(PSTR(" ml"), &msg);
-                Console_printLineCS(&msg);
-#endif
-                if (runPump) {
-                    LinearMotionControl_moveToPosition(
-                        EEPROMStorage_plungerOutPos(), EEPROMStorage_motorPwm(), &syringePlunger);
-                    state = ps_drawingWaterIn;
-                } else {
-                    state = ps_idle;
-                }
-            }
-            break;
-    }
-
-    LinearMotionControl_task(&syringePlunger);
-}
+//
+//  Water Pump Control
+//
+//  Uses pin PC4 for water level float sensor (QTR-1A reflectance sensor)
+//
+#include "WaterPumpControl.h"
+
+#include "avr/io.h"
+#include "LinearMotionControl.h"
+#include "EEPROMStorage.h"
+#include "StatusStream.h"
+
+#include "Console.h"
+#include "StringInteger.h"
+#include "MSVS_AVR.h"
+#define DEBUG_TRACE 1
+
+#define FLOAT_SENSOR_DIR DDRC
+#define FLOAT_SENSOR_INPORT PINC
+#define FLOAT_SENSOR_OUTPORT PORTC
+#define FLOAT_SENSOR_PIN PC4
+
+// hundredths of a second between drawing water in and pushing it out.
+// braking to a stop already waits for the motor to stop turning
+#define PLUNGER_REVERSAL_DWELL 0
+
+static bool floatSensorLast;
+static bool plungerStalledLast;
+
+static WaterPumpControl_state state;
+static bool runPump;
+static uint16_t volumeRemainingToPump;   // units: ml
+static uint8_t plungerSegmentsCompleted;
+
+// volume accounting. Plunger travel is converted to 16.16 fixed point ml
+// with a reciprocal of posPerMl cached when the settings change, and the
+// fraction of a ml that doesn't make a whole one is carried over to the
+// next stroke. Per stroke there are only multiplies and shifts
+static uint16_t scalePosPerMl;      // posPerMl the scale was computed for
+static uint8_t scaleSettingsGeneration;
+static uint16_t mlPerCountWhole;    // units: 1/65536 ml per odometer count
+static uint16_t mlPerCountFraction; // units: 1/2^32 ml per odometer count
+static uint16_t mlFractionCarry;    // units: 1/2^32 ml
+static uint16_t mlCarry;            // units: 1/65536 ml, less than a whole ml
+static bool finalStroke;            // stroke is sized for the remaining volume
+static bool held;                   // no stroke is begun while held
+static LinearMotionControl_t syringePlunger;
+
+// returns true when the float sensor is actuated (float ball in range)
+static bool readFloatSensor(void)
+{
+    return (FLOAT_SENSOR_INPORT & (1 << FLOAT_SENSOR_PIN)) == 0;
+}
+
+// moves at the closed loop plunger speed if one is set, otherwise
+// open loop at the motor PWM setting
+static void movePlunger(
+    const int16_t pos)
+{
+    LinearMotionControl_moveToPositionAtSpeed(pos,
+        EEPROMStorage_motorPwm(), EEPROMStorage_plungerSpeed(), &syringePlunger);
+}
+
+// recomputes the travel to volume scale if the settings have changed.
+// this is the only division in the volume accounting
+static void updateVolumeScale(void)
+{
+    const uint8_t settingsGeneration = EEPROMStorage_generation();
+    if (settingsGeneration != scaleSettingsGeneration) {
+        scaleSettingsGeneration = settingsGeneration;
+        const uint16_t posPerMl = EEPROMStorage_posPerMl();
+        if (posPerMl != scalePosPerMl) {
+            scalePosPerMl = posPerMl;
+            // 2^32 - 1 rather than 2^32, so that it fits
+            const uint32_t scale = (posPerMl != 0)
+                ? (UINT32_MAX / posPerMl)
+                : 0;
+            mlPerCountWhole = scale >> 16;
+            mlPerCountFraction = scale & 0xFFFF;
+        }
+    }
+}
+
+// returns the whole ml pumped for the given plunger travel
+static uint16_t volumePumpedForTravel(
+    const uint16_t travel)
+{
+    const uint32_t fraction =
+        (((uint32_t)travel) * mlPerCountFraction) + mlFractionCarry;
+    mlFractionCarry = fraction & 0xFFFF;
+    const uint32_t ml =
+        (((uint32_t)travel) * mlPerCountWhole) + (fraction >> 16) + mlCarry;
+    mlCarry = ml & 0xFFFF;
+    return ml >> 16;
+}
+
+// returns the position to draw the plunger out to. That is the fully out
+// position unless the remaining volume takes less than a full syringe,
+// in which case the stroke is shortened to pump just that volume and
+// becomes the final stroke
+static int16_t planDrawPosition(void)
+{
+    const int16_t inPos = EEPROMStorage_plungerInPos();
+    const int16_t outPos = EEPROMStorage_plungerOutPos();
+    updateVolumeScale();
+
+    // the fraction of a ml already pumped but not yet counted comes off the
+    // remaining volume. Whole ml and the carry are scaled separately, so
+    // the product stays within 32 bits for any volume and posPerMl
+    const uint32_t travelNeeded = (volumeRemainingToPump != 0)
+        ? ((((uint32_t)volumeRemainingToPump) * scalePosPerMl) -
+            ((((uint32_t)mlCarry) * scalePosPerMl) >> 16))
+        : 0;
+    const uint16_t fullTravel = (inPos > outPos) ? (inPos - outPos) : 0;
+    finalStroke = (travelNeeded < fullTravel);
+    return finalStroke ? (inPos - (int16_t)travelNeeded) : outPos;
+}
+
+// queues the draw and the push of one syringe cycle, so the plunger
+// reverses as soon as the draw has stopped
+static void queuePumpCycle(void)
+{
+    const uint8_t pwm = EEPROMStorage_motorPwm();
+    const uint16_t speed = EEPROMStorage_plungerSpeed();
+    plungerSegmentsCompleted = LinearMotionControl_segmentsCompleted(&syringePlunger);
+    LinearMotionControl_queueMove(planDrawPosition(), pwm, speed,
+        PLUNGER_REVERSAL_DWELL, &syringePlunger);
+    LinearMotionControl_queueMove(EEPROMStorage_plungerInPos(), pwm, speed,
+        0, &syringePlunger);
+}
+
+// returns true once for each plunger move that reaches its target
+static bool plungerMoveCompleted(void)
+{
+    const uint8_t segmentsCompleted =
+        LinearMotionControl_segmentsCompleted(&syringePlunger);
+    if (segmentsCompleted != plungerSegmentsCompleted) {
+        plungerSegmentsCompleted = segmentsCompleted;
+        return true;
+    }
+    return false;
+}
+
+void WaterPumpControl_Initialize(void)
+{
+    // set up float sensor pin
+    FLOAT_SENSOR_DIR &= ~(1 << FLOAT_SENSOR_PIN);
+    // enable pull-up in case sensor is disconnected
+    FLOAT_SENSOR_OUTPORT |= (1 << FLOAT_SENSOR_PIN);
+    floatSensorLast = false;
+    plungerStalledLast = false;
+
+    state = ps_idle;
+    runPump = false;
+    volumeRemainingToPump = 0;
+    plungerSegmentsCompleted = 0;
+    scalePosPerMl = 0;
+    scaleSettingsGeneration = EEPROMStorage_generation() - 1;
+    mlPerCountWhole = 0;
+    mlPerCountFraction = 0;
+    mlFractionCarry = 0;
+    mlCarry = 0;
+    finalStroke = false;
+    held = false;
+    updateVolumeScale();
+
+    LinearMotionControl_init(
+        IOPortBitfield_ps_b, 0, // tachometer/odomerter sensor pin
+        IOPortBitfield_ps_d, 2, // home position sensor pin
+        &syringePlunger);
+}
+
+void WaterPumpControl_beginPumping(void)
+{
+    if (!runPump) {
+#if DEBUG_TRACE
+        Console_printLineP(PSTR("starting pump"));
+#endif
+        volumeRemainingToPump = EEPROMStorage_mlToPump();
+        runPump = true;
+    }
+}
+
+void WaterPumpControl_endPumping(void)
+{
+    runPump = false;
+}
+
+void WaterPumpControl_stopNow(void)
+{
+    LinearMotionControl_brakeToStop(&syringePlunger);
+    runPump = false;
+    state = ps_idle;
+}
+
+void WaterPumpControl_hold(
+    const bool hold)
+{
+    held = hold;
+}
+
+void WaterPumpControl_movePlungerTo(
+    const int16_t pos)
+{
+    movePlunger(pos);
+}
+
+int16_t WaterPumpControl_plungerPosition(void)
+{
+    return LinearMotionControl_position(&syringePlunger);
+}
+
+uint8_t WaterPumpControl_plungerSpeed(void)
+{
+    return LinearMotionControl_speed(&syringePlunger);
+}
+
+int16_t WaterPumpControl_plungerOvershoot(void)
+{
+    return LinearMotionControl_lastOvershoot(&syringePlunger);
+}
+
+uint16_t WaterPumpControl_volumeRemaining(void)
+{
+    return volumeRemainingToPump;
+}
+
+WaterPumpControl_state WaterPumpControl_pumpingState(void)
+{
+    return state;
+}
+
+bool WaterPumpControl_tankFull(void)
+{
+    return floatSensorLast;
+}
+
+bool WaterPumpControl_plungerStalled(void)
+{
+    return plungerStalledLast;
+}
+
+// starts strokes, and moves on when they complete
+static void advanceState(void)
+{
+    switch (state) {
+        case ps_idle:
+            if (runPump) {
+                if (!LinearMotionControl_homePositionIsKnown(&syringePlunger)) {
+                    LinearMotionControl_findHomePosition(EEPROMStorage_motorPwm(), &syringePlunger);
+                    state = ps_findingHomePosition;
+                } else {
+                    queuePumpCycle();
+                    state = ps_drawingWaterIn;
+                    StatusStream_notifyEvent(se_strokeStart);
+                }
+            }
+            break;
+        case ps_findingHomePosition:
+            if (LinearMotionControl_homePositionIsKnown(&syringePlunger) &&
+                LinearMotionControl_isStopped(&syringePlunger)) {
+                StatusStream_notifyEvent(se_homeFound);
+                queuePumpCycle();
+                state = ps_drawingWaterIn;
+                StatusStream_notifyEvent(se_strokeStart);
+            }
+            break;
+        case ps_drawingWaterIn:
+            if (plungerMoveCompleted()) {
+                // push is already under way
+                state = ps_pushingWaterOut;
+            }
+            break;
+        case ps_pushingWaterOut:
+            if (plungerMoveCompleted()) {
+                const int16_t plungerTravel =
+                    LinearMotionControl_completedSegmentTravel(&syringePlunger);
+                updateVolumeScale();
+                const uint16_t volumePumped =
+                    volumePumpedForTravel((plungerTravel > 0) ? plungerTravel : 0);
+
+                if (finalStroke || (volumePumped >= volumeRemainingToPump)) {
+                    // the final stroke pumps the remaining volume to
+                    // within odometer resolution
+                    volumeRemainingToPump = 0;
+                    runPump = false;
+                } else {
+                    volumeRemainingToPump -= volumePumped;
+                }
+#if DEBUG_TRACE
+                CharString_define(40, msg);
+                CharString_appendP(PSTR("pumped "), &msg);
+                StringInteger_appendDecimal(volumePumped, 1, 0, &msg);
+                CharString_appendP(PSTR(" ml"), &msg);
+                Console_printLineCS(&msg);
+#endif
+                StatusStream_notifyEvent(se_strokeEnd);
+                if (runPump) {
+                    queuePumpCycle();
+                    state = ps_drawingWaterIn;
+                    StatusStream_notifyEvent(se_strokeStart);
+                } else {
+                    state = ps_idle;
+                }
+            }
+            break;
+    }
+}
+
+void WaterPumpControl_task(void)
+{
+    // check float sensor
+    const bool floatSensor = readFloatSensor();
+    if (floatSensor != floatSensorLast) {
+        // float sensor state changed
+        floatSensorLast = floatSensor;
+
+        if (floatSensor) {
+            // float sensor actuated
+            WaterPumpControl_beginPumping();
+        }
+    }
+
+    if (!held) {
+        advanceState();
+    }
+
+    LinearMotionControl_task(&syringePlunger);
+
+    const bool plungerStalled = LinearMotionControl_isStalled(&syringePlunger);
+    if (plungerStalled && !plungerStalledLast) {
+        StatusStream_notifyEvent(se_stall);
+    }
+    plungerStalledLast = plungerStalled;
+}
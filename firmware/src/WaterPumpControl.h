@@ -0,0 +1,64 @@
+//
+//  Water Pump Control
+//
+//  Runs the syringe pump: when the tank float sensor is actuated it
+//  draws water into the syringe and pushes it out, repeating until
+//  the stored volume has been pumped
+//
+#ifndef WATERPUMPCONTROL_H
+#define WATERPUMPCONTROL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum WaterPumpControl_state_enum {
+    ps_idle,
+    ps_findingHomePosition,
+    ps_drawingWaterIn,
+    ps_pushingWaterOut
+} WaterPumpControl_state;
+
+// sets up sensor pins and the plunger motion control.
+// called once at power-up
+extern void WaterPumpControl_Initialize(void);
+
+// starts pumping EEPROMStorage_mlToPump() ml of water
+extern void WaterPumpControl_beginPumping(void);
+
+// stops pumping after the current syringe cycle
+extern void WaterPumpControl_endPumping(void);
+
+// brakes the plunger and stops pumping immediately
+extern void WaterPumpControl_stopNow(void);
+
+// while held no stroke is begun or ended, so that settings changed
+// together take effect together. The plunger's motion carries on
+extern void WaterPumpControl_hold(
+    const bool hold);
+
+// units are odometer counts
+extern void WaterPumpControl_movePlungerTo(
+    const int16_t pos);
+extern int16_t WaterPumpControl_plungerPosition(void);
+
+// units: tachometer pulses per 200mS
+extern uint8_t WaterPumpControl_plungerSpeed(void);
+
+// odometer counts past the target the last plunger move stopped at
+extern int16_t WaterPumpControl_plungerOvershoot(void);
+
+// units: ml
+extern uint16_t WaterPumpControl_volumeRemaining(void);
+
+extern WaterPumpControl_state WaterPumpControl_pumpingState(void);
+
+// the float sensor was actuated when last checked
+extern bool WaterPumpControl_tankFull(void);
+
+// the plunger was stalled when last checked
+extern bool WaterPumpControl_plungerStalled(void);
+
+// called in each iteration of the mainloop
+extern void WaterPumpControl_task(void);
+
+#endif  // WATERPUMPCONTROL_H